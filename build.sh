@@ -19,7 +19,6 @@ function test_headers() {
     $CC include/prarena.h -o out/prarena.pch
     $CC include/prclist.h -o out/prclist.pch
     $CC include/mo_cntxt.h -o out/mo_cntxt.pch
-    $CC src/alloca.h -o out/alloca.pch
     $CC include/prprf.h -o out/prprf.pch
     $CC include/prglobal.h -o out/prglobal.pch
     $CC include/prlog.h -o out/prlog.pch
@@ -30,6 +29,11 @@ function test_headers() {
     $CC include/prosdep.h -o out/prosdep.pch
     $CC include/prunixos.h -o out/prunixos.pch
     $CC include/prsync.h -o out/prsync.pch
+    $CC include/mo_exec.h -o out/mo_exec.pch
+    $CC include/mo_clone.h -o out/mo_clone.pch
+    $CC include/mo_cache.h -o out/mo_cache.pch
+    $CC include/mo_eval.h -o out/mo_eval.pch
+    $CC include/mo_value.h -o out/mo_value.pch
 }
 
 function compile_objs() {
@@ -38,9 +42,13 @@ function compile_objs() {
     $CC -Iinclude src/mo_atom.c -c -o out/mo_atom.o
     $CC -Iinclude src/mo_bcode.c -c -o out/mo_bcode.o
     $CC -Iinclude src/mo_bool.c -c -o out/mo_bool.o
+    $CC -Iinclude src/mo_cache.c -c -o out/mo_cache.o
+    $CC -Iinclude src/mo_clone.c -c -o out/mo_clone.o
     $CC -Iinclude src/mo_cntxt.c -c -o out/mo_cntxt.o
     $CC -Iinclude src/mo_date.c -Wno-dangling-else -c -o out/mo_date.o
     $CC -Iinclude src/mo_emit.c -c -o out/mo_emit.o
+    $CC -Iinclude src/mo_eval.c -c -o out/mo_eval.o
+    $CC -Iinclude src/mo_exec.c -c -o out/mo_exec.o
     $CC -Iinclude src/mo_fun.c -c -o out/mo_fun.o
     $CC -Iinclude src/mo_math.c -c -o out/mo_math.o
     $CC -Iinclude src/mo_num.c -Wno-non-literal-null-conversion -c -o out/mo_num.o
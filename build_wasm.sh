@@ -14,9 +14,9 @@ OUT="$ROOT/out/wasm"
 DEST="$ROOT/web/public/engine"
 
 ENGINE_SRCS=(
-  mo_array mo_atom mo_bcode mo_bool mo_cntxt mo_date mo_emit mo_fun
-  mo_math mo_num mo_obj mo_parse mo_scan mo_scope mo_str mocha mochaapi
-  mochalib prmjtime prtime prarena prhash prprf prdtoa log2 longlong
+  mo_array mo_atom mo_bcode mo_bool mo_cache mo_clone mo_cntxt mo_date mo_emit
+  mo_eval mo_fun mo_math mo_num mo_obj mo_parse mo_scan mo_scope mo_str mocha
+  mochaapi mochalib prmjtime prtime prarena prhash prprf prdtoa log2 longlong
 )
 
 if ! command -v emcc >/dev/null 2>&1; then
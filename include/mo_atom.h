@@ -8,47 +8,113 @@
 #include <stddef.h>
 #include "prhash.h"
 #include "prmacros.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
 #include "mo_prvtd.h"
 #include "mochaapi.h"
 
 NSPR_BEGIN_EXTERN_C
 
-typedef uint8 MochaAtomFlags;
+typedef uint32 MochaAtomFlags;
 
-#define ATOM_KEYWORD    0x01            /* keyIndex is keyword table slot */
 #define ATOM_NAME       0x02            /* atom is an identifier */
 #define ATOM_NUMBER     0x04            /* atom is a numeric literal */
 #define ATOM_STRING     0x08            /* atom is a string literal */
+#define ATOM_ROPE       0x10            /* unflattened concatenation */
+#define ATOM_LOOSE      0x20            /* not in table, freed on last drop */
 #define ATOM_HELD       0x40            /* ask mocha_Atomize() to hold atom */
-#define ATOM_INDEXED    0x80            /* indexed for literal mapping */
-#define ATOM_TYPEMASK   0x3f            /* isolate atom type bits */
+#define ATOM_TYPEMASK   0x0f            /* isolate atom type bits */
 
 struct MochaAtom {
-    PRHashEntry         entry;          /* key is string, value keyword info */
+    PRHashEntry         entry;          /* key is atom, keyHash hashes name */
     MochaRefCount       nrefs;          /* reference count (not at front!) */
-    size_t              length;         /* length of atom name (entry.key) */
-    MochaAtomFlags      flags;          /* tags atom name, keyIndex, and fval */
-    uint8               keyIndex;       /* keyword index if ATOM_KEYWORD */
-    uint16              index;          /* atom table index for literal map */
+    const char          *chars;         /* name, NUL-terminated, may hold NULs */
+    size_t              length;         /* length of atom name in chars */
+    MochaAtomFlags      flags;          /* tags atom name and fval */
     MochaAtomNumber     number;         /* atom serial number and hash code */
     MochaFloat          fval;           /* value if atom is numeric literal */
 };
 
-#define atom_name(atom) ((const char *)(atom)->entry.key)
-#define atom_next(atom) ((MochaAtom *)(atom)->entry.value)
+/*
+** A rope is a loose atom standing for the concatenation of left and right,
+** made by mocha_ConcatAtoms without copying either part.  Its length and
+** hash are computed from its parts', but its name is null until atom_name
+** flattens it, which copies the parts into a new string and drops them.
+*/
+typedef struct MochaRope {
+    MochaAtom           atom;           /* ATOM_ROPE | ATOM_LOOSE string */
+    MochaAtom           *left;          /* held left part until flattened */
+    MochaAtom           *right;         /* held right part until flattened */
+} MochaRope;
+
+#define atom_name(atom) ((atom)->chars ? (atom)->chars : mocha_FlattenAtom(atom))
 
 struct MochaAtomMap {
     MochaAtom           **vector;       /* array of ptrs to indexed atoms */
     MochaAtomNumber     length;         /* count of (to-be-)indexed atoms */
 };
 
+/*
+** The atom table is split by keyHash into shards.  In a MOCHA_THREADSAFE
+** build each shard has its own lock, so contexts running on different
+** threads contend only when they atomize names that land in the same shard.
+** A table atom's nrefs is then updated atomically, and may go from 0 to 1
+** or from 1 to 0 only under its shard's lock, so that a lookup can't hold
+** an atom that a concurrent mocha_DropAtom() is about to free.  A table
+** atom's type bits may be set while other threads read its flags without a
+** lock, so read them with ATOM_FLAGS(), after which fval may be read if
+** ATOM_NUMBER is set.
+*/
+#ifdef MOCHA_THREADSAFE
+#define MOCHA_ATOM_SHARDS_LOG2  4
+#define ATOM_FLAGS(atom)        PR_ATOMIC_LOAD(&(atom)->flags)
+#else
+#define MOCHA_ATOM_SHARDS_LOG2  0
+#define ATOM_FLAGS(atom)        ((atom)->flags)
+#endif
+#define MOCHA_ATOM_SHARDS       PR_BIT(MOCHA_ATOM_SHARDS_LOG2)
+
+typedef struct MochaAtomShard {
+#ifdef MOCHA_THREADSAFE
+    PRSyncLock          lock;           /* guards table and nrefs of 0 */
+#endif
+    PRHashTable         *table;         /* atoms whose names hash here */
+} MochaAtomShard;
+
 struct MochaAtomState {
     MochaBoolean        valid;          /* successfully initialized */
     MochaRefCount       nrefs;          /* number of active contexts */
-    PRHashTable         *table;         /* hash table containing all atoms */
+    MochaAtomShard      shards[MOCHA_ATOM_SHARDS];
     MochaAtomNumber     number;         /* count of all atoms */
 };
 
+#ifdef MOCHA_THREADSAFE
+/*
+** Each context caches the table atoms it recently atomized, so a thread can
+** find the names it keeps using without taking a shard lock.  The cache
+** holds its atoms.  One evicted from a cache slot is parked in defer, and
+** dropped only after MOCHA_ATOM_DEFER more evictions, so an atom returned
+** by mocha_Atomize() without ATOM_HELD stays alive until its caller holds
+** it, even if another thread drops the last other reference meanwhile.
+*/
+#define MOCHA_ATOM_CACHE_LOG2   8
+#define MOCHA_ATOM_CACHE_SIZE   PR_BIT(MOCHA_ATOM_CACHE_LOG2)
+#define MOCHA_ATOM_DEFER        64
+
+struct MochaAtomCache {
+    MochaAtom           *table[MOCHA_ATOM_CACHE_SIZE];
+    MochaAtom           *defer[MOCHA_ATOM_DEFER];
+    unsigned            deferIndex;     /* next defer slot to reuse */
+};
+
+/*
+** Drop all atoms held by mc's cache.  Call before mocha_FreeAtomState(mc).
+*/
+extern void
+mocha_FlushAtomCache(MochaContext *mc);
+#endif
+
 /* Well-known predefined atoms and their strings. */
 extern MochaAtom    *mocha_typeAtoms[MOCHA_NTYPES];
 extern MochaAtom    *mocha_booleanAtoms[2];
@@ -94,15 +160,104 @@ extern void
 mocha_FreeAtomState(MochaContext *mc);
 
 /*
-** Find or create the atom for string.  If we create a new atom, give it the
-** type indicated in flags.  Return 0 on failure to allocate memory.
+** Find or create the atom for the length chars at string, which may contain
+** NULs.  If we create a new atom, give it the type indicated in flags.
+** Return 0 on failure to allocate memory.
+*/
+extern MochaAtom *
+mocha_Atomize(MochaContext *mc, const char *string, size_t length,
+	      MochaAtomFlags flags);
+
+/*
+** Like mocha_Atomize(), but for a caller that has already hashed string,
+** for instance while scanning it: keyHash must equal
+** mocha_HashChars(string, length).
 */
 extern MochaAtom *
-mocha_Atomize(MochaContext *mc, const char *string, MochaAtomFlags flags);
+mocha_AtomizeHashed(MochaContext *mc, const char *string, size_t length,
+		    PRHashNumber keyHash, MochaAtomFlags flags);
+
+/*
+** Like mocha_Atomize(), but give the atom ATOM_NUMBER and the value fval if
+** it lacks ATOM_NUMBER.  Use this rather than setting fval after atomizing,
+** so that no thread can find the atom flagged as a number without its value.
+*/
+extern MochaAtom *
+mocha_AtomizeNumber(MochaContext *mc, const char *string, size_t length,
+		    MochaFloat fval, MochaAtomFlags flags);
+
+/*
+** Hash length chars.  Every atom caches this hash of its name in keyHash.
+** The hash starts at 0 and takes one MOCHA_HASH_CHAR step per char, so a
+** scanner can compute it a char at a time.
+*/
+#define MOCHA_HASH_CHAR(h, c)   (((h) >> 28) ^ ((h) << 4) ^ (unsigned char)(c))
+
+extern PRHashNumber
+mocha_HashChars(const char *chars, size_t length);
 
+/*
+** Compare atom names char by char, then by length, returning a negative,
+** zero, or positive int as memcmp does.
+*/
+extern int
+mocha_CompareAtoms(MochaAtom *atom1, MochaAtom *atom2);
+
+/*
+** Return the index of atom in the literal map that cg will make, holding
+** atom for the map if it is new to cg.  Return MOCHA_ATOM_INDEX_MAX after
+** reporting an error if cg has too many atoms or memory runs out.
+*/
 extern MochaAtomNumber
 mocha_IndexAtom(MochaContext *mc, MochaAtom *atom, CodeGenerator *cg);
 
+/*
+** Make a loose atom for the string of the given length, copying it.  Unlike
+** mocha_Atomize(), this doesn't look string up or enter it in the table, so
+** runtime string results cost one allocation and are freed on last drop.
+** The type bits and ATOM_HELD in flags are honored as for mocha_Atomize().
+** Return 0 on failure to allocate memory.
+*/
+extern MochaAtom *
+mocha_NewStringAtom(MochaContext *mc, const char *string, size_t length,
+		    MochaAtomFlags flags);
+
+/*
+** Make a rope for the concatenation of atom1 and atom2, holding both.  Like
+** an atom from mocha_Atomize() without ATOM_HELD, the rope is not held.  It
+** is loose, so it must go through mocha_InternAtom() before naming a symbol.
+** Return 0 on failure to allocate memory.
+*/
+extern MochaAtom *
+mocha_ConcatAtoms(MochaContext *mc, MochaAtom *atom1, MochaAtom *atom2);
+
+/*
+** Copy rope's parts into its name, drop the parts, and return the name.  The
+** atom_name macro calls this, so it has no context for an out of memory
+** report; if it can't allocate the name, it returns the empty string.  It
+** takes a const rope, as atom_name may be used on any atom.
+*/
+extern const char *
+mocha_FlattenAtom(const MochaAtom *rope);
+
+/*
+** Return a held atom with atom's name and type for use by mc, which may run
+** on another thread than the context that made atom.  A table atom is just
+** held; a loose atom is copied, as loose atoms' counts aren't thread-safe.
+** Return 0 on failure to allocate memory.
+*/
+extern MochaAtom *
+mocha_CloneAtom(MochaContext *mc, MochaAtom *atom);
+
+/*
+** Given a held atom, return a held atom from the atom table with the same
+** name.  If atom is loose, that means atomizing its name and dropping atom.
+** The loose atom's cached keyHash spares rehashing its name.
+** Return 0 on failure to allocate memory, having dropped atom regardless.
+*/
+extern MochaAtom *
+mocha_InternAtom(MochaContext *mc, MochaAtom *atom);
+
 /*
 ** Atom reference counting operators.
 */
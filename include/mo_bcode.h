@@ -32,6 +32,8 @@ typedef enum MochaOpFormat {
     MOF_INCOP,                  /* 1-byte increment pre/post-order flag */
     MOF_ARGC,                   /* unsigned 8-bit argument count */
     MOF_CONST,                  /* unsigned 16-bit constant pool index */
+    MOF_LOCAL,                  /* unsigned 8-bit frame slot number */
+    MOF_LOCALINC,               /* frame slot, then pre/post-order flag */
     MOF_MAX
 } MochaOpFormat;
 
@@ -44,6 +46,7 @@ typedef enum MochaOpFormat {
 	((pc)[1] = (atom)->number >> 8, (pc)[2] = (atom)->number)
 
 #define MOCHA_ATOM_INDEX_MAX   (1L << 16)
+#define MOCHA_LOCAL_SLOT_MAX   255
 
 struct MochaCodeSpec {
     char                *name;          /* Mocha bytecode name */
@@ -111,6 +114,9 @@ mocha_DecompileScript(MochaScript *script, MochaPrinter *mp);
 extern MochaBoolean
 mocha_DecompileFunction(MochaFunction *fun, MochaPrinter *mp);
 
+extern MochaBoolean
+mocha_DecompileFunctionBody(MochaFunction *fun, MochaPrinter *mp);
+
 NSPR_END_EXTERN_C
 
 #endif /* _mo_bcode_h_ */
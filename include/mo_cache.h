@@ -0,0 +1,68 @@
+#ifndef mo_cache_h___
+#define mo_cache_h___
+/*
+** Mocha compiled script cache.
+**
+** A script cache keeps compiled scripts in files in a directory, so that a
+** script whose source was compiled once, by this or an earlier process, can
+** be loaded without scanning or parsing it again.  A cached script's file
+** is named by a hash of its source text, filename and first line number,
+** and holds that source, filename and line number, which loading compares
+** with its own so that sources whose hashes collide are not confused, then
+** its bytecode, literal atoms, source notes and stack depth, followed by
+** the var and function declarations it makes, each function with its
+** arguments, local variables and script.  Loading a cached script repeats
+** those declarations in the object it is compiled for, as compiling it
+** would have done.
+**
+** Files are memory-mapped where the system allows.  A file written by an
+** engine with another bytecode format or byte order, or one that is
+** truncated or corrupt, is ignored and rewritten.  Files are written
+** under a temporary name and then renamed, so processes and threads may
+** share a cache directory.  Cached bytecode is run as found, so only those
+** trusted to supply scripts may write to a cache directory.
+*/
+#include <stddef.h>
+#include "prmacros.h"
+#include "mo_pubtd.h"
+#include "mochaapi.h"
+
+NSPR_BEGIN_EXTERN_C
+
+typedef struct MochaScriptCache MochaScriptCache;
+
+/*
+** Make a cache keeping its files in the existing directory dirname.  Return
+** null after reporting an error via mc if out of memory.  A cache may be
+** used by contexts on any thread.
+*/
+extern MochaScriptCache *
+MOCHA_NewScriptCache(MochaContext *mc, const char *dirname);
+
+/*
+** Free cache, leaving its files in place.
+*/
+extern void
+MOCHA_DestroyScriptCache(MochaContext *mc, MochaScriptCache *cache);
+
+/*
+** Like MOCHA_CompileBuffer(), but load the script from cache if it holds
+** the script compiled from the same source, filename and lineno, else
+** compile it and save it in cache.  A failure to save is not reported.
+*/
+extern MochaScript *
+MOCHA_CompileCachedBuffer(MochaContext *mc, MochaScriptCache *cache,
+                          MochaObject *obj, const char *base, size_t length,
+                          const char *filename, unsigned lineno);
+
+/*
+** Like MOCHA_CompileFile(), but map or read filename and compile its source
+** with MOCHA_CompileCachedBuffer().
+*/
+extern MochaScript *
+MOCHA_CompileCachedFile(MochaContext *mc, MochaScriptCache *cache,
+                        MochaObject *obj, const char *filename);
+
+NSPR_END_EXTERN_C
+
+#endif /* mo_cache_h___ */
@@ -0,0 +1,32 @@
+#ifndef _mo_clone_h_
+#define _mo_clone_h_
+/*
+** Mocha object graph cloning, for templates.
+**
+** A cloner copies an object graph into the context it's working for.  It
+** maps each original object, scope, property, symbol and variable that it
+** has copied to the copy, so the copy has the same sharing as the original.
+*/
+#include "prmacros.h"
+#include "mo_pubtd.h"
+#include "mochaapi.h"
+
+NSPR_BEGIN_EXTERN_C
+
+/*
+** Return the copy of thing made by cl, or null if thing hasn't been copied.
+*/
+extern void *
+mocha_GetClone(MochaCloner *cl, const void *thing);
+
+/*
+** Map thing to its copy in cl.  Return false after reporting an error via
+** mc if out of memory.
+*/
+extern MochaBoolean
+mocha_PutClone(MochaContext *mc, MochaCloner *cl, const void *thing,
+               void *copy);
+
+NSPR_END_EXTERN_C
+
+#endif /* _mo_clone_h_ */
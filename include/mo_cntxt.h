@@ -8,7 +8,10 @@
 #include <stddef.h>
 #include "prarena.h"
 #include "prclist.h"
+#include "prhash.h"
 #include "prmacros.h"
+#include "prlong.h"
+#include "mo_introspect.h"
 #include "mo_prvtd.h"
 #include "mocha.h"
 #include "mochaapi.h"
@@ -28,6 +31,11 @@ struct MochaContext {
     PRArenaPool             codePool;
     PRArenaPool             tempPool;
 
+#ifdef MOCHA_THREADSAFE
+    /* Atoms this context atomized recently (see mo_atom.c). */
+    MochaAtomCache          atomCache;
+
+#endif
     /* Static and dynamic scope stacks (see mo_cntxt.c, mo_scope.c). */
     MochaObject             *staticLink;
     MochaObjectStack        *objectStack;
@@ -36,6 +44,12 @@ struct MochaContext {
     /* XXX weak link; not necessarily reachable from static link. */
     MochaObject             *globalObject;
 
+    /* Overlays of the frozen scopes this context set (see mo_scope.c). */
+    PRHashTable             *overlays;
+
+    /* Scripts recently compiled by eval and Function (see mo_eval.c). */
+    MochaEvalCache          *evalCache;
+
     /* Context taint code and current taint accumulator. */
     MochaTaintInfo          *taintInfo;
     MochaTaintInfo          defaultTaintInfo;
@@ -51,6 +65,20 @@ struct MochaContext {
     /* Per-context optional user callbacks. */
     MochaBranchCallback     branchCallback;
     MochaErrorReporter      errorReporter;
+    MochaTraceHook          traceHook;
+
+    /* Taint callbacks, copied from MOCHA_SetTaintCallbacks(). */
+    MochaTaintCounter       holdTaint;
+    MochaTaintCounter       dropTaint;
+    MochaTaintMixer         mixTaint;
+
+    /* Math.random() generator state (see mo_math.c). */
+    MochaBoolean            rngInitialized;
+    int64                   rngMultiplier;
+    int64                   rngAddend;
+    int64                   rngMask;
+    int64                   rngSeed;
+    MochaFloat              rngDscale;
 
     /* Java environment to use for java calls */
     void                    *javaEnv;
@@ -66,7 +94,8 @@ struct MochaContext {
 };
 
 /*
-** mocha_NewContext(stackSize) constructs a new Mocha execution context.
+** mocha_NewContext(stackSize) constructs a new Mocha execution context,
+** whose stack starts small and grows to at most stackSize bytes.
 ** mocha_DestroyContext(mc) destroys mc.
 */
 extern MochaContext *
@@ -78,6 +107,14 @@ mocha_DestroyContext(MochaContext *mc);
 extern MochaContext *
 mocha_ContextIterator(MochaContext **iterp);
 
+/*
+** Set the taint callbacks for contexts created after this call.  A running
+** context reads its callbacks without locking, so they never change.
+*/
+extern void
+mocha_SetTaintCallbacks(MochaTaintCounter hold, MochaTaintCounter drop,
+			MochaTaintMixer mix);
+
 extern void
 mocha_InitTaintInfo(MochaContext *mc);
 
@@ -27,31 +27,48 @@ struct LoopInfo {
 #define SET_LOOPINFO_TOP(li, top) \
     ((li)->top = (li)->update = (li)->breaks = (li)->continues = (top))
 
+/*
+** A top-level var or function declaration, recorded in the order parsed so
+** that a script saved with its declarations can repeat them when loaded.
+*/
+typedef struct CodeDecl CodeDecl;
+
+struct CodeDecl {
+    MochaAtom           *atom;          /* held name of the var or function */
+    MochaFunction       *fun;           /* held function, or null for var */
+    CodeDecl            *next;          /* next declaration in source order */
+};
+
 struct CodeGenerator {
     struct PRArenaPool  *pool;          /* pool in which to allocate code */
     MochaCode           *base;          /* base of Mocha bytecode vector */
     MochaCode           *limit;         /* one byte beyond end of bytecode */
     MochaCode           *ptr;           /* pointer to next free bytecode */
-    MochaAtom           *atomList;      /* literals indexed for mapping */
+    struct PRHashTableStr *atomTable;   /* maps literal atoms to indexes */
     MochaAtomNumber     atomCount;      /* count of indexed literals */
     MochaOp             lastOpcode;     /* last bytecode emited */
     LoopInfo            *loopInfo;      /* LoopInfo stack for break/continue */
     uint32              depthTypeSet;   /* bitset of statement depth types */
     int                 withDepth;      /* with/for-in statement depth count */
+    int                 nameDepth;      /* if > 0, emit MOP_NAME for locals */
     int                 stackDepth;     /* current stack depth in basic block */
     int                 maxStackDepth;  /* maximum stack depth so far */
     SourceNote          *notes;         /* source notes, see below */
     unsigned            noteCount;      /* number of source notes so far */
     ptrdiff_t           lastOffset;     /* pc offset of last source note */
+    CodeDecl            *decls;         /* top-level declarations, if taken */
+    CodeDecl            **declTail;     /* null unless taking declarations */
 };
 
 #define CG_CODE(cg,offset)      ((cg)->base + (offset))
 #define CG_OFFSET(cg)           ((cg)->ptr - (cg)->base)
 #define CG_RESET(cg)            ((cg)->ptr = (cg)->base,                      \
-				 (cg)->atomList = 0, (cg)->atomCount = 0,     \
+				 (cg)->atomTable = 0, (cg)->atomCount = 0,    \
                                  (cg)->lastOpcode = 0, (cg)->loopInfo = 0,    \
                                  (cg)->depthTypeSet = 0, (cg)->withDepth = 0, \
+                                 (cg)->nameDepth = 0,                         \
                                  (cg)->stackDepth = (cg)->maxStackDepth = 0,  \
+                                 (cg)->decls = 0, (cg)->declTail = 0,         \
                                  CG_RESET_NOTES(cg))
 #define CG_RESET_NOTES(cg)      ((cg)->notes = 0, (cg)->noteCount = 0,        \
                                  (cg)->lastOffset = 0)
@@ -136,6 +153,22 @@ mocha_EmitContinue(MochaContext *mc, CodeGenerator *cg);
 extern void
 mocha_PopLoopInfo(CodeGenerator *cg);
 
+/*
+** If cg is taking declarations (cg->declTail is non-null), append one for
+** atom, and for fun unless it's null for a var.  Hold atom and fun until
+** mocha_FreeDeclarations().  Return false if out of memory, else true.
+*/
+extern MochaBoolean
+mocha_NoteDeclaration(MochaContext *mc, CodeGenerator *cg, MochaAtom *atom,
+                      MochaFunction *fun);
+
+/*
+** Drop the atoms and functions held by cg's declarations, which were
+** allocated from mc's tempPool, and stop taking them.
+*/
+extern void
+mocha_FreeDeclarations(MochaContext *mc, CodeGenerator *cg);
+
 /*
 ** Source notes generated along with bytecode for decompiling and debugging.
 ** A source note is a uint16 with 4 bits of type and 12 of offset.
@@ -236,6 +269,14 @@ mocha_NewScript(MochaContext *mc, CodeGenerator *cg, const char *filename,
 extern void
 mocha_DestroyScript(MochaContext *mc, MochaScript *script);
 
+/*
+** Return a copy of script for use by mc, with its own atom holds and inline
+** caches, and with no formal argument list.  Return null on allocation
+** failure, which this function reports.
+*/
+extern MochaScript *
+mocha_CloneScript(MochaContext *mc, MochaScript *script);
+
 NSPR_END_EXTERN_C
 
 #endif /* _mo_emit_h_ */
@@ -0,0 +1,62 @@
+#ifndef _mo_eval_h_
+#define _mo_eval_h_
+/*
+** Mocha compile cache for eval and the Function constructor.
+**
+** Each context keeps the scripts it most recently compiled for eval() and
+** Function(), keyed by kind (eval or function body), source text, filename
+** and line number, so that evaluating the same string again, or making the
+** same function again, needn't scan and parse it.  A function body's key
+** includes its formal argument names, on which its code depends.  When the
+** cache is full, the least recently used entry that isn't running goes.
+**
+** An eval'd script that declares vars or functions is not cached, as those
+** declarations must be made anew in the object it is evaluated for.  The
+** cache is flushed when the context's character filter, which the scanner
+** applies to the source, changes.
+*/
+#include "prmacros.h"
+#include "mo_prvtd.h"
+#include "mo_pubtd.h"
+
+NSPR_BEGIN_EXTERN_C
+
+#define MOCHA_EVAL_CACHE_SIZE   32      /* scripts kept per context */
+#define MOCHA_EVAL_CACHE_MAXLEN 65536   /* longest source kept, in chars */
+
+/*
+** Evaluate source in obj as MOCHA_EvaluateBuffer() does, reusing the script
+** compiled for it by a previous call with the same filename and lineno.
+*/
+extern MochaBoolean
+mocha_EvaluateCached(MochaContext *mc, MochaObject *obj, MochaAtom *source,
+                     const char *filename, unsigned lineno, MochaDatum *rval);
+
+/*
+** Set fun->script to a script compiled from body, for a function whose
+** formal arguments, listed by args, are already defined in its scope, as
+** mocha_ParseFunctionBody() does.  Reuse the script and local variables of
+** a previous function made from the same body, arguments, filename and
+** lineno.  Return false on error, which has been reported.
+*/
+extern MochaBoolean
+mocha_CompileFunctionCached(MochaContext *mc, MochaFunction *fun,
+                            MochaSymbol *args, MochaAtom *body,
+                            const char *filename, unsigned lineno);
+
+/*
+** Forget the scripts mc has cached.  Entries still running are freed when
+** they finish.
+*/
+extern void
+mocha_FlushEvalCache(MochaContext *mc);
+
+/*
+** Flush mc's cache and free it.  Call only when mc is not running.
+*/
+extern void
+mocha_DestroyEvalCache(MochaContext *mc);
+
+NSPR_END_EXTERN_C
+
+#endif /* _mo_eval_h_ */
@@ -0,0 +1,100 @@
+#ifndef mo_exec_h___
+#define mo_exec_h___
+/*
+** Mocha batch script executor.
+**
+** An executor runs independent scripts, called jobs, on a pool of worker
+** threads.  Each worker owns a context whose global object has the standard
+** library already initialized, and reuses it for every job it runs, so a
+** job costs no context or library setup.  A worker takes jobs from its own
+** queue, and when that is empty steals from other workers' queues.  Jobs
+** that finish are queued for MOCHA_NextDoneJob().
+**
+** Each job runs with a new global object whose prototype is its worker's
+** warm global, so names the job defines vanish with it, while the standard
+** constructors and functions are found by prototype lookup.  The workers'
+** globals use the shared library (see MOCHA_SetSharedGlobalObject()), and
+** whatever a job sets in the standard objects (e.g., Math.foo) is forgotten
+** when it finishes, so jobs are independent of one another.
+**
+** The executor is available only in a library built with MOCHA_THREADSAFE.
+*/
+#include <stddef.h>
+#include "prmacros.h"
+#include "mo_pubtd.h"
+#include "mochaapi.h"
+
+NSPR_BEGIN_EXTERN_C
+
+#ifdef MOCHA_THREADSAFE
+
+typedef struct MochaExecutor    MochaExecutor;
+typedef struct MochaJob         MochaJob;
+
+/*
+** A job's init function is called on the worker thread, with the job's new
+** global object, before the job's source is compiled.  It may define host
+** objects and functions in obj.  Return false to fail the job.
+*/
+typedef MochaBoolean
+(*MochaGlobalInit)(MochaContext *mc, MochaObject *obj, void *data);
+
+/*
+** A job is allocated and owned by its submitter, and must stay valid, as
+** must the source it points to, until MOCHA_NextDoneJob() returns it.  The
+** executor sets the result members; result and error are malloc'd, and the
+** submitter must free them.
+*/
+struct MochaJob {
+    /* Set by the submitter. */
+    const char          *source;        /* script source, any NULs allowed */
+    size_t              length;         /* length of source in chars */
+    const char          *filename;      /* name for error reports, or null */
+    MochaGlobalInit     init;           /* global object init, or null */
+    void                *data;          /* for init and the submitter */
+
+    /* Set by the executor. */
+    MochaBoolean        ok;             /* true if the script ran */
+    MochaTag            tag;            /* type of the script's result */
+    char                *result;        /* result as a string, if ok */
+    size_t              resultLength;   /* length of result in chars */
+    char                *error;         /* last error message, or null */
+
+    /* Private to the executor. */
+    MochaJob            *next;          /* next job in a queue */
+};
+
+/*
+** Make an executor with nthreads workers, each owning a context with a
+** stack of stackSize bytes.  Return null on failure.
+*/
+extern MochaExecutor *
+MOCHA_NewExecutor(unsigned nthreads, size_t stackSize);
+
+/*
+** Queue job to run on one of ex's workers.  Any thread may submit jobs.
+*/
+extern void
+MOCHA_SubmitJob(MochaExecutor *ex, MochaJob *job);
+
+/*
+** Return a finished job, in order of completion.  If no job has finished,
+** wait for one if wait is true, else return null.  Return null at once if
+** every submitted job has been returned already.
+*/
+extern MochaJob *
+MOCHA_NextDoneJob(MochaExecutor *ex, MochaBoolean wait);
+
+/*
+** Run every job submitted to ex, then stop its workers and free it.  Jobs
+** not yet returned by MOCHA_NextDoneJob() are not freed, as they belong to
+** their submitters.
+*/
+extern void
+MOCHA_DestroyExecutor(MochaExecutor *ex);
+
+#endif /* MOCHA_THREADSAFE */
+
+NSPR_END_EXTERN_C
+
+#endif /* mo_exec_h___ */
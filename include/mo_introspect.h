@@ -3,8 +3,8 @@
 **
 ** A minimal, always-compiled instrumentation point for the bytecode
 ** interpreter, used by the web playground to capture a structured
-** execution trace.  When `mocha_TraceHook` is non-null, the interpreter
-** calls it once per bytecode instruction, just before the instruction is
+** execution trace.  When a context has a trace hook, the interpreter calls
+** it once per bytecode instruction, just before the instruction is
 ** dispatched.  This lets an embedder snapshot the program counter, the
 ** value stack and the active call frame without patching the interpreter
 ** beyond a single call.
@@ -18,7 +18,13 @@
 typedef void (*MochaTraceHook)(MochaContext *mc, MochaScript *script,
                                MochaCode *pc, struct MochaStack *sp);
 
-extern MochaTraceHook mocha_TraceHook;
+/*
+** Set mc's trace hook, or clear it if hook is null, and return the old one.
+** Each context has its own hook, so tracing one context doesn't slow down
+** contexts running on other threads.
+*/
+extern MochaTraceHook
+mocha_SetTraceHook(MochaContext *mc, MochaTraceHook hook);
 
 /*
 ** Compile and run `source`, returning a freshly malloc'd JSON string that
@@ -4,12 +4,30 @@
 ** Mocha parser definitions.
 ** Brendan Eich, 6/14/95
 */
+#include <stddef.h>
 #include "prmacros.h"
 #include "mo_prvtd.h"
 #include "mo_pubtd.h"
 
 NSPR_BEGIN_EXTERN_C
 
+/*
+** The source of a function body whose compilation has been deferred until
+** the function is first called.  A function defined in a script scanned
+** from a buffer is checked only for balanced braces and the errors that the
+** scanner finds; other syntax errors in its body are reported when it is
+** first called.  The record, its filename, and its text, which runs from
+** just after the body's { through its closing }, are allocated together.
+*/
+struct MochaFunctionSource {
+    size_t              length;         /* length of text */
+    unsigned            lineno;         /* base line number for the script */
+    unsigned            scanLineno;     /* line number to start scanning at */
+    MochaSymbol         *args;          /* formal arguments in fun's scope */
+    char                *filename;      /* source filename or null */
+    char                text[1];        /* body text, not null-terminated */
+};
+
 extern MochaBoolean
 mocha_Parse(MochaContext *mc, MochaObject *slink, MochaTokenStream *ts,
 	    CodeGenerator *cg);
@@ -18,6 +36,23 @@ extern MochaBoolean
 mocha_ParseFunctionBody(MochaContext *mc, MochaTokenStream *ts,
 			MochaFunction *fun);
 
+/*
+** Return a new function source record holding copies of text and filename.
+** Return null on allocation failure, which this function reports.
+*/
+extern MochaFunctionSource *
+mocha_NewFunctionSource(MochaContext *mc, const char *text, size_t length,
+			const char *filename, unsigned lineno,
+			unsigned scanLineno);
+
+/*
+** If fun's body is deferred, compile it now, giving fun its script and free
+** fun->source.  Return false on error, which has been reported, leaving the
+** body to be compiled again by the next call.
+*/
+extern MochaBoolean
+mocha_CompileFunctionSource(MochaContext *mc, MochaFunction *fun);
+
 NSPR_END_EXTERN_C
 
 #endif /* _mo_parse_h_ */
@@ -32,14 +32,21 @@ typedef uint32                  MochaUint;
 #define MOCHA_INT_MAX           (((MochaUint)1 << 31) - 1)
 #define MOCHA_INT_MIN           ((MochaInt)1 << 31)
 
+typedef struct MochaAtomCache   MochaAtomCache;
 typedef struct MochaAtomMap     MochaAtomMap;
 typedef uint32                  MochaAtomNumber;
 typedef struct MochaAtomState   MochaAtomState;
 typedef struct MochaCodeSpec    MochaCodeSpec;
+typedef struct MochaEvalCache   MochaEvalCache;
+typedef struct MochaFunctionSource MochaFunctionSource;
 typedef struct MochaObjectStack MochaObjectStack;
 typedef struct MochaPrinter     MochaPrinter;
 typedef struct MochaProperty    MochaProperty;
+typedef struct MochaPropertyCache MochaPropertyCache;
+typedef struct MochaShape       MochaShape;
 typedef struct MochaStackFrame  MochaStackFrame;
 typedef struct MochaStack       MochaStack;
+typedef struct MochaStackSegment MochaStackSegment;
+typedef struct MochaThreadedOp  MochaThreadedOp;
 
 #endif /* _mo_prvtd_h_ */
@@ -11,6 +11,7 @@
 
 typedef struct MochaAtom         MochaAtom;
 typedef struct MochaClass        MochaClass;
+typedef struct MochaCloner       MochaCloner;
 typedef uint8                    MochaCode;
 typedef struct MochaContext      MochaContext;
 typedef struct MochaDatum        MochaDatum;
@@ -26,12 +27,16 @@ typedef struct MochaScript       MochaScript;
 typedef int32                    MochaSlot;
 typedef struct MochaSymbol       MochaSymbol;
 typedef struct MochaTaintInfo    MochaTaintInfo;
+typedef struct MochaTemplate     MochaTemplate;
 
 #define MOCHAFILE
 
 /* Special reference count value for objects being finalized. */
 #define MOCHA_FINALIZING	((MochaRefCount)0xdeadbeef)
 
+/* Special reference count value for shared objects and scopes, never freed. */
+#define MOCHA_FROZEN		((MochaRefCount)0xf0f0f0f0)
+
 /* Mocha Boolean enumerated type. */
 typedef PRBool MochaBoolean;
 #define MOCHA_FALSE PR_FALSE
@@ -68,7 +68,8 @@ typedef enum MochaTokenType {
 
 struct MochaToken {
     MochaTokenType      type;           /* char value or above enumerator */
-    char                *ptr;           /* beginning of token in line buffer */
+    const char          *ptr;           /* beginning of token in input */
+    size_t              length;         /* length of token in input */
     union {
         MochaAtom       *atom;          /* atom table entry */
         MochaFloat      fval;           /* floating point number */
@@ -82,20 +83,42 @@ typedef struct MochaTokenBuf {
     char                *ptr;           /* next char to get, or slot to use */
 } MochaTokenBuf;
 
-#define MOCHA_LINE_MAX  256             /* logical line buffer size limit --
-                                           physical line length is unlimited */
+#define MOCHA_LINE_MAX  256             /* longest source line excerpt in an
+                                           error report -- input line length
+                                           is unlimited */
 
+/*
+** A file's contents, mapped where the system allows and otherwise read into
+** malloc'd memory.
+*/
+typedef struct MochaMappedFile {
+    char                *base;          /* contents, null if size is 0 */
+    size_t              size;           /* length of file in bytes */
+} MochaMappedFile;
+
+/*
+** The scanner reads chars in place from userbuf, which holds the caller's
+** buffer, a mapped file, or the line last read from a stream that can't be
+** mapped, such as a terminal or pipe.  Tokens are slices of userbuf.  The
+** scanner counts a line when it gets the line's first char, so lineno is the
+** number of the line holding the last char gotten.
+*/
 struct MochaTokenStream {
     MochaToken          token;          /* last token scanned */
     MochaToken          pushback;       /* pushed-back already-scanned token */
     uint16              flags;          /* flags -- see below */
     uint16              lineno;         /* current line number */
-    MochaTokenBuf       linebuf;        /* line buffer for diagnostics */
-    MochaTokenBuf       userbuf;        /* user input buffer if !file */
-    MochaTokenBuf       tokenbuf;       /* current token string buffer */
+    const char          *linestart;     /* start of current line in userbuf */
+    const char          *nextline;      /* userbuf.ptr if it starts a line not
+                                           yet counted, else null */
+    MochaTokenBuf       userbuf;        /* input being scanned */
+    MochaTokenBuf       tokenbuf;       /* buffer for escaped strings and
+                                           numbers */
     const char          *filename;      /* input filename or null */
 #ifdef MOCHAFILE
-    FILE                *file;          /* stdio stream if reading from file */
+    FILE                *file;          /* stdio stream if reading by lines */
+    MochaTokenBuf       linebuf;        /* malloc'd line read from file */
+    MochaMappedFile     map;            /* contents of mapped input file */
 #endif
 };
 
@@ -107,6 +130,7 @@ struct MochaTokenStream {
 #define TSF_RETURN_VOID 0x10            /* function has 'return;' */
 #define TSF_INTERACTIVE 0x20            /* interactive parsing mode */
 #define TSF_COMMAND     0x40            /* command parsing mode */
+#define TSF_NOWARN      0x80            /* source was checked, don't warn */
 
 #define CLEAR_PUSHBACK(ts)  ((ts)->pushback.type = TOK_EOF)
 #define SCAN_NEWLINES(ts)   ((ts)->flags |= TSF_NEWLINES)
@@ -119,7 +143,9 @@ struct MochaTokenStream {
 
 /*
 ** Create a new token stream, either from an input buffer or from a file.
-** Return null on file-open or memory-allocation failure.
+** Return null on file-open or memory-allocation failure.  A buffer must stay
+** unchanged until its token stream is closed.  A regular file is mapped and
+** scanned like a buffer; other files are read a line at a time.
 **
 ** NB: Both mocha_New{Buffer,File}TokenStream() return a pointer to transient
 ** memory in the current context's data pool.  This memory is deallocated via
@@ -135,11 +161,39 @@ mocha_NewBufferTokenStream(MochaContext *mc, const char *base, size_t length);
 extern MochaTokenStream *
 mocha_NewFileTokenStream(MochaContext *mc, const char *filename);
 
+/*
+** Close ts's file, if any, and free the memory holding its contents.
+*/
 extern MochaBoolean
 mocha_CloseTokenStream(MochaTokenStream *ts);
 
 /*
-** Initialize the scanner, installing Mocha keywords into mc's global scope.
+** Map the file named by path into memory, or read it into malloc'd memory
+** if it can't be mapped, and describe its contents in *mf.  Return false,
+** leaving errno set, if path can't be opened or isn't a regular file.
+*/
+extern MochaBoolean
+mocha_MapFile(const char *path, MochaMappedFile *mf);
+
+/*
+** Free the contents of a file mapped by mocha_MapFile().
+*/
+extern void
+mocha_UnmapFile(MochaMappedFile *mf);
+
+/*
+** If ts scans a buffer, return the address in it of the next char to scan,
+** and set *linenop, unless linenop is null, to the line number with which a
+** token stream scanning the rest of the buffer from there should start.
+** Return null if ts reads a file by lines.  Call only when no token is
+** pushed back.
+*/
+extern const char *
+mocha_GetTokenStreamPosition(MochaTokenStream *ts, unsigned *linenop);
+
+/*
+** Initialize the scanner for mc.  Keywords are found by a static perfect
+** hash table, so this only checks that table in DEBUG builds.
 */
 extern int
 mocha_InitScanner(MochaContext *mc);
@@ -28,13 +28,42 @@ typedef enum MochaSymbolType {
 } MochaSymbolType;
 
 /*
-** A Mocha symbol table, scope for short.
+** A shape describes the layout of a scope: the names of its symbols, in the
+** order they were defined.  Shapes form a tree whose root has no names; the
+** shape of a scope that defines a, then b, is the child of a's shape that adds
+** b.  Scopes that define the same names in the same order share a shape, and
+** each keeps its symbols in a vector indexed by order of definition, so the
+** index of a name found in one scope of a shape is good in all of them.
+**
+** A shape is held by each scope and inline cache that uses it, and by each
+** of its kids.  The root lives forever; any other shape is freed, and its
+** atom dropped, when its last reference goes.
+*/
+struct MochaShape {
+    MochaRefCount       nrefs;          /* scopes, caches, and kids using it */
+    MochaShape          *parent;        /* shape without the last name */
+    MochaAtom           *atom;          /* last name, held by the shape */
+    unsigned            nsyms;          /* number of names in this layout */
+    PRHashTable         *table;         /* atom to shape adding it, if long */
+    MochaShape          *kids;          /* shapes that add one more name */
+    unsigned            nkids;          /* number of kids */
+    PRHashTable         *kidTable;      /* atom to kid, if many kids */
+    MochaShape          *sibling;       /* next kid of parent */
+    MochaShape          **prevp;        /* pointer to pointer to this kid */
+};
+
+/*
+** A Mocha symbol table, scope for short.  A scope has a shape and a vector of
+** symbols until it grows too big or loses a symbol, and then it becomes a
+** hash table of symbols with a null shape.
 */
 struct MochaScope {
     MochaRefCount       nrefs;          /* reference count for sharing */
     MochaObject         *object;        /* object that owns this scope */
-    PRHashTable         *table;         /* a scope is based on a hash table */
-    MochaSymbol         *list;          /* or a linked list if few entries */
+    MochaShape          *shape;         /* layout of symv, null if table */
+    MochaSymbol         **symv;         /* symbols in order of definition */
+    unsigned            symvlen;        /* allocated length of symv */
+    PRHashTable         *table;         /* hash table if no shape */
     MochaProperty       *props;         /* linked list of properties */
     MochaProperty       **proptail;     /* pointer to pointer to last prop */
     MochaSlot           freeslot;       /* next free property slot >= 0 */
@@ -131,6 +160,61 @@ mocha_CopyScope(MochaContext *mc, MochaScope *from, MochaScope *to);
 extern void
 mocha_ClearScope(MochaContext *mc, MochaScope *scope);
 
+/*
+** Copy the symbols and properties of from into to, a new and empty scope,
+** for cl.  Objects that from's properties refer to are copied by cl.  On
+** failure, to holds what was copied before the error was reported, and can
+** be destroyed as usual.
+*/
+extern MochaBoolean
+mocha_CloneScope(MochaContext *mc, MochaScope *from, MochaScope *to,
+                 MochaCloner *cl);
+
+/*
+** A frozen scope belongs to a shared object (see MOCHA_SetSharedGlobalObject)
+** and is never changed.  Each context that sets a symbol in a frozen scope
+** gets an overlay scope for it instead, which mocha_LookupSymbol searches
+** before the frozen scope whenever that context looks there.  The scope
+** functions below redirect changes to a frozen scope into mc's overlay.
+*/
+#define SCOPE_IS_FROZEN(scope)  ((scope)->nrefs == MOCHA_FROZEN)
+
+/*
+** Drop all of mc's overlays, forgetting what its scripts set in shared
+** objects.
+*/
+extern void
+mocha_DestroyOverlays(MochaContext *mc);
+
+/*
+** Return the first of scope's properties, or the one after prop, for
+** enumeration.  Unlike the props list, these include the properties in mc's
+** overlay of a frozen scope, which come first.
+*/
+extern MochaProperty *
+mocha_FirstProperty(MochaContext *mc, MochaScope *scope);
+
+extern MochaProperty *
+mocha_NextProperty(MochaContext *mc, MochaScope *scope, MochaProperty *prop);
+
+/*
+** Hold and drop a reference to shape.  Dropping the last reference frees
+** shape and drops its parent in turn.
+*/
+extern MochaShape *
+mocha_HoldShape(MochaShape *shape);
+
+extern void
+mocha_DropShape(MochaContext *mc, MochaShape *shape);
+
+/*
+** Free all shapes and drop their atoms.  Called when the last context is
+** destroyed, before the atom table goes, to free the shapes of any scopes
+** that were never destroyed.  No scope may still use a shape.
+*/
+extern void
+mocha_FreeShapeTree(MochaContext *mc);
+
 /*
 ** mocha_LookupSymbol looks in scope and its prototypes for a symbol named
 ** by atom.  If flag is MLF_SET, it ensures that the found symbol it returns
@@ -170,6 +254,13 @@ mocha_DefineSymbol(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
 extern void
 mocha_RemoveSymbol(MochaContext *mc, MochaScope *scope, MochaAtom *atom);
 
+/*
+** Return the index of sym in scope->symv, or -1 if sym is not defined in
+** scope or scope has no shape.
+*/
+extern int32
+mocha_SymbolIndex(MochaScope *scope, MochaSymbol *sym);
+
 /* XXX begin move me to mo_fun.h */
 /*
 ** Create/destroy ops for MochaFunction.
@@ -0,0 +1,73 @@
+#ifndef _mo_value_h_
+#define _mo_value_h_
+/*
+** Mocha compact values.
+**
+** A MochaValue holds an rvalue in 64 bits.  A number is kept as the bits of
+** its IEEE double, with every NaN made a quiet NaN of the same sign, which
+** leaves the doubles whose top 16 bits exceed 0xfff8 free to hold the other
+** types: the top 16 bits are a tag, and the low 48 bits hold a boolean, or
+** the pointer to an atom, object, or function.  A value has no flags, taint
+** or reference count of its own, so only an enumerable, untainted datum with
+** no other flags can be boxed.  A null datum that is not enumerable boxes as
+** a hole, for arrays.
+**
+** Only the elements of dense arrays are kept as values.  The operand stack
+** and property slots still hold MochaDatums, since they carry lvalue pairs,
+** flags and taint that a value can't.
+*/
+#include "prtypes.h"
+#include "prmacros.h"
+#include "mo_pubtd.h"
+
+NSPR_BEGIN_EXTERN_C
+
+typedef uint64_t MochaValue;
+
+#define MOCHA_VALUE_TAG_SHIFT   48
+#define MOCHA_VALUE_PAYLOAD     (((MochaValue)1 << MOCHA_VALUE_TAG_SHIFT) - 1)
+
+#define MVT_UNDEF       0xfff9          /* undefined value */
+#define MVT_BOOLEAN     0xfffa          /* boolean in the low bit */
+#define MVT_STRING      0xfffb          /* string atom */
+#define MVT_OBJECT      0xfffc          /* object pointer, or null */
+#define MVT_FUNCTION    0xfffd          /* function pointer */
+#define MVT_HOLE        0xfffe          /* null not visible to for-in */
+
+#define MOCHA_VALUE_TAG(v)      ((uint32)((v) >> MOCHA_VALUE_TAG_SHIFT))
+#define MOCHA_VALUE_IS_NUMBER(v) (MOCHA_VALUE_TAG(v) < MVT_UNDEF)
+#define MOCHA_VALUE_TO_PTR(v)                                                 \
+    ((void *)(uprword_t)((v) & MOCHA_VALUE_PAYLOAD))
+#define MOCHA_MAKE_VALUE(tag,payload)                                         \
+    (((MochaValue)(tag) << MOCHA_VALUE_TAG_SHIFT) | (MochaValue)(payload))
+
+#define MOCHA_VALUE_NAN         MOCHA_MAKE_VALUE(0x7ff8, 0)
+#define MOCHA_VALUE_SIGN        MOCHA_MAKE_VALUE(0x8000, 0)
+#define MOCHA_VALUE_HOLE        MOCHA_MAKE_VALUE(MVT_HOLE, 0)
+
+/*
+** Box *dp into *vp and return true, or return false if *dp has a tag,
+** flags, taint, or pointer that a value can't hold.  No reference is held.
+*/
+extern MochaBoolean
+mocha_BoxDatum(MochaDatum *dp, MochaValue *vp);
+
+/*
+** Set *dp to the datum boxed in v, enumerable unless v is a hole.  No
+** reference is held, and dp->nrefs is left alone.
+*/
+extern void
+mocha_UnboxValue(MochaContext *mc, MochaValue v, MochaDatum *dp);
+
+/*
+** Hold or drop the atom or object that v refers to, if any.
+*/
+extern void
+mocha_HoldValue(MochaContext *mc, MochaValue v);
+
+extern void
+mocha_DropValue(MochaContext *mc, MochaValue v);
+
+NSPR_END_EXTERN_C
+
+#endif /* _mo_value_h_ */
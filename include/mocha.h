@@ -26,6 +26,47 @@ struct MochaScript {
     unsigned            lineno;         /* base line number of script */
     void                *notes;         /* decompiling source notes */
     MochaSymbol         *args;          /* formal argument symbols */
+    MochaThreadedOp     *threaded;      /* lowered code, see mocha.c */
+    MochaThreadedOp     *traced;        /* lowered for the traced loop */
+    MochaPropertyCache  *pcache;        /* member op inline caches by offset */
+    unsigned            npcache;        /* number of member op sites */
+};
+
+/*
+** An inline cache for one MOP_MEMBER or MOP_LMEMBER site.  Each way records
+** the shape of a receiver scope in which the site's name was found, and the
+** index of the name's symbol in that scope's symbol vector.  A receiver whose
+** scope has a cached shape can load its symbol from the vector without calling
+** mocha_LookupSymbol.  Only symbols in the receiver's own scope are cached;
+** see mocha.c.
+*/
+#define MOCHA_PCACHE_WAYS	4
+
+typedef struct MochaPropertyCacheWay {
+    MochaShape          *shape;         /* held receiver shape, or null */
+    int32               index;          /* index of symbol in scope->symv */
+} MochaPropertyCacheWay;
+
+struct MochaPropertyCache {
+    unsigned            offset;         /* bytecode offset of member op */
+    unsigned            victim;         /* next way to replace when full */
+    MochaPropertyCacheWay ways[MOCHA_PCACHE_WAYS];
+};
+
+/*
+** A bytecode lowered by mocha_Interpret into direct-threaded form: the address
+** of the interpreter's handler for the op, the bytecode it came from (for
+** mc->pc and error reporting), and its pre-decoded immediate operand.
+*/
+struct MochaThreadedOp {
+    void                *handler;       /* interpreter label for this op */
+    MochaCode           *pc;            /* bytecode lowered into this op */
+    union {
+	MochaAtom       *atom;          /* MOF_CONST literal or name */
+	MochaThreadedOp *target;        /* MOF_JUMP branch target */
+	MochaPropertyCache *cache;      /* MOP_MEMBER/MOP_LMEMBER cache */
+	int             immediate;      /* MOF_ARGC count or MOF_INCOP flag */
+    } u;
 };
 
 /*
@@ -39,11 +80,15 @@ struct MochaFunction {
     uint16              spare;          /* reserved for future use */
     MochaAtom           *atom;          /* held name atom for diagnostics */
     MochaScript         *script;        /* Mocha bytecode */
+    MochaFunctionSource *source;        /* body to compile when first called */
 };
 
 /*
-** Mocha stack frame, allocated on the C runtime stack, one per native or
-** interpreted Mocha function activation.
+** Mocha stack frame, one per native or interpreted Mocha function activation.
+** Call() allocates a frame on the C runtime stack.  When the interpreter loop
+** calls an interpreted function, it instead takes a frame from the stack's
+** free list and runs the function's script itself, so the frame also records
+** where to resume the caller's script when the function returns.
 */
 struct MochaStackFrame {
     MochaFunction       *fun;           /* function being called */
@@ -54,28 +99,71 @@ struct MochaStackFrame {
     MochaDatum          *vars;          /* base of variable stack slots */
     MochaStackFrame     *down;          /* previous frame */
     MochaDatum          rval;           /* function return value */
+    MochaObjectStack    *objectStack;   /* caller's with-statement objects */
+    MochaBoolean        noParent;       /* fun's parent set to global object */
+    MochaBoolean        newSegment;     /* fun and args moved to new segment */
+    unsigned            nextop;         /* index of caller's next lowered op */
+    MochaScript         *script;        /* calling script, if interpreted */
+    MochaObject         *slink;         /* calling script's static link */
+    MochaCode           *pc;            /* caller's next op */
+};
+
+/*
+** A segment of a Mocha stack: an array of MochaDatum structs that is never
+** moved, so pointers into it stay good until it is popped.  A segment that
+** isn't current saves its top of stack in ptr.
+*/
+struct MochaStackSegment {
+    MochaStackSegment   *down;          /* next older segment, or null */
+    MochaDatum          *base;          /* lowest address in segment */
+    MochaDatum          *limit;         /* one beyond highest address */
+    MochaDatum          *ptr;           /* top of stack if not current */
 };
 
 /*
-** Mocha uses a single fixed-size array of MochaDatum structs for its stack,
-** to keep things simple and fast.
+** Mocha's stack starts as one small segment at the end of the context.  When
+** a script or function call needs more room than the current segment has,
+** a new segment is pushed for it, and popped when it returns, so the stack
+** holds up to maxbytes of datums without moving any.  The current segment is
+** cached in base and limit, to keep pushing and popping simple and fast.
+** Frames for calls made by the interpreter loop are kept on a free list when
+** they return, for the next call to reuse.
 */
+#define MOCHA_STACK_CHUNK       1024    /* bytes in first stack segment */
+
 struct MochaStack {
-    MochaDatum          *base;          /* lowest address in stack */
+    MochaDatum          *base;          /* lowest address in segment */
     MochaDatum          *limit;         /* one beyond highest byte address */
     MochaStackFrame     *frame;         /* current frame pointer */
     MochaDatum          *ptr;           /* one beyond top of stack */
+    MochaStackFrame     *freeFrames;    /* frames to reuse, linked by down */
+    MochaStackSegment   *segment;       /* current segment */
+    MochaStackSegment   *spare;         /* last popped segment, for reuse */
+    size_t              below;          /* datums in use under segment */
+    size_t              maxbytes;       /* limit on bytes of datums in use */
+    MochaStackSegment   first;          /* segment at the end of context */
 };
 
-#define MOCHA_INIT_STACK(sp, space, nbytes)                                   \
+#define MOCHA_INIT_STACK(sp, space, size, max)                                \
     NSPR_BEGIN_MACRO                                                          \
 	(sp)->base = (sp)->ptr = (MochaDatum *)(space);                       \
-	(sp)->limit = (MochaDatum *)((char *)(space) + (nbytes));             \
-	(sp)->frame = 0;                                                      \
+	(sp)->limit = (sp)->base + (size) / sizeof(MochaDatum);               \
+	(sp)->frame = (sp)->freeFrames = 0;                                   \
+	(sp)->first.down = 0;                                                 \
+	(sp)->first.base = (sp)->first.ptr = (sp)->base;                      \
+	(sp)->first.limit = (sp)->limit;                                      \
+	(sp)->segment = &(sp)->first;                                         \
+	(sp)->spare = 0;                                                      \
+	(sp)->below = 0;                                                      \
+	(sp)->maxbytes = (max);                                               \
     NSPR_END_MACRO
 
-extern MochaTaintCounter mocha_HoldTaint;
-extern MochaTaintCounter mocha_DropTaint;
+/*
+** Free the frames on mc's stack free list, and any stack segments other than
+** the first, when mc is destroyed.
+*/
+extern void
+mocha_FinishStack(MochaContext *mc);
 
 /*
 ** Hold and release atom and object references from a stack datum, a global
@@ -129,6 +217,19 @@ mocha_Call(MochaContext *mc, MochaDatum fd,
 extern MochaBoolean
 mocha_TypeOfDatum(MochaContext *mc, MochaDatum d, MochaAtom **atomp);
 
+/*
+** Allocate script's table of inline caches, one per member op, sorted by
+** bytecode offset.  Called once by whoever creates a script.
+*/
+extern MochaBoolean
+mocha_InitPropertyCaches(MochaContext *mc, MochaScript *script);
+
+/*
+** Drop the shapes held by script's inline caches, and free them.
+*/
+extern void
+mocha_FinishPropertyCaches(MochaContext *mc, MochaScript *script);
+
 /*
 ** Interpret script in the given context and static link.
 */
@@ -25,6 +25,7 @@ typedef enum MochaTag {
     MOCHA_INTERNAL,                     /* internal handle (void *) */
     MOCHA_ATOM,                         /* unresolved identifier */
     MOCHA_SYMBOL,                       /* resolved symbol (lvalue) */
+    MOCHA_ELEMENT,                      /* array element (lvalue) */
     MOCHA_FUNCTION,                     /* function pointer (rvalue) */
     MOCHA_OBJECT,                       /* object reference (rvalue) */
     MOCHA_NUMBER,                       /* floating point number (rvalue) */
@@ -38,6 +39,11 @@ typedef struct MochaPair {
     MochaSymbol         *sym;           /* member symbol in object scope */
 } MochaPair;
 
+typedef struct MochaElement {
+    MochaObject         *obj;           /* array object containing element */
+    MochaSlot           index;          /* element index, not atomized */
+} MochaElement;
+
 /*
 ** API clients should not set or use nrefs.  All MochaDatum instances visible
 ** through this API are stack-allocated, either on the Mocha virtual machine
@@ -56,9 +62,14 @@ struct MochaDatum {
         void            *ptr;           /* internal pointer */
         MochaAtom       *atom;          /* literal */
         MochaPair       pair;           /* object/symbol pair */
+        MochaElement    elem;           /* array object/element index pair */
         MochaFunction   *fun;           /* function pointer */
         MochaObject     *obj;           /* object pointer */
         MochaFloat      fval;           /* number */
+        struct {
+            MochaFloat  fval;           /* number, the same as u.fval */
+            int32       ival;           /* fval as an int32 if MDF_INT */
+        } num;
         MochaBoolean    bval;           /* boolean */
     } u;
 };
@@ -68,7 +79,8 @@ struct MochaDatum {
 #define MDF_READONLY    0x04            /* set when property is read-only */
 #define MDF_VISITED     0x08            /* visited bit for depth-first search */
 #define MDF_TAINTED     0x10            /* for private/secret data tainting */
-#define MDF_ALLFLAGS    0x1f            /* bit-set of all valid datum flags */
+#define MDF_INT         0x40            /* number is an int32, see u.num */
+#define MDF_ALLFLAGS    0x5f            /* bit-set of all valid datum flags */
 
 #ifdef DEBUG_brendan
 #define MDF_TRACEBITS   0xa0            /* make sure these two bits propagate */
@@ -92,15 +104,17 @@ struct MochaDatum {
             if (_ACCUM == MOCHA_TAINT_IDENTITY) {                             \
                 (ACCUM) = _TAINT;                                             \
             } else if (_TAINT != MOCHA_TAINT_IDENTITY) {                      \
-                if (mocha_MixTaint)                                           \
-                    (ACCUM) = (*mocha_MixTaint)(MC, _ACCUM, _TAINT);          \
-                else                                                          \
-                    (ACCUM) = MOCHA_TAINT_MAX;                                \
+                (ACCUM) = MOCHA_MixTaint(MC, _ACCUM, _TAINT);                 \
             }                                                                 \
         }                                                                     \
     NSPR_END_MACRO
 
-extern MochaTaintMixer mocha_MixTaint;
+/*
+** Mix two different, non-identity taints using MC's taint mixer, or return
+** MOCHA_TAINT_MAX if there is no mixer.
+*/
+extern uint16
+MOCHA_MixTaint(MochaContext *mc, uint16 accum, uint16 taint);
 
 /*
 ** Call MOCHA_INIT_DATUM to initialize a datum passed by reference from the
@@ -109,17 +123,22 @@ extern MochaTaintMixer mocha_MixTaint;
 **
 ** Call MOCHA_INIT_FULL_DATUM to initialize an auto storage class temporary
 ** datum that's passed to MOCHA_SetProperty(), MOCHA_ConvertDatum(), etc.
+**
+** Both clear MDF_INT, which only the interpreter sets: a number's value is
+** always in u.fval, and API clients need not keep u.num.ival.
 */
 #define MOCHA_INIT_DATUM(MC,DP,TAG,ARM,VAL)                                   \
     NSPR_BEGIN_MACRO                                                          \
         (DP)->tag = TAG;                                                      \
         (DP)->ARM = VAL;                                                      \
+        (DP)->flags &= ~MDF_INT;                                              \
     NSPR_END_MACRO
 
 #define MOCHA_INIT_FULL_DATUM(MC,DP,TAG,FLAGS,TAINT,ARM,VAL)                  \
     NSPR_BEGIN_MACRO                                                          \
-        MOCHA_INIT_DATUM(MC,DP,TAG,ARM,VAL);                                  \
-        (DP)->flags = MDF_TRACEBITS | ((FLAGS) & MDF_ALLFLAGS);               \
+        (DP)->tag = TAG;                                                      \
+        (DP)->ARM = VAL;                                                      \
+        (DP)->flags = MDF_TRACEBITS | ((FLAGS) & MDF_ALLFLAGS & ~MDF_INT);    \
         (DP)->taint = TAINT;                                                  \
     NSPR_END_MACRO
 
@@ -229,9 +248,25 @@ MOCHA_TypeOfDatum(MochaContext *mc, MochaDatum d);
 /*
 ** Initialize Mocha by calling MOCHA_NewContext(), which creates a new
 ** execution context for compiling and running Mocha scripts and functions.
-** Its return value is an opaque pointer to the new Mocha context.
+** Its return value is an opaque pointer to the new Mocha context.  The
+** context's stack starts small and grows as scripts need it, up to stackSize
+** bytes; a script that needs more fails with a stack overflow error.
 **
 ** When you're all through doing Mocha, you may call MOCHA_DestroyContext().
+**
+** Threading model: in a library built with MOCHA_THREADSAFE defined, any
+** number of threads may create, use, and destroy contexts at once, each
+** thread using only the contexts it created and the objects reachable from
+** them.  A context and its objects must not be used by two threads at once;
+** a context may move to another thread only when its first thread is done
+** with it.  Atoms are shared by all contexts, and are safe to share.  The
+** taint callbacks are process-wide, and each context uses those set before
+** it was created, so call MOCHA_SetTaintCallbacks() before making contexts.
+** MOCHA_ContextIterator() walks a list that other threads may change, so it
+** is reliable only while no thread is creating or destroying a context.
+**
+** When the last context is destroyed, all atoms and scope shapes are freed,
+** so nothing from a destroyed context may be kept across that point.
 */
 extern MochaContext *
 MOCHA_NewContext(size_t stackSize);
@@ -254,6 +289,74 @@ MOCHA_SetGlobalObject(MochaContext *mc, MochaObject *obj);
 extern MochaObject *
 MOCHA_GetStaticLink(MochaContext *mc);
 
+/*
+** A template is a copy of a fully initialized global object, and of every
+** object reachable from it, kept apart from any running context.  Making a
+** global object by cloning a template costs a fraction of what setting one
+** up with MOCHA_SetGlobalObject() does, as there are no names to atomize,
+** no constructors to run, and no scope shapes to look up.
+**
+** MOCHA_NewTemplate() copies obj, usually a global object initialized with
+** MOCHA_SetGlobalObject() and perhaps given host objects and functions,
+** into a new template.  obj may be changed or destroyed afterward without
+** affecting the template.  Every object reachable from obj must be of a
+** class with a clone op or no private data; functions compiled from source
+** are copied along with their scripts.  Shared objects (see below) are
+** referenced by the template, not copied.  Return null after reporting an
+** error via mc on failure.
+**
+** MOCHA_CloneTemplate() makes a new global object for mc from tmpl, and
+** makes it mc's global object as MOCHA_SetGlobalObject() would, without
+** initializing the standard library again.  The new object is not held;
+** hold it with MOCHA_HoldObject() as for MOCHA_NewObject().  Contexts on
+** different threads may clone one template at the same time.
+**
+** A template holds a context of its own, so the atoms and shapes it uses
+** stay alive.  Destroy it with MOCHA_DestroyTemplate() when all contexts
+** that will clone it have been made.
+*/
+extern MochaTemplate *
+MOCHA_NewTemplate(MochaContext *mc, MochaObject *obj);
+
+extern MochaObject *
+MOCHA_CloneTemplate(MochaContext *mc, MochaTemplate *tmpl);
+
+extern void
+MOCHA_DestroyTemplate(MochaTemplate *tmpl);
+
+/*
+** The shared library is one copy of the standard library's constructors,
+** prototypes and functions that every context on every thread may use at
+** once.  Its objects are frozen: a script that sets or deletes a property
+** of one changes only its own context's view of that object, through an
+** overlay kept with the context.  Objects with private state, such as
+** Date.prototype, can't have that state changed at all.
+**
+** MOCHA_SetSharedGlobalObject() is MOCHA_SetGlobalObject() for obj, a new
+** global object, but defines the shared library's constructors and
+** functions in obj instead of making new ones, making the library the
+** first time it's called.  It also forgets whatever scripts in mc have set
+** in the shared objects.  Return false after reporting an error on failure.
+**
+** MOCHA_DestroySharedLibrary() frees the shared library once no context
+** refers to it anymore.
+*/
+extern MochaBoolean
+MOCHA_SetSharedGlobalObject(MochaContext *mc, MochaObject *obj);
+
+extern void
+MOCHA_DestroySharedLibrary(void);
+
+/*
+** Copy the datum at from into to for a class clone op, holding whatever to
+** refers to.  An object that from refers to is copied the first time it is
+** seen by cl, so objects shared in the original graph are shared in the
+** copy.  Return false after reporting an error on failure.
+*/
+extern MochaBoolean
+MOCHA_CloneDatum(MochaContext *mc, MochaCloner *cl, MochaDatum *from,
+                 MochaDatum *to);
+
 /*
 ** Wrapper function that calls malloc but reports errors via mc.
 */
@@ -312,6 +415,14 @@ struct MochaObject {
 ** reporting convention as native functions: return MOCHA_FALSE after reporting
 ** the error with MOCHA_ReportError() or MOCHA_ReportOutOfMemory() on failure,
 ** return MOCHA_TRUE on success.
+**
+** The optional clone entry point copies obj's private state into copy when
+** a template is made or cloned (see MOCHA_NewTemplate()), using the same
+** convention.  It should set copy->data to a copy of obj->data, using
+** MOCHA_CloneDatum() for any datums therein.  copy is finalized by the
+** class's finalize op if cloning fails, so the clone op must leave it in a
+** state that finalize can handle.  Objects of a class with no clone op can
+** be copied only if their data is null.
 */
 struct MochaClass {
     const char      *name;
@@ -323,6 +434,8 @@ struct MochaClass {
     MochaBoolean    (*convert)(MochaContext *mc, MochaObject *obj,
                                MochaTag tag, MochaDatum *dp);
     void            (*finalize)(MochaContext *mc, MochaObject *obj);
+    MochaBoolean    (*clone)(MochaContext *mc, MochaObject *obj,
+                             MochaObject *copy, MochaCloner *cl);
 };
 
 /* Helper macros that take MochaObject * and call object operations. */
@@ -412,10 +525,10 @@ struct MochaPropertySpec {
 ** are passed the rest will be passed as MOCHA_void.
 **
 ** The fun member should not be set by the API client -- it should be left
-** statically-initialized by default to 0.  After the first call that passes
-** a vector of MochaFunctionSpec structs to MOCHA_DefineFunctions(), each vector
-** element's fun pointer will point to a shared MochaFunction to be added to
-** subsequent objects' scopes by reference.
+** statically-initialized by default to 0.  It is no longer used: each call to
+** MOCHA_DefineFunctions() defines new functions, because a function shared
+** through a static spec would outlive the atoms it names, which are freed
+** with the last context, and could be used by contexts on other threads.
 */
 struct MochaFunctionSpec {
     char                *name;
@@ -527,7 +640,8 @@ extern void
 MOCHA_RemoveProperty(MochaContext *mc, MochaObject *obj, const char *name);
 
 /*
-** Get, set (add), and remove property by slot instead of by name.
+** Get, set (add), and remove property by slot instead of by name.  For an
+** Array object, slot is an element index and these use its element vector.
 */
 extern MochaBoolean
 MOCHA_GetSlot(MochaContext *mc, MochaObject *obj, MochaSlot slot,
@@ -541,17 +655,22 @@ extern void
 MOCHA_RemoveSlot(MochaContext *mc, MochaObject *obj, MochaSlot slot);
 
 /*
-** XXX comment me
+** Return the unheld string atom for the length chars at name, which need not
+** be NUL-terminated and may contain NULs.  A null name gives the empty string.
 */
 MochaAtom *
-MOCHA_Atomize(MochaContext *mc, const char *name);
+MOCHA_Atomize(MochaContext *mc, const char *name, size_t length);
 
 /*
-** XXX comment me
+** Return atom's name, which is NUL-terminated but may contain other NULs, so
+** use MOCHA_GetAtomLength to learn its length.
 */
 const char *
 MOCHA_GetAtomName(MochaContext *mc, MochaAtom *atom);
 
+size_t
+MOCHA_GetAtomLength(MochaContext *mc, MochaAtom *atom);
+
 /*
 ** XXX comment me
 */
@@ -22,6 +22,8 @@ mocha_InitMathClass(MochaContext *mc, MochaObject *obj);
 /*
 ** Function class declarations.
 */
+extern MochaClass mocha_FunctionClass;
+
 extern MochaBoolean
 mocha_FunctionToString(MochaContext *mc, MochaFunction *fun, MochaAtom **atomp);
 
@@ -69,6 +71,13 @@ mocha_SetPrototype(MochaContext *mc, MochaFunction *fun, MochaObject *obj);
 extern MochaBoolean
 mocha_GetMutableScope(MochaContext *mc, MochaObject *obj);
 
+/*
+** Return true if obj's private data may be changed, else report an error
+** and return false, as obj is a shared library object.
+*/
+extern MochaBoolean
+mocha_CheckMutable(MochaContext *mc, MochaObject *obj);
+
 extern MochaObject *
 mocha_NewObjectByClass(MochaContext *mc, MochaClass *clazz);
 
@@ -142,11 +151,46 @@ mocha_InitDateClass(MochaContext *mc, MochaObject *obj);
 /*
 ** Array class declarations.
 */
+extern MochaClass mocha_ArrayClass;
+
 extern MochaObject *
 mocha_InitArrayClass(MochaContext *mc, MochaObject *obj);
 
 extern MochaObject *
 mocha_NewArrayObject(MochaContext *mc, unsigned length, MochaDatum *base);
+
+/*
+** Set *dp to array obj's element at index, growing obj's length to index + 1
+** with null holes if index is past the end.  No reference is held, and
+** dp->nrefs is left alone.  On error, report it and return false.
+*/
+extern MochaBoolean
+mocha_GetArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index,
+		      MochaDatum *dp);
+
+/*
+** Set array obj's element at index to d, growing obj as above.  Like
+** MOCHA_SetSlot, this keeps d's flags and does no readonly checking.  If d
+** can't be boxed in a compact value, obj goes sparse to keep it.
+*/
+extern MochaBoolean
+mocha_SetArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index,
+		      MochaDatum d);
+
+/*
+** Make array obj's element at index a hole, shortening obj if it was the
+** last element.
+*/
+extern void
+mocha_RemoveArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index);
+
+/*
+** Return the least index not less than index of an enumerable element held
+** in array obj's element vector, or -1 if there is none.  An array that has
+** gone sparse keeps its elements as properties, so for-in finds them there.
+*/
+extern MochaSlot
+mocha_NextArrayElement(MochaObject *obj, MochaSlot index);
 /* XXX end move me to mo_array.h */
 
 /*
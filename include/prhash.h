@@ -40,16 +40,18 @@ typedef struct PRHashAllocOps {
 #define HT_FREE_ENTRY   1               /* free value and entire entry */
     
 struct PRHashEntryStr {
-    PRHashEntry         *next;          /* hash chain linkage */
+    PRHashEntry         *next;          /* free for the entry owner's use */
     PRHashNumber        keyHash;        /* key hash function result */
     const void          *key;           /* ptr to opaque key */
     void                *value;         /* ptr to opaque value */
 };
 
 struct PRHashTableStr {
-    PRHashEntry         **buckets;      /* vector of hash buckets */
+    PRHashEntry         **buckets;      /* vector of open-addressed buckets */
+    uint8               *ctrl;          /* control byte for each bucket */
     unsigned int        nentries;       /* number of entries in table */
-    unsigned int        shift;          /* multiplicative hash shift */
+    unsigned int        ndeleted;       /* number of deleted bucket markers */
+    unsigned int        shift;          /* PR_HASH_BITS - log2(nbuckets) */
     PRHashFunction      keyHash;        /* key hash function */
     PRHashComparator    keyCompare;     /* key comparison function */
     PRHashComparator    valueCompare;   /* value comparison function */
@@ -57,7 +59,7 @@ struct PRHashTableStr {
     void                *allocPool;     /* allocation private data */
 #ifdef HASHMETER
     unsigned int        nlookups;       /* total number of lookups */
-    unsigned int        nsteps;         /* number of hash chains traversed */
+    unsigned int        nsteps;         /* number of extra groups probed */
     unsigned int        ngrows;         /* number of table expansions */
     unsigned int        nshrinks;       /* number of table contractions */
 #endif
@@ -75,7 +77,11 @@ PR_NewHashTable(uint32 n, PRHashFunction keyHash,
 extern PR_PUBLIC_API(void)
 PR_HashTableDestroy(PRHashTable *ht);
 
-/* Low level access methods */
+/*
+** Low level access methods.  RawLookup returns a pointer to key's bucket,
+** which is null if key is not in the table.  A bucket pointer is good only
+** until the next add or remove.
+*/
 extern PR_PUBLIC_API(PRHashEntry **)
 PR_HashTableRawLookup(PRHashTable *ht, PRHashNumber keyHash, const void *key);
 
@@ -83,6 +89,13 @@ extern PR_PUBLIC_API(PRHashEntry *)
 PR_HashTableRawAdd(PRHashTable *ht, PRHashEntry **hep, PRHashNumber keyHash,
                    const void *key, void *value);
 
+/*
+** Like RawAdd, but add he, an entry already allocated and initialized by the
+** caller, to the null bucket at hep.
+*/
+extern PR_PUBLIC_API(PRHashEntry *)
+PR_HashTableRawAddEntry(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he);
+
 extern PR_PUBLIC_API(void)
 PR_HashTableRawRemove(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he);
 
@@ -9,10 +9,188 @@
 */
 
 #include "prmacros.h"
+#include "prtypes.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(XP_MAC)
+#include <pthread.h>
+#endif
 
 NSPR_BEGIN_EXTERN_C
 
-#define PR_CAS(new, old, oldp)	(*(oldp) = (new), (old))
+/*
+** Atomic operations on an int32 word shared by threads.  PR_CAS stores new
+** in *oldp if *oldp equals old, and returns the value *oldp had, so it won
+** iff it returns old.  PR_ATOMIC_INCREMENT and PR_ATOMIC_DECREMENT return
+** the new value.  PR_ATOMIC_LOAD reads a word that another thread may store
+** to without a lock, and orders the reader's later loads after it, so they
+** see what the writer stored before its PR_ATOMIC_STORE or PR_ATOMIC_OR,
+** which sets bits in *p.  Without threads, these are plain loads and stores.
+*/
+#if defined(_WIN32)
+#define PR_CAS(new, old, oldp)  InterlockedCompareExchange((LONG *)(oldp),   \
+                                                           (new), (old))
+#define PR_ATOMIC_INCREMENT(p)  InterlockedIncrement((LONG *)(p))
+#define PR_ATOMIC_DECREMENT(p)  InterlockedDecrement((LONG *)(p))
+#define PR_ATOMIC_LOAD(p)       InterlockedCompareExchange((LONG *)(p), 0, 0)
+#define PR_ATOMIC_STORE(p, v)   InterlockedExchange((LONG *)(p), (v))
+#define PR_ATOMIC_OR(p, bits)   InterlockedOr((LONG *)(p), (bits))
+#elif defined(__GNUC__)
+#define PR_CAS(new, old, oldp)  __sync_val_compare_and_swap(oldp, old, new)
+#define PR_ATOMIC_INCREMENT(p)  __sync_add_and_fetch(p, 1)
+#define PR_ATOMIC_DECREMENT(p)  __sync_sub_and_fetch(p, 1)
+#define PR_ATOMIC_LOAD(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define PR_ATOMIC_STORE(p, v)   __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define PR_ATOMIC_OR(p, bits)   __atomic_fetch_or(p, bits, __ATOMIC_ACQ_REL)
+#else
+#define PR_CAS(new, old, oldp)  (*(oldp) = (new), (old))
+#define PR_ATOMIC_INCREMENT(p)  (++*(p))
+#define PR_ATOMIC_DECREMENT(p)  (--*(p))
+#define PR_ATOMIC_LOAD(p)       (*(p))
+#define PR_ATOMIC_STORE(p, v)   (*(p) = (v))
+#define PR_ATOMIC_OR(p, bits)   (*(p) |= (bits))
+#endif
+
+/*
+** A sync lock is a bare mutex: no owner tracking, no recursion, and no
+** condition to wait on.  Hold one only for a few instructions.  A static
+** sync lock may be initialized with PR_SYNC_LOCK_INITIALIZER instead of by
+** calling PR_InitSyncLock.
+*/
+#if defined(_WIN32)
+typedef SRWLOCK PRSyncLock;
+#define PR_SYNC_LOCK_INITIALIZER    SRWLOCK_INIT
+#define PR_InitSyncLock(lock)       (InitializeSRWLock(lock), 0)
+#define PR_DestroySyncLock(lock)    ((void)(lock))
+#define PR_SyncLock(lock)           AcquireSRWLockExclusive(lock)
+#define PR_SyncUnlock(lock)         ReleaseSRWLockExclusive(lock)
+#elif defined(XP_MAC)
+typedef int PRSyncLock;
+#define PR_SYNC_LOCK_INITIALIZER    0
+#define PR_InitSyncLock(lock)       (*(lock) = 0)
+#define PR_DestroySyncLock(lock)    ((void)(lock))
+#define PR_SyncLock(lock)           ((void)(lock))
+#define PR_SyncUnlock(lock)         ((void)(lock))
+#else
+typedef pthread_mutex_t PRSyncLock;
+#define PR_SYNC_LOCK_INITIALIZER    PTHREAD_MUTEX_INITIALIZER
+#define PR_InitSyncLock(lock)       pthread_mutex_init(lock, 0)
+#define PR_DestroySyncLock(lock)    pthread_mutex_destroy(lock)
+#define PR_SyncLock(lock)           pthread_mutex_lock(lock)
+#define PR_SyncUnlock(lock)         pthread_mutex_unlock(lock)
+#endif
+
+/*
+** A sync condition is a bare condition variable used with a sync lock.
+** PR_WaitSyncCond atomically unlocks lock and waits for cond to be notified,
+** then relocks lock.  Waits may end spuriously, so test the awaited state in
+** a loop.
+*/
+#if defined(_WIN32)
+typedef CONDITION_VARIABLE PRSyncCond;
+#define PR_InitSyncCond(cond)       (InitializeConditionVariable(cond), 0)
+#define PR_DestroySyncCond(cond)    ((void)(cond))
+#define PR_WaitSyncCond(cond, lock) SleepConditionVariableSRW(cond, lock,    \
+                                                              INFINITE, 0)
+#define PR_NotifySyncCond(cond)     WakeConditionVariable(cond)
+#define PR_NotifyAllSyncCond(cond)  WakeAllConditionVariable(cond)
+#elif defined(XP_MAC)
+typedef int PRSyncCond;
+#define PR_InitSyncCond(cond)       (*(cond) = 0)
+#define PR_DestroySyncCond(cond)    ((void)(cond))
+#define PR_WaitSyncCond(cond, lock) ((void)(cond))
+#define PR_NotifySyncCond(cond)     ((void)(cond))
+#define PR_NotifyAllSyncCond(cond)  ((void)(cond))
+#else
+typedef pthread_cond_t PRSyncCond;
+#define PR_InitSyncCond(cond)       pthread_cond_init(cond, 0)
+#define PR_DestroySyncCond(cond)    pthread_cond_destroy(cond)
+#define PR_WaitSyncCond(cond, lock) pthread_cond_wait(cond, lock)
+#define PR_NotifySyncCond(cond)     pthread_cond_signal(cond)
+#define PR_NotifyAllSyncCond(cond)  pthread_cond_broadcast(cond)
+#endif
+
+/*
+** A sync thread runs a function declared with PR_SYNC_THREAD_MAIN, which
+** must end with PR_SYNC_THREAD_RETURN.  PR_CreateSyncThread returns 0 on
+** success.  Every thread created must be joined.
+*/
+#if defined(_WIN32)
+typedef HANDLE PRSyncThread;
+#define PR_SYNC_THREAD_MAIN(name, arg)  DWORD WINAPI name(LPVOID arg)
+#define PR_SYNC_THREAD_RETURN           return 0
+#define PR_CreateSyncThread(tp, main, arg)                                    \
+    ((*(tp) = CreateThread(0, 0, main, arg, 0, 0)) != 0 ? 0 : -1)
+#define PR_JoinSyncThread(t)            (WaitForSingleObject(t, INFINITE),    \
+                                         CloseHandle(t))
+#elif defined(XP_MAC)
+typedef int PRSyncThread;
+#define PR_SYNC_THREAD_MAIN(name, arg)  void name(void *arg)
+#define PR_SYNC_THREAD_RETURN           return
+#define PR_CreateSyncThread(tp, main, arg)  (-1)
+#define PR_JoinSyncThread(t)            ((void)(t))
+#else
+typedef pthread_t PRSyncThread;
+#define PR_SYNC_THREAD_MAIN(name, arg)  void *name(void *arg)
+#define PR_SYNC_THREAD_RETURN           return 0
+#define PR_CreateSyncThread(tp, main, arg)  pthread_create(tp, 0, main, arg)
+#define PR_JoinSyncThread(t)            pthread_join(t, 0)
+#endif
+
+/*
+** PR_ATOMIC_LOADP and PR_ATOMIC_STOREP load and store a pointer, to publish
+** a structure to threads reading without a lock: a reader that loads the
+** pointer sees all the stores that initialized it.  PR_CASP stores new in
+** *oldp if *oldp equals old, and returns the pointer *oldp had, so it won iff
+** it returns old; if it wins, it publishes new like PR_ATOMIC_STOREP.
+*/
+#if defined(_WIN32)
+#define PR_ATOMIC_LOADP(p)      InterlockedCompareExchangePointer(           \
+                                    (PVOID volatile *)(p), 0, 0)
+#define PR_ATOMIC_STOREP(p, v)  InterlockedExchangePointer(                  \
+                                    (PVOID volatile *)(p), (v))
+#define PR_CASP(new, old, oldp) InterlockedCompareExchangePointer(           \
+                                    (PVOID volatile *)(oldp), (new), (old))
+#elif defined(__GNUC__)
+#define PR_ATOMIC_LOADP(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define PR_ATOMIC_STOREP(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define PR_CASP(new, old, oldp) __sync_val_compare_and_swap(oldp, old, new)
+#else
+#define PR_ATOMIC_LOADP(p)      (*(p))
+#define PR_ATOMIC_STOREP(p, v)  (*(p) = (v))
+#define PR_CASP(new, old, oldp) (*(oldp) = (new), (old))
+#endif
+
+/*
+** PR_RELAXED_LOAD and PR_RELAXED_STORE read and write an aligned word or
+** pointer that threads share without a lock, in one piece but with no
+** ordering, for a value that is good on its own, such as a counter or a code
+** address.  Compilers other than GCC don't split such loads and stores.
+*/
+#if defined(__GNUC__)
+#define PR_RELAXED_LOAD(p)      __atomic_load_n(p, __ATOMIC_RELAXED)
+#define PR_RELAXED_STORE(p, v)  __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#else
+#define PR_RELAXED_LOAD(p)      (*(p))
+#define PR_RELAXED_STORE(p, v)  (*(p) = (v))
+#endif
+
+/*
+** PR_MEMORY_BARRIER orders the stores that initialize a structure before
+** the store that publishes it to threads reading without a lock.
+** PR_THREAD_LOCAL declares a static variable with one instance per thread.
+*/
+#if defined(_WIN32)
+#define PR_MEMORY_BARRIER()         MemoryBarrier()
+#define PR_THREAD_LOCAL             __declspec(thread)
+#elif defined(__GNUC__)
+#define PR_MEMORY_BARRIER()         __sync_synchronize()
+#define PR_THREAD_LOCAL             __thread
+#else
+#define PR_MEMORY_BARRIER()         ((void)0)
+#define PR_THREAD_LOCAL
+#endif
 
 NSPR_END_EXTERN_C
 
@@ -5,12 +5,308 @@
 */
 #include <stdlib.h>
 #include <string.h>
+#include "prlog.h"
 #include "prprf.h"
 #include "mo_cntxt.h"
 #include "mo_scope.h"
 #include "mocha.h"
 #include "mochaapi.h"
 #include "mochalib.h"
+#include "mo_value.h"
+
+/*
+** Array elements live in a dense vector of compact values (see mo_value.h)
+** hung off obj->data, so an indexed get or set needs no atom and no symbol
+** table lookup, and an element takes 8 bytes rather than a whole datum.  A
+** hole is MOCHA_VALUE_HOLE, as is an element made by reading past the end
+** of the array.  If growing the vector would leave it mostly holes, or an
+** element is set to a datum that can't be boxed (one that is tainted,
+** readonly, or not enumerable), the array goes sparse for good: its elements
+** move into slot-numbered properties of obj->scope, which is how all
+** elements used to be kept.
+*/
+typedef struct MochaArray {
+    MochaValue          *vector;        /* dense elements, null if sparse */
+    MochaSlot           length;         /* element count, including holes */
+    MochaSlot           capacity;       /* number of values in vector */
+    MochaBoolean        sparse;         /* elements are scope properties */
+} MochaArray;
+
+#define ARRAY_MIN_CAPACITY      8       /* initial vector length */
+#define ARRAY_SPARSE_GAP        1024    /* most holes one store may add... */
+#define ARRAY_SPARSE_RATIO      8       /* ...unless length grows less than 8x */
+
+static MochaArray *
+GetArray(MochaContext *mc, MochaObject *obj)
+{
+    MochaArray *array;
+
+    PR_ASSERT(obj->clazz == &mocha_ArrayClass);
+    if (!mocha_CheckMutable(mc, obj))
+	return 0;
+    array = obj->data;
+    if (!array) {
+	array = MOCHA_malloc(mc, sizeof *array);
+	if (!array)
+	    return 0;
+	memset(array, 0, sizeof *array);
+	obj->data = array;
+    }
+    return array;
+}
+
+/*
+** Arrays use their element count for length; other objects that borrow the
+** Array methods use their highest slot-numbered property, as before.
+*/
+static MochaSlot
+ArrayLength(MochaObject *obj)
+{
+    MochaArray *array;
+
+    if (obj->clazz != &mocha_ArrayClass)
+	return obj->scope->freeslot;
+    array = obj->data;
+    return array ? array->length : 0;
+}
+
+static MochaBoolean
+MakeSparse(MochaContext *mc, MochaObject *obj, MochaArray *array)
+{
+    MochaSlot slot;
+    MochaValue *vector;
+    MochaDatum d;
+
+    if (!mocha_GetMutableScope(mc, obj))
+	return MOCHA_FALSE;
+    for (slot = 0; slot < array->length; slot++) {
+	if (array->vector[slot] == MOCHA_VALUE_HOLE)
+	    continue;
+	mocha_UnboxValue(mc, array->vector[slot], &d);
+	if (!mocha_SetProperty(mc, obj->scope, 0, slot, d))
+	    return MOCHA_FALSE;
+    }
+
+    /* Go sparse before dropping, in case a finalizer uses this array. */
+    vector = array->vector;
+    array->vector = 0;
+    array->capacity = 0;
+    array->sparse = MOCHA_TRUE;
+    for (slot = 0; slot < array->length; slot++)
+	mocha_DropValue(mc, vector[slot]);
+    MOCHA_free(mc, vector);
+    return MOCHA_TRUE;
+}
+
+static void
+RemoveSparseElement(MochaContext *mc, MochaObject *obj, MochaSlot index)
+{
+    char buf[20];
+    MochaAtom *atom;
+
+    PR_snprintf(buf, sizeof buf, "%ld", (long)index);
+    atom = mocha_Atomize(mc, buf, strlen(buf), ATOM_HELD | ATOM_NAME);
+    if (!atom)
+	return;
+    mocha_RemoveProperty(mc, obj->scope, atom);
+    mocha_DropAtom(mc, atom);
+}
+
+static MochaBoolean
+SetArrayLength(MochaContext *mc, MochaObject *obj, MochaArray *array,
+	       MochaSlot length)
+{
+    MochaSlot oldlen, capacity, slot;
+    MochaValue *vector;
+    MochaProperty *prop, *next;
+
+    oldlen = array->length;
+    if (!array->sparse &&
+	length - oldlen > ARRAY_SPARSE_GAP &&
+	length / ARRAY_SPARSE_RATIO > oldlen) {
+	if (!MakeSparse(mc, obj, array))
+	    return MOCHA_FALSE;
+    }
+
+    if (array->sparse) {
+	array->length = length;
+	for (prop = obj->scope->props; prop; prop = next) {
+	    next = prop->next;
+	    if (prop->slot >= length)
+		RemoveSparseElement(mc, obj, prop->slot);
+	}
+	return MOCHA_TRUE;
+    }
+
+    if (length > array->capacity) {
+	capacity = array->capacity ? array->capacity : ARRAY_MIN_CAPACITY;
+	while (capacity < length) {
+	    /* Double, taking care not to overflow a MochaSlot. */
+	    capacity = (capacity < 0x40000000) ? 2 * capacity : length;
+	}
+	vector = MOCHA_malloc(mc, (size_t)capacity * sizeof *vector);
+	if (!vector)
+	    return MOCHA_FALSE;
+	if (array->vector) {
+	    memcpy(vector, array->vector, (size_t)oldlen * sizeof *vector);
+	    MOCHA_free(mc, array->vector);
+	}
+	array->vector = vector;
+	array->capacity = capacity;
+    }
+
+    /* Set length before dropping, in case a finalizer uses this array. */
+    array->length = length;
+    for (slot = oldlen; slot < length; slot++)
+	array->vector[slot] = MOCHA_VALUE_HOLE;
+    for (slot = length; slot < oldlen; slot++)
+	mocha_DropValue(mc, array->vector[slot]);
+    return MOCHA_TRUE;
+}
+
+/*
+** Return a pointer to the datum of the slot-numbered property for a sparse
+** array's element at index, making the property if necessary.
+*/
+static MochaDatum *
+GetSparseElement(MochaContext *mc, MochaObject *obj, MochaSlot index)
+{
+    char buf[20];
+    MochaAtom *atom;
+    MochaSymbol *sym;
+    MochaBoolean ok;
+
+    PR_snprintf(buf, sizeof buf, "%ld", (long)index);
+    atom = mocha_Atomize(mc, buf, strlen(buf), ATOM_HELD | ATOM_NAME);
+    if (!atom)
+	return 0;
+    ok = mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &sym);
+    mocha_DropAtom(mc, atom);
+    if (!ok)
+	return 0;
+    if (!sym || sym->type != SYM_PROPERTY || sym->scope != obj->scope) {
+	sym = mocha_SetProperty(mc, obj->scope, 0, index, MOCHA_null);
+	if (!sym)
+	    return 0;
+    }
+    return &sym_property(sym)->datum;
+}
+
+/*
+** Return the element storage for array obj, first growing obj's length to
+** index + 1 with holes if index is past the end.
+*/
+static MochaArray *
+GetElementArray(MochaContext *mc, MochaObject *obj, MochaSlot index)
+{
+    MochaArray *array;
+
+    PR_ASSERT(index >= 0);
+    array = GetArray(mc, obj);
+    if (!array)
+	return 0;
+    if (index >= array->length &&
+	!SetArrayLength(mc, obj, array, index + 1)) {
+	return 0;
+    }
+    return array;
+}
+
+MochaBoolean
+mocha_GetArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index,
+		      MochaDatum *dp)
+{
+    MochaArray *array;
+    MochaDatum *vp;
+
+    array = GetElementArray(mc, obj, index);
+    if (!array)
+	return MOCHA_FALSE;
+    if (!array->sparse) {
+	mocha_UnboxValue(mc, array->vector[index], dp);
+	return MOCHA_TRUE;
+    }
+    vp = GetSparseElement(mc, obj, index);
+    if (!vp)
+	return MOCHA_FALSE;
+    MOCHA_INIT_FULL_DATUM(mc, dp, vp->tag, vp->flags, vp->taint, u, vp->u);
+    return MOCHA_TRUE;
+}
+
+MochaBoolean
+mocha_SetArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index,
+		      MochaDatum d)
+{
+    MochaArray *array;
+    MochaValue value, oldValue;
+    MochaDatum *vp, oldDatum;
+
+    array = GetElementArray(mc, obj, index);
+    if (!array)
+	return MOCHA_FALSE;
+    if (!array->sparse) {
+	if (mocha_BoxDatum(&d, &value)) {
+	    mocha_HoldValue(mc, value);
+	    oldValue = array->vector[index];
+	    array->vector[index] = value;
+	    mocha_DropValue(mc, oldValue);
+	    return MOCHA_TRUE;
+	}
+	if (!MakeSparse(mc, obj, array))
+	    return MOCHA_FALSE;
+    }
+    vp = GetSparseElement(mc, obj, index);
+    if (!vp)
+	return MOCHA_FALSE;
+
+    /* Keep vp->nrefs, which counts symbols for a sparse element property. */
+    oldDatum = *vp;
+    d.nrefs = oldDatum.nrefs;
+    mocha_HoldRef(mc, &d);
+    *vp = d;
+    mocha_DropRef(mc, &oldDatum);
+    return MOCHA_TRUE;
+}
+
+void
+mocha_RemoveArrayElement(MochaContext *mc, MochaObject *obj, MochaSlot index)
+{
+    MochaArray *array;
+    MochaValue oldValue;
+
+    array = obj->data;
+    if (!array || index >= array->length || obj->nrefs == MOCHA_FROZEN)
+	return;
+    if (array->sparse) {
+	RemoveSparseElement(mc, obj, index);
+	if (index + 1 == array->length)
+	    array->length = index;
+	return;
+    }
+    oldValue = array->vector[index];
+    if (index + 1 == array->length)
+	array->length = index;
+    else
+	array->vector[index] = MOCHA_VALUE_HOLE;
+    mocha_DropValue(mc, oldValue);
+}
+
+MochaSlot
+mocha_NextArrayElement(MochaObject *obj, MochaSlot index)
+{
+    MochaArray *array;
+
+    if (obj->clazz != &mocha_ArrayClass)
+	return -1;
+    array = obj->data;
+    if (!array || array->sparse)
+	return -1;
+    for (; index < array->length; index++) {
+	if (array->vector[index] != MOCHA_VALUE_HOLE)
+	    return index;
+    }
+    return -1;
+}
 
 enum array_slot {
     ARRAY_LENGTH = -1
@@ -27,7 +323,7 @@ array_get_property(MochaContext *mc, MochaObject *obj, MochaSlot slot,
 {
     switch (slot) {
       case ARRAY_LENGTH:
-	MOCHA_INIT_DATUM(mc, dp, MOCHA_NUMBER, u.fval, obj->scope->freeslot);
+	MOCHA_INIT_DATUM(mc, dp, MOCHA_NUMBER, u.fval, ArrayLength(obj));
 	break;
       default:;
     }
@@ -38,7 +334,8 @@ static MochaBoolean
 array_set_property(MochaContext *mc, MochaObject *obj, MochaSlot slot,
 		   MochaDatum *dp)
 {
-    MochaSlot newlen, oldlen;
+    MochaSlot newlen;
+    MochaArray *array;
 
     switch (slot) {
       case ARRAY_LENGTH:
@@ -51,11 +348,10 @@ array_set_property(MochaContext *mc, MochaObject *obj, MochaSlot slot,
 	    MOCHA_ReportError(mc, "illegal array length %g", dp->u.fval);
 	    return MOCHA_FALSE;
 	}
-	oldlen = obj->scope->freeslot;
-	for (slot = newlen; slot < oldlen; slot++)
-	    MOCHA_RemoveSlot(mc, obj, slot);
-	obj->scope->freeslot = newlen;
-	break;
+	array = GetArray(mc, obj);
+	if (!array)
+	    return MOCHA_FALSE;
+	return SetArrayLength(mc, obj, array, newlen);
 
       default:;
     }
@@ -67,71 +363,152 @@ array_convert(MochaContext *mc, MochaObject *obj, MochaTag tag, MochaDatum *dp)
 {
     switch (tag) {
       case MOCHA_NUMBER:
-	MOCHA_INIT_DATUM(mc, dp, MOCHA_NUMBER, u.fval, obj->scope->freeslot);
+	MOCHA_INIT_DATUM(mc, dp, MOCHA_NUMBER, u.fval, ArrayLength(obj));
 	return MOCHA_TRUE;
       case MOCHA_BOOLEAN:
 	MOCHA_INIT_DATUM(mc, dp, MOCHA_BOOLEAN,
-			 u.bval, obj->scope->freeslot != 0);
+			 u.bval, ArrayLength(obj) != 0);
 	return MOCHA_TRUE;
       default:
 	return MOCHA_TRUE;
     }
 }
 
-static MochaClass array_class = {
+static void
+array_finalize(MochaContext *mc, MochaObject *obj)
+{
+    MochaArray *array;
+    MochaSlot slot;
+
+    array = obj->data;
+    if (!array)
+	return;
+    if (array->vector) {
+	for (slot = 0; slot < array->length; slot++)
+	    mocha_DropValue(mc, array->vector[slot]);
+	MOCHA_free(mc, array->vector);
+    }
+    MOCHA_free(mc, array);
+}
+
+static MochaBoolean
+array_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	    MochaCloner *cl)
+{
+    MochaArray *array, *acopy;
+    MochaSlot slot;
+    MochaDatum d, dcopy;
+    MochaValue value;
+
+    array = obj->data;
+    if (!array)
+	return MOCHA_TRUE;
+    acopy = MOCHA_malloc(mc, sizeof *acopy);
+    if (!acopy)
+	return MOCHA_FALSE;
+    *acopy = *array;
+    acopy->vector = 0;
+    acopy->capacity = 0;
+    copy->data = acopy;
+    if (!array->vector)
+	return MOCHA_TRUE;
+
+    acopy->length = 0;
+    acopy->vector = MOCHA_malloc(mc, (size_t)array->capacity *
+				     sizeof *acopy->vector);
+    if (!acopy->vector)
+	return MOCHA_FALSE;
+    acopy->capacity = array->capacity;
+
+    /* Count elements as they're copied, so finalize drops only those. */
+    for (slot = 0; slot < array->length; slot++) {
+	mocha_UnboxValue(mc, array->vector[slot], &d);
+	if (!MOCHA_CloneDatum(mc, cl, &d, &dcopy))
+	    return MOCHA_FALSE;
+	if (!mocha_BoxDatum(&dcopy, &value)) {
+	    mocha_DropRef(mc, &dcopy);
+	    MOCHA_ReportError(mc, "can't clone %s object", obj->clazz->name);
+	    return MOCHA_FALSE;
+	}
+	acopy->vector[slot] = value;
+	acopy->length++;
+    }
+    return MOCHA_TRUE;
+}
+
+MochaClass mocha_ArrayClass = {
     "Array",
     array_get_property, array_set_property, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, array_convert, MOCHA_FinalizeStub
+    MOCHA_ResolveStub, array_convert, array_finalize,
+    array_clone
 };
 
 static MochaBoolean
 array_join_str(MochaContext *mc, MochaObject *obj, const char *separator,
-	       MochaDatum *rval)
+	       size_t seplen, MochaDatum *rval)
 {
-    char *last;
+    char *buf, *newbuf;
+    size_t length, size, need;
     MochaSlot slot;
     MochaDatum d;
     uint16 taint;
     MochaAtom *atom;
 
-    last = 0;
+    buf = 0;
+    length = size = 0;
     taint = MOCHA_TAINT_IDENTITY;
-    for (slot = 0; slot < obj->scope->freeslot; slot++) {
+    for (slot = 0; slot < ArrayLength(obj); slot++) {
 	if (!MOCHA_GetSlot(mc, obj, slot, &d))
-	    return MOCHA_FALSE;
+	    goto fail;
 	if (MOCHA_DATUM_IS_NULL(d)) {
 	    atom = mocha_HoldAtom(mc, MOCHA_empty.u.atom);
 	} else {
 	    if (!mocha_RawDatumToString(mc, d, &atom))
-		return MOCHA_FALSE;
+		goto fail;
 	}
-	last = PR_sprintf_append(last, "%s%s",
-				 (slot == 0) ? "" : separator,
-				 atom_name(atom));
-	mocha_DropAtom(mc, atom);
-	if (!last) {
-	    MOCHA_ReportOutOfMemory(mc);
-	    return MOCHA_FALSE;
+
+	/* Grow buf geometrically so joining n elements costs O(n) copies. */
+	need = length + ((slot == 0) ? 0 : seplen) + atom->length + 1;
+	if (need > size) {
+	    size = PR_MAX(2 * size, need);
+	    newbuf = realloc(buf, size);
+	    if (!newbuf) {
+		mocha_DropAtom(mc, atom);
+		MOCHA_ReportOutOfMemory(mc);
+		goto fail;
+	    }
+	    buf = newbuf;
+	}
+	if (slot != 0) {
+	    memcpy(buf + length, separator, seplen);
+	    length += seplen;
 	}
+	memcpy(buf + length, atom_name(atom), atom->length);
+	length += atom->length;
+	mocha_DropAtom(mc, atom);
 	MOCHA_MIX_TAINT(mc, taint, d.taint);
     }
-    if (!last) {
+    if (!buf) {
 	*rval = MOCHA_empty;
 	return MOCHA_TRUE;
     }
-    atom = mocha_Atomize(mc, last, ATOM_STRING);
-    free(last);
+    atom = mocha_NewStringAtom(mc, buf, length, ATOM_STRING);
+    free(buf);
     if (!atom)
 	return MOCHA_FALSE;
     MOCHA_INIT_FULL_DATUM(mc, rval, MOCHA_STRING, 0, taint, u.atom, atom);
     return MOCHA_TRUE;
+
+fail:
+    free(buf);
+    return MOCHA_FALSE;
 }
 
 static MochaBoolean
 array_to_string(MochaContext *mc, MochaObject *obj,
 		unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
-    return array_join_str(mc, obj, ",", rval);
+    return array_join_str(mc, obj, ",", 1, rval);
 }
 
 static MochaBoolean
@@ -145,7 +522,7 @@ array_join(MochaContext *mc, MochaObject *obj,
 	return array_to_string(mc, obj, argc, argv, rval);
     if (!mocha_DatumToString(mc, argv[0], &atom))
 	return MOCHA_FALSE;
-    ok = array_join_str(mc, obj, atom_name(atom), rval);
+    ok = array_join_str(mc, obj, atom_name(atom), atom->length, rval);
     mocha_DropAtom(mc, atom);
     return ok;
 }
@@ -166,25 +543,56 @@ InitArrayObject(MochaContext *mc, MochaObject *obj, unsigned length,
     return MOCHA_TRUE;
 }
 
+/*
+** Return a new vector holding len datums, obj's elements in index order with
+** undefined for any slot that has no element property.  The caller must drop
+** each datum and free the vector.
+*/
+static MochaDatum *
+GetElementVector(MochaContext *mc, MochaObject *obj, size_t len)
+{
+    MochaDatum *vec;
+    MochaArray *array;
+    MochaProperty *prop;
+    size_t i;
+
+    vec = MOCHA_malloc(mc, len * sizeof *vec);
+    if (!vec)
+	return 0;
+    memset(vec, 0, len * sizeof *vec);
+    array = (obj->clazz == &mocha_ArrayClass) ? obj->data : 0;
+    if (array && !array->sparse) {
+	for (i = 0; i < len; i++) {
+	    mocha_UnboxValue(mc, array->vector[i], &vec[i]);
+	    mocha_HoldRef(mc, &vec[i]);
+	}
+    } else {
+	for (prop = obj->scope->props; prop; prop = prop->next) {
+	    if (prop->slot >= 0 && (size_t)prop->slot < len) {
+		vec[prop->slot] = prop->datum;
+		vec[prop->slot].nrefs = 0;
+		mocha_HoldRef(mc, &vec[prop->slot]);
+	    }
+	}
+    }
+    return vec;
+}
+
 static MochaBoolean
 array_reverse(MochaContext *mc, MochaObject *obj,
 	      unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
     size_t len, i;
-    MochaDatum *vec, *dp;
-    MochaProperty *prop;
+    MochaDatum *vec, d;
 
-    len = (size_t)obj->scope->freeslot;
-    vec = MOCHA_malloc(mc, len * sizeof *vec);
+    len = (size_t)ArrayLength(obj);
+    vec = GetElementVector(mc, obj, len);
     if (!vec)
 	return MOCHA_FALSE;
-    memset(vec, 0, len * sizeof *vec);
-    for (prop = obj->scope->props; prop; prop = prop->next) {
-	if (prop->slot >= 0) {
-	    dp = &vec[len - prop->slot - 1];
-	    *dp = prop->datum;
-	    mocha_HoldRef(mc, dp);
-	}
+    for (i = 0; i < len / 2; i++) {
+	d = vec[i];
+	vec[i] = vec[len - i - 1];
+	vec[len - i - 1] = d;
     }
     InitArrayObject(mc, obj, len, vec);
     for (i = 0; i < len; i++)
@@ -287,7 +695,7 @@ sort_compare(const void *a, const void *b, void *arg)
 
 	if (mocha_RawDatumToString(mc, *adp, &aatom) &&
 	    mocha_RawDatumToString(mc, *bdp, &batom)) {
-	    fval = strcoll(atom_name(aatom), atom_name(batom));
+	    fval = mocha_CompareAtoms(aatom, batom);
 	}
 	if (aatom) mocha_DropAtom(mc, aatom);
 	if (batom) mocha_DropAtom(mc, batom);
@@ -312,26 +720,18 @@ array_sort(MochaContext *mc, MochaObject *obj,
     MochaFunction *fun;
     size_t len, i;
     MochaDatum *vec;
-    MochaProperty *prop;
     CompareArgs ca;
 
     fun = 0;
     if (argc > 0 && !MOCHA_DatumToFunction(mc, argv[0], &fun))
 	return MOCHA_FALSE;
 
-    len = (size_t)obj->scope->freeslot;
-    vec = MOCHA_malloc(mc, len * sizeof *vec);
+    len = (size_t)ArrayLength(obj);
+    vec = GetElementVector(mc, obj, len);
     if (!vec) {
 	MOCHA_DropObject(mc, &fun->object);
 	return MOCHA_FALSE;
     }
-    memset(vec, 0, len * sizeof *vec);
-    for (prop = obj->scope->props; prop; prop = prop->next) {
-	if (prop->slot >= 0) {
-	    vec[prop->slot] = prop->datum;
-	    mocha_HoldRef(mc, &vec[prop->slot]);
-	}
-    }
 
     ca.context = mc;
     ca.fun = fun;
@@ -382,7 +782,7 @@ Array(MochaContext *mc, MochaObject *obj,
 MochaObject *
 mocha_InitArrayClass(MochaContext *mc, MochaObject *obj)
 {
-    return MOCHA_InitClass(mc, obj, &array_class, 0, Array, 1,
+    return MOCHA_InitClass(mc, obj, &mocha_ArrayClass, 0, Array, 1,
 			   array_props, array_methods, 0, 0);
 }
 
@@ -391,7 +791,7 @@ mocha_NewArrayObject(MochaContext *mc, unsigned length, MochaDatum *base)
 {
     MochaObject *obj;
 
-    obj = mocha_NewObjectByClass(mc, &array_class);
+    obj = mocha_NewObjectByClass(mc, &mocha_ArrayClass);
     if (!obj)
 	return 0;
     if (!InitArrayObject(mc, obj, length, base)) {
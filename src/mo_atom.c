@@ -10,6 +10,9 @@
 #include "prhash.h"
 #include "prlog.h"
 #include "prmem.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
 #include "mo_atom.h"
 #include "mo_bcode.h"
 #include "mo_emit.h"
@@ -39,6 +42,7 @@ char *mocha_typeStr[] = {
     "internal",
     "atom",
     "symbol",
+    "element",
     "function",
     "object",
     "number",
@@ -90,11 +94,33 @@ FreeAtom(void *pool, PRHashEntry *he, int flag)
 
     PR_ASSERT(flag == HT_FREE_ENTRY);
     if (flag == HT_FREE_ENTRY) {
-	free((char *)atom->entry.key);
+	free((char *)atom->chars);
 	PR_DELETE(atom);
     }
 }
 
+/*
+** An atom in the table is its own key, so lookups can compare lengths as
+** well as names that may contain NULs, and need not rehash the name.
+*/
+PR_STATIC_CALLBACK(PRHashNumber)
+HashAtomKey(const void *key)
+{
+    const MochaAtom *atom = key;
+
+    return atom->entry.keyHash;
+}
+
+PR_STATIC_CALLBACK(int)
+CompareAtomKeys(const void *v1, const void *v2)
+{
+    const MochaAtom *atom1 = v1, *atom2 = v2;
+
+    return atom1 == atom2 ||
+	   (atom1->length == atom2->length &&
+	    memcmp(atom1->chars, atom2->chars, atom1->length) == 0);
+}
+
 static PRHashAllocOps atomAllocOps = {
     AllocAtomSpace, FreeAtomStub,
     AllocAtom, FreeAtom
@@ -102,10 +128,59 @@ static PRHashAllocOps atomAllocOps = {
 
 #define MOCHA_ATOM_HASH_SIZE	1024
 
+/*
+** Pick a shard using bits of keyHash other than those the shard's table
+** mixes into its group index and tag, so each shard's table stays balanced.
+*/
+#define ATOM_SHARD(keyHash)                                                   \
+    (&mocha_AtomState.shards[((keyHash) ^ ((keyHash) >> 16))                 \
+			     & PR_BITMASK(MOCHA_ATOM_SHARDS_LOG2)])
+
+#ifdef MOCHA_THREADSAFE
+#define LOCK_SHARD(shard)       PR_SyncLock(&(shard)->lock)
+#define UNLOCK_SHARD(shard)     PR_SyncUnlock(&(shard)->lock)
+#define HOLD_TABLE_ATOM(atom)   PR_ATOMIC_INCREMENT(&(atom)->nrefs)
+#define DROP_TABLE_ATOM(atom)   PR_ATOMIC_DECREMENT(&(atom)->nrefs)
+#define TABLE_ATOM_NREFS(atom)  PR_ATOMIC_LOAD(&(atom)->nrefs)
+#define SET_ATOM_FLAGS(atom,f)  PR_ATOMIC_OR(&(atom)->flags, f)
+#define NEXT_ATOM_NUMBER()      ((MochaAtomNumber)                            \
+				 PR_ATOMIC_INCREMENT(&mocha_AtomState.number) \
+				 - 1)
+#define CACHE_INDEX(keyHash)    (((keyHash) ^ ((keyHash) >> 12))              \
+				 & PR_BITMASK(MOCHA_ATOM_CACHE_LOG2))
+#else
+#define LOCK_SHARD(shard)       ((void)0)
+#define UNLOCK_SHARD(shard)     ((void)0)
+#define HOLD_TABLE_ATOM(atom)   (++(atom)->nrefs)
+#define DROP_TABLE_ATOM(atom)   (--(atom)->nrefs)
+#define TABLE_ATOM_NREFS(atom)  ((atom)->nrefs)
+#define SET_ATOM_FLAGS(atom,f)  ((atom)->flags |= (f))
+#define NEXT_ATOM_NUMBER()      (mocha_AtomState.number++)
+#endif
+
+static void
+DestroyShards(void)
+{
+    unsigned i;
+    MochaAtomShard *shard;
+
+    for (i = 0; i < MOCHA_ATOM_SHARDS; i++) {
+	shard = &mocha_AtomState.shards[i];
+	if (!shard->table)
+	    continue;
+	PR_HashTableDestroy(shard->table);
+	shard->table = 0;
+#ifdef MOCHA_THREADSAFE
+	PR_DestroySyncLock(&shard->lock);
+#endif
+    }
+}
+
 MochaBoolean
 mocha_InitAtomState(MochaContext *mc)
 {
     unsigned i;
+    MochaAtomShard *shard;
     MochaAtom *atom;
 
     if (mocha_AtomState.valid) {
@@ -113,19 +188,34 @@ mocha_InitAtomState(MochaContext *mc)
 	return MOCHA_TRUE;
     }
 
-    mocha_AtomState.table = PR_NewHashTable(MOCHA_ATOM_HASH_SIZE,
-					    PR_HashString,
-					    PR_CompareStrings,
-					    PR_CompareValues,
-					    &atomAllocOps, 0);
-    if (!mocha_AtomState.table) {
-	MOCHA_ReportOutOfMemory(mc);
-	return MOCHA_FALSE;
+    for (i = 0; i < MOCHA_ATOM_SHARDS; i++) {
+	shard = &mocha_AtomState.shards[i];
+#ifdef MOCHA_THREADSAFE
+	if (PR_InitSyncLock(&shard->lock) != 0) {
+	    DestroyShards();
+	    MOCHA_ReportOutOfMemory(mc);
+	    return MOCHA_FALSE;
+	}
+#endif
+	shard->table = PR_NewHashTable(MOCHA_ATOM_HASH_SIZE
+				       >> MOCHA_ATOM_SHARDS_LOG2,
+				       HashAtomKey,
+				       CompareAtomKeys,
+				       PR_CompareValues,
+				       &atomAllocOps, 0);
+	if (!shard->table) {
+#ifdef MOCHA_THREADSAFE
+	    PR_DestroySyncLock(&shard->lock);
+#endif
+	    DestroyShards();
+	    MOCHA_ReportOutOfMemory(mc);
+	    return MOCHA_FALSE;
+	}
     }
 
 #define FROB(lval,str,type) {                                                 \
     if (lval) mocha_DropAtom(mc, lval);                                       \
-    lval = atom = mocha_Atomize(mc, str, ATOM_HELD | type);                   \
+    lval = atom = mocha_Atomize(mc, str, strlen(str), ATOM_HELD | type);      \
     if (!atom) return MOCHA_FALSE;                                            \
 }
 
@@ -134,10 +224,10 @@ mocha_InitAtomState(MochaContext *mc)
 	FROB(mocha_typeAtoms[i],    mocha_typeStr[i],         ATOM_NAME);
 
     /* XXX redundant w.r.t. mo_scan.c */
-    FROB(mocha_booleanAtoms[0],     mocha_false,              ATOM_KEYWORD);
-    FROB(mocha_booleanAtoms[1],     mocha_true,               ATOM_KEYWORD);
+    FROB(mocha_booleanAtoms[0],     mocha_false,              ATOM_NAME);
+    FROB(mocha_booleanAtoms[1],     mocha_true,               ATOM_NAME);
     atom->fval = 1;
-    FROB(mocha_nullAtom,            mocha_null,               ATOM_KEYWORD);
+    FROB(mocha_nullAtom,            mocha_null,               ATOM_NAME);
 
     FROB(mocha_anonymousAtom,       mocha_anonymousStr,       ATOM_NAME);
     FROB(mocha_assignAtom,          mocha_assignStr,          ATOM_NAME);
@@ -150,6 +240,7 @@ mocha_InitAtomState(MochaContext *mc)
     FROB(mocha_setPropertyAtom,     mocha_setPropertyStr,     ATOM_NAME);
     FROB(mocha_toStringAtom,        mocha_toStringStr,        ATOM_NAME);
     FROB(mocha_valueOfAtom,         mocha_valueOfStr,         ATOM_NAME);
+    FROB(MOCHA_empty.u.atom,        "",                       ATOM_STRING);
 
 #undef FROB
 
@@ -164,90 +255,526 @@ mocha_FreeAtomState(MochaContext *mc)
     PR_ASSERT(mocha_AtomState.nrefs > 0);
     if (mocha_AtomState.nrefs <= 0) return;
     if (--mocha_AtomState.nrefs == 0) {
-	PR_HashTableDestroy(mocha_AtomState.table);
+	DestroyShards();
 	memset(&mocha_AtomState, 0, sizeof mocha_AtomState);
+
+	/* Forget the well-known atoms, which went with the table. */
+	memset(mocha_typeAtoms, 0, sizeof mocha_typeAtoms);
+	memset(mocha_booleanAtoms, 0, sizeof mocha_booleanAtoms);
+	mocha_nullAtom = 0;
+	mocha_anonymousAtom = 0;
+	mocha_assignAtom = 0;
+	mocha_constructorAtom = 0;
+	mocha_finalizeAtom = 0;
+	mocha_getPropertyAtom = 0;
+	mocha_listPropertiesAtom = 0;
+	mocha_prototypeAtom = 0;
+	mocha_resolveNameAtom = 0;
+	mocha_setPropertyAtom = 0;
+	mocha_toStringAtom = 0;
+	mocha_valueOfAtom = 0;
+	MOCHA_empty.u.atom = 0;
     }
 }
 
-MochaAtom *
-mocha_Atomize(MochaContext *mc, const char *string, MochaAtomFlags flags)
+#ifdef MOCHA_THREADSAFE
+/*
+** Cache atom, which the caller holds on the cache's behalf, in mc's slot
+** for keyHash.  Park any atom it evicts in the defer ring, dropping the one
+** parked longest ago.
+*/
+static void
+CacheAtom(MochaContext *mc, PRHashNumber keyHash, MochaAtom *atom)
+{
+    MochaAtomCache *cache;
+    MochaAtom **slotp, *evicted, *dropped;
+
+    cache = &mc->atomCache;
+    slotp = &cache->table[CACHE_INDEX(keyHash)];
+    evicted = *slotp;
+    *slotp = atom;
+    if (!evicted)
+	return;
+    dropped = cache->defer[cache->deferIndex];
+    cache->defer[cache->deferIndex] = evicted;
+    cache->deferIndex = (cache->deferIndex + 1) % MOCHA_ATOM_DEFER;
+    if (dropped)
+	mocha_DropAtom(mc, dropped);
+}
+
+void
+mocha_FlushAtomCache(MochaContext *mc)
+{
+    MochaAtomCache *cache;
+    MochaAtom *atom;
+    unsigned i;
+
+    cache = &mc->atomCache;
+    for (i = 0; i < MOCHA_ATOM_CACHE_SIZE; i++) {
+	if ((atom = cache->table[i]) != 0) {
+	    cache->table[i] = 0;
+	    mocha_DropAtom(mc, atom);
+	}
+    }
+    for (i = 0; i < MOCHA_ATOM_DEFER; i++) {
+	if ((atom = cache->defer[i]) != 0) {
+	    cache->defer[i] = 0;
+	    mocha_DropAtom(mc, atom);
+	}
+    }
+    cache->deferIndex = 0;
+}
+#endif /* MOCHA_THREADSAFE */
+
+static MochaAtom *
+AtomizeHashed(MochaContext *mc, const char *string, size_t length,
+	      PRHashNumber keyHash, MochaAtomFlags flags, MochaFloat fval)
 {
     MochaBoolean doHold;
-    unsigned length;
-    PRHashNumber keyHash;
+    MochaAtom probe, *atom;
+    MochaAtomShard *shard;
     PRHashEntry *he, **hep;
     char *newString;
-    MochaAtom *atom;
 
     doHold  = (flags & ATOM_HELD) ? MOCHA_TRUE : MOCHA_FALSE;
     flags &= ATOM_TYPEMASK;
-    length = strlen(string);
 
-    keyHash = PR_HashString(string);
-    hep = PR_HashTableRawLookup(mocha_AtomState.table, keyHash, string);
+#ifdef MOCHA_THREADSAFE
+    /* A hit that needs no new type bits can skip the shard lock. */
+    atom = mc->atomCache.table[CACHE_INDEX(keyHash)];
+    if (atom &&
+	atom->entry.keyHash == keyHash &&
+	atom->length == length &&
+	(ATOM_FLAGS(atom) & flags) == flags &&
+	memcmp(atom->chars, string, length) == 0) {
+	if (doHold)
+	    HOLD_TABLE_ATOM(atom);
+	return atom;
+    }
+#endif
+
+    probe.entry.keyHash = keyHash;
+    probe.chars = string;
+    probe.length = length;
+    shard = ATOM_SHARD(keyHash);
+    LOCK_SHARD(shard);
+    hep = PR_HashTableRawLookup(shard->table, keyHash, &probe);
     if ((he = *hep) != 0) {
         atom = (MochaAtom *)he;
-	atom->flags |= flags;
+	if ((atom->flags & flags) != flags) {
+	    /*
+	    ** Only this shard's lock holder sets flags, so it may read them
+	    ** plainly.  Set fval before ATOM_NUMBER, which lock-free readers
+	    ** test with ATOM_FLAGS() before they read fval.
+	    */
+	    if ((flags & ATOM_NUMBER) && !(atom->flags & ATOM_NUMBER))
+		atom->fval = fval;
+	    SET_ATOM_FLAGS(atom, flags);
+	}
     } else {
-	newString = MOCHA_malloc(mc, length + 1);
-	if (!newString)
-	    return 0;
-	strcpy(newString, string);
-	he = PR_HashTableRawAdd(mocha_AtomState.table, hep, keyHash,
-				newString, 0);
+	newString = malloc(length + 1);
+	he = 0;
+	if (newString) {
+	    memcpy(newString, string, length);
+	    newString[length] = '\0';
+	    he = PR_HashTableRawAdd(shard->table, hep, keyHash, &probe, 0);
+	}
 	if (!he) {
+	    UNLOCK_SHARD(shard);
+	    PR_FREEIF(newString);
 	    MOCHA_ReportOutOfMemory(mc);
 	    return 0;
 	}
 	atom = (MochaAtom *)he;
+	atom->entry.key = atom;
 	atom->entry.value = 0;
+	atom->chars = newString;
 	atom->nrefs = 0;
 	atom->length = length;
 	atom->flags = flags;
-	atom->keyIndex = -1;
-	atom->index = 0;
-	atom->number = mocha_AtomState.number++;
-	atom->fval = 0;
+	atom->number = NEXT_ATOM_NUMBER();
+	atom->fval = (flags & ATOM_NUMBER) ? fval : 0;
     }
 #ifdef DEBUG_brendan
-    hep = PR_HashTableRawLookup(mocha_AtomState.table, keyHash, string);
+    hep = PR_HashTableRawLookup(shard->table, keyHash, &probe);
     he = *hep;
     PR_ASSERT(atom == (MochaAtom *)he);
 #endif
 
+    /*
+    ** Hold while the shard is locked: a table atom's nrefs may leave zero
+    ** only under the lock (see DropTableAtom).
+    */
     if (doHold)
-	mocha_HoldAtom(mc, atom);
+	HOLD_TABLE_ATOM(atom);
+#ifdef MOCHA_THREADSAFE
+    if (mc->atomCache.table[CACHE_INDEX(keyHash)] != atom) {
+	HOLD_TABLE_ATOM(atom);
+	UNLOCK_SHARD(shard);
+	CacheAtom(mc, keyHash, atom);
+	return atom;
+    }
+#endif
+    UNLOCK_SHARD(shard);
     return atom;
 }
 
+MochaAtom *
+mocha_Atomize(MochaContext *mc, const char *string, size_t length,
+	      MochaAtomFlags flags)
+{
+    return AtomizeHashed(mc, string, length, mocha_HashChars(string, length),
+			 flags, 0);
+}
+
+MochaAtom *
+mocha_AtomizeHashed(MochaContext *mc, const char *string, size_t length,
+		    PRHashNumber keyHash, MochaAtomFlags flags)
+{
+    PR_ASSERT(keyHash == mocha_HashChars(string, length));
+    return AtomizeHashed(mc, string, length, keyHash, flags, 0);
+}
+
+MochaAtom *
+mocha_AtomizeNumber(MochaContext *mc, const char *string, size_t length,
+		    MochaFloat fval, MochaAtomFlags flags)
+{
+    return AtomizeHashed(mc, string, length, mocha_HashChars(string, length),
+			 flags | ATOM_NUMBER, fval);
+}
+
+PRHashNumber
+mocha_HashChars(const char *chars, size_t length)
+{
+    PRHashNumber h;
+    const unsigned char *s;
+
+    h = 0;
+    for (s = (const unsigned char *)chars; length != 0; s++, length--)
+	h = MOCHA_HASH_CHAR(h, *s);
+    return h;
+}
+
+/*
+** Each step of mocha_HashChars rotates h left by 4 bits and xors in a char,
+** so the hash of a concatenation is the left part's hash rotated 4 bits per
+** char of the right part, xor the right part's hash.
+*/
+static PRHashNumber
+ConcatHashes(PRHashNumber h1, PRHashNumber h2, size_t length2)
+{
+    unsigned shift;
+
+    shift = (unsigned)(length2 % 8) * 4;
+    if (shift != 0)
+	h1 = (h1 << shift) | (h1 >> (PR_HASH_BITS - shift));
+    return h1 ^ h2;
+}
+
+int
+mocha_CompareAtoms(MochaAtom *atom1, MochaAtom *atom2)
+{
+    size_t length;
+    int cmp;
+
+    if (atom1 == atom2)
+	return 0;
+    length = PR_MIN(atom1->length, atom2->length);
+    cmp = memcmp(atom_name(atom1), atom_name(atom2), length);
+    if (cmp != 0)
+	return cmp;
+    return (atom1->length < atom2->length) ? -1
+	   : (atom1->length > atom2->length);
+}
+
+/*
+** A code generator maps each atom it indexes to its index in a table of its
+** own, so that contexts compiling at once on different threads never store
+** compiler state in the atoms they share.
+*/
+PR_STATIC_CALLBACK(PRHashNumber)
+HashAtomNumber(const void *key)
+{
+    const MochaAtom *atom = key;
+
+    return atom->number;
+}
+
 MochaAtomNumber
 mocha_IndexAtom(MochaContext *mc, MochaAtom *atom, CodeGenerator *cg)
 {
-    if (!(atom->flags & ATOM_INDEXED)) {
-	atom->flags |= ATOM_INDEXED;
-	atom->index = (uint16) cg->atomCount++;
-	atom->entry.value = cg->atomList;
-	cg->atomList = mocha_HoldAtom(mc, atom);
+    PRHashTable *table;
+    PRHashEntry *he, **hep;
+    MochaAtomNumber index;
+
+    table = cg->atomTable;
+    if (!table) {
+	table = PR_NewHashTable(16, HashAtomNumber, PR_CompareValues,
+				PR_CompareValues, 0, 0);
+	if (!table)
+	    goto bad;
+	cg->atomTable = table;
+    }
+    hep = PR_HashTableRawLookup(table, atom->number, atom);
+    if ((he = *hep) != 0)
+	return (MochaAtomNumber)(uprword_t)he->value;
+
+    index = cg->atomCount;
+    if (index >= MOCHA_ATOM_INDEX_MAX) {
+	MOCHA_ReportError(mc, "too many atoms");
+	return MOCHA_ATOM_INDEX_MAX;
+    }
+    he = PR_HashTableRawAdd(table, hep, atom->number, atom,
+			    (void *)(uprword_t)index);
+    if (!he)
+	goto bad;
+    cg->atomCount++;
+    mocha_HoldAtom(mc, atom);
+    return index;
+
+bad:
+    MOCHA_ReportOutOfMemory(mc);
+    return MOCHA_ATOM_INDEX_MAX;
+}
+
+/*
+** A flat loose atom and its name are allocated together, the name following
+** the atom, so freeing the atom frees the name unless a rope was flattened.
+*/
+#define LOOSE_NAME(atom)	((char *)((atom) + 1))
+
+MochaAtom *
+mocha_NewStringAtom(MochaContext *mc, const char *string, size_t length,
+		    MochaAtomFlags flags)
+{
+    MochaAtom *atom;
+
+    atom = MOCHA_malloc(mc, sizeof *atom + length + 1);
+    if (!atom)
+	return 0;
+    memset(atom, 0, sizeof *atom);
+    memcpy(LOOSE_NAME(atom), string, length);
+    LOOSE_NAME(atom)[length] = '\0';
+    atom->entry.keyHash = mocha_HashChars(string, length);
+    atom->chars = LOOSE_NAME(atom);
+    atom->length = length;
+    atom->flags = (flags & ATOM_TYPEMASK) | ATOM_LOOSE;
+    if (flags & ATOM_HELD)
+	atom->nrefs = 1;
+    return atom;
+}
+
+MochaAtom *
+mocha_ConcatAtoms(MochaContext *mc, MochaAtom *atom1, MochaAtom *atom2)
+{
+    MochaRope *rope;
+
+    rope = MOCHA_malloc(mc, sizeof *rope);
+    if (!rope)
+	return 0;
+    memset(rope, 0, sizeof *rope);
+    rope->atom.entry.keyHash = ConcatHashes(atom1->entry.keyHash,
+					    atom2->entry.keyHash,
+					    atom2->length);
+    rope->atom.length = atom1->length + atom2->length;
+    rope->atom.flags = ATOM_STRING | ATOM_ROPE | ATOM_LOOSE;
+    rope->left = mocha_HoldAtom(mc, atom1);
+    rope->right = mocha_HoldAtom(mc, atom2);
+    return &rope->atom;
+}
+
+/*
+** Drop a reference to a table atom, removing and freeing it if that was the
+** last.  Return true if atom was freed.  In a MOCHA_THREADSAFE build, any
+** reference but the last is dropped without locking; the last is dropped
+** under the shard lock, so a concurrent lookup either holds atom first or
+** misses it after it has been removed.
+*/
+static MochaBoolean
+DropTableAtom(MochaAtom *atom)
+{
+    MochaAtomShard *shard;
+    MochaBoolean removed;
+#ifdef MOCHA_THREADSAFE
+    MochaRefCount nrefs;
+
+    PR_ASSERT(TABLE_ATOM_NREFS(atom) > 0);
+    while ((nrefs = TABLE_ATOM_NREFS(atom)) > 1) {
+	if (PR_CAS(nrefs - 1, nrefs, &atom->nrefs) == nrefs)
+	    return MOCHA_FALSE;
+    }
+#endif
+    shard = ATOM_SHARD(atom->entry.keyHash);
+    LOCK_SHARD(shard);
+    removed = (DROP_TABLE_ATOM(atom) == 0);
+    if (removed)
+	PR_HashTableRemove(shard->table, atom);
+    UNLOCK_SHARD(shard);
+    return removed;
+}
+
+/*
+** Drop a rope's parts, returning list with any loose parts that are now
+** unreferenced linked onto it through entry.next.  Freeing a rope can free
+** its parts, and their parts, and so on: s = s + t in a loop makes ropes as
+** deep as the loop is long, so callers free such lists iteratively instead
+** of recurring.
+*/
+static MochaAtom *
+DropRopeParts(MochaRope *rope, MochaAtom *list)
+{
+    MochaAtom *part;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+	part = i ? rope->right : rope->left;
+	if (!part)
+	    continue;
+	if (!(ATOM_FLAGS(part) & ATOM_LOOSE)) {
+	    DropTableAtom(part);
+	    continue;
+	}
+	PR_ASSERT(part->nrefs > 0);
+	if (--part->nrefs == 0) {
+	    part->entry.next = (PRHashEntry *)list;
+	    list = part;
+	}
+    }
+    rope->left = rope->right = 0;
+    return list;
+}
+
+static void
+FreeLooseAtoms(MochaAtom *list)
+{
+    MochaAtom *atom;
+
+    while ((atom = list) != 0) {
+	list = (MochaAtom *)atom->entry.next;
+	if (atom->flags & ATOM_ROPE)
+	    list = DropRopeParts((MochaRope *)atom, list);
+	if (atom->chars != LOOSE_NAME(atom))
+	    free((char *)atom->chars);
+	free(atom);
+    }
+}
+
+const char *
+mocha_FlattenAtom(const MochaAtom *rope)
+{
+    MochaAtom *atom, *node, **stack, **newstack;
+    size_t pos, depth, maxdepth;
+    char *name;
+
+    /* Flattening changes how rope is stored, not its value. */
+    atom = (MochaAtom *)rope;
+    PR_ASSERT(atom->flags & ATOM_ROPE);
+    name = malloc(atom->length + 1);
+    if (!name)
+	return "";
+
+    /* Copy flat parts from right to left, stacking left parts of ropes. */
+    stack = 0;
+    depth = maxdepth = 0;
+    pos = atom->length;
+    name[pos] = '\0';
+    node = atom;
+    for (;;) {
+	if (node->chars) {
+	    pos -= node->length;
+	    memcpy(name + pos, node->chars, node->length);
+	    if (depth == 0)
+		break;
+	    node = stack[--depth];
+	} else {
+	    if (depth == maxdepth) {
+		maxdepth = maxdepth ? 2 * maxdepth : 16;
+		newstack = realloc(stack, maxdepth * sizeof *stack);
+		if (!newstack) {
+		    free(stack);
+		    free(name);
+		    return "";
+		}
+		stack = newstack;
+	    }
+	    stack[depth++] = ((MochaRope *)node)->left;
+	    node = ((MochaRope *)node)->right;
+	}
+    }
+    PR_ASSERT(pos == 0);
+    free(stack);
+
+    /* Now atom is a flat loose string, and needs its parts no more. */
+    atom->chars = name;
+    atom->flags &= ~ATOM_ROPE;
+    FreeLooseAtoms(DropRopeParts((MochaRope *)atom, 0));
+    return name;
+}
+
+MochaAtom *
+mocha_CloneAtom(MochaContext *mc, MochaAtom *atom)
+{
+    const char *name;
+    MochaAtom *copy;
+
+    if (!(ATOM_FLAGS(atom) & ATOM_LOOSE))
+	return mocha_HoldAtom(mc, atom);
+    name = atom_name(atom);
+    if (*name == '\0' && atom->length != 0) {
+	MOCHA_ReportOutOfMemory(mc);
+	return 0;
+    }
+    copy = mocha_NewStringAtom(mc, name, atom->length,
+			       (atom->flags & ATOM_TYPEMASK) | ATOM_HELD);
+    if (copy)
+	copy->fval = atom->fval;
+    return copy;
+}
+
+MochaAtom *
+mocha_InternAtom(MochaContext *mc, MochaAtom *atom)
+{
+    MochaAtom *interned;
+    const char *name;
+
+    if (!(ATOM_FLAGS(atom) & ATOM_LOOSE))
+	return atom;
+    name = atom_name(atom);
+    if (*name == '\0' && atom->length != 0) {
+	MOCHA_ReportOutOfMemory(mc);
+	mocha_DropAtom(mc, atom);
+	return 0;
     }
-    return atom->index;
+    interned = AtomizeHashed(mc, name, atom->length, atom->entry.keyHash,
+			     (atom->flags & ATOM_TYPEMASK) | ATOM_HELD,
+			     atom->fval);
+    mocha_DropAtom(mc, atom);
+    return interned;
 }
 
 MochaAtom *
 mocha_HoldAtom(MochaContext *mc, MochaAtom *atom)
 {
 #ifdef DEBUG_brendan
-    const char *string;
-    PRHashNumber keyHash;
+    MochaAtomShard *shard;
     PRHashEntry *he, **hep;
 
-    string = atom->entry.key;
-    keyHash = PR_HashString(string);
-    hep = PR_HashTableRawLookup(mocha_AtomState.table, keyHash, string);
-    he = *hep;
-    PR_ASSERT(atom == (MochaAtom *)he);
+    if (!(ATOM_FLAGS(atom) & ATOM_LOOSE)) {
+	shard = ATOM_SHARD(atom->entry.keyHash);
+	LOCK_SHARD(shard);
+	hep = PR_HashTableRawLookup(shard->table, atom->entry.keyHash, atom);
+	he = *hep;
+	UNLOCK_SHARD(shard);
+	PR_ASSERT(atom == (MochaAtom *)he);
+    }
 #endif
-    atom->nrefs++;
-    PR_ASSERT(atom->nrefs > 0);
+    if (ATOM_FLAGS(atom) & ATOM_LOOSE) {
+	atom->nrefs++;
+	PR_ASSERT(atom->nrefs > 0);
+    } else {
+	HOLD_TABLE_ATOM(atom);
+	PR_ASSERT(TABLE_ATOM_NREFS(atom) > 0);
+    }
     return atom;
 }
 
@@ -255,25 +782,41 @@ MochaAtom *
 mocha_DropAtom(MochaContext *mc, MochaAtom *atom)
 {
 #ifdef DEBUG_brendan
-    const char *string;
-    PRHashNumber keyHash;
+    MochaAtom probe;
+    char *string;
+    MochaAtomShard *shard;
     PRHashEntry *he, **hep;
 
-    string = strdup(atom->entry.key);
-    if (string) {
-	keyHash = PR_HashString(string);
-	hep = PR_HashTableRawLookup(mocha_AtomState.table, keyHash, string);
+    string = 0;
+    shard = ATOM_SHARD(atom->entry.keyHash);
+    if (!(ATOM_FLAGS(atom) & ATOM_LOOSE)) {
+	LOCK_SHARD(shard);
+	hep = PR_HashTableRawLookup(shard->table, atom->entry.keyHash, atom);
 	he = *hep;
+	UNLOCK_SHARD(shard);
 	PR_ASSERT(atom == (MochaAtom *)he);
+	string = malloc(atom->length + 1);
+	if (string) {
+	    memcpy(string, atom->chars, atom->length + 1);
+	    probe.entry.keyHash = atom->entry.keyHash;
+	    probe.chars = string;
+	    probe.length = atom->length;
+	}
     }
 #endif
-    PR_ASSERT(atom->nrefs > 0);
-    if (atom->nrefs <= 0) return 0;
-    if (--atom->nrefs == 0) {
-	PR_HashTableRemove(mocha_AtomState.table, atom->entry.key);
-#ifdef DEBUG_brendan
+    if (ATOM_FLAGS(atom) & ATOM_LOOSE) {
+	PR_ASSERT(atom->nrefs > 0);
+	if (atom->nrefs <= 0) return 0;
+	if (--atom->nrefs == 0) {
+	    atom->entry.next = 0;
+	    FreeLooseAtoms(atom);
+	    atom = 0;
+	}
+    } else if (DropTableAtom(atom)) {
+#if defined DEBUG_brendan && !defined MOCHA_THREADSAFE
 	if (string) {
-	    hep = PR_HashTableRawLookup(mocha_AtomState.table, keyHash, string);
+	    hep = PR_HashTableRawLookup(shard->table, probe.entry.keyHash,
+					&probe);
 	    he = *hep;
 	    PR_ASSERT(he == 0);
 	}
@@ -301,19 +844,28 @@ mocha_GetAtom(MochaContext *mc, MochaAtomMap *map, MochaAtomNumber n)
     return atom;
 }
 
+PR_STATIC_CALLBACK(int)
+MapIndexedAtom(PRHashEntry *he, int i, void *arg)
+{
+    MochaAtom **vector = arg;
+
+    (void)i;
+    vector[(uprword_t)he->value] = (MochaAtom *)he->key;
+    return HT_ENUMERATE_NEXT;
+}
+
 MochaBoolean
 mocha_InitAtomMap(MochaContext *mc, MochaAtomMap *map, CodeGenerator *cg)
 {
-    MochaAtom *atom, *next, **vector;
+    MochaAtom **vector;
     MochaAtomNumber length;
 
-    atom = cg->atomList;
-    if (!atom) {
+    length = cg->atomCount;
+    if (length == 0) {
 	map->vector = 0, map->length = 0;
 	return MOCHA_TRUE;
     }
 
-    length = cg->atomCount;
     if (length >= MOCHA_ATOM_INDEX_MAX) {
         MOCHA_ReportError(mc, "too many atoms");
 	return MOCHA_FALSE;
@@ -322,13 +874,10 @@ mocha_InitAtomMap(MochaContext *mc, MochaAtomMap *map, CodeGenerator *cg)
     if (!vector)
 	return MOCHA_FALSE;
 
-    do {
-        vector[atom->index] = atom;
-	atom->flags &= ~ATOM_INDEXED;
-	next = atom_next(atom);
-	atom->entry.value = 0;
-    } while ((atom = next) != 0);
-    cg->atomList = 0;
+    /* The map takes over the holds that cg's table had on its atoms. */
+    PR_HashTableEnumerateEntries(cg->atomTable, MapIndexedAtom, vector);
+    PR_HashTableDestroy(cg->atomTable);
+    cg->atomTable = 0;
     cg->atomCount = 0;
 
     map->vector = vector;
@@ -350,17 +899,23 @@ mocha_FreeAtomMap(MochaContext *mc, MochaAtomMap *map)
     map->length = 0;
 }
 
+PR_STATIC_CALLBACK(int)
+DropIndexedAtom(PRHashEntry *he, int i, void *arg)
+{
+    MochaContext *mc = arg;
+
+    (void)i;
+    mocha_DropAtom(mc, (MochaAtom *)he->key);
+    return HT_ENUMERATE_NEXT;
+}
+
 void
 mocha_DropUnmappedAtoms(MochaContext *mc, CodeGenerator *cg)
 {
-    MochaAtom *atom, *next;
-
-    for (atom = cg->atomList; atom; atom = next) {
-	atom->flags &= ~ATOM_INDEXED;
-	next = atom_next(atom);
-	atom->entry.value = 0;
-	mocha_DropAtom(mc, atom);
+    if (cg->atomTable) {
+	PR_HashTableEnumerateEntries(cg->atomTable, DropIndexedAtom, mc);
+	PR_HashTableDestroy(cg->atomTable);
+	cg->atomTable = 0;
     }
-    cg->atomList = 0;
     cg->atomCount = 0;
 }
@@ -13,11 +13,11 @@
 #include "prlog.h"
 #include "prmem.h"
 #include "prprf.h"
-#include "alloca.h"
 #include "mo_atom.h"
 #include "mo_bcode.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
+#include "mo_parse.h"
 #include "mochaapi.h"
 
 char mocha_new[]    = "new";
@@ -97,6 +97,12 @@ mocha_Disassemble1(MochaContext *mc, MochaScript *script, MochaCode *pc,
 	atom = GET_CONST_ATOM(mc, script, pc);
 	fprintf(fp, (op == MOP_STRING) ? " \"%s\"" : " %s", atom_name(atom));
 	break;
+      case MOF_LOCAL:
+	fprintf(fp, " %u", pc[1]);
+	break;
+      case MOF_LOCALINC:
+	fprintf(fp, " %u (%s)", pc[1], pc[2] ? "post" : "pre");
+	break;
       default:
 	MOCHA_ReportError(mc, "unknown bytecode format %d", cs->format);
 	return 0;
@@ -200,21 +206,51 @@ SprintPut(Sprinter *sp, const char *s, size_t len)
     return offset;
 }
 
+/*
+** Convert format into a buffer of nb bytes, the size guessed by
+** GuessFormatConversionSize, and put the result in sp.  The arguments may
+** point into sp's buffer, which SprintPut may move, so convert into a stack
+** buffer, or a malloc'd one if the guess is too big for the stack.
+*/
+#define SPRINT_BUFSIZE  256
+
+static ptrdiff_t
+SprintFormat(Sprinter *sp, size_t nb, const char *format, va_list ap)
+{
+    char buf[SPRINT_BUFSIZE], *bp;
+    size_t cc;
+    ptrdiff_t offset;
+
+    if (nb <= sizeof buf) {
+	bp = buf;
+    } else {
+	bp = malloc(nb);
+	if (!bp) {
+	    MOCHA_ReportOutOfMemory(sp->context);
+	    return -1;
+	}
+    }
+    cc = PR_vsnprintf(bp, nb, format, ap);
+    offset = SprintPut(sp, bp, cc);
+    if (bp != buf)
+	free(bp);
+    return offset;
+}
+
 static ptrdiff_t
 Sprint(Sprinter *sp, const char *format, ...)
 {
     va_list ap;
-    int nb, cc;
-    char *bp;
+    size_t nb;
+    ptrdiff_t offset;
 
     va_start(ap, format);
     nb = GuessFormatConversionSize(format, ap);
-    bp = alloca(nb);
-    cc = PR_vsnprintf(bp, nb, format, ap);
     va_end(ap);
-    if (cc < 0)
-	return cc;
-    return SprintPut(sp, bp, cc);
+    va_start(ap, format);	/* the guess consumed ap, so restart it */
+    offset = SprintFormat(sp, nb, format, ap);
+    va_end(ap);
+    return offset;
 }
 
 static char escapeMap[] = "\bb\ff\nn\rr\tt\vv\"\"";
@@ -253,6 +289,7 @@ struct MochaPrinter {
     PRArenaPool     pool;           /* string allocation pool */
     unsigned        indent;         /* indentation in spaces */
     MochaScript     *script;        /* script being printed */
+    MochaFunction   *fun;           /* function being printed, or null */
 };
 
 MochaPrinter *
@@ -269,6 +306,7 @@ mocha_NewPrinter(MochaContext *mc, const char *name, unsigned indent)
     PR_InitArenaPool(&mp->pool, name, 256, 1);
     mp->indent = indent;
     mp->script = 0;
+    mp->fun = 0;
     return mp;
 }
 
@@ -297,10 +335,8 @@ int
 mocha_printf(MochaPrinter *mp, char *format, ...)
 {
     va_list ap;
-    int nb, cc;
-    char *bp;
-
-    va_start(ap, format);
+    size_t nb;
+    ptrdiff_t offset;
 
     /* Expand magic tab into a run of mp->indent spaces. */
     if (*format == '\t') {
@@ -309,15 +345,16 @@ mocha_printf(MochaPrinter *mp, char *format, ...)
 	format++;
     }
 
-    /* Allocate temp space, convert format, and put. */
+    /* Guess the converted size, then convert format in place. */
+    va_start(ap, format);
     nb = GuessFormatConversionSize(format, ap);
-    bp = (char *)alloca(nb);
-    cc = PR_vsnprintf(bp, nb, format, ap);
-    if (cc > 0 && SprintPut(&mp->sprinter, bp, cc) < 0)
-	return -1;
-
     va_end(ap);
-    return cc;
+    va_start(ap, format);	/* the guess consumed ap, so restart it */
+    offset = SprintFormat(&mp->sprinter, nb, format, ap);
+    va_end(ap);
+    if (offset < 0)
+	return -1;
+    return mp->sprinter.offset - offset;
 }
 
 MochaBoolean
@@ -365,6 +402,54 @@ PopOff(SprintStack *ss, MochaOp op)
     return off;
 }
 
+typedef struct LocalSearch {
+    MochaSymbolType     type;           /* SYM_ARGUMENT or SYM_VARIABLE */
+    MochaSlot           slot;           /* frame slot to find */
+    MochaSymbol         *sym;           /* the symbol found, or null */
+} LocalSearch;
+
+static int
+FindLocal(PRHashEntry *he, int i, void *arg)
+{
+    MochaSymbol *sym = (MochaSymbol *)he;
+    LocalSearch *ls = arg;
+
+    (void)i;
+    if (sym->type == ls->type && sym->slot == ls->slot) {
+	ls->sym = sym;
+	return HT_ENUMERATE_STOP;
+    }
+    return HT_ENUMERATE_NEXT;
+}
+
+/*
+** Return the name of the argument (if arg) or variable in slot of the function
+** being decompiled, for the frame slot bytecodes.
+*/
+static const char *
+LocalName(MochaPrinter *mp, MochaBoolean arg, MochaSlot slot)
+{
+    MochaScope *scope;
+    unsigned i;
+    LocalSearch ls;
+
+    if (!mp->fun)
+	return "?";
+    scope = mp->fun->object.scope;
+    ls.type = arg ? SYM_ARGUMENT : SYM_VARIABLE;
+    ls.slot = slot;
+    ls.sym = 0;
+    if (scope->table) {
+	PR_HashTableEnumerateEntries(scope->table, FindLocal, &ls);
+    } else {
+	for (i = 0; i < scope->shape->nsyms; i++) {
+	    if (FindLocal(&scope->symv[i]->entry, i, &ls) == HT_ENUMERATE_STOP)
+		break;
+	}
+    }
+    return ls.sym ? atom_name(sym_atom(ls.sym)) : "?";
+}
+
 static MochaBoolean
 Decompile(MochaCode *pc, int nb, SprintStack *ss, MochaPrinter *mp)
 {
@@ -764,6 +849,42 @@ Decompile(MochaCode *pc, int nb, SprintStack *ss, MochaPrinter *mp)
 		todo = Sprint(&ss->sprinter, atom_name(atom));
 		break;
 
+	      case MOP_GETARG:
+	      case MOP_GETVAR:
+		sn = mocha_GetSourceNote(mp->script, pc);
+		todo = Sprint(&ss->sprinter,
+			      (sn && SN_TYPE(sn) == SRC_VAR) ? "var %s" : "%s",
+			      LocalName(mp, op == MOP_GETARG, pc[1]));
+		break;
+
+	      case MOP_SETARG:
+	      case MOP_SETVAR:
+		op = MOP_ASSIGN;	/* parenthesize as an assignment */
+		rval = POP_STR();
+		lval = POP_STR();
+		if ((sn = mocha_GetSourceNote(mp->script, pc - 1)) &&
+		    SN_TYPE(sn) == SRC_ASSIGNOP &&
+		    (cs = &mocha_CodeSpec[pc[-1]])->pretty == 2) {
+		    todo = Sprint(&ss->sprinter, "%s %s= %s",
+				  lval, cs->image, rval);
+		} else {
+		    todo = Sprint(&ss->sprinter, "%s = %s", lval, rval);
+		}
+		break;
+
+	      case MOP_INCARG:
+	      case MOP_DECARG:
+	      case MOP_INCVAR:
+	      case MOP_DECVAR:
+		op = MOP_INC;		/* parenthesize as an increment */
+		lval = POP_STR();
+		if (pc[2]) {
+		    todo = Sprint(&ss->sprinter, "%s%s", lval, cs->image);
+		} else {
+		    todo = Sprint(&ss->sprinter, "%s%s", cs->image, lval);
+		}
+		break;
+
 	      case MOP_STRING:
 		atom = GET_CONST_ATOM(mp->sprinter.context, mp->script, pc);
 		rval = EscapeString(&ss->sprinter, atom_name(atom));
@@ -801,16 +922,23 @@ mocha_DecompileScript(MochaScript *script, MochaPrinter *mp)
     SprintStack ss;
     MochaBoolean ok;
 
-    /* Initialize a sprinter for use with the offset stack. */
+    /* Allocate the offset and opcode stacks before the growing sprinter. */
     mc = mp->sprinter.context;
     mark = PR_ARENA_MARK(&mc->tempPool);
-    INIT_SPRINTER(mc, &ss.sprinter, &mc->tempPool, PARENSLOP);
-
-    /* Initialize the offset and opcode stacks. */
-    ss.offsets = (ptrdiff_t *)alloca(script->depth * sizeof *ss.offsets);
-    ss.opcodes = (MochaCode *)alloca(script->depth * sizeof *ss.opcodes);
+    PR_ARENA_ALLOCATE(ss.offsets, &mc->tempPool,
+		      script->depth * sizeof *ss.offsets);
+    PR_ARENA_ALLOCATE(ss.opcodes, &mc->tempPool,
+		      script->depth * sizeof *ss.opcodes);
+    if (!ss.offsets || !ss.opcodes) {
+	PR_ARENA_RELEASE(&mc->tempPool, mark);
+	MOCHA_ReportOutOfMemory(mc);
+	return MOCHA_FALSE;
+    }
     ss.top = 0;
 
+    /* Initialize a sprinter for use with the offset stack. */
+    INIT_SPRINTER(mc, &ss.sprinter, &mc->tempPool, PARENSLOP);
+
     /* Set mp->script for source note referencing. */
     mp->script = script;
 
@@ -827,6 +955,8 @@ mocha_DecompileFunction(MochaFunction *fun, MochaPrinter *mp)
     const MochaAtom *atom;
     unsigned indent;
 
+    if (!mocha_CompileFunctionSource(mp->sprinter.context, fun))
+	return MOCHA_FALSE;
     mocha_printf(mp, "\nfunction %s(", atom_name(fun->atom));
     if (fun->script) {
 	for (arg = fun->script->args; arg; arg = arg->next) {
@@ -840,7 +970,7 @@ mocha_DecompileFunction(MochaFunction *fun, MochaPrinter *mp)
     } else {
 	indent = mp->indent;
 	mp->indent += 4;
-	if (!mocha_DecompileScript(fun->script, mp)) {
+	if (!mocha_DecompileFunctionBody(fun, mp)) {
 	    mp->indent = indent;
 	    return MOCHA_FALSE;
 	}
@@ -849,3 +979,16 @@ mocha_DecompileFunction(MochaFunction *fun, MochaPrinter *mp)
     mocha_printf(mp, "}\n");
     return MOCHA_TRUE;
 }
+
+MochaBoolean
+mocha_DecompileFunctionBody(MochaFunction *fun, MochaPrinter *mp)
+{
+    MochaBoolean ok;
+
+    if (!mocha_CompileFunctionSource(mp->sprinter.context, fun))
+	return MOCHA_FALSE;
+    mp->fun = fun;
+    ok = mocha_DecompileScript(fun->script, mp);
+    mp->fun = 0;
+    return ok;
+}
@@ -61,13 +61,28 @@ bool_finalize(MochaContext *mc, MochaObject *obj)
     MochaAtom *atom;
 
     atom = obj->data;
-    mocha_DropAtom(mc, atom);
+    if (atom)
+	mocha_DropAtom(mc, atom);
+}
+
+static MochaBoolean
+bool_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	   MochaCloner *cl)
+{
+    (void)cl;
+    if (obj->data) {
+	copy->data = mocha_CloneAtom(mc, obj->data);
+	if (!copy->data)
+	    return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
 }
 
 static MochaClass boolean_class = {
     "Boolean",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, bool_finalize
+    MOCHA_ResolveStub, MOCHA_ConvertStub, bool_finalize,
+    bool_clone
 };
 
 static MochaBoolean
@@ -0,0 +1,826 @@
+/*
+** Mocha compiled script cache.
+**
+** A cache file starts with a CacheHeader, followed by the source text,
+** filename and line number the file was compiled from, which a load compares
+** with its own, as two sources may hash to the same file name.  Then come
+** the declarations the script makes, and the script itself.  Numbers are
+** stored in native byte order, which the header's magic number checks.
+** Each declaration is a kind word and a name atom; a function's declaration
+** goes on with its argument count, its scope's free slot, its arguments and
+** variables, and its script, or the source of its body if compiling that
+** was deferred.  A script is its code length, stack depth, line number and
+** filename, then its code, source notes and literal atoms.  The whole file
+** is mapped, checked and decoded into new scripts by LoadScript(), so the
+** mapping is released before the script is returned.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prarena.h"
+#include "prlog.h"
+#include "prprf.h"
+#include "mo_atom.h"
+#include "mo_bcode.h"
+#include "mo_cache.h"
+#include "mo_cntxt.h"
+#include "mo_emit.h"
+#include "mo_parse.h"
+#include "mo_scan.h"
+#include "mo_scope.h"
+#include "mocha.h"
+#include "mochalib.h"
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid()        _getpid()
+#elif defined(XP_MAC)
+#define getpid()        0
+#else
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC     0x4d424331      /* "MBC1" */
+#define CACHE_VERSION   2               /* bump when the format changes */
+#define HASH_BASIS      2166136261U     /* FNV-1a offset basis */
+
+#define DECL_END        0               /* no more declarations */
+#define DECL_VAR        1               /* top-level var */
+#define DECL_FUNCTION   2               /* top-level function */
+
+#define FUN_SCRIPT      0               /* function's script follows */
+#define FUN_SOURCE      1               /* function's deferred body follows */
+
+typedef struct CacheHeader {
+    uint32              magic;          /* CACHE_MAGIC in native byte order */
+    uint16              version;        /* CACHE_VERSION */
+    uint16              nops;           /* MOP_MAX of the writing engine */
+    uint8               floatSize;      /* sizeof(MochaFloat) */
+    uint8               noteSize;       /* sizeof(SourceNote) */
+    uint16              spare;          /* zero */
+    uint32              key[2];         /* hashes of source, filename, line */
+    uint32              srclen;         /* source length in chars */
+    uint32              length;         /* bytes following the header */
+    uint32              checksum;       /* HashBytes of those bytes */
+} CacheHeader;
+
+struct MochaScriptCache {
+    char                *dirname;       /* directory holding cache files */
+};
+
+typedef struct CacheKey {
+    uint32              hash[2];        /* names the cache file */
+    const char          *source;        /* source text, not terminated */
+    size_t              length;         /* source length in chars */
+    const char          *filename;      /* source filename or null */
+    unsigned            lineno;         /* source's first line number */
+} CacheKey;
+
+typedef struct CacheWriter {
+    char                *base;          /* malloc'd buffer */
+    size_t              length;         /* bytes written to base */
+    size_t              size;           /* allocated size of base */
+    MochaBoolean        ok;             /* false if out of memory */
+} CacheWriter;
+
+typedef struct CacheReader {
+    const char          *ptr;           /* next byte to read */
+    const char          *limit;         /* end of bytes to read */
+    MochaBoolean        ok;             /* false if ptr passed limit */
+} CacheReader;
+
+/*
+** FNV-1a, used to check a cache file's contents and as the first half of
+** a script's key.
+*/
+static uint32
+HashBytes(uint32 h, const void *p, size_t n)
+{
+    const uint8 *cp = p;
+
+    while (n-- != 0)
+	h = (h ^ *cp++) * 16777619;
+    return h;
+}
+
+/*
+** A multiplicative hash, unrelated to HashBytes, for the other half of the
+** key.
+*/
+static uint32
+MixBytes(uint32 h, const void *p, size_t n)
+{
+    const uint8 *cp = p;
+
+    while (n-- != 0) {
+	h = (h + *cp++) * 0x9e3779b1;
+	h ^= h >> 15;
+    }
+    return h;
+}
+
+static void
+HashSource(const char *base, size_t length, const char *filename,
+	   unsigned lineno, CacheKey *key)
+{
+    uint32 line;
+
+    line = lineno;
+    key->hash[0] = HashBytes(HASH_BASIS, base, length);
+    key->hash[1] = MixBytes(0, base, length);
+    if (filename) {
+	key->hash[0] = HashBytes(key->hash[0], filename, strlen(filename) + 1);
+	key->hash[1] = MixBytes(key->hash[1], filename, strlen(filename) + 1);
+    }
+    key->hash[0] = HashBytes(key->hash[0], &line, sizeof line);
+    key->hash[1] = MixBytes(key->hash[1], &line, sizeof line);
+    key->source = base;
+    key->length = length;
+    key->filename = filename;
+    key->lineno = lineno;
+}
+
+/*
+** Return the malloc'd pathname of the cache file for key.
+*/
+static char *
+CachePath(MochaScriptCache *cache, CacheKey *key)
+{
+    return PR_smprintf("%s/%08x%08x.mbc", cache->dirname,
+		       key->hash[0], key->hash[1]);
+}
+
+static void
+PutBytes(CacheWriter *cw, const void *p, size_t n)
+{
+    size_t size;
+    char *base;
+
+    if (!cw->ok)
+	return;
+    if (cw->length + n > cw->size) {
+	size = cw->size ? cw->size : 1024;
+	while (size < cw->length + n)
+	    size *= 2;
+	base = realloc(cw->base, size);
+	if (!base) {
+	    cw->ok = MOCHA_FALSE;
+	    return;
+	}
+	cw->base = base;
+	cw->size = size;
+    }
+    memcpy(cw->base + cw->length, p, n);
+    cw->length += n;
+}
+
+static void
+Put32(CacheWriter *cw, uint32 v)
+{
+    PutBytes(cw, &v, sizeof v);
+}
+
+static void
+PutAtom(CacheWriter *cw, MochaAtom *atom)
+{
+    const char *name;
+    MochaAtomFlags flags;
+
+    name = atom_name(atom);
+    flags = ATOM_FLAGS(atom) & (ATOM_NAME | ATOM_NUMBER | ATOM_STRING);
+    Put32(cw, flags);
+    Put32(cw, atom->length);
+    if (flags & ATOM_NUMBER)
+	PutBytes(cw, &atom->fval, sizeof atom->fval);
+    PutBytes(cw, name, atom->length);
+}
+
+static void
+PutScript(CacheWriter *cw, MochaScript *script)
+{
+    SourceNote *sn;
+    unsigned nnotes;
+    MochaAtomNumber i;
+
+    Put32(cw, script->length);
+    Put32(cw, script->depth);
+    Put32(cw, script->lineno);
+    if (script->filename) {
+	Put32(cw, strlen(script->filename) + 1);
+	PutBytes(cw, script->filename, strlen(script->filename) + 1);
+    } else {
+	Put32(cw, 0);
+    }
+    PutBytes(cw, script->code, script->length);
+
+    for (sn = script->notes; !SN_IS_TERMINATOR(sn); sn = SN_NEXT(sn))
+	continue;
+    nnotes = sn + 1 - (SourceNote *)script->notes;
+    Put32(cw, nnotes);
+    PutBytes(cw, script->notes, nnotes * sizeof(SourceNote));
+
+    Put32(cw, script->atomMap.length);
+    for (i = 0; i < script->atomMap.length; i++)
+	PutAtom(cw, script->atomMap.vector[i]);
+}
+
+static void
+PutSource(CacheWriter *cw, MochaFunctionSource *source)
+{
+    Put32(cw, source->length);
+    Put32(cw, source->lineno);
+    Put32(cw, source->scanLineno);
+    if (source->filename) {
+	Put32(cw, strlen(source->filename) + 1);
+	PutBytes(cw, source->filename, strlen(source->filename) + 1);
+    } else {
+	Put32(cw, 0);
+    }
+    PutBytes(cw, source->text, source->length);
+}
+
+static void
+PutVariable(CacheWriter *cw, MochaSymbol *sym, unsigned *countp)
+{
+    if (sym->type != SYM_VARIABLE)
+	return;
+    PutAtom(cw, sym_atom(sym));
+    Put32(cw, sym->slot);
+    (*countp)++;
+}
+
+typedef struct PutArgs {
+    CacheWriter         *writer;
+    unsigned            count;
+} PutArgs;
+
+static int
+PutHashEntry(PRHashEntry *he, int i, void *arg)
+{
+    PutArgs *pa = arg;
+
+    (void)i;
+    PutVariable(pa->writer, (MochaSymbol *)he, &pa->count);
+    return HT_ENUMERATE_NEXT;
+}
+
+/*
+** Put fun's arguments, in order, and then its local variables, in the order
+** they were declared unless its scope has become a hash table.
+*/
+static void
+PutFunction(CacheWriter *cw, MochaFunction *fun)
+{
+    MochaScope *scope;
+    MochaSymbol *args, *arg;
+    size_t offset;
+    unsigned i, count;
+    PutArgs pa;
+
+    scope = fun->object.scope;
+    Put32(cw, fun->nargs);
+    Put32(cw, scope->freeslot);
+
+    args = fun->source ? fun->source->args : fun->script->args;
+    count = 0;
+    for (arg = args; arg; arg = arg->next)
+	count++;
+    Put32(cw, count);
+    for (arg = args; arg; arg = arg->next) {
+	PutAtom(cw, sym_atom(arg));
+	Put32(cw, arg->slot);
+    }
+
+    offset = cw->length;
+    count = 0;
+    Put32(cw, count);
+    if (scope->table) {
+	pa.writer = cw;
+	pa.count = 0;
+	PR_HashTableEnumerateEntries(scope->table, PutHashEntry, &pa);
+	count = pa.count;
+    } else {
+	for (i = 0; i < scope->shape->nsyms; i++)
+	    PutVariable(cw, scope->symv[i], &count);
+    }
+    if (cw->ok)
+	memcpy(cw->base + offset, &count, sizeof count);
+
+    if (fun->source) {
+	Put32(cw, FUN_SOURCE);
+	PutSource(cw, fun->source);
+    } else {
+	Put32(cw, FUN_SCRIPT);
+	PutScript(cw, fun->script);
+    }
+}
+
+/*
+** Write script, with the declarations made by compiling it, to its cache
+** file.  Write a temporary file first and rename it, so no reader can see
+** a partly written file.  Ignore failures, as the cache is only an aid.
+*/
+static void
+SaveScript(MochaContext *mc, MochaScriptCache *cache, CacheKey *key,
+	   CodeDecl *decls, MochaScript *script)
+{
+    CacheWriter cw;
+    CacheHeader hdr;
+    CodeDecl *decl;
+    char *path, *temp;
+    FILE *fp;
+    MochaBoolean ok;
+
+    cw.base = 0;
+    cw.length = cw.size = 0;
+    cw.ok = MOCHA_TRUE;
+    memset(&hdr, 0, sizeof hdr);
+    PutBytes(&cw, &hdr, sizeof hdr);
+    PutBytes(&cw, key->source, key->length);
+    if (key->filename) {
+	Put32(&cw, strlen(key->filename) + 1);
+	PutBytes(&cw, key->filename, strlen(key->filename) + 1);
+    } else {
+	Put32(&cw, 0);
+    }
+    Put32(&cw, key->lineno);
+    for (decl = decls; decl; decl = decl->next) {
+	Put32(&cw, decl->fun ? DECL_FUNCTION : DECL_VAR);
+	PutAtom(&cw, decl->atom);
+	if (decl->fun)
+	    PutFunction(&cw, decl->fun);
+    }
+    Put32(&cw, DECL_END);
+    PutScript(&cw, script);
+    if (!cw.ok)
+	goto out;
+
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.nops = MOP_MAX;
+    hdr.floatSize = sizeof(MochaFloat);
+    hdr.noteSize = sizeof(SourceNote);
+    hdr.key[0] = key->hash[0];
+    hdr.key[1] = key->hash[1];
+    hdr.srclen = key->length;
+    hdr.length = cw.length - sizeof hdr;
+    hdr.checksum = HashBytes(HASH_BASIS, cw.base + sizeof hdr, hdr.length);
+    memcpy(cw.base, &hdr, sizeof hdr);
+
+    path = CachePath(cache, key);
+    if (!path)
+	goto out;
+    temp = PR_smprintf("%s.%d.%p", path, (int)getpid(), (void *)mc);
+    if (temp) {
+	fp = fopen(temp, "wb");
+	if (fp) {
+	    ok = fwrite(cw.base, 1, cw.length, fp) == cw.length;
+	    if (fclose(fp) != 0)
+		ok = MOCHA_FALSE;
+#ifdef _WIN32
+	    if (ok)
+		remove(path);
+#endif
+	    if (!ok || rename(temp, path) != 0)
+		remove(temp);
+	}
+	free(temp);
+    }
+    free(path);
+out:
+    free(cw.base);
+}
+
+static const char *
+GetBytes(CacheReader *cr, size_t n)
+{
+    const char *p;
+
+    if (!cr->ok || (size_t)(cr->limit - cr->ptr) < n) {
+	cr->ok = MOCHA_FALSE;
+	return 0;
+    }
+    p = cr->ptr;
+    cr->ptr += n;
+    return p;
+}
+
+static uint32
+Get32(CacheReader *cr)
+{
+    const char *p;
+    uint32 v;
+
+    p = GetBytes(cr, sizeof v);
+    if (!p)
+	return 0;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+/*
+** Return a held atom read from cr, or null if cr is exhausted or out of
+** memory.
+*/
+static MochaAtom *
+GetAtom(MochaContext *mc, CacheReader *cr)
+{
+    MochaAtomFlags flags;
+    uint32 length;
+    MochaFloat fval;
+    const char *p;
+
+    flags = (MochaAtomFlags)Get32(cr);
+    length = Get32(cr);
+    if (flags & ATOM_NUMBER) {
+	p = GetBytes(cr, sizeof fval);
+	if (!p)
+	    return 0;
+	memcpy(&fval, p, sizeof fval);
+    }
+    p = GetBytes(cr, length);
+    if (!p)
+	return 0;
+    if (flags & ATOM_NUMBER) {
+	return mocha_AtomizeNumber(mc, p, length, fval,
+				   (flags & ~ATOM_NUMBER) | ATOM_HELD);
+    }
+    return mocha_Atomize(mc, p, length, flags | ATOM_HELD);
+}
+
+/*
+** Make a script from cr, as mocha_CloneScript() copies one.
+*/
+static MochaScript *
+GetScript(MochaContext *mc, CacheReader *cr)
+{
+    uint32 length, depth, lineno, n, i;
+    const char *filename, *code, *notes;
+    SourceNote last;
+    MochaScript *script;
+    MochaAtom *atom;
+
+    length = Get32(cr);
+    depth = Get32(cr);
+    lineno = Get32(cr);
+    n = Get32(cr);
+    filename = n ? GetBytes(cr, n) : 0;
+    if (filename && filename[n - 1] != '\0')
+	cr->ok = MOCHA_FALSE;
+    code = GetBytes(cr, length);
+    n = Get32(cr);
+    notes = GetBytes(cr, n * sizeof(SourceNote));
+    if (!cr->ok || n == 0)
+	goto corrupt;
+    memcpy(&last, notes + (n - 1) * sizeof(SourceNote), sizeof last);
+    if (!SN_IS_TERMINATOR(&last))
+	goto corrupt;
+
+    script = MOCHA_malloc(mc, sizeof(MochaScript) + length);
+    if (!script)
+	return 0;
+    memset(script, 0, sizeof(MochaScript));
+    script->code = (MochaCode *)(script + 1);
+    memcpy(script->code, code, length);
+    script->length = length;
+    script->depth = depth;
+    script->lineno = lineno;
+    if (filename) {
+	script->filename = MOCHA_strdup(mc, filename);
+	if (!script->filename)
+	    goto bad;
+    }
+    script->notes = MOCHA_malloc(mc, n * sizeof(SourceNote));
+    if (!script->notes)
+	goto bad;
+    memcpy(script->notes, notes, n * sizeof(SourceNote));
+
+    n = Get32(cr);
+    if (n > (size_t)(cr->limit - cr->ptr)) {
+	cr->ok = MOCHA_FALSE;
+	goto bad;
+    }
+    if (n) {
+	script->atomMap.vector = MOCHA_malloc(mc, n * sizeof(MochaAtom *));
+	if (!script->atomMap.vector)
+	    goto bad;
+	for (i = 0; i < n; i++) {
+	    atom = GetAtom(mc, cr);
+	    if (!atom)
+		goto bad;
+	    script->atomMap.vector[script->atomMap.length++] = atom;
+	}
+    }
+    if (!mocha_InitPropertyCaches(mc, script))
+	goto bad;
+    return script;
+
+bad:
+    mocha_DestroyScript(mc, script);
+    return 0;
+
+corrupt:
+    cr->ok = MOCHA_FALSE;
+    return 0;
+}
+
+/*
+** Make a function source record from cr, or return null if cr is exhausted
+** or out of memory.
+*/
+static MochaFunctionSource *
+GetSource(MochaContext *mc, CacheReader *cr)
+{
+    uint32 length, lineno, scanLineno, n;
+    const char *filename, *text;
+
+    length = Get32(cr);
+    lineno = Get32(cr);
+    scanLineno = Get32(cr);
+    n = Get32(cr);
+    filename = n ? GetBytes(cr, n) : 0;
+    if (filename && filename[n - 1] != '\0')
+	cr->ok = MOCHA_FALSE;
+    text = GetBytes(cr, length);
+    if (!cr->ok)
+	return 0;
+    return mocha_NewFunctionSource(mc, text, length, filename, lineno,
+				   scanLineno);
+}
+
+/*
+** Read count symbols of the given type from cr and define them in scope,
+** linking them in order through *symp if it's not null.
+*/
+static MochaBoolean
+GetSymbols(MochaContext *mc, CacheReader *cr, MochaScope *scope,
+	   MochaSymbolType type, MochaSymbol **symp)
+{
+    uint32 count;
+    MochaAtom *atom;
+    MochaSymbol *sym;
+
+    for (count = Get32(cr); count != 0; count--) {
+	atom = GetAtom(mc, cr);
+	if (!atom)
+	    return MOCHA_FALSE;
+	sym = mocha_DefineSymbol(mc, scope, atom, type, 0);
+	mocha_DropAtom(mc, atom);
+	if (!sym)
+	    return MOCHA_FALSE;
+	sym->slot = (MochaSlot)Get32(cr);
+	if (symp) {
+	    *symp = sym;
+	    symp = &sym->next;
+	}
+    }
+    return cr->ok;
+}
+
+/*
+** Define a function in obj as FunctionDefinition() in mo_parse.c does, but
+** from cr.
+*/
+static MochaBoolean
+GetFunction(MochaContext *mc, CacheReader *cr, MochaObject *obj,
+	    MochaAtom *atom)
+{
+    unsigned nargs;
+    MochaSlot freeslot;
+    MochaFunction *fun;
+    MochaSymbol *args;
+
+    nargs = Get32(cr);
+    freeslot = (MochaSlot)Get32(cr);
+    if (!cr->ok)
+	return MOCHA_FALSE;
+    fun = mocha_DefineFunction(mc, obj, atom, 0, nargs, 0);
+    if (!fun || !mocha_GetMutableScope(mc, &fun->object))
+	goto bad;
+    args = 0;
+    if (!GetSymbols(mc, cr, fun->object.scope, SYM_ARGUMENT, &args) ||
+	!GetSymbols(mc, cr, fun->object.scope, SYM_VARIABLE, 0)) {
+	goto bad;
+    }
+    fun->object.scope->freeslot = freeslot;
+    fun->nargs = nargs;
+    if (Get32(cr) == FUN_SOURCE) {
+	fun->source = GetSource(mc, cr);
+	if (!fun->source)
+	    goto bad;
+	fun->source->args = args;
+    } else {
+	fun->script = GetScript(mc, cr);
+	if (!fun->script)
+	    goto bad;
+	fun->script->args = args;
+    }
+    return MOCHA_TRUE;
+
+bad:
+    mocha_RemoveSymbol(mc, obj->scope, atom);
+    return MOCHA_FALSE;
+}
+
+/*
+** Return true if the source that cr's file was compiled from is key's.
+*/
+static MochaBoolean
+MatchSource(CacheReader *cr, CacheKey *key)
+{
+    const char *text, *filename;
+    uint32 n;
+
+    text = GetBytes(cr, key->length);
+    if (!text || memcmp(text, key->source, key->length) != 0)
+	return MOCHA_FALSE;
+    n = Get32(cr);
+    filename = n ? GetBytes(cr, n) : 0;
+    if (!cr->ok)
+	return MOCHA_FALSE;
+    if (filename || key->filename) {
+	if (!filename || !key->filename ||
+	    n != strlen(key->filename) + 1 ||
+	    memcmp(filename, key->filename, n) != 0) {
+	    return MOCHA_FALSE;
+	}
+    }
+    return Get32(cr) == key->lineno && cr->ok;
+}
+
+/*
+** Load the script for key from cache, repeating the declarations saved with
+** it in obj.  Return null if it's not in cache or its file won't do, or if
+** out of memory.
+*/
+static MochaScript *
+LoadScript(MochaContext *mc, MochaScriptCache *cache, MochaObject *obj,
+	   CacheKey *key)
+{
+    char *path;
+    MochaMappedFile mf;
+    CacheHeader hdr;
+    CacheReader cr;
+    uint32 kind;
+    MochaAtom *atom;
+    MochaSymbol *sym;
+    MochaScript *script;
+
+    path = CachePath(cache, key);
+    if (!path)
+	return 0;
+    if (!mocha_MapFile(path, &mf)) {
+	free(path);
+	return 0;
+    }
+    free(path);
+
+    script = 0;
+    if (mf.size < sizeof hdr)
+	goto out;
+    memcpy(&hdr, mf.base, sizeof hdr);
+    if (hdr.magic != CACHE_MAGIC ||
+	hdr.version != CACHE_VERSION ||
+	hdr.nops != MOP_MAX ||
+	hdr.floatSize != sizeof(MochaFloat) ||
+	hdr.noteSize != sizeof(SourceNote) ||
+	hdr.key[0] != key->hash[0] || hdr.key[1] != key->hash[1] ||
+	hdr.srclen != (uint32)key->length ||
+	hdr.length != mf.size - sizeof hdr ||
+	hdr.checksum != HashBytes(HASH_BASIS, mf.base + sizeof hdr,
+				  hdr.length)) {
+	goto out;
+    }
+
+    cr.ptr = mf.base + sizeof hdr;
+    cr.limit = mf.base + mf.size;
+    cr.ok = MOCHA_TRUE;
+    if (!MatchSource(&cr, key))
+	goto out;
+    while ((kind = Get32(&cr)) != DECL_END) {
+	atom = GetAtom(mc, &cr);
+	if (!atom)
+	    goto out;
+	if (kind == DECL_FUNCTION) {
+	    if (!GetFunction(mc, &cr, obj, atom)) {
+		mocha_DropAtom(mc, atom);
+		goto out;
+	    }
+	} else {
+	    sym = mocha_DefineSymbol(mc, obj->scope, atom, SYM_VARIABLE, 0);
+	    if (!sym) {
+		mocha_DropAtom(mc, atom);
+		goto out;
+	    }
+	    sym->slot = obj->scope->freeslot++;
+	}
+	mocha_DropAtom(mc, atom);
+    }
+    if (!cr.ok)
+	goto out;
+    script = GetScript(mc, &cr);
+    if (script && cr.ptr != cr.limit) {
+	mocha_DestroyScript(mc, script);
+	script = 0;
+    }
+out:
+    mocha_UnmapFile(&mf);
+    return script;
+}
+
+/*
+** Compile ts as CompileTokenStream() in mochaapi.c does, taking the
+** declarations it makes so the script can be saved in cache with them.
+*/
+static MochaScript *
+CompileAndSave(MochaContext *mc, MochaScriptCache *cache, MochaObject *obj,
+	       MochaTokenStream *ts, void *tempMark, CacheKey *key)
+{
+    void *codeMark;
+    CodeGenerator cg;
+    unsigned lineno;
+    MochaScript *script;
+
+    codeMark = PR_ARENA_MARK(&mc->codePool);
+    if (!mocha_InitCodeGenerator(mc, &cg, &mc->codePool))
+	return 0;
+    cg.declTail = &cg.decls;
+    lineno = ts->lineno;
+    if (mocha_Parse(mc, obj, ts, &cg))
+	script = mocha_NewScript(mc, &cg, ts->filename, lineno);
+    else
+	script = 0;
+    if (!mocha_CloseTokenStream(ts) && script) {
+	mocha_DestroyScript(mc, script);
+	script = 0;
+    }
+    if (script)
+	SaveScript(mc, cache, key, cg.decls, script);
+    mocha_FreeDeclarations(mc, &cg);
+    PR_ARENA_RELEASE(&mc->codePool, codeMark);
+    PR_ARENA_RELEASE(&mc->tempPool, tempMark);
+    return script;
+}
+
+MochaScriptCache *
+MOCHA_NewScriptCache(MochaContext *mc, const char *dirname)
+{
+    MochaScriptCache *cache;
+
+    cache = MOCHA_malloc(mc, sizeof *cache);
+    if (!cache)
+	return 0;
+    cache->dirname = MOCHA_strdup(mc, dirname);
+    if (!cache->dirname) {
+	MOCHA_free(mc, cache);
+	return 0;
+    }
+    return cache;
+}
+
+void
+MOCHA_DestroyScriptCache(MochaContext *mc, MochaScriptCache *cache)
+{
+    MOCHA_free(mc, cache->dirname);
+    MOCHA_free(mc, cache);
+}
+
+MochaScript *
+MOCHA_CompileCachedBuffer(MochaContext *mc, MochaScriptCache *cache,
+			  MochaObject *obj, const char *base, size_t length,
+			  const char *filename, unsigned lineno)
+{
+    CacheKey key;
+    MochaScript *script;
+    void *mark;
+    MochaTokenStream *ts;
+
+    HashSource(base, length, filename, lineno, &key);
+    script = LoadScript(mc, cache, obj, &key);
+    if (script)
+	return script;
+    mark = PR_ARENA_MARK(&mc->tempPool);
+    ts = mocha_NewTokenStream(mc, base, length, filename, lineno);
+    if (!ts)
+	return 0;
+    return CompileAndSave(mc, cache, obj, ts, mark, &key);
+}
+
+MochaScript *
+MOCHA_CompileCachedFile(MochaContext *mc, MochaScriptCache *cache,
+			MochaObject *obj, const char *filename)
+{
+    MochaMappedFile mf;
+    MochaScript *script;
+
+    if (!mocha_MapFile(filename, &mf)) {
+	MOCHA_ReportError(mc, "can't open %s: %s", filename, strerror(errno));
+	return 0;
+    }
+    script = MOCHA_CompileCachedBuffer(mc, cache, obj,
+				       mf.base ? mf.base : "", mf.size,
+				       filename, 1);
+    mocha_UnmapFile(&mf);
+    return script;
+}
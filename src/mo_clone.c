@@ -0,0 +1,589 @@
+/*
+** Mocha object graph cloning and templates.
+**
+** CloneGraph copies an object and everything reachable from it without
+** recursion.  CloneObject allocates an empty copy of an object the first
+** time the object is seen, and queues it; copying a queued object's
+** prototype and private data, or a queued scope's properties, may see more
+** objects, which are queued in turn.  The loop in CloneGraph runs until
+** both queues are drained.  Every copy is held by the cloner until the end,
+** so that a failure part way can drop whatever was made.
+**
+** The shared library is a template whose copies are frozen instead: their
+** reference counts are set to MOCHA_FROZEN, so holds and drops by any
+** context leave them alone, and they live until MOCHA_DestroySharedLibrary.
+** Frozen objects are referenced, not copied, by later clones.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "prlog.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
+#include "mo_atom.h"
+#include "mo_clone.h"
+#include "mo_cntxt.h"
+#include "mo_parse.h"
+#include "mo_scope.h"
+#include "mocha.h"
+#include "mochaapi.h"
+#include "mochalib.h"
+
+typedef struct CloneEntry {
+    const void          *thing;         /* original, null if entry is free */
+    void                *copy;          /* thing's copy */
+} CloneEntry;
+
+typedef struct CloneList {
+    CloneEntry          *vector;        /* originals and copies, in order */
+    uint32              length;         /* number of entries in vector */
+    uint32              capacity;       /* allocated length of vector */
+} CloneList;
+
+struct MochaCloner {
+    CloneEntry          *table;         /* open-addressed map, thing to copy */
+    uint32              shift;          /* 32 - log2(table size) */
+    uint32              count;          /* number of entries in table */
+    CloneList           objects;        /* objects copied, held by copies */
+    CloneList           scopes;         /* scopes copied, held by copies */
+};
+
+#define CLONE_MIN_LOG2          8       /* initial log2 of table size */
+#define CLONE_SIZE(cl)          PR_BIT(32 - (cl)->shift)
+
+/* Pointers are at least 8-byte aligned, so shift out the zero bits. */
+#define CLONE_HASH(thing, shift)                                              \
+    (((uint32)((uprword_t)(thing) >> 3) * 0x9E3779B9U) >> (shift))
+
+#define TEMPLATE_STACK_SIZE     1024    /* template contexts run no code */
+
+struct MochaTemplate {
+    MochaContext        *context;       /* holds global, atoms, and shapes */
+    MochaObject         *global;        /* copy of the original global */
+    uint32              shift;          /* table shift that fit the global */
+    CloneList           objects;        /* frozen objects, if shared */
+    CloneList           scopes;         /* frozen scopes, if shared */
+};
+
+static MochaClass shared_global_class = {
+    "global",
+    MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
+    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub,
+    0
+};
+
+static MochaTemplate *shared_library;
+
+#ifdef MOCHA_THREADSAFE
+static PRSyncLock shared_library_lock = PR_SYNC_LOCK_INITIALIZER;
+#define LOCK_LIBRARY()          PR_SyncLock(&shared_library_lock)
+#define UNLOCK_LIBRARY()        PR_SyncUnlock(&shared_library_lock)
+#else
+#define LOCK_LIBRARY()          ((void)0)
+#define UNLOCK_LIBRARY()        ((void)0)
+#endif
+
+static CloneEntry *
+FindEntry(CloneEntry *table, uint32 shift, const void *thing)
+{
+    uint32 mask, i;
+    CloneEntry *ce;
+
+    mask = PR_BIT(32 - shift) - 1;
+    for (i = CLONE_HASH(thing, shift); ; i = (i + 1) & mask) {
+	ce = &table[i];
+	if (ce->thing == thing || !ce->thing)
+	    return ce;
+    }
+}
+
+void *
+mocha_GetClone(MochaCloner *cl, const void *thing)
+{
+    return FindEntry(cl->table, cl->shift, thing)->copy;
+}
+
+MochaBoolean
+mocha_PutClone(MochaContext *mc, MochaCloner *cl, const void *thing,
+	       void *copy)
+{
+    uint32 size, i;
+    CloneEntry *table, *ce;
+
+    /* Double the table when it would become more than 3/4 full. */
+    size = CLONE_SIZE(cl);
+    if (cl->count + 1 > size - size / 4) {
+	table = MOCHA_malloc(mc, 2 * size * sizeof *table);
+	if (!table)
+	    return MOCHA_FALSE;
+	memset(table, 0, 2 * size * sizeof *table);
+	for (i = 0; i < size; i++) {
+	    ce = &cl->table[i];
+	    if (ce->thing)
+		*FindEntry(table, cl->shift - 1, ce->thing) = *ce;
+	}
+	MOCHA_free(mc, cl->table);
+	cl->table = table;
+	cl->shift--;
+    }
+    ce = FindEntry(cl->table, cl->shift, thing);
+    PR_ASSERT(!ce->thing);
+    ce->thing = thing;
+    ce->copy = copy;
+    cl->count++;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+AddToList(MochaContext *mc, CloneList *list, const void *thing, void *copy)
+{
+    uint32 capacity;
+    CloneEntry *vector;
+
+    if (list->length == list->capacity) {
+	capacity = list->capacity ? 2 * list->capacity : 64;
+	vector = MOCHA_malloc(mc, capacity * sizeof *vector);
+	if (!vector)
+	    return MOCHA_FALSE;
+	if (list->vector) {
+	    memcpy(vector, list->vector, list->length * sizeof *vector);
+	    MOCHA_free(mc, list->vector);
+	}
+	list->vector = vector;
+	list->capacity = capacity;
+    }
+    list->vector[list->length].thing = thing;
+    list->vector[list->length].copy = copy;
+    list->length++;
+    return MOCHA_TRUE;
+}
+
+/*
+** Return the copy of scope, making a new empty scope for it the first time
+** it's seen.  The new scope is filled in by mocha_CloneScope later.
+*/
+static MochaScope *
+CloneScope(MochaContext *mc, MochaCloner *cl, MochaScope *scope)
+{
+    MochaScope *copy;
+
+    if (SCOPE_IS_FROZEN(scope))
+	return scope;
+    copy = mocha_GetClone(cl, scope);
+    if (copy)
+	return copy;
+    copy = mocha_NewScope(mc, 0);
+    if (!copy)
+	return 0;
+    mocha_HoldScope(mc, copy);
+    if (!AddToList(mc, &cl->scopes, scope, copy)) {
+	mocha_DropScope(mc, copy);
+	return 0;
+    }
+    if (!mocha_PutClone(mc, cl, scope, copy))
+	return 0;
+    return copy;
+}
+
+/*
+** Return the copy of obj, making a new object for it the first time it's
+** seen.  The new object has the class of a plain object until its prototype
+** and private data are copied, and is held by cl.
+*/
+static MochaObject *
+CloneObject(MochaContext *mc, MochaCloner *cl, MochaObject *obj)
+{
+    MochaObject *copy;
+    MochaScope *scope;
+    size_t nbytes;
+
+    if (obj->nrefs == MOCHA_FROZEN)
+	return obj;
+    copy = mocha_GetClone(cl, obj);
+    if (copy)
+	return copy;
+    scope = CloneScope(mc, cl, obj->scope);
+    if (!scope)
+	return 0;
+
+    /* Functions extend MochaObject, so their copies must be as big. */
+    nbytes = (obj->clazz == &mocha_FunctionClass)
+	     ? sizeof(MochaFunction)
+	     : sizeof(MochaObject);
+    copy = MOCHA_malloc(mc, nbytes);
+    if (!copy)
+	return 0;
+    memset(copy, 0, nbytes);
+    copy->nrefs = 1;
+    copy->clazz = &mocha_ObjectClass;
+    copy->scope = mocha_HoldScope(mc, scope);
+    if (!AddToList(mc, &cl->objects, obj, copy)) {
+	copy->nrefs = 0;
+	mocha_DestroyObject(mc, copy);
+	return 0;
+    }
+    if (!mocha_PutClone(mc, cl, obj, copy))
+	return 0;
+    return copy;
+}
+
+MochaBoolean
+MOCHA_CloneDatum(MochaContext *mc, MochaCloner *cl, MochaDatum *from,
+		 MochaDatum *to)
+{
+    MochaObject *obj;
+
+    *to = *from;
+    switch (from->tag) {
+      case MOCHA_UNDEF:
+      case MOCHA_INTERNAL:
+      case MOCHA_NUMBER:
+      case MOCHA_BOOLEAN:
+	break;
+
+      case MOCHA_ATOM:
+      case MOCHA_STRING:
+	to->u.atom = mocha_CloneAtom(mc, from->u.atom);
+	if (!to->u.atom)
+	    return MOCHA_FALSE;
+	break;
+
+      case MOCHA_FUNCTION:
+      case MOCHA_OBJECT:
+	if (!from->u.obj)
+	    break;
+	obj = CloneObject(mc, cl, from->u.obj);
+	if (!obj)
+	    return MOCHA_FALSE;
+	to->u.obj = obj;
+	if ((to->flags & MDF_BACKEDGE) == 0)
+	    MOCHA_HoldObject(mc, obj);
+	break;
+
+      default:
+	MOCHA_ReportError(mc, "can't clone %s datum",
+			  (from->tag < MOCHA_NTYPES)
+			  ? mocha_typeStr[from->tag]
+			  : "internal");
+	return MOCHA_FALSE;
+    }
+    if (to->taint != MOCHA_TAINT_IDENTITY && mc->holdTaint)
+	(*mc->holdTaint)(mc, to->taint);
+    return MOCHA_TRUE;
+}
+
+/*
+** Copy root and every object reachable from it into mc, returning root's
+** copy unheld, or null after reporting an error.  *shiftp is the shift for
+** the cloner's table to start with, and is set to the shift it ended with,
+** so that cloning the copy again need not grow the table.  If freeze is not
+** null, freeze the copies and give freeze the lists of them.
+*/
+static MochaObject *
+CloneGraph(MochaContext *mc, MochaObject *root, uint32 *shiftp,
+	   MochaTemplate *freeze)
+{
+    MochaCloner cl;
+    MochaObject *copy, *obj, *objcopy;
+    MochaScope *scope;
+    uint32 i, j;
+    CloneEntry *ce;
+    MochaFunction *fun, *funcopy;
+    MochaSymbol *arg, **argp;
+
+    memset(&cl, 0, sizeof cl);
+    cl.shift = *shiftp;
+    cl.table = MOCHA_malloc(mc, CLONE_SIZE(&cl) * sizeof *cl.table);
+    if (!cl.table)
+	return 0;
+    memset(cl.table, 0, CLONE_SIZE(&cl) * sizeof *cl.table);
+
+    copy = CloneObject(mc, &cl, root);
+    if (!copy)
+	goto bad;
+    i = j = 0;
+    while (i < cl.objects.length || j < cl.scopes.length) {
+	if (i < cl.objects.length) {
+	    ce = &cl.objects.vector[i++];
+	    obj = (MochaObject *)ce->thing;
+	    objcopy = ce->copy;
+	    if (obj->prototype) {
+		objcopy->prototype = CloneObject(mc, &cl, obj->prototype);
+		if (!objcopy->prototype)
+		    goto bad;
+		MOCHA_HoldObject(mc, objcopy->prototype);
+	    }
+
+	    /* From here on, objcopy is finalized by its class if we fail. */
+	    objcopy->clazz = obj->clazz;
+	    if (obj->clazz->clone) {
+		if (!(*obj->clazz->clone)(mc, obj, objcopy, &cl))
+		    goto bad;
+	    } else if (obj->data) {
+		MOCHA_ReportError(mc, "can't clone %s object",
+				  obj->clazz->name);
+		goto bad;
+	    }
+	} else {
+	    ce = &cl.scopes.vector[j++];
+	    if (!mocha_CloneScope(mc, (MochaScope *)ce->thing, ce->copy, &cl))
+		goto bad;
+	}
+    }
+
+    /*
+    ** Everything is copied, so set the weak links, and the lists of formal
+    ** arguments, whose symbols are in the copies of function scopes.
+    */
+    for (i = 0; i < cl.objects.length; i++) {
+	ce = &cl.objects.vector[i];
+	obj = (MochaObject *)ce->thing;
+	objcopy = ce->copy;
+	if (obj->parent && !objcopy->parent)
+	    objcopy->parent = mocha_GetClone(&cl, obj->parent);
+	if (obj->clazz == &mocha_FunctionClass) {
+	    fun = (MochaFunction *)obj;
+	    funcopy = (MochaFunction *)objcopy;
+	    if (fun->script) {
+		arg = fun->script->args;
+		argp = &funcopy->script->args;
+	    } else if (fun->source) {
+		arg = fun->source->args;
+		argp = &funcopy->source->args;
+	    } else {
+		continue;
+	    }
+	    for (; arg; arg = arg->next) {
+		*argp = mocha_GetClone(&cl, arg);
+		if (!*argp)
+		    break;
+		argp = &(*argp)->next;
+	    }
+	}
+    }
+    for (i = 0; i < cl.scopes.length; i++) {
+	ce = &cl.scopes.vector[i];
+	scope = ce->copy;
+	obj = ((MochaScope *)ce->thing)->object;
+	scope->object = obj ? mocha_GetClone(&cl, obj) : 0;
+    }
+    *shiftp = cl.shift;
+
+    if (freeze) {
+	for (i = 0; i < cl.objects.length; i++)
+	    ((MochaObject *)cl.objects.vector[i].copy)->nrefs = MOCHA_FROZEN;
+	for (i = 0; i < cl.scopes.length; i++)
+	    ((MochaScope *)cl.scopes.vector[i].copy)->nrefs = MOCHA_FROZEN;
+	freeze->objects = cl.objects;
+	freeze->scopes = cl.scopes;
+	cl.objects.vector = cl.scopes.vector = 0;
+	goto out;
+    }
+
+    /*
+    ** Release our holds.  Like an object from mocha_NewObject, root's copy
+    ** may be left with no references.  Any other copy that is referenced
+    ** only by back-edges keeps our hold, as its original must be held by
+    ** something outside the graph.
+    */
+    for (i = 0; i < cl.objects.length; i++) {
+	obj = cl.objects.vector[i].copy;
+	if (obj == copy)
+	    obj->nrefs--;
+	else if (obj->nrefs > 1)
+	    MOCHA_DropObject(mc, obj);
+    }
+    for (i = 0; i < cl.scopes.length; i++)
+	mocha_DropScope(mc, cl.scopes.vector[i].copy);
+    goto out;
+
+bad:
+    for (i = 0; i < cl.objects.length; i++)
+	MOCHA_DropObject(mc, cl.objects.vector[i].copy);
+    for (i = 0; i < cl.scopes.length; i++)
+	mocha_DropScope(mc, cl.scopes.vector[i].copy);
+    copy = 0;
+out:
+    MOCHA_free(mc, cl.objects.vector);
+    MOCHA_free(mc, cl.scopes.vector);
+    MOCHA_free(mc, cl.table);
+    return copy;
+}
+
+static MochaTemplate *
+NewTemplate(MochaContext *mc, MochaObject *obj, MochaBoolean frozen)
+{
+    MochaTemplate *tmpl;
+    MochaContext *tc;
+    MochaObject *global;
+    uint32 shift;
+
+    tmpl = MOCHA_malloc(mc, sizeof *tmpl);
+    if (!tmpl)
+	return 0;
+    memset(tmpl, 0, sizeof *tmpl);
+    tc = MOCHA_NewContext(TEMPLATE_STACK_SIZE);
+    if (!tc) {
+	MOCHA_ReportOutOfMemory(mc);
+	MOCHA_free(mc, tmpl);
+	return 0;
+    }
+    shift = 32 - CLONE_MIN_LOG2;
+    global = CloneGraph(tc, obj, &shift, frozen ? tmpl : 0);
+    if (!global) {
+	mocha_ReportErrorAgain(mc, tc->lastMessage, 0);
+	MOCHA_DestroyContext(tc);
+	MOCHA_free(mc, tmpl);
+	return 0;
+    }
+    tc->globalObject = MOCHA_HoldObject(tc, global);
+    tmpl->context = tc;
+    tmpl->global = global;
+    tmpl->shift = shift;
+    return tmpl;
+}
+
+MochaTemplate *
+MOCHA_NewTemplate(MochaContext *mc, MochaObject *obj)
+{
+    return NewTemplate(mc, obj, MOCHA_FALSE);
+}
+
+MochaObject *
+MOCHA_CloneTemplate(MochaContext *mc, MochaTemplate *tmpl)
+{
+    MochaObject *global;
+    uint32 shift;
+
+    shift = tmpl->shift;
+    global = CloneGraph(mc, tmpl->global, &shift, 0);
+    if (!global)
+	return 0;
+    mc->globalObject = global;	/* XXX weak link */
+    return global;
+}
+
+void
+MOCHA_DestroyTemplate(MochaTemplate *tmpl)
+{
+    MochaContext *tc;
+
+    tc = tmpl->context;
+    MOCHA_DropObject(tc, tmpl->global);
+    tc->globalObject = 0;
+    MOCHA_free(tc, tmpl);
+    MOCHA_DestroyContext(tc);
+}
+
+/*
+** Return the shared library, making it the first time it's needed from the
+** standard library of a global object in a throwaway context.
+*/
+static MochaTemplate *
+GetSharedLibrary(MochaContext *mc)
+{
+    MochaTemplate *lib;
+    MochaContext *ic;
+    MochaObject *glob;
+
+    LOCK_LIBRARY();
+    lib = shared_library;
+    if (!lib) {
+	ic = MOCHA_NewContext(TEMPLATE_STACK_SIZE);
+	if (!ic) {
+	    MOCHA_ReportOutOfMemory(mc);
+	    goto out;
+	}
+	glob = MOCHA_NewObject(ic, &shared_global_class, 0, 0, 0, 0, 0);
+	if (glob) {
+	    MOCHA_HoldObject(ic, glob);
+	    if (MOCHA_SetGlobalObject(ic, glob))
+		lib = NewTemplate(ic, glob, MOCHA_TRUE);
+	    MOCHA_DropObject(ic, glob);
+	}
+	if (!lib)
+	    mocha_ReportErrorAgain(mc, ic->lastMessage, 0);
+	ic->globalObject = 0;
+	MOCHA_DestroyContext(ic);
+	shared_library = lib;
+    }
+out:
+    UNLOCK_LIBRARY();
+    return lib;
+}
+
+MochaBoolean
+MOCHA_SetSharedGlobalObject(MochaContext *mc, MochaObject *obj)
+{
+    MochaTemplate *lib;
+    MochaScope *scope;
+    MochaProperty *prop;
+
+    if (obj->parent) {
+	MOCHA_ReportError(mc, "illegal global object %s", obj->clazz->name);
+	return MOCHA_FALSE;
+    }
+    lib = GetSharedLibrary(mc);
+    if (!lib)
+	return MOCHA_FALSE;
+
+    /* Forget what scripts set in the old global's shared objects. */
+    mocha_DestroyOverlays(mc);
+    mc->globalObject = obj;	/* XXX weak link */
+
+    /* Give obj the library's globals, and Object.prototype if it needs it. */
+    if (!mocha_GetMutableScope(mc, obj))
+	return MOCHA_FALSE;
+    scope = obj->scope;
+    for (prop = lib->global->scope->props; prop; prop = prop->next) {
+	if (!mocha_SetProperty(mc, scope, sym_atom(prop->lastsym),
+			       scope->minslot - 1, prop->datum)) {
+	    return MOCHA_FALSE;
+	}
+    }
+    if (!obj->prototype)
+	obj->prototype = MOCHA_HoldObject(mc, lib->global->prototype);
+    return MOCHA_TRUE;
+}
+
+void
+MOCHA_DestroySharedLibrary(void)
+{
+    MochaTemplate *lib;
+    MochaContext *tc;
+    MochaObject *obj;
+    MochaScope *scope;
+    uint32 i;
+
+    LOCK_LIBRARY();
+    lib = shared_library;
+    shared_library = 0;
+    UNLOCK_LIBRARY();
+    if (!lib)
+	return;
+
+    /*
+    ** Like mocha_FreeObject, but for the whole graph at once: mark every
+    ** object as finalizing so the scopes' drops leave them alone, free the
+    ** scopes, then finalize and free the objects.
+    */
+    tc = lib->context;
+    for (i = 0; i < lib->objects.length; i++)
+	((MochaObject *)lib->objects.vector[i].copy)->nrefs = MOCHA_FINALIZING;
+    for (i = 0; i < lib->scopes.length; i++) {
+	scope = lib->scopes.vector[i].copy;
+	scope->nrefs = 1;
+	mocha_DropScope(tc, scope);
+    }
+    for (i = 0; i < lib->objects.length; i++) {
+	obj = lib->objects.vector[i].copy;
+	obj->scope = 0;
+	OBJ_FINALIZE(tc, obj);
+	MOCHA_free(tc, obj);
+    }
+    MOCHA_free(tc, lib->objects.vector);
+    MOCHA_free(tc, lib->scopes.vector);
+    tc->globalObject = 0;
+    MOCHA_free(tc, lib);
+    MOCHA_DestroyContext(tc);
+}
@@ -11,40 +11,78 @@
 #include "prlog.h"
 #include "prmem.h"
 #include "prprf.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
 #include "mo_atom.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
+#include "mo_eval.h"
 #include "mo_scan.h"
 #include "mo_scope.h"
 #include "mocha.h"
 
 static PRCList mocha_context_list = PR_INIT_STATIC_CLIST(&mocha_context_list);
 
+/*
+** Taint callbacks given to every new context.
+*/
+static MochaTaintCounter mocha_HoldTaint;
+static MochaTaintCounter mocha_DropTaint;
+static MochaTaintMixer   mocha_MixTaint;
+
+/*
+** The runtime lock protects the context list and the taint callbacks above,
+** and serializes making and freeing the atom table, which happen when the
+** first context is created and the last destroyed.  Contexts don't take it
+** while running.
+*/
+#ifdef MOCHA_THREADSAFE
+static PRSyncLock mocha_runtime_lock = PR_SYNC_LOCK_INITIALIZER;
+#define LOCK_RUNTIME()          PR_SyncLock(&mocha_runtime_lock)
+#define UNLOCK_RUNTIME()        PR_SyncUnlock(&mocha_runtime_lock)
+#else
+#define LOCK_RUNTIME()          ((void)0)
+#define UNLOCK_RUNTIME()        ((void)0)
+#endif
+
 MochaContext *
 mocha_NewContext(size_t stackSize)
 {
     MochaContext *mc;
+    size_t firstSize;
 
-    mc = malloc(sizeof *mc - sizeof mc->stackBase + stackSize);
+    firstSize = PR_MIN(stackSize, MOCHA_STACK_CHUNK);
+    mc = malloc(sizeof *mc - sizeof mc->stackBase + firstSize);
     if (!mc)
 	return 0;
     memset(mc, 0, sizeof *mc);
 
+    LOCK_RUNTIME();
     if (!mocha_InitAtomState(mc)) {
+	UNLOCK_RUNTIME();
 	free(mc);
 	return 0;
     }
     if (!mocha_InitScanner(mc)) {
+#ifdef MOCHA_THREADSAFE
+	mocha_FlushAtomCache(mc);
+#endif
 	mocha_FreeAtomState(mc);
+	UNLOCK_RUNTIME();
 	free(mc);
 	return 0;
     }
-
+    mc->holdTaint = mocha_HoldTaint;
+    mc->dropTaint = mocha_DropTaint;
+    mc->mixTaint = mocha_MixTaint;
     PR_APPEND_LINK(&mc->links, &mocha_context_list);
+    UNLOCK_RUNTIME();
+
     PR_InitArenaPool(&mc->codePool, "code", 1024, sizeof(double));
     PR_InitArenaPool(&mc->tempPool, "temp", 1024, sizeof(double));
     mocha_InitTaintInfo(mc);
-    MOCHA_INIT_STACK(&mc->stack, mc->stackBase, stackSize);
+    MOCHA_INIT_STACK(&mc->stack, mc->stackBase, firstSize, stackSize);
     return mc;
 }
 
@@ -54,11 +92,23 @@ mocha_DestroyContext(MochaContext *mc)
 #ifdef JAVA
     mocha_DestroyJavaContext(mc);
 #endif
+    mocha_DestroyEvalCache(mc);
+    mocha_DestroyOverlays(mc);
+#ifdef MOCHA_THREADSAFE
+    mocha_FlushAtomCache(mc);
+#endif
+    LOCK_RUNTIME();
+    PR_REMOVE_LINK(&mc->links);
+    if (PR_CLIST_IS_EMPTY(&mocha_context_list)) {
+	/* Shapes hold atoms, so they must go before the atom table. */
+	mocha_FreeShapeTree(mc);
+    }
     mocha_FreeAtomState(mc);
+    UNLOCK_RUNTIME();
     PR_FinishArenaPool(&mc->codePool);
     PR_FinishArenaPool(&mc->tempPool);
+    mocha_FinishStack(mc);
     PR_FREEIF(mc->lastMessage);
-    PR_REMOVE_LINK(&mc->links);
     free(mc);
 }
 
@@ -75,6 +125,27 @@ mocha_ContextIterator(MochaContext **iterp)
     return mc;
 }
 
+void
+mocha_SetTaintCallbacks(MochaTaintCounter hold, MochaTaintCounter drop,
+			MochaTaintMixer mix)
+{
+    LOCK_RUNTIME();
+    mocha_HoldTaint = hold;
+    mocha_DropTaint = drop;
+    mocha_MixTaint = mix;
+    UNLOCK_RUNTIME();
+}
+
+MochaTraceHook
+mocha_SetTraceHook(MochaContext *mc, MochaTraceHook hook)
+{
+    MochaTraceHook oldHook;
+
+    oldHook = mc->traceHook;
+    mc->traceHook = hook;
+    return oldHook;
+}
+
 void
 mocha_InitTaintInfo(MochaContext *mc)
 {
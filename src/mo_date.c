@@ -103,10 +103,34 @@ date_finalize(MochaContext *mc, MochaObject *obj)
     MOCHA_free(mc, dateObj);
 }
 
+static void date_explode(DateObject* dateObj);
+
+static MochaBoolean
+date_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	   MochaCloner *cl)
+{
+    DateObject *dateObj, *dateCopy;
+
+    (void)cl;
+    dateObj = obj->data;
+    if (!dateObj)
+	return MOCHA_TRUE;
+    dateCopy = MOCHA_malloc(mc, sizeof *dateCopy);
+    if (!dateCopy)
+	return MOCHA_FALSE;
+    *dateCopy = *dateObj;
+
+    /* Explode now, so getters only read the copy if it's to be shared. */
+    date_explode(dateCopy);
+    copy->data = dateCopy;
+    return MOCHA_TRUE;
+}
+
 static MochaClass date_class = {
     "Date",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, date_finalize
+    MOCHA_ResolveStub, MOCHA_ConvertStub, date_finalize,
+    date_clone
 };
 
 static void date_implode(DateObject* dateObj);
@@ -629,8 +653,10 @@ date_setDate(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     date_explode( dateObj );
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
@@ -647,8 +673,10 @@ date_setMinutes(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
 
@@ -666,8 +694,10 @@ date_setHours(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
 
@@ -685,8 +715,10 @@ date_setMonth(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
 
@@ -704,8 +736,10 @@ date_setSeconds(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
 
@@ -726,8 +760,10 @@ date_setTime(MochaContext *mc, MochaObject *obj,
     int64 oneThousand;
     int64 theTimeMS;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
 
@@ -747,8 +783,10 @@ date_setYear(MochaContext *mc, MochaObject *obj,
     DateObject *dateObj;
     MochaFloat fval;
 
-    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &date_class, argv[-1].u.fun) ||
+	!mocha_CheckMutable(mc, obj)) {
 	return MOCHA_FALSE;
+    }
     dateObj = obj->data;
     date_explode( dateObj );
     if (!mocha_DatumToNumber(mc,argv[0],&fval)) return MOCHA_FALSE;
@@ -785,7 +823,7 @@ date_toGMTString(MochaContext *mc, MochaObject *obj,
 
     PR_FormatTimeUSEnglish(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT",
                            &theGmtSplit);
-    atom = mocha_Atomize(mc, buf, ATOM_STRING);
+    atom = mocha_NewStringAtom(mc, buf, strlen(buf), ATOM_STRING);
     if (atom)
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
     else
@@ -808,7 +846,7 @@ date_toLocaleString(MochaContext *mc, MochaObject *obj,
     date_explode( dateObj );
     PR_FormatTime(buf, sizeof buf, "%c", &dateObj->split);
 
-    atom = mocha_Atomize(mc, buf, ATOM_STRING);
+    atom = mocha_NewStringAtom(mc, buf, strlen(buf), ATOM_STRING);
     if (atom)
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
     else
@@ -836,7 +874,7 @@ date_toString(MochaContext *mc, MochaObject *obj,
                   &dateObj->split);
 #endif
 
-    atom = mocha_Atomize(mc, buf, ATOM_STRING);
+    atom = mocha_NewStringAtom(mc, buf, strlen(buf), ATOM_STRING);
     if (atom)
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
     else
@@ -919,7 +957,7 @@ Date(MochaContext *mc, MochaObject *obj,
 	PR_FormatTime(buf, sizeof buf, "%a %b %d %H:%M:%S %Z %Y", &prtm);
 #endif
 
-	atom = mocha_Atomize(mc, buf, ATOM_STRING);
+	atom = mocha_NewStringAtom(mc, buf, strlen(buf), ATOM_STRING);
 	if (atom)
 	    MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
 	else
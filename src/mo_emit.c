@@ -8,6 +8,7 @@
 #include <string.h>
 #include "prarena.h"
 #include "prlog.h"
+#include "mo_atom.h"
 #include "mo_bcode.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
@@ -357,6 +358,43 @@ mocha_FinishTakingSourceNotes(MochaContext *mc, CodeGenerator *cg)
     return final;
 }
 
+MochaBoolean
+mocha_NoteDeclaration(MochaContext *mc, CodeGenerator *cg, MochaAtom *atom,
+		      MochaFunction *fun)
+{
+    CodeDecl *decl;
+
+    if (!cg->declTail)
+	return MOCHA_TRUE;
+    PR_ARENA_ALLOCATE(decl, &mc->tempPool, sizeof *decl);
+    if (!decl) {
+	MOCHA_ReportOutOfMemory(mc);
+	return MOCHA_FALSE;
+    }
+    decl->atom = mocha_HoldAtom(mc, atom);
+    decl->fun = fun;
+    if (fun)
+	MOCHA_HoldObject(mc, &fun->object);
+    decl->next = 0;
+    *cg->declTail = decl;
+    cg->declTail = &decl->next;
+    return MOCHA_TRUE;
+}
+
+void
+mocha_FreeDeclarations(MochaContext *mc, CodeGenerator *cg)
+{
+    CodeDecl *decl;
+
+    for (decl = cg->decls; decl; decl = decl->next) {
+	mocha_DropAtom(mc, decl->atom);
+	if (decl->fun)
+	    MOCHA_DropObject(mc, &decl->fun->object);
+    }
+    cg->decls = 0;
+    cg->declTail = 0;
+}
+
 SourceNote *
 mocha_GetSourceNote(MochaScript *script, MochaCode *pc)
 {
@@ -441,9 +479,67 @@ mocha_NewScript(MochaContext *mc, CodeGenerator *cg, const char *filename,
     script->length = length;
     script->depth = cg->maxStackDepth;
     script->lineno = lineno;
+    if (!mocha_InitPropertyCaches(mc, script)) {
+	mocha_DestroyScript(mc, script);
+	return 0;
+    }
     return script;
 }
 
+MochaScript *
+mocha_CloneScript(MochaContext *mc, MochaScript *script)
+{
+    MochaScript *copy;
+    MochaAtomNumber i, length;
+    MochaAtom *atom;
+    SourceNote *sn;
+    size_t nbytes;
+
+    copy = MOCHA_malloc(mc, sizeof(MochaScript) + script->length);
+    if (!copy)
+	return 0;
+    memset(copy, 0, sizeof(MochaScript));
+    copy->code = (MochaCode *)(copy + 1);
+    memcpy(copy->code, script->code, script->length);
+    copy->length = script->length;
+    copy->depth = script->depth;
+    copy->lineno = script->lineno;
+
+    length = script->atomMap.length;
+    if (length) {
+	copy->atomMap.vector = MOCHA_malloc(mc, length * sizeof(MochaAtom *));
+	if (!copy->atomMap.vector)
+	    goto bad;
+	for (i = 0; i < length; i++) {
+	    atom = mocha_CloneAtom(mc, script->atomMap.vector[i]);
+	    if (!atom)
+		goto bad;
+	    copy->atomMap.vector[copy->atomMap.length++] = atom;
+	}
+    }
+    if (script->filename) {
+	copy->filename = MOCHA_strdup(mc, script->filename);
+	if (!copy->filename)
+	    goto bad;
+    }
+    if (script->notes) {
+	for (sn = script->notes; !SN_IS_TERMINATOR(sn); sn = SN_NEXT(sn))
+	    continue;
+	nbytes = (sn + 1 - (SourceNote *)script->notes) * sizeof(SourceNote);
+	copy->notes = MOCHA_malloc(mc, nbytes);
+	if (!copy->notes)
+	    goto bad;
+	memcpy(copy->notes, script->notes, nbytes);
+    }
+    if (!mocha_InitPropertyCaches(mc, copy))
+	goto bad;
+    return copy;
+
+bad:
+    mocha_DestroyScript(mc, copy);
+    return 0;
+}
+
 void
 mocha_DestroyScript(MochaContext *mc, MochaScript *script)
 {
@@ -452,5 +548,10 @@ mocha_DestroyScript(MochaContext *mc, MochaScript *script)
 	MOCHA_free(mc, script->filename);
     if (script->notes)
 	MOCHA_free(mc, script->notes);
+    if (script->threaded)
+	MOCHA_free(mc, script->threaded);
+    if (script->traced)
+	MOCHA_free(mc, script->traced);
+    mocha_FinishPropertyCaches(mc, script);
     MOCHA_free(mc, script);
 }
@@ -0,0 +1,413 @@
+/*
+** Mocha compile cache for eval and the Function constructor.
+**
+** A context's cache is a list of entries, most recently used first, which
+** is short enough to search linearly by comparing hashes.  An entry holds
+** its key text as an atom: an eval'd source atom itself, or a loose atom
+** made of a function's formal argument names, each followed by a comma,
+** then a right parenthesis and the body, which can't be confused as the
+** names are identifiers.  An entry's script is run in place by eval, and
+** copied for each new function, which owns and destroys its script.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "prarena.h"
+#include "prclist.h"
+#include "prlog.h"
+#include "mo_atom.h"
+#include "mo_cntxt.h"
+#include "mo_emit.h"
+#include "mo_eval.h"
+#include "mo_parse.h"
+#include "mo_scan.h"
+#include "mo_scope.h"
+#include "mocha.h"
+#include "mochalib.h"
+
+typedef enum EvalKind {
+    EVAL_SCRIPT,                        /* source given to eval */
+    EVAL_FUNCTION                       /* body given to Function */
+} EvalKind;
+
+typedef struct EvalVar {
+    MochaAtom           *atom;          /* held name of local variable */
+    MochaSlot           slot;           /* its stack slot */
+} EvalVar;
+
+typedef struct EvalEntry {
+    PRCList             links;          /* in cache->entries or unlinked */
+    EvalKind            kind;           /* what text was compiled as */
+    MochaAtom           *text;          /* held key text */
+    char                *filename;      /* malloc'd filename, or null */
+    unsigned            lineno;         /* line number of text */
+    MochaScript         *script;        /* compiled text */
+    EvalVar             *vars;          /* function body's local variables */
+    unsigned            nvars;          /* length of vars */
+    MochaSlot           freeslot;       /* function scope's free slot */
+    unsigned            running;        /* number of evals running script */
+    MochaBoolean        flushed;        /* free when running drops to 0 */
+} EvalEntry;
+
+struct MochaEvalCache {
+    PRCList             entries;        /* most recently used first */
+    unsigned            count;          /* number of entries in the list */
+};
+
+static void
+FreeEntry(MochaContext *mc, EvalEntry *entry)
+{
+    unsigned i;
+
+    mocha_DropAtom(mc, entry->text);
+    if (entry->filename)
+	free(entry->filename);
+    if (entry->script)
+	mocha_DestroyScript(mc, entry->script);
+    for (i = 0; i < entry->nvars; i++)
+	mocha_DropAtom(mc, entry->vars[i].atom);
+    if (entry->vars)
+	free(entry->vars);
+    free(entry);
+}
+
+/*
+** Return the entry for kind, text, filename and lineno, moving it to the
+** front of mc's cache, or null if there is none.
+*/
+static EvalEntry *
+LookupEntry(MochaContext *mc, EvalKind kind, MochaAtom *text,
+	    const char *filename, unsigned lineno)
+{
+    MochaEvalCache *cache;
+    PRCList *link;
+    EvalEntry *entry;
+
+    cache = mc->evalCache;
+    if (!cache)
+	return 0;
+    for (link = cache->entries.next; link != &cache->entries;
+	 link = link->next) {
+	entry = (EvalEntry *)link;
+	if (entry->text->entry.keyHash != text->entry.keyHash ||
+	    entry->text->length != text->length ||
+	    entry->kind != kind ||
+	    entry->lineno != lineno) {
+	    continue;
+	}
+	if (filename ? !entry->filename || strcmp(entry->filename, filename)
+		     : entry->filename != 0) {
+	    continue;
+	}
+	if (entry->text != text &&
+	    memcmp(atom_name(entry->text), atom_name(text), text->length)) {
+	    continue;
+	}
+	if (link != cache->entries.next) {
+	    PR_REMOVE_LINK(link);
+	    PR_INSERT_LINK(link, &cache->entries);
+	}
+	return entry;
+    }
+    return 0;
+}
+
+/*
+** Return a new entry for kind, text, filename and lineno at the front of
+** mc's cache, evicting the least recently used entry that isn't running if
+** the cache is full.  Return null if the cache is full of running entries
+** or out of memory, which is not reported, as the caller can do without.
+*/
+static EvalEntry *
+NewEntry(MochaContext *mc, EvalKind kind, MochaAtom *text,
+	 const char *filename, unsigned lineno)
+{
+    MochaEvalCache *cache;
+    PRCList *link;
+    EvalEntry *entry;
+
+    cache = mc->evalCache;
+    if (!cache) {
+	cache = malloc(sizeof *cache);
+	if (!cache)
+	    return 0;
+	PR_INIT_CLIST(&cache->entries);
+	cache->count = 0;
+	mc->evalCache = cache;
+    }
+    if (cache->count == MOCHA_EVAL_CACHE_SIZE) {
+	for (link = cache->entries.prev; link != &cache->entries;
+	     link = link->prev) {
+	    entry = (EvalEntry *)link;
+	    if (entry->running == 0)
+		break;
+	}
+	if (link == &cache->entries)
+	    return 0;
+	PR_REMOVE_LINK(link);
+	cache->count--;
+	FreeEntry(mc, (EvalEntry *)link);
+    }
+
+    entry = calloc(1, sizeof *entry);
+    if (!entry)
+	return 0;
+    if (filename) {
+	entry->filename = strdup(filename);
+	if (!entry->filename) {
+	    free(entry);
+	    return 0;
+	}
+    }
+    entry->kind = kind;
+    entry->text = mocha_HoldAtom(mc, text);
+    entry->lineno = lineno;
+    PR_INSERT_LINK(&entry->links, &cache->entries);
+    cache->count++;
+    return entry;
+}
+
+static void
+RemoveEntry(MochaContext *mc, EvalEntry *entry)
+{
+    PR_REMOVE_LINK(&entry->links);
+    mc->evalCache->count--;
+    FreeEntry(mc, entry);
+}
+
+/*
+** Compile the length chars at base in obj as MOCHA_CompileBuffer() does,
+** setting *declaredp to whether the script declared any vars or functions.
+*/
+static MochaScript *
+Compile(MochaContext *mc, MochaObject *obj, const char *base, size_t length,
+	const char *filename, unsigned lineno, MochaBoolean *declaredp)
+{
+    void *tempMark, *codeMark;
+    MochaTokenStream *ts;
+    CodeGenerator cg;
+    MochaScript *script;
+
+    *declaredp = MOCHA_FALSE;
+    tempMark = PR_ARENA_MARK(&mc->tempPool);
+    ts = mocha_NewTokenStream(mc, base, length, filename, lineno);
+    if (!ts)
+	return 0;
+    script = 0;
+    codeMark = PR_ARENA_MARK(&mc->codePool);
+    if (mocha_InitCodeGenerator(mc, &cg, &mc->codePool)) {
+	cg.declTail = &cg.decls;
+	if (mocha_Parse(mc, obj, ts, &cg))
+	    script = mocha_NewScript(mc, &cg, ts->filename, lineno);
+	*declaredp = (cg.decls != 0);
+	mocha_FreeDeclarations(mc, &cg);
+    }
+    if (!mocha_CloseTokenStream(ts) && script) {
+	mocha_DestroyScript(mc, script);
+	script = 0;
+    }
+    PR_ARENA_RELEASE(&mc->codePool, codeMark);
+    PR_ARENA_RELEASE(&mc->tempPool, tempMark);
+    return script;
+}
+
+MochaBoolean
+mocha_EvaluateCached(MochaContext *mc, MochaObject *obj, MochaAtom *source,
+		     const char *filename, unsigned lineno, MochaDatum *rval)
+{
+    const char *base;
+    EvalEntry *entry;
+    MochaScript *script;
+    MochaBoolean declared, ok;
+
+    base = atom_name(source);
+    if (*base == '\0' && source->length != 0) {
+	MOCHA_ReportOutOfMemory(mc);
+	return MOCHA_FALSE;
+    }
+    if (source->length > MOCHA_EVAL_CACHE_MAXLEN) {
+	return MOCHA_EvaluateBuffer(mc, obj, base, source->length,
+				    filename, lineno, rval);
+    }
+
+    entry = LookupEntry(mc, EVAL_SCRIPT, source, filename, lineno);
+    if (!entry) {
+	script = Compile(mc, obj, base, source->length, filename, lineno,
+			 &declared);
+	if (!script)
+	    return MOCHA_FALSE;
+	entry = declared ? 0
+			 : NewEntry(mc, EVAL_SCRIPT, source, filename, lineno);
+	if (!entry) {
+	    ok = MOCHA_ExecuteScript(mc, obj, script, rval);
+	    mocha_DestroyScript(mc, script);
+	    return ok;
+	}
+	entry->script = script;
+    }
+
+    entry->running++;
+    ok = MOCHA_ExecuteScript(mc, obj, entry->script, rval);
+    if (--entry->running == 0 && entry->flushed)
+	FreeEntry(mc, entry);
+    return ok;
+}
+
+/*
+** Make the loose atom keying a function with formal arguments args and
+** body.
+*/
+static MochaAtom *
+FunctionKey(MochaContext *mc, MochaSymbol *args, MochaAtom *body)
+{
+    MochaSymbol *arg;
+    size_t length;
+    char *text, *cp;
+    MochaAtom *atom;
+
+    length = 1 + body->length;
+    for (arg = args; arg; arg = arg->next)
+	length += sym_atom(arg)->length + 1;
+    text = MOCHA_malloc(mc, length);
+    if (!text)
+	return 0;
+    cp = text;
+    for (arg = args; arg; arg = arg->next) {
+	memcpy(cp, atom_name(sym_atom(arg)), sym_atom(arg)->length);
+	cp += sym_atom(arg)->length;
+	*cp++ = ',';
+    }
+    *cp++ = ')';
+    memcpy(cp, atom_name(body), body->length);
+    atom = mocha_NewStringAtom(mc, text, length, ATOM_STRING | ATOM_HELD);
+    MOCHA_free(mc, text);
+    return atom;
+}
+
+/*
+** Save fun's script and local variables in a new entry for key, unless its
+** scope has become a hash table, whose symbols aren't kept in order.
+*/
+static void
+SaveFunction(MochaContext *mc, MochaFunction *fun, MochaAtom *key,
+	     const char *filename, unsigned lineno)
+{
+    MochaScope *scope;
+    unsigned i, n;
+    MochaSymbol *sym;
+    EvalEntry *entry;
+
+    scope = fun->object.scope;
+    if (scope->table)
+	return;
+    n = 0;
+    for (i = 0; i < scope->shape->nsyms; i++) {
+	if (scope->symv[i]->type == SYM_VARIABLE)
+	    n++;
+    }
+
+    entry = NewEntry(mc, EVAL_FUNCTION, key, filename, lineno);
+    if (!entry)
+	return;
+    entry->freeslot = scope->freeslot;
+    if (n) {
+	entry->vars = malloc(n * sizeof *entry->vars);
+	if (!entry->vars)
+	    goto bad;
+	for (i = 0; i < scope->shape->nsyms; i++) {
+	    sym = scope->symv[i];
+	    if (sym->type != SYM_VARIABLE)
+		continue;
+	    entry->vars[entry->nvars].atom = mocha_HoldAtom(mc, sym_atom(sym));
+	    entry->vars[entry->nvars].slot = sym->slot;
+	    entry->nvars++;
+	}
+    }
+    entry->script = mocha_CloneScript(mc, fun->script);
+    if (!entry->script)
+	goto bad;
+    return;
+
+bad:
+    RemoveEntry(mc, entry);
+}
+
+MochaBoolean
+mocha_CompileFunctionCached(MochaContext *mc, MochaFunction *fun,
+			    MochaSymbol *args, MochaAtom *body,
+			    const char *filename, unsigned lineno)
+{
+    MochaAtom *key;
+    EvalEntry *entry;
+    MochaScope *scope;
+    MochaSymbol *var;
+    unsigned i;
+    MochaTokenStream *ts;
+    MochaBoolean ok;
+
+    key = 0;
+    if (body->length <= MOCHA_EVAL_CACHE_MAXLEN) {
+	key = FunctionKey(mc, args, body);
+	if (!key)
+	    return MOCHA_FALSE;
+	entry = LookupEntry(mc, EVAL_FUNCTION, key, filename, lineno);
+	if (entry) {
+	    mocha_DropAtom(mc, key);
+	    scope = fun->object.scope;
+	    for (i = 0; i < entry->nvars; i++) {
+		var = mocha_DefineSymbol(mc, scope, entry->vars[i].atom,
+					 SYM_VARIABLE, 0);
+		if (!var)
+		    return MOCHA_FALSE;
+		var->slot = entry->vars[i].slot;
+	    }
+	    scope->freeslot = entry->freeslot;
+	    fun->script = mocha_CloneScript(mc, entry->script);
+	    return fun->script != 0;
+	}
+    }
+
+    ts = mocha_NewTokenStream(mc, atom_name(body), body->length,
+			      filename, lineno);
+    if (ts) {
+	ok = mocha_ParseFunctionBody(mc, ts, fun);
+	(void) mocha_CloseTokenStream(ts);
+    } else {
+	ok = MOCHA_FALSE;
+    }
+    if (key) {
+	if (ok)
+	    SaveFunction(mc, fun, key, filename, lineno);
+	mocha_DropAtom(mc, key);
+    }
+    return ok;
+}
+
+void
+mocha_FlushEvalCache(MochaContext *mc)
+{
+    MochaEvalCache *cache;
+    EvalEntry *entry;
+
+    cache = mc->evalCache;
+    if (!cache)
+	return;
+    while (!PR_CLIST_IS_EMPTY(&cache->entries)) {
+	entry = (EvalEntry *)cache->entries.next;
+	PR_REMOVE_AND_INIT_LINK(&entry->links);
+	if (entry->running)
+	    entry->flushed = MOCHA_TRUE;
+	else
+	    FreeEntry(mc, entry);
+    }
+    cache->count = 0;
+}
+
+void
+mocha_DestroyEvalCache(MochaContext *mc)
+{
+    mocha_FlushEvalCache(mc);
+    if (mc->evalCache) {
+	free(mc->evalCache);
+	mc->evalCache = 0;
+    }
+}
@@ -0,0 +1,355 @@
+/*
+** Mocha batch script executor.
+**
+** Every worker has a queue of jobs, guarded by its own lock so submitters
+** and thieves contend only per worker.  MOCHA_SubmitJob deals jobs to the
+** workers round-robin.  A worker runs jobs from the head of its own queue;
+** when that is empty it steals from the heads of the others, so a worker
+** stuck on a long job doesn't hold up the rest of its queue.  The executor
+** lock guards the done list, the job counts, and the wait conditions.
+*/
+#ifdef MOCHA_THREADSAFE
+#include <stdlib.h>
+#include <string.h>
+#include "prlog.h"
+#include "prmem.h"
+#include "prprf.h"
+#include "prsync.h"
+#include "mo_atom.h"
+#include "mo_cntxt.h"
+#include "mo_exec.h"
+#include "mocha.h"
+#include "mo_scope.h"
+#include "mochalib.h"
+
+typedef struct MochaWorker {
+    MochaExecutor       *executor;      /* executor owning this worker */
+    PRSyncThread        thread;         /* thread running WorkerMain */
+    PRSyncLock          lock;           /* guards head and tail */
+    MochaJob            *head;          /* first queued job, or null */
+    MochaJob            *tail;          /* last queued job if head */
+    MochaContext        *context;       /* context reused by every job */
+    MochaObject         *global;        /* global with standard library */
+    unsigned            index;          /* index in executor->workers */
+} MochaWorker;
+
+struct MochaExecutor {
+    PRSyncLock          lock;           /* guards members through queued */
+    PRSyncCond          workCond;       /* notified when work is queued */
+    PRSyncCond          doneCond;       /* notified when a job is done */
+    unsigned            nidle;          /* number of workers waiting */
+    unsigned            outstanding;    /* jobs not returned by NextDone */
+    MochaJob            *doneHead;      /* first done job, or null */
+    MochaJob            *doneTail;      /* last done job if doneHead */
+    MochaBoolean        stopping;       /* true if workers should exit */
+    unsigned            queued;         /* number of jobs in worker queues */
+    int32               nextWorker;     /* round-robin, updated atomically */
+    unsigned            nworkers;       /* length of workers */
+    unsigned            nthreads;       /* number of threads started */
+    MochaWorker         workers[1];     /* nworkers workers */
+};
+
+static MochaClass exec_global_class = {
+    "global",
+    MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
+    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub,
+    0
+};
+
+/*
+** Keep a job's last error, prefixed by where it happened, in lastMessage,
+** for RunJob to hand to the job's submitter.
+*/
+static void
+ReportJobError(MochaContext *mc, const char *message, MochaErrorReport *report)
+{
+    char *last;
+
+    if (report && report->filename) {
+	last = PR_smprintf("%s, line %u: %s",
+			   report->filename, report->lineno, message);
+    } else {
+	last = strdup(message);
+    }
+    PR_FREEIF(mc->lastMessage);
+    mc->lastMessage = last;
+}
+
+/*
+** Remove and return the job at the head of w's queue, or null.
+*/
+static MochaJob *
+TakeJob(MochaWorker *w)
+{
+    MochaJob *job;
+
+    PR_SyncLock(&w->lock);
+    job = w->head;
+    if (job) {
+	w->head = job->next;
+	job->next = 0;
+    }
+    PR_SyncUnlock(&w->lock);
+    return job;
+}
+
+/*
+** Return a job from w's own queue, or else one stolen from another worker,
+** or null if every queue is empty.
+*/
+static MochaJob *
+FindJob(MochaWorker *w)
+{
+    MochaExecutor *ex;
+    MochaJob *job;
+    unsigned i, n;
+
+    ex = w->executor;
+    n = ex->nworkers;
+    for (i = 0; i < n; i++) {
+	job = TakeJob(&ex->workers[(w->index + i) % n]);
+	if (job) {
+	    PR_SyncLock(&ex->lock);
+	    ex->queued--;
+	    PR_SyncUnlock(&ex->lock);
+	    return job;
+	}
+    }
+    return 0;
+}
+
+/*
+** Run job in w's context, with a new global object that inherits from w's
+** global, and store its result or error message in job.
+*/
+static void
+RunJob(MochaWorker *w, MochaJob *job)
+{
+    MochaContext *mc;
+    MochaObject *glob;
+    MochaDatum result;
+    MochaAtom *atom;
+
+    mc = w->context;
+    job->ok = MOCHA_FALSE;
+    job->tag = MOCHA_UNDEF;
+    job->result = job->error = 0;
+    job->resultLength = 0;
+    PR_FREEIF(mc->lastMessage);
+    mc->lastMessage = 0;
+
+    glob = MOCHA_NewObject(mc, &exec_global_class, 0, w->global, 0, 0, 0);
+    if (!glob)
+	goto out;
+    MOCHA_HoldObject(mc, glob);
+
+    /*
+    ** Give glob its own scope now, as the compiler defines top-level vars
+    ** and functions in the scope it finds, which glob shares with w->global
+    ** until something is set in it.
+    */
+    if (!mocha_GetMutableScope(mc, glob))
+	goto drop;
+    mc->globalObject = glob;
+    if ((!job->init || (*job->init)(mc, glob, job->data)) &&
+	MOCHA_EvaluateBuffer(mc, glob, job->source, job->length,
+			     job->filename, 1, &result)) {
+	job->tag = result.tag;
+	if (MOCHA_DatumToString(mc, result, &atom)) {
+	    job->result = malloc(atom->length + 1);
+	    if (job->result) {
+		memcpy(job->result, atom_name(atom), atom->length);
+		job->result[atom->length] = '\0';
+		job->resultLength = atom->length;
+		job->ok = MOCHA_TRUE;
+	    }
+	    mocha_DropAtom(mc, atom);
+	}
+	mocha_DropRef(mc, &result);
+    }
+    mc->globalObject = w->global;
+drop:
+    MOCHA_DropObject(mc, glob);
+    mocha_DestroyOverlays(mc);
+
+out:
+    if (!job->ok) {
+	job->error = mc->lastMessage;
+	mc->lastMessage = 0;
+    }
+}
+
+static PR_SYNC_THREAD_MAIN(WorkerMain, arg)
+{
+    MochaWorker *w = arg;
+    MochaExecutor *ex = w->executor;
+    MochaJob *job;
+
+    for (;;) {
+	job = FindJob(w);
+	if (!job) {
+	    PR_SyncLock(&ex->lock);
+	    while (ex->queued == 0 && !ex->stopping) {
+		ex->nidle++;
+		PR_WaitSyncCond(&ex->workCond, &ex->lock);
+		ex->nidle--;
+	    }
+	    if (ex->queued == 0) {
+		PR_SyncUnlock(&ex->lock);
+		break;
+	    }
+	    PR_SyncUnlock(&ex->lock);
+	    continue;
+	}
+
+	RunJob(w, job);
+
+	PR_SyncLock(&ex->lock);
+	if (ex->doneHead)
+	    ex->doneTail->next = job;
+	else
+	    ex->doneHead = job;
+	ex->doneTail = job;
+	PR_NotifySyncCond(&ex->doneCond);
+	PR_SyncUnlock(&ex->lock);
+    }
+    PR_SYNC_THREAD_RETURN;
+}
+
+/*
+** Stop and join ex's threads, then free its workers' contexts and ex.
+*/
+static void
+FreeExecutor(MochaExecutor *ex)
+{
+    MochaWorker *w;
+    unsigned i;
+
+    PR_SyncLock(&ex->lock);
+    ex->stopping = MOCHA_TRUE;
+    PR_NotifyAllSyncCond(&ex->workCond);
+    PR_SyncUnlock(&ex->lock);
+    for (i = 0; i < ex->nthreads; i++)
+	PR_JoinSyncThread(ex->workers[i].thread);
+
+    for (i = 0; i < ex->nworkers; i++) {
+	w = &ex->workers[i];
+	if (w->context) {
+	    if (w->global)
+		MOCHA_DropObject(w->context, w->global);
+	    MOCHA_DestroyContext(w->context);
+	}
+	PR_DestroySyncLock(&w->lock);
+    }
+    PR_DestroySyncCond(&ex->doneCond);
+    PR_DestroySyncCond(&ex->workCond);
+    PR_DestroySyncLock(&ex->lock);
+    free(ex);
+}
+
+MochaExecutor *
+MOCHA_NewExecutor(unsigned nthreads, size_t stackSize)
+{
+    MochaExecutor *ex;
+    MochaWorker *w;
+    MochaContext *mc;
+    unsigned i;
+
+    if (nthreads == 0)
+	return 0;
+    ex = calloc(1, sizeof *ex + (nthreads - 1) * sizeof(MochaWorker));
+    if (!ex)
+	return 0;
+    PR_InitSyncLock(&ex->lock);
+    PR_InitSyncCond(&ex->workCond);
+    PR_InitSyncCond(&ex->doneCond);
+    ex->nworkers = nthreads;
+    for (i = 0; i < nthreads; i++) {
+	w = &ex->workers[i];
+	w->executor = ex;
+	w->index = i;
+	PR_InitSyncLock(&w->lock);
+    }
+
+    /*
+    ** Make every worker's context and global here, so the standard library
+    ** is set up before any job is submitted.
+    */
+    for (i = 0; i < nthreads; i++) {
+	w = &ex->workers[i];
+	mc = MOCHA_NewContext(stackSize);
+	if (!mc)
+	    goto bad;
+	w->context = mc;
+	MOCHA_SetErrorReporter(mc, ReportJobError);
+	w->global = MOCHA_NewObject(mc, &exec_global_class, 0, 0, 0, 0, 0);
+	if (!w->global)
+	    goto bad;
+	MOCHA_HoldObject(mc, w->global);
+	if (!MOCHA_SetSharedGlobalObject(mc, w->global))
+	    goto bad;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+	w = &ex->workers[i];
+	if (PR_CreateSyncThread(&w->thread, WorkerMain, w) != 0)
+	    goto bad;
+	ex->nthreads++;
+    }
+    return ex;
+
+bad:
+    FreeExecutor(ex);
+    return 0;
+}
+
+void
+MOCHA_SubmitJob(MochaExecutor *ex, MochaJob *job)
+{
+    MochaWorker *w;
+
+    job->next = 0;
+    w = &ex->workers[(uint32)PR_ATOMIC_INCREMENT(&ex->nextWorker) %
+		     ex->nworkers];
+    PR_SyncLock(&w->lock);
+    if (w->head)
+	w->tail->next = job;
+    else
+	w->head = job;
+    w->tail = job;
+    PR_SyncUnlock(&w->lock);
+
+    PR_SyncLock(&ex->lock);
+    ex->queued++;
+    ex->outstanding++;
+    if (ex->nidle)
+	PR_NotifySyncCond(&ex->workCond);
+    PR_SyncUnlock(&ex->lock);
+}
+
+MochaJob *
+MOCHA_NextDoneJob(MochaExecutor *ex, MochaBoolean wait)
+{
+    MochaJob *job;
+
+    PR_SyncLock(&ex->lock);
+    while (!ex->doneHead && ex->outstanding && wait)
+	PR_WaitSyncCond(&ex->doneCond, &ex->lock);
+    job = ex->doneHead;
+    if (job) {
+	ex->doneHead = job->next;
+	job->next = 0;
+	PR_ASSERT(ex->outstanding > 0);
+	ex->outstanding--;
+    }
+    PR_SyncUnlock(&ex->lock);
+    return job;
+}
+
+void
+MOCHA_DestroyExecutor(MochaExecutor *ex)
+{
+    FreeExecutor(ex);
+}
+
+#endif /* MOCHA_THREADSAFE */
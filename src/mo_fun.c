@@ -9,6 +9,7 @@
 #include "mo_bcode.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
+#include "mo_eval.h"
 #include "mo_parse.h"
 #include "mo_scan.h"
 #include "mo_scope.h"
@@ -22,17 +23,23 @@ function_to_atom(MochaContext *mc, MochaFunction *fun)
     MochaPrinter *mp;
     MochaBoolean ok;
     char *str;
+    MochaAtom *atom;
 
     mp = mocha_NewPrinter(mc, atom_name(fun->atom), 0);
     if (!mp)
 	return 0;
+    str = 0;
     ok = mocha_DecompileFunction(fun, mp);
     if (ok)
 	ok = mocha_GetPrinterOutput(mp, &str);
     mocha_DestroyPrinter(mp);
     if (!ok)
 	return 0;
-    return mocha_Atomize(mc, str, ATOM_STRING);
+    if (!str)
+	return mocha_NewStringAtom(mc, "", 0, ATOM_STRING);
+    atom = mocha_NewStringAtom(mc, str, strlen(str), ATOM_STRING);
+    MOCHA_free(mc, str);
+    return atom;
 }
 
 MochaBoolean
@@ -162,20 +169,70 @@ fun_finalize(MochaContext *mc, MochaObject *obj)
     MochaFunction *fun;
 
     fun = (MochaFunction *)obj;
-    mocha_DropAtom(mc, fun->atom);
+    if (fun->atom)
+	mocha_DropAtom(mc, fun->atom);
     if (fun->bound)
 	MOCHA_DropObject(mc, fun->object.parent);
     if (fun->script)
 	mocha_DestroyScript(mc, fun->script);
+    if (fun->source)
+	MOCHA_free(mc, fun->source);
 }
 
-static MochaClass function_class = {
+static MochaBoolean
+fun_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	  MochaCloner *cl)
+{
+    MochaFunction *fun, *funcopy;
+    MochaFunctionSource *source;
+    MochaDatum d, dcopy;
+
+    fun = (MochaFunction *)obj;
+    funcopy = (MochaFunction *)copy;
+    funcopy->call = fun->call;
+    funcopy->nargs = fun->nargs;
+    funcopy->spare = fun->spare;
+    funcopy->atom = mocha_CloneAtom(mc, fun->atom);
+    if (!funcopy->atom)
+	return MOCHA_FALSE;
+
+    /* The cloner links the copy's args once it has copied fun's scope. */
+    if (fun->script) {
+	funcopy->script = mocha_CloneScript(mc, fun->script);
+	if (!funcopy->script)
+	    return MOCHA_FALSE;
+    }
+    source = fun->source;
+    if (source) {
+	funcopy->source = mocha_NewFunctionSource(mc, source->text,
+						  source->length,
+						  source->filename,
+						  source->lineno,
+						  source->scanLineno);
+	if (!funcopy->source)
+	    return MOCHA_FALSE;
+    }
+
+    /* A bound method holds its parent, so copy the parent along with it. */
+    if (fun->bound) {
+	MOCHA_INIT_FULL_DATUM(mc, &d, MOCHA_OBJECT, 0, MOCHA_TAINT_IDENTITY,
+			      u.obj, fun->object.parent);
+	if (!MOCHA_CloneDatum(mc, cl, &d, &dcopy))
+	    return MOCHA_FALSE;
+	funcopy->object.parent = dcopy.u.obj;
+	funcopy->bound = MOCHA_TRUE;
+    }
+    return MOCHA_TRUE;
+}
+
+MochaClass mocha_FunctionClass = {
     "Function",
     fun_get_property, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, fun_convert, fun_finalize
+    MOCHA_ResolveStub, fun_convert, fun_finalize,
+    fun_clone
 };
 
-/* This needs function_class, so it has a forward declaration above. */
+/* This needs mocha_FunctionClass, so it has a forward declaration above. */
 static MochaBoolean
 fun_convert(MochaContext *mc, MochaObject *obj, MochaTag tag, MochaDatum *dp)
 {
@@ -195,7 +252,7 @@ fun_to_string(MochaContext *mc, MochaObject *obj,
     MochaFunction *fun;
     MochaAtom *atom;
 
-    if (!MOCHA_InstanceOf(mc, obj, &function_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &mocha_FunctionClass, argv[-1].u.fun))
 	return MOCHA_FALSE;
     fun = (MochaFunction *)obj;
     atom = function_to_atom(mc, fun);
@@ -209,7 +266,7 @@ static MochaBoolean
 fun_value_of(MochaContext *mc, MochaObject *obj,
 	     unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
-    if (!MOCHA_InstanceOf(mc, obj, &function_class, argv[-1].u.fun))
+    if (!MOCHA_InstanceOf(mc, obj, &mocha_FunctionClass, argv[-1].u.fun))
 	return MOCHA_FALSE;
     MOCHA_INIT_DATUM(mc, rval, MOCHA_FUNCTION, u.fun, (MochaFunction *)obj);
     return MOCHA_TRUE;
@@ -230,7 +287,6 @@ Function(MochaContext *mc, MochaObject *obj,
     MochaAtom *atom;
     const char *name, *filename;
     MochaSymbol *arg, *args, **argp;
-    MochaTokenStream *ts;
     MochaBoolean ok;
 
     nargs = argc ? argc - 1 : 0;
@@ -238,11 +294,19 @@ Function(MochaContext *mc, MochaObject *obj,
     if (!fun)
 	return MOCHA_FALSE;
 
+    /* Give fun a scope for its arguments, as FunctionDefinition does. */
+    if (!mocha_GetMutableScope(mc, &fun->object)) {
+	mocha_DestroyFunction(mc, fun);
+	return MOCHA_FALSE;
+    }
+
     args = 0;
     argp = &args;
     for (i = 0; i < nargs; i++) {
-	if (!mocha_DatumToString(mc, argv[i], &atom))
+	if (!mocha_DatumToString(mc, argv[i], &atom) ||
+	    !(atom = mocha_InternAtom(mc, atom))) {
 	    goto fail;
+	}
 	name = atom_name(atom);
 	if (!IsIdentifier(name)) {
 	    MOCHA_ReportError(mc, "illegal formal argument name %s", name);
@@ -271,14 +335,7 @@ Function(MochaContext *mc, MochaObject *obj,
 	filename = 0;
 	lineno = 0;
     }
-    ts = mocha_NewTokenStream(mc, atom_name(atom), atom->length,
-			      filename, lineno);
-    if (ts) {
-	ok = mocha_ParseFunctionBody(mc, ts, fun);
-	(void) mocha_CloseTokenStream(ts);
-    } else {
-	ok = MOCHA_FALSE;
-    }
+    ok = mocha_CompileFunctionCached(mc, fun, args, atom, filename, lineno);
     mocha_DropAtom(mc, atom);
     if (!ok)
 	goto fail;
@@ -295,7 +352,7 @@ fail:
 MochaObject *
 mocha_InitFunctionClass(MochaContext *mc, MochaObject *obj)
 {
-    return MOCHA_InitClass(mc, obj, &function_class, 0, Function, 1,
+    return MOCHA_InitClass(mc, obj, &mocha_FunctionClass, 0, Function, 1,
 			   function_props, function_methods, 0, 0);
 }
 
@@ -318,8 +375,8 @@ mocha_NewFunction(MochaContext *mc, MochaNativeCall call, unsigned nargs,
 	return 0;
 
     /* Initialize base state. */
-    if (!mocha_GetPrototype(mc, &function_class, &prototype) ||
-	!mocha_InitObject(mc, &fun->object, &function_class, 0, prototype,
+    if (!mocha_GetPrototype(mc, &mocha_FunctionClass, &prototype) ||
+	!mocha_InitObject(mc, &fun->object, &mocha_FunctionClass, 0, prototype,
 			  parent)) {
 	MOCHA_free(mc, fun);
 	return 0;
@@ -332,6 +389,7 @@ mocha_NewFunction(MochaContext *mc, MochaNativeCall call, unsigned nargs,
     fun->spare = 0;
     fun->atom = mocha_HoldAtom(mc, atom);
     fun->script = 0;
+    fun->source = 0;
     return fun;
 }
 
@@ -0,0 +1,1438 @@
+/*
+** The Mocha interpreter loop, included twice by mocha.c rather than compiled
+** on its own.  Before each inclusion mocha.c defines INTERPRET as the name of
+** the static function to generate, and INSTRUMENTED as 1 or 0.
+**
+** The instrumented loop saves and restores the taint accumulator around each
+** op, calls mc->traceHook, and under DEBUG traces to mc->tracefp.  The fast
+** loop does none of that: mocha_Interpret runs it only when there is no trace
+** hook, no trace file, and no taint callbacks or taint data, so the saved and
+** restored accumulator would always be MOCHA_TAINT_IDENTITY.  Both loops share
+** the same opcode bodies and set mc->pc for error reporting.
+**
+** INTERPRET runs script's bytecode from start, with mc->staticLink and
+** mc->script already set by mocha_Interpret, which also checks for stack
+** overflow beforehand and restores the stack and context state afterward.
+** MOP_CALL of an interpreted function doesn't recurse: it pushes a frame
+** that records where the caller's script left off, and runs the function's
+** script in the same loop, updating mc->staticLink and mc->script.  Return
+** pops the frame and resumes the caller, unless the frame is entry, the one
+** that was current when mocha_Interpret began, in which case the loop ends.
+** If the loop fails, mocha_Interpret unwinds the frames above entry.
+** A native function called from the fast loop may turn on tracing or taint
+** (e.g., tracing(true) in the DEBUG shell), so after each call the fast loop
+** checks again, and if instrumentation is needed it stores the next op's pc
+** in *resumep and returns so that mocha_Interpret can resume in the other.
+*/
+
+/*
+** Opcode case delimiters and immediate operand accessors, so the same case
+** bodies work with either threaded code or the switch loop.  BEGIN_OP sets
+** mc->pc and, if INSTRUMENTED, saves the taint accumulator and calls any
+** trace hook before the op runs; END_CASE ends the op and goes on to the next
+** one, or to a branch target set by DO_JUMP.
+*/
+#if INSTRUMENTED
+
+#define BEGIN_TRACE()                                                         \
+    taint = mc->taintInfo->accum;                                             \
+    if (mc->traceHook)                                                        \
+	(*mc->traceHook)(mc, script, pc, sp);                                 \
+    TRACE_INPUTS();
+
+#define END_OP()                                                              \
+    mc->taintInfo->accum = taint;                                             \
+    TRACE_OUTPUTS();
+
+#define LOWERED(script)         (&(script)->traced)
+#define CHECK_INSTRUMENTATION() /* nothing */
+
+#else  /* !INSTRUMENTED */
+
+#define BEGIN_TRACE()           /* nothing */
+#define END_OP()                /* nothing */
+#define LOWERED(script)         (&(script)->threaded)
+#define CHECK_INSTRUMENTATION() {                                             \
+    if (NeedsInstrumentation(mc)) {                                           \
+	*resumep = NEXT_PC();                                                 \
+	goto out;                                                             \
+    }                                                                         \
+}
+
+#endif /* !INSTRUMENTED */
+
+#ifdef MOCHA_THREADED_CODE
+
+#define BEGIN_OP()                                                            \
+    mc->pc = pc = ip->pc;                                                     \
+    op = (MochaOp)*pc;                                                        \
+    next = ip + 1;                                                            \
+    BEGIN_TRACE()
+
+#define BEGIN_CASE(OP)          L_##OP: BEGIN_OP()
+#define BEGIN_CASE2(OP1,OP2)    L_##OP1: L_##OP2: BEGIN_OP()
+#define DEFAULT_CASE            L_default: BEGIN_OP()
+#define END_CASE {                                                            \
+    ip = next;                                                                \
+    END_OP()                                                                  \
+    goto *OP_HANDLER(ip);                                                     \
+}
+#define HANDLER(OP)             [OP] = &&L_##OP
+
+/*
+** Threads running the same script may each find it not yet lowered, and
+** lower it; PublishLoweredScript keeps the first one's ops.  Once loaded
+** non-null, *lowered never changes, so it may then be read directly.
+*/
+#ifdef MOCHA_THREADSAFE
+#define LOAD_LOWERED(lowered)   PR_ATOMIC_LOADP(lowered)
+#else
+#define LOAD_LOWERED(lowered)   (*(lowered))
+#endif
+
+#define LOWER_SCRIPT() {                                                      \
+    lowered = LOWERED(script);                                                \
+    ip = LOAD_LOWERED(lowered);                                               \
+    if (!ip) {                                                                \
+	ip = LowerScript(mc, script, handlers, &&L_default, &&L_stop);        \
+	if (!ip) {                                                            \
+	    ok = MOCHA_FALSE;                                                 \
+	    goto out;                                                         \
+	}                                                                     \
+	ip = PublishLoweredScript(mc, lowered, ip);                           \
+    }                                                                         \
+}
+#define ENTER_SCRIPT() {                                                      \
+    LOWER_SCRIPT();                                                           \
+    goto *OP_HANDLER(ip);                                                     \
+}
+#define SAVE_NEXT_OP(fp)        ((fp)->nextop = next - *lowered)
+
+#define DO_JUMP()               (next = ip->u.target)
+#define GET_IMMEDIATE()         (ip->u.immediate)
+#define GET_LITERAL()           (ip->u.atom)
+#define GET_PCACHE()            (ip->u.cache)
+#define NEXT_PC()               (next->pc)
+
+/*
+** Quickening.  A generic add or comparison op that finds operands of a type
+** it has a typed body for rewrites its threaded op's handler to that typed
+** variant, so later runs go straight to the typed op.  A typed op checks its
+** operands after BEGIN_OP, and if they don't fit, it deoptimizes: it puts
+** back the generic handler and continues at ENTRY in the generic op, which
+** may quicken again.  Ops that quicken take no immediate operand, so ip->u
+** counts deoptimizations, and a site that has deoptimized QUICKEN_LIMIT
+** times stays generic.  The bytecode is never rewritten.
+**
+** Threads running the same script may rewrite an op's handler and count
+** while others dispatch through it, so in a thread-safe build these are
+** loaded and stored whole, with relaxed atomics.  Every handler is right for
+** any operands, so any handler a thread loads will do, and a count that
+** loses an increment to a race only lets the op quicken once more.
+*/
+#define QUICKEN_LIMIT           4
+
+#ifdef MOCHA_THREADSAFE
+#define OP_HANDLER(ip)          PR_RELAXED_LOAD(&(ip)->handler)
+#define SET_OP_HANDLER(ip, h)   PR_RELAXED_STORE(&(ip)->handler, h)
+#define DEOPT_COUNT(ip)         PR_RELAXED_LOAD(&(ip)->u.immediate)
+#define SET_DEOPT_COUNT(ip, n)  PR_RELAXED_STORE(&(ip)->u.immediate, n)
+#else
+#define OP_HANDLER(ip)          ((ip)->handler)
+#define SET_OP_HANDLER(ip, h)   ((ip)->handler = (h))
+#define DEOPT_COUNT(ip)         ((ip)->u.immediate)
+#define SET_DEOPT_COUNT(ip, n)  ((ip)->u.immediate = (n))
+#endif
+
+#define QUICKEN(NAME) {                                                       \
+    if (DEOPT_COUNT(ip) < QUICKEN_LIMIT)                                      \
+	SET_OP_HANDLER(ip, &&L_##NAME);                                       \
+}
+#define BEGIN_QUICK_CASE(NAME, GUARD, GENERIC, ENTRY)                         \
+    L_##NAME: BEGIN_OP()                                                      \
+    if (!(GUARD)) {                                                           \
+	SET_DEOPT_COUNT(ip, DEOPT_COUNT(ip) + 1);                             \
+	SET_OP_HANDLER(ip, &&L_##GENERIC);                                    \
+	goto ENTRY;                                                           \
+    }
+#define GENERIC_ENTRY(ENTRY)    ENTRY:
+
+#else  /* !MOCHA_THREADED_CODE */
+
+#define BEGIN_OP()                                                            \
+    NSPR_BEGIN_MACRO                                                          \
+	mc->pc = pc;                                                          \
+	op = (MochaOp)*pc;                                                    \
+	len = mocha_CodeSpec[op].length;                                      \
+	BEGIN_TRACE()                                                         \
+    NSPR_END_MACRO
+
+#define BEGIN_CASE(OP)          case OP:
+#define BEGIN_CASE2(OP1,OP2)    case OP1: case OP2:
+#define DEFAULT_CASE            default:
+#define END_CASE                break;
+
+#define DO_JUMP()               (len = GET_JUMP_OFFSET(pc))
+#define GET_IMMEDIATE()         (pc[1])
+#define GET_LITERAL()           GET_CONST_ATOM(mc, script, pc)
+#define GET_PCACHE()            FindPropertyCache(script, pc)
+#define NEXT_PC()               (pc + len)
+
+#define ENTER_SCRIPT() {                                                      \
+    pc = script->code;                                                        \
+    end = pc + script->length;                                                \
+    continue;                                                                 \
+}
+#define SAVE_NEXT_OP(fp)        /* nothing: fp->pc is enough */
+
+/* The bytecode is never rewritten, so generic ops just goto typed bodies. */
+#define QUICKEN(NAME)           /* nothing */
+#define BEGIN_QUICK_CASE(NAME, GUARD, GENERIC, ENTRY) /* nothing */
+#define GENERIC_ENTRY(ENTRY)    /* nothing */
+
+#endif /* !MOCHA_THREADED_CODE */
+
+static MochaBoolean
+INTERPRET(MochaContext *mc, MochaObject *slink, MochaScript *script,
+	  MochaCode *start, MochaStackFrame *entry, MochaCode **resumep,
+	  MochaDatum *result)
+{
+    MochaCode *pc;
+    MochaBranchCallback onBranch;
+    MochaBoolean ok, bval, valid;
+    MochaStack *sp;
+    MochaStackFrame *fp;
+    uint16 taint;
+    int argc;
+    MochaOp op;
+    MochaDatum *vp, lval, rval, aval, aval2;
+    MochaObject *obj, *obj2, *prototype;
+    MochaObjectStack *top;
+    MochaProperty *prop;
+    MochaInt ival, ival2;
+    MochaFloat fval, fval2;
+    MochaSymbol *sym;
+    MochaAtom *atom, *atom2, *atom3;
+    MochaFunction *fun;
+    MochaSlot slot;
+    MochaPropertyCache *cache;
+#ifdef MOCHA_THREADED_CODE
+    MochaThreadedOp *ip, *next, **lowered;
+    static void *const handlers[MOP_MAX] = {
+	HANDLER(MOP_NOP),       HANDLER(MOP_PUSH),      HANDLER(MOP_POP),
+	HANDLER(MOP_ENTER),     HANDLER(MOP_LEAVE),     HANDLER(MOP_RETURN),
+	HANDLER(MOP_GOTO),      HANDLER(MOP_IFEQ),      HANDLER(MOP_IFNE),
+	HANDLER(MOP_IN),        HANDLER(MOP_DUP),       HANDLER(MOP_ASSIGN),
+	HANDLER(MOP_BITOR),     HANDLER(MOP_BITXOR),    HANDLER(MOP_BITAND),
+	HANDLER(MOP_EQ),        HANDLER(MOP_NE),        HANDLER(MOP_LT),
+	HANDLER(MOP_LE),        HANDLER(MOP_GT),        HANDLER(MOP_GE),
+	HANDLER(MOP_LSH),       HANDLER(MOP_RSH),       HANDLER(MOP_URSH),
+	HANDLER(MOP_ADD),       HANDLER(MOP_SUB),       HANDLER(MOP_MUL),
+	HANDLER(MOP_DIV),       HANDLER(MOP_MOD),       HANDLER(MOP_NOT),
+	HANDLER(MOP_BITNOT),    HANDLER(MOP_NEG),       HANDLER(MOP_NEW),
+	HANDLER(MOP_TYPEOF),    HANDLER(MOP_VOID),      HANDLER(MOP_INC),
+	HANDLER(MOP_DEC),       HANDLER(MOP_MEMBER),    HANDLER(MOP_LMEMBER),
+	HANDLER(MOP_INDEX),     HANDLER(MOP_LINDEX),    HANDLER(MOP_CALL),
+	HANDLER(MOP_NAME),      HANDLER(MOP_NUMBER),    HANDLER(MOP_STRING),
+	HANDLER(MOP_ZERO),      HANDLER(MOP_ONE),       HANDLER(MOP_NULL),
+	HANDLER(MOP_THIS),      HANDLER(MOP_FALSE),     HANDLER(MOP_TRUE),
+	HANDLER(MOP_GETARG),    HANDLER(MOP_SETARG),    HANDLER(MOP_GETVAR),
+	HANDLER(MOP_SETVAR),    HANDLER(MOP_INCARG),    HANDLER(MOP_DECARG),
+	HANDLER(MOP_INCVAR),    HANDLER(MOP_DECVAR),
+#ifdef MOCHA_HAS_DELETE_OPERATOR
+	HANDLER(MOP_DELETE),
+#endif
+    };
+#else
+    MochaCode *end;
+    int len;
+#endif
+
+
+    onBranch = mc->branchCallback;
+    sp = &mc->stack;
+    ok = MOCHA_TRUE;
+#if INSTRUMENTED
+    (void)resumep;
+#else
+    taint = MOCHA_TAINT_IDENTITY;
+#endif
+
+#define CHECK_BRANCH() {                                                      \
+    if (onBranch && !(*onBranch)(mc, script)) {                               \
+	ok = MOCHA_FALSE;                                                     \
+	goto out;                                                             \
+    }                                                                         \
+}
+
+#ifdef MOCHA_THREADED_CODE
+    LOWER_SCRIPT();
+    while (ip->pc < start)
+	ip++;
+    goto *OP_HANDLER(ip);
+
+    {
+#else
+    pc = start;
+    end = script->code + script->length;
+
+  run:
+    while (pc < end) {
+	BEGIN_OP();
+	switch (op) {
+#endif
+	  BEGIN_CASE(MOP_NOP)
+	    END_CASE
+
+	  BEGIN_CASE(MOP_PUSH)
+	    Push(mc, MOCHA_void);	/* no need to taint (yet) */
+	    END_CASE
+
+	  BEGIN_CASE(MOP_POP)
+	    aval = rval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_ResolveValue(mc, &rval);
+
+	    /* Keep the value of entry's script, not of a function it calls. */
+	    if (rval.tag != MOCHA_PROPERTY && rval.tag != MOCHA_ITERATOR &&
+		sp->frame == entry) {
+		PR_ASSERT(rval.tag != MOCHA_OBJECTSTACK);
+		mocha_HoldRef(mc, &rval);
+		mocha_DropRef(mc, result);
+		*result = rval;
+	    }
+	    mocha_DropRef(mc, &aval);
+	    if (!ok)
+		goto out;
+	    END_CASE
+
+	  BEGIN_CASE(MOP_ENTER)
+	    rval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_DatumToObject(mc, rval, &obj);
+	    mocha_DropRef(mc, &rval);
+	    if (!obj) {
+		if (mocha_RawDatumToString(mc, rval, &atom)) {
+		    MOCHA_ReportError(mc,
+				      "%s can't be used in a with statement",
+				      atom_name(atom));
+		    mocha_DropAtom(mc, atom);
+		}
+		ok = MOCHA_FALSE;
+	    }
+	    if (!ok) goto out;
+	    ok = mocha_PushObject(mc, obj, &top);
+	    if (!ok) goto out;
+	    MOCHA_INIT_FULL_DATUM(mc, &rval, MOCHA_OBJECTSTACK,
+				  0, MOCHA_TAINT_IDENTITY,
+				  u.ptr, top);
+	    MOCHA_DropObject(mc, obj);
+	    Push(mc, rval);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_LEAVE)
+	    PR_ASSERT(sp->ptr[-1].tag == MOCHA_OBJECTSTACK);
+	    (void) Pop(mc, MOCHA_TRUE);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_RETURN)
+	    CHECK_BRANCH();
+	    aval = rval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_ResolveValue(mc, &rval);
+	    mocha_HoldRef(mc, &rval);
+	    sp->frame->rval = rval;
+	    mocha_DropRef(mc, &aval);
+	    if (!ok || sp->frame == entry)
+		goto out;
+	    goto leave;
+
+	  BEGIN_CASE(MOP_GOTO)
+	    CHECK_BRANCH();
+	    DO_JUMP();
+	    END_CASE
+
+	  BEGIN_CASE(MOP_IFEQ)
+	    CHECK_BRANCH();
+	    if (!(ok = PopBoolean(mc, &bval)))
+		goto out;
+	    if (bval == MOCHA_FALSE)
+		DO_JUMP();
+	    taint = mc->taintInfo->accum;
+	    END_CASE
+
+	  BEGIN_CASE(MOP_IFNE)
+	    CHECK_BRANCH();
+	    if (!(ok = PopBoolean(mc, &bval)))
+		goto out;
+	    if (bval != MOCHA_FALSE)
+		DO_JUMP();
+	    taint = mc->taintInfo->accum;
+	    END_CASE
+
+	  BEGIN_CASE(MOP_IN)
+	    aval = rval = Pop(mc, MOCHA_FALSE);
+	    lval = Pop(mc, MOCHA_TRUE);
+
+	    /* If the thing to the right of 'in' isn't an object, break. */
+	    ok = mocha_DatumToObject(mc, rval, &obj);
+	    mocha_DropRef(mc, &aval);
+	    if (!ok) goto out;
+	    if (!obj) {
+		PushBoolean(mc, MOCHA_FALSE);
+		END_CASE
+	    }
+
+	    /* Enumerate an Array's elements first, in index order. */
+	    vp = sp->ptr - 1;
+	    if (vp->tag == MOCHA_UNDEF || vp->tag == MOCHA_ITERATOR) {
+		slot = mocha_NextArrayElement(obj, (vp->tag == MOCHA_UNDEF)
+						   ? 0
+						   : vp->u.elem.index);
+		if (slot >= 0) {
+		    if (vp->tag == MOCHA_UNDEF) {
+			vp->tag = MOCHA_ITERATOR;
+			vp->u.elem.obj = MOCHA_HoldObject(mc, obj);
+		    }
+		    vp->u.elem.index = slot + 1;
+		    MOCHA_DropObject(mc, obj);
+		    ok = mocha_NumberToString(mc, (MochaFloat)slot, &atom);
+		    if (!ok) goto out;
+		    goto iterate;
+		}
+
+		/* No more elements: go on to obj's properties. */
+		if (vp->tag == MOCHA_ITERATOR) {
+		    mocha_DropRef(mc, vp);
+		    vp->tag = MOCHA_UNDEF;
+		}
+	    }
+
+	    /* Save obj held by obj2 to suppress clone-parent properties. */
+	    obj2 = MOCHA_HoldObject(mc, obj);
+	  again:
+	    prototype = obj->prototype;
+
+	    /*
+	    ** Don't hold a property reference here, there is no way yet for
+	    ** Mocha users to remove properties (XXX).
+	    */
+	    vp = sp->ptr - 1;
+	    if (vp->tag == MOCHA_UNDEF) {
+		/* Let lazy reflectors be eager so for-in works for them. */
+		ok = OBJ_LIST_PROPERTIES(mc, obj);
+		if (!ok) {
+		    MOCHA_DropObject(mc, obj);
+		    MOCHA_DropObject(mc, obj2);
+		    goto out;
+		}
+
+		/* Set the iterator to point to the first property. */
+		prop = mocha_FirstProperty(mc, obj->scope);
+
+		/* Rewrite the iterator tag so we know to do the next case. */
+		vp->tag = MOCHA_PROPERTY;
+		vp->u.pair.obj = MOCHA_HoldObject(mc, obj);
+	    } else {
+		/* Use the iterator to find the next property. */
+		PR_ASSERT(vp->tag == MOCHA_PROPERTY);
+		prop = (MochaProperty *)vp->u.pair.sym;	/* XXX type me please */
+
+		/* If we're enumerating a prototype, reset obj and prototype. */
+		if (obj != vp->u.pair.obj) {
+		    MOCHA_DropObject(mc, obj);
+		    obj = MOCHA_HoldObject(mc, vp->u.pair.obj);
+		    prototype = obj->prototype;
+		}
+		PR_ASSERT(!prop || prop->lastsym->scope == obj->scope ||
+			  SCOPE_IS_FROZEN(obj->scope));
+	    }
+	    MOCHA_DropObject(mc, obj);
+
+	    /* Skip pre-defined properties for backward compatibility. */
+	    while (prop) {
+		if (prop->datum.flags & MDF_ENUMERATE) {
+		    /* Have we already enumerated a clone of this property? */
+		    atom = sym_atom(prop->lastsym);
+		    mocha_LookupSymbol(mc, obj2->scope, atom, MLF_GET, &sym);
+		    if (sym && sym->entry.value == prop)
+			break;
+		}
+		prop = mocha_NextProperty(mc, obj->scope, prop);
+	    }
+
+	    if (!prop) {
+		/* Enumerate prototype properties, if there are any. */
+		if (prototype) {
+		    obj = MOCHA_HoldObject(mc, prototype);
+		    MOCHA_DropObject(mc, vp->u.pair.obj);
+		    vp->u.pair.obj = MOCHA_HoldObject(mc, obj);
+		    vp->u.pair.sym = (MochaSymbol *)
+			mocha_FirstProperty(mc, obj->scope);
+		    goto again;
+		}
+
+		/* End of property list -- terminate this loop. */
+		PushBoolean(mc, MOCHA_FALSE);
+		MOCHA_DropObject(mc, obj2);
+		END_CASE
+	    }
+	    MOCHA_DropObject(mc, obj2);
+
+	    /* Make a string for the iterator name and assign it to lval. */
+	    atom = mocha_HoldAtom(mc, sym_atom(prop->lastsym));
+	    vp->u.pair.sym = (MochaSymbol *)
+		mocha_NextProperty(mc, vp->u.pair.obj->scope, prop);
+	  iterate:
+	    Push(mc, lval);
+	    PushString(mc, atom);
+	    mocha_DropAtom(mc, atom);
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    ok = Assign(mc, &taint);
+	    if (!ok)
+		goto out;
+
+	    /* Throw away Assign()'s result and push true to keep looping. */
+	    (void) Pop(mc, MOCHA_TRUE);
+	    PushBoolean(mc, MOCHA_TRUE);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_DUP)
+	    PR_ASSERT(sp->ptr > sp->base);
+	    Push(mc, sp->ptr[-1]);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_ASSIGN)
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    ok = Assign(mc, &taint);
+	    if (!ok)
+		goto out;
+	    END_CASE
+
+#define INTEGEROP(OP, EXTRA_CODE, LEFT_CAST, PUSH) {                          \
+    valid = MOCHA_TRUE;                                                       \
+    if (!(ok = PopInt(mc,&ival2,&valid)) || !(ok = PopInt(mc,&ival,&valid)))  \
+	goto out;                                                             \
+    EXTRA_CODE                                                                \
+    if (valid)                                                                \
+	PUSH(mc, LEFT_CAST ival OP ival2);                                    \
+    else                                                                      \
+	PushNumber(mc, MOCHA_NaN.u.fval);                                     \
+}
+
+#define BITWISEOP(OP)		INTEGEROP(OP, (void) 0;, (MochaInt), PushInt)
+#define SIGNEDSHIFT(OP)                                                       \
+    INTEGEROP(OP, ival2 &= 31;, (MochaInt), PushInt)
+#define UNSIGNEDSHIFT(OP)                                                     \
+    INTEGEROP(OP, ival2 &= 31;, (MochaUint), PushUint)
+
+	  BEGIN_CASE(MOP_BITOR)
+	    BITWISEOP(|);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_BITXOR)
+	    BITWISEOP(^);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_BITAND)
+	    BITWISEOP(&);
+	    END_CASE
+
+#ifdef XP_PC
+#define COMPARE_FLOATS(LVAL, OP, RVAL)                                        \
+    ((MOCHA_FLOAT_IS_NaN(LVAL) || MOCHA_FLOAT_IS_NaN(RVAL))                   \
+     ? MOCHA_FALSE                                                            \
+     : (LVAL) OP (RVAL))
+#else
+#define COMPARE_FLOATS(LVAL, OP, RVAL) ((LVAL) OP (RVAL))
+#endif
+
+#define COMPARISON(OP, EXTRA_CODE) {                                          \
+    aval = rval = Pop(mc, MOCHA_FALSE);                                       \
+    aval2 = lval = Pop(mc, MOCHA_FALSE);                                      \
+    ok = mocha_ResolveValue(mc, &lval) && mocha_ResolveValue(mc, &rval);      \
+    if (ok) {                                                                 \
+	atom = 0;                                                             \
+	EXTRA_CODE                                                            \
+	if (ResolveString(mc,lval,&atom) && ResolveString(mc,rval,&atom2)) {  \
+	    bval = mocha_CompareAtoms(atom, atom2) OP 0;                      \
+	    mocha_DropAtom(mc, atom);                                         \
+	    mocha_DropAtom(mc, atom2);                                        \
+	} else {                                                              \
+	    if (atom) mocha_DropAtom(mc, atom);                               \
+	    ok = mocha_DatumToNumber(mc, lval, &fval) &&                      \
+		 mocha_DatumToNumber(mc, rval, &fval2);                       \
+	    if (ok)                                                           \
+		bval = COMPARE_FLOATS(fval, OP, fval2);                       \
+	}                                                                     \
+    }                                                                         \
+    mocha_DropRef(mc, &aval);                                                 \
+    mocha_DropRef(mc, &aval2);                                                \
+    if (!ok)                                                                  \
+	goto out;                                                             \
+    PushBoolean(mc, bval);                                                    \
+}
+
+#define EQUALITYOP(OP) {                                                      \
+    COMPARISON(OP,                                                            \
+	if ((lval.tag == MOCHA_FUNCTION || lval.tag == MOCHA_OBJECT) &&       \
+	    (rval.tag == MOCHA_FUNCTION || rval.tag == MOCHA_OBJECT)) {       \
+	    bval = lval.u.obj OP rval.u.obj;                                  \
+	} else if (MOCHA_DATUM_IS_NULL(lval) || MOCHA_DATUM_IS_NULL(rval)) {  \
+	    obj = obj2 = 0;                                                   \
+	    ok = mocha_DatumToObject(mc, lval, &obj) &&                       \
+		 mocha_DatumToObject(mc, rval, &obj2);                        \
+	    if (ok)                                                           \
+		bval = obj OP obj2;                                           \
+	    if (obj)  MOCHA_DropObject(mc, obj);                              \
+	    if (obj2) MOCHA_DropObject(mc, obj2);                             \
+	} else                                                                \
+    )                                                                         \
+}
+
+#define RELATIONAL(OP)	COMPARISON(OP, (void) 0;)
+
+/*
+** Typed bodies for operands that PeekNumber or PeekString can see through,
+** reached from the generic ops or run as quickened ops; see QUICKEN above.
+*/
+#define PEEK_NUMBERS()                                                        \
+    (PeekNumber(&sp->ptr[-2], &fval) && PeekNumber(&sp->ptr[-1], &fval2))
+#define PEEK_INTS()                                                           \
+    (PeekInt(&sp->ptr[-2], &ival) && PeekInt(&sp->ptr[-1], &ival2))
+#define PEEK_STRINGS()                                                        \
+    (PeekString(&sp->ptr[-2], &atom) && PeekString(&sp->ptr[-1], &atom2))
+
+#define COMPARE_NUMBERS(OP) {                                                 \
+    (void) Pop(mc, MOCHA_TRUE);                                               \
+    (void) Pop(mc, MOCHA_TRUE);                                               \
+    PushBoolean(mc, COMPARE_FLOATS(fval, OP, fval2));                         \
+}
+
+	  BEGIN_CASE(MOP_EQ)
+	  GENERIC_ENTRY(eq_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(EQ_NUM);
+		goto eq_number;
+	    }
+	    EQUALITYOP(==);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(EQ_NUM, PEEK_NUMBERS(), MOP_EQ, eq_generic)
+	  eq_number:
+	    COMPARE_NUMBERS(==);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_NE)
+	  GENERIC_ENTRY(ne_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(NE_NUM);
+		goto ne_number;
+	    }
+	    EQUALITYOP(!=);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(NE_NUM, PEEK_NUMBERS(), MOP_NE, ne_generic)
+	  ne_number:
+	    COMPARE_NUMBERS(!=);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_LT)
+	  GENERIC_ENTRY(lt_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(LT_NUM);
+		goto lt_number;
+	    }
+	    RELATIONAL(<);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(LT_NUM, PEEK_NUMBERS(), MOP_LT, lt_generic)
+	  lt_number:
+	    COMPARE_NUMBERS(<);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_LE)
+	  GENERIC_ENTRY(le_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(LE_NUM);
+		goto le_number;
+	    }
+	    RELATIONAL(<=);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(LE_NUM, PEEK_NUMBERS(), MOP_LE, le_generic)
+	  le_number:
+	    COMPARE_NUMBERS(<=);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_GT)
+	  GENERIC_ENTRY(gt_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(GT_NUM);
+		goto gt_number;
+	    }
+	    RELATIONAL(>);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(GT_NUM, PEEK_NUMBERS(), MOP_GT, gt_generic)
+	  gt_number:
+	    COMPARE_NUMBERS(>);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_GE)
+	  GENERIC_ENTRY(ge_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(GE_NUM);
+		goto ge_number;
+	    }
+	    RELATIONAL(>=);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(GE_NUM, PEEK_NUMBERS(), MOP_GE, ge_generic)
+	  ge_number:
+	    COMPARE_NUMBERS(>=);
+	    END_CASE
+
+#undef COMPARISON
+#undef EQUALITYOP
+#undef RELATIONAL
+#undef COMPARE_NUMBERS
+
+	  BEGIN_CASE(MOP_LSH)
+	    SIGNEDSHIFT(<<);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_RSH)
+	    SIGNEDSHIFT(>>);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_URSH)
+	    UNSIGNEDSHIFT(>>);
+	    END_CASE
+
+#undef INTEGEROP
+#undef BITWISEOP
+#undef SIGNEDSHIFT
+#undef UNSIGNEDSHIFT
+
+	  BEGIN_CASE(MOP_ADD)
+	  GENERIC_ENTRY(add_generic)
+	    if (PEEK_NUMBERS()) {
+		QUICKEN(ADD_NUM);
+		goto add_number;
+	    }
+	    if (PEEK_STRINGS()) {
+		QUICKEN(ADD_STR);
+		goto add_string;
+	    }
+	    rval = Pop(mc, MOCHA_FALSE);
+	    lval = Pop(mc, MOCHA_FALSE);
+	    atom = atom2 = 0;
+	    if (ResolveString(mc,lval,&atom) || ResolveString(mc,rval,&atom2)) {
+		ok = atom ? mocha_DatumToString(mc, rval, &atom2)
+			  : mocha_DatumToString(mc, lval, &atom);
+		if (ok) {
+		    if (atom == MOCHA_empty.u.atom)
+			atom3 = atom2;
+		    else if (atom2 == MOCHA_empty.u.atom)
+			atom3 = atom;
+		    else
+			atom3 = CatStrings(mc, atom, atom2);
+		    if (!atom3)
+			ok = MOCHA_FALSE;
+		}
+		if (ok)
+		    PushString(mc, atom3);
+		if (atom)  mocha_DropAtom(mc, atom);
+		if (atom2) mocha_DropAtom(mc, atom2);
+	    } else {
+		ok = mocha_DatumToNumber(mc, lval, &fval) &&
+		     mocha_DatumToNumber(mc, rval, &fval2);
+		if (ok)
+		    PushNumber(mc, fval + fval2);
+	    }
+	    mocha_DropRef(mc, &lval);
+	    mocha_DropRef(mc, &rval);
+	    if (!ok)
+		goto out;
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(ADD_NUM, PEEK_NUMBERS(), MOP_ADD, add_generic)
+	  add_number:
+	    valid = PEEK_INTS() && AddInts(ival, ival2, &ival);
+	    (void) Pop(mc, MOCHA_TRUE);
+	    (void) Pop(mc, MOCHA_TRUE);
+	    if (valid)
+		PushInt(mc, ival);
+	    else
+		PushNumber(mc, fval + fval2);
+	    END_CASE
+
+	  BEGIN_QUICK_CASE(ADD_STR, PEEK_STRINGS(), MOP_ADD, add_generic)
+	  add_string:
+	    /* The operands hold atom and atom2 until they are popped. */
+	    if (atom == MOCHA_empty.u.atom) {
+		atom3 = atom2;
+	    } else if (atom2 == MOCHA_empty.u.atom) {
+		atom3 = atom;
+	    } else {
+		atom3 = CatStrings(mc, atom, atom2);
+		if (!atom3) {
+		    ok = MOCHA_FALSE;
+		    goto out;
+		}
+	    }
+	    mocha_HoldAtom(mc, atom3);
+	    (void) Pop(mc, MOCHA_TRUE);
+	    (void) Pop(mc, MOCHA_TRUE);
+	    PushString(mc, atom3);
+	    mocha_DropAtom(mc, atom3);
+	    END_CASE
+
+#undef PEEK_NUMBERS
+#undef PEEK_STRINGS
+
+/* Ints whose result fits stay ints; see AddInts in mocha.c. */
+#define BINARYOP(OP, INTOP) {                                                 \
+    if (PEEK_INTS() && INTOP(ival, ival2, &ival)) {                           \
+	(void) Pop(mc, MOCHA_TRUE);                                           \
+	(void) Pop(mc, MOCHA_TRUE);                                           \
+	PushInt(mc, ival);                                                    \
+    } else {                                                                  \
+	if (!(ok = PopNumber(mc, &fval2)) || !(ok = PopNumber(mc, &fval)))    \
+	    goto out;                                                         \
+	PushNumber(mc, fval OP fval2);                                        \
+    }                                                                         \
+}
+
+	  BEGIN_CASE(MOP_SUB)
+	    BINARYOP(-, SubInts);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_MUL)
+	    BINARYOP(*, MulInts);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_DIV, MOP_MOD)
+	    /* A nonnegative int mod a positive one is an int, never -0. */
+	    if (op == MOP_MOD && PEEK_INTS() && ival >= 0 && ival2 > 0) {
+		(void) Pop(mc, MOCHA_TRUE);
+		(void) Pop(mc, MOCHA_TRUE);
+		PushInt(mc, ival % ival2);
+		END_CASE
+	    }
+	    if (!(ok = PopNumber(mc, &fval2)) || !(ok = PopNumber(mc, &fval)))
+		goto out;
+	    if (fval2 == 0)
+		PushNumber(mc, MOCHA_NaN.u.fval);
+	    else if (op == MOP_DIV)
+		PushNumber(mc, fval / fval2);
+	    else
+		PushNumber(mc, fmod(fval, fval2));
+	    END_CASE
+
+#undef PEEK_INTS
+
+	  BEGIN_CASE(MOP_NOT)
+	    if (!(ok = PopBoolean(mc, &bval)))
+		goto out;
+	    PushBoolean(mc, !bval);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_BITNOT)
+	    valid = MOCHA_TRUE;
+	    if (!(ok = PopInt(mc, &ival, &valid)))
+		goto out;
+	    if (!valid)
+		PushNumber(mc, MOCHA_NaN.u.fval);
+	    else
+		PushInt(mc, ~ival);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_NEG)
+	    if (!(ok = PopNumber(mc, &fval)))
+		goto out;
+	    PushNumber(mc, -fval);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_NEW)
+	    CHECK_BRANCH();
+
+	    /* Get argc from immediate and find the constructor function. */
+	    argc = GET_IMMEDIATE();
+	    vp = sp->ptr - (argc + 1);
+	    PR_ASSERT(vp >= sp->base);
+	    ok = mocha_DatumToFunction(mc, *vp, &fun);
+	    if (!ok)
+		goto out;
+
+	    /* Find the constructor name in order to name its new scope. */
+	    lval = *vp;
+	    ok = mocha_ResolveSymbol(mc, &lval, MLF_GET);
+	    if (!ok) {
+		MOCHA_DropObject(mc, &fun->object);
+		goto out;
+	    }
+
+	    /* Get the prototype object for this constructor function. */
+	    ok = mocha_LookupSymbol(mc, fun->object.scope, mocha_prototypeAtom,
+				    MLF_GET, &sym);
+	    if (!ok) {
+		MOCHA_DropObject(mc, &fun->object);
+		goto out;
+	    }
+
+	    if (!sym ||
+		sym->type != SYM_PROPERTY ||
+		(prop = sym_property(sym))->datum.tag != MOCHA_OBJECT ||
+		!(prototype = prop->datum.u.obj)) {
+		prototype = mocha_NewObjectByClass(mc, &mocha_ObjectClass);
+		if (!prototype) {
+		    MOCHA_DropObject(mc, &fun->object);
+		    ok = MOCHA_FALSE;
+		    goto out;
+		}
+		if (!mocha_GetMutableScope(mc, prototype) ||
+		    !mocha_SetPrototype(mc, fun, prototype)) {
+		    MOCHA_DestroyObject(mc, prototype);
+		    MOCHA_DropObject(mc, &fun->object);
+		    ok = MOCHA_FALSE;
+		    goto out;
+		}
+	    }
+
+	    /* Create a new user-allocated object. */
+	    obj = mocha_NewObjectByPrototype(mc, prototype);
+	    if (!obj) {
+                MOCHA_DropObject(mc, &fun->object);
+		ok = MOCHA_FALSE;
+		goto out;
+	    }
+	    obj = MOCHA_HoldObject(mc, obj);
+
+	    /* Find the constructor property in obj's (prototype's) scope. */
+	    ok = mocha_LookupSymbol(mc, obj->scope, mocha_constructorAtom,
+				    MLF_GET, &sym);
+	    if (!ok) {
+		obj->clazz = &mocha_ObjectClass;
+		MOCHA_DropObject(mc, obj);
+                MOCHA_DropObject(mc, &fun->object);
+		goto out;
+	    }
+
+	    /* Mutate the function reference at vp into a symbol ref. */
+	    mocha_DropRef(mc, vp);
+	    vp->tag = MOCHA_SYMBOL;
+	    vp->u.pair.obj = obj;
+	    vp->u.pair.sym = sym;
+	    mocha_HoldRef(mc, vp);
+
+	    /* Now we have an object with a constructor method -- call it. */
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    ok = Call(mc, argc);
+            MOCHA_DropObject(mc, &fun->object);
+	    if (!ok) {
+		obj->clazz = &mocha_ObjectClass;
+		MOCHA_DropObject(mc, obj);
+		goto out;
+	    }
+
+	    /* Don't reset taint accumulator on return from function. */
+	    taint = mc->taintInfo->accum;
+
+	    /* Pop the return value, taking care not to drop prematurely. */
+	    rval = Pop(mc, MOCHA_FALSE);
+	    if (rval.tag == MOCHA_OBJECT && rval.u.obj != obj) {
+		obj->clazz = &mocha_ObjectClass;
+		MOCHA_DropObject(mc, obj);
+		obj = MOCHA_HoldObject(mc, rval.u.obj);
+	    }
+	    mocha_DropRef(mc, &rval);
+
+	    /* Then push the newly constructed object. */
+	    PushObject(mc, obj);
+
+	    /* Finally, drop obj -- it may have been the return value(!). */
+	    MOCHA_DropObject(mc, obj);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_TYPEOF)
+	    lval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_TypeOfDatum(mc, lval, &atom);
+	    mocha_DropRef(mc, &lval);
+	    if (!ok) goto out;
+	    PushString(mc, atom ? atom : MOCHA_empty.u.atom);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_VOID)
+	    (void) Pop(mc, MOCHA_TRUE);
+	    Push(mc, MOCHA_void);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_INC, MOP_DEC)
+	    /*
+	    ** The operand must contain a number, which stays an int if it is
+	    ** one and the result fits.
+	    */
+	    valid = PeekInt(&sp->ptr[-1], &ival) &&
+		    AddInts(ival, (op == MOP_INC) ? 1 : -1, &ival2);
+	    aval = lval = Pop(mc, MOCHA_FALSE);
+	    if (valid) {
+		PushInt(mc, GET_IMMEDIATE() ? ival : ival2);
+	    } else {
+		ok = mocha_DatumToNumber(mc, lval, &fval);
+		if (!ok) {
+		    mocha_DropRef(mc, &aval);
+		    goto out;
+		}
+
+		/* Push the post- or pre-incremented value. */
+		if (op == MOP_INC)
+		    PushNumber(mc, GET_IMMEDIATE() ? fval++ : ++fval);
+		else
+		    PushNumber(mc, GET_IMMEDIATE() ? fval-- : --fval);
+	    }
+
+	    /* XXX Need two stack slots to call Assign(). */
+	    ok = (sp->ptr + 2 < sp->limit);
+	    if (!ok) {
+		ReportStackOverflow(mc);
+		mocha_DropRef(mc, &aval);
+		goto out;
+	    }
+
+	    /* Assign the resulting number to lval. */
+	    Push(mc, lval);
+	    if (valid)
+		PushInt(mc, ival2);
+	    else
+		PushNumber(mc, fval);
+	    mocha_DropRef(mc, &aval);
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    ok = Assign(mc, &taint);
+	    if (!ok)
+		goto out;
+	    (void) Pop(mc, MOCHA_TRUE);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_MEMBER, MOP_LMEMBER)
+	    /* Pop an atom (held by an atom map) naming the member. */
+	    rval = Pop(mc, MOCHA_TRUE);
+	    PR_ASSERT(rval.tag == MOCHA_ATOM);
+
+	    /* Pop the left part and resolve it to an object. */
+	    lval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_DatumToObject(mc, lval, &obj);
+	    mocha_DropRef(mc, &lval);
+	    if (!ok) goto out;
+	    if (!obj) {
+		if (mocha_RawDatumToString(mc, lval, &atom)) {
+		    MOCHA_ReportError(mc, "%s has no property named '%s'",
+				      atom_name(atom), atom_name(rval.u.atom));
+		    mocha_DropAtom(mc, atom);
+		}
+		ok = MOCHA_FALSE;
+		goto out;
+	    }
+
+	    /*
+	    ** Try this site's inline cache.  An lvalue can use it only if obj
+	    ** already has a mutable scope of its own.  A frozen scope's symbol
+	    ** may be shadowed by one in this context's overlay, or need to be
+	    ** copied there to be set, so look those up the long way.
+	    */
+	    atom = rval.u.atom;
+	    sym = 0;
+	    cache = GET_PCACHE();
+	    if (cache && (op == MOP_MEMBER || obj->scope->object == obj) &&
+		!(SCOPE_IS_FROZEN(obj->scope) &&
+		  (op == MOP_LMEMBER || mc->overlays))) {
+		sym = ProbePropertyCache(cache, obj->scope);
+	    }
+
+	    /* Lookup atom in object scope, push undef symbol if not found. */
+	    if (!sym) {
+		if (op == MOP_LMEMBER)
+		    ok = mocha_GetMutableScope(mc, obj);
+		if (ok) {
+		    ok = mocha_LookupSymbol(mc, obj->scope, atom,
+					    (op == MOP_LMEMBER)
+					    ? MLF_SET : MLF_GET,
+					    &sym);
+		    if (ok && !sym &&
+			(op == MOP_LMEMBER ||
+			 (ok = mocha_GetMutableScope(mc, obj)))) { /* XXXhertme! */
+			/* Create a new undefined symbol in a mutable scope. */
+			sym = mocha_DefineSymbol(mc, obj->scope, atom,
+						 SYM_UNDEF, 0);
+			ok = (sym != 0);
+		    }
+		}
+		if (sym && cache && sym->scope == obj->scope)
+		    FillPropertyCache(mc, cache, obj->scope, sym);
+	    }
+	    if (sym)
+		PushSymbol(mc, obj, sym);
+	    MOCHA_DropObject(mc, obj);
+	    if (!ok) goto out;
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_INDEX, MOP_LINDEX)
+	    /* Pop the index (without dropping it!) and resolve it. */
+	    aval = rval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_ResolveValue(mc, &rval);
+	    if (!ok) {
+		mocha_DropRef(mc, &aval);
+		goto out;
+	    }
+
+	    /* If rval is a nonnegative integer, treat it as a slot number. */
+	    slot = -1;
+	    if (rval.tag == MOCHA_NUMBER) {
+		if (rval.flags & MDF_INT) {
+		    if (rval.u.num.ival >= 0)
+			slot = rval.u.num.ival;
+		} else if (FloatToInt(rval.u.fval, &ival) && ival >= 0) {
+		    slot = ival;
+		}
+	    } else if (mocha_RawDatumToNumber(mc, rval, &fval)) {
+		if (FloatToInt(fval, &ival) && ival >= 0)
+		    slot = ival;
+	    }
+
+	    /* Pop the array and resolve it to an object. */
+	    lval = Pop(mc, MOCHA_FALSE);
+	    obj = 0;
+	    ok = mocha_DatumToObject(mc, lval, &obj);
+	    mocha_DropRef(mc, &lval);
+
+	    /* Index an Array's elements directly, without atomizing slot. */
+	    if (ok && obj && slot >= 0 && obj->clazz == &mocha_ArrayClass) {
+		mocha_DropRef(mc, &aval);
+		PushElement(mc, obj, slot);
+		MOCHA_DropObject(mc, obj);
+		END_CASE
+	    }
+
+	    /* Otherwise the index names a property. */
+	    valid = mocha_RawDatumToString(mc, rval, &atom) &&
+		    (atom = mocha_InternAtom(mc, atom)) != 0;
+	    mocha_DropRef(mc, &aval);
+	    if (!valid) {
+		if (obj)
+		    MOCHA_DropObject(mc, obj);
+		ok = MOCHA_FALSE;
+		goto out;
+	    }
+	    if (!ok || !obj) {
+		if (ok && mocha_RawDatumToString(mc, lval, &atom2)) {
+		    MOCHA_ReportError(mc,
+				      "%s has no property indexed by '%s'",
+				      atom_name(atom2), atom_name(atom));
+		    mocha_DropAtom(mc, atom2);
+		}
+		mocha_DropAtom(mc, atom);
+		ok = MOCHA_FALSE;
+		goto out;
+	    }
+
+	    /* Lookup the indexed symbol, defining a new one if not found. */
+	    sym = 0;
+	    if (op == MOP_LINDEX)
+		ok = mocha_GetMutableScope(mc, obj);
+	    if (ok) {
+		ok = mocha_LookupSymbol(mc, obj->scope, atom,
+					(op == MOP_LINDEX) ? MLF_SET : MLF_GET,
+					&sym);
+		if (ok && !sym &&
+		    (op == MOP_LINDEX ||
+		     (ok = mocha_GetMutableScope(mc, obj)))) {	/* XXXhertme! */
+		    /*
+		    ** Create a new undefined symbol in a mutable scope.
+		    ** XXX want a way to distinguish o[0x10] from o["16"]
+		    */
+		    sym = (slot < 0)
+			? mocha_DefineSymbol(mc, obj->scope, atom, SYM_UNDEF, 0)
+			: mocha_SetProperty(mc, obj->scope, atom, slot,
+					    MOCHA_null);
+		    ok = (sym != 0);
+		}
+	    }
+	    mocha_DropAtom(mc, atom);
+	    if (sym)
+		PushSymbol(mc, obj, sym);
+	    MOCHA_DropObject(mc, obj);
+	    if (!ok) goto out;
+	    END_CASE
+
+	  BEGIN_CASE(MOP_CALL)
+	    CHECK_BRANCH();
+
+	    /* Resolve *vp to a function and push a frame for calling it. */
+	    argc = GET_IMMEDIATE();
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    fp = NewFrame(mc);
+	    if (!fp) {
+		ok = MOCHA_FALSE;
+		goto out;
+	    }
+	    ok = EnterFrame(mc, argc, fp);
+	    if (!ok) {
+		FreeFrame(mc, fp);
+		goto out;
+	    }
+
+	    /* Call a native function right away. */
+	    fun = fp->fun;
+	    if (!FUN_INTERPRETED(fun)) {
+		ok = fun->call ? CallNative(mc, fp) : MOCHA_TRUE;
+		LeaveFrame(mc, fp);
+		FreeFrame(mc, fp);
+		if (!ok)
+		    goto out;
+
+		/* Don't reset taint accumulator on return from function. */
+		taint = mc->taintInfo->accum;
+		CHECK_INSTRUMENTATION();
+		END_CASE
+	    }
+
+	    /* Save the caller's place and run the function's script. */
+	    PR_ASSERT(sp->ptr + fun->script->depth < sp->limit);
+	    fp->script = script;
+	    fp->slink = slink;
+	    fp->pc = NEXT_PC();
+	    SAVE_NEXT_OP(fp);
+	    slink = mc->staticLink = &fun->object;
+	    script = mc->script = fun->script;
+	    ENTER_SCRIPT();
+
+	  BEGIN_CASE(MOP_NAME)
+	    MOCHA_INIT_FULL_DATUM(mc, &lval, MOCHA_ATOM,
+				  0, MOCHA_TAINT_IDENTITY,
+				  u.atom, GET_LITERAL());
+	    Push(mc, lval);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_NUMBER)
+	    /* Literals are nonnegative, so a whole one that fits is an int. */
+	    atom = GET_LITERAL();
+	    fval = atom->fval;
+	    if (fval >= 0 && fval <= MOCHA_INT_MAX &&
+		(MochaFloat)(ival = (MochaInt)fval) == fval) {
+		PushInt(mc, ival);
+	    } else {
+		PushNumber(mc, fval);
+	    }
+	    END_CASE
+
+	  BEGIN_CASE(MOP_STRING)
+	    atom = GET_LITERAL();
+	    PushString(mc, atom);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_ZERO)
+	    PushInt(mc, 0);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_ONE)
+	    PushInt(mc, 1);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_NULL)
+	    PushObject(mc, 0);
+	    END_CASE
+
+	  BEGIN_CASE(MOP_THIS)
+	    PushObject(mc, sp->frame ? sp->frame->thisp : slink);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_FALSE, MOP_TRUE)
+	    PushBoolean(mc, (op == MOP_TRUE) ? MOCHA_TRUE : MOCHA_FALSE);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_GETARG, MOP_GETVAR)
+	    /* Push the value of a local name resolved by the compiler. */
+	    PR_ASSERT(sp->frame && sp->frame->fun->script == script);
+	    vp = (op == MOP_GETARG) ? &sp->frame->argv[GET_IMMEDIATE()]
+				    : &sp->frame->vars[GET_IMMEDIATE()];
+	    MOCHA_INIT_FULL_DATUM(mc, &rval, vp->tag, 0, vp->taint, u, vp->u);
+	    COPY_INT_FLAG(&rval, *vp);
+	    Push(mc, rval);
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_SETARG, MOP_SETVAR)
+	    vp = (op == MOP_SETARG) ? &sp->frame->argv[GET_IMMEDIATE()]
+				    : &sp->frame->vars[GET_IMMEDIATE()];
+	    ok = AssignSlot(mc, vp, &taint);
+	    if (!ok)
+		goto out;
+	    END_CASE
+
+	  BEGIN_CASE2(MOP_INCARG, MOP_DECARG)
+	    vp = &sp->frame->argv[GET_IMMEDIATE()];
+	    goto incdec_slot;
+
+	  BEGIN_CASE2(MOP_INCVAR, MOP_DECVAR)
+	    vp = &sp->frame->vars[GET_IMMEDIATE()];
+	  incdec_slot:
+	    /* The operand is the slot's value, pushed by MOP_GET{ARG,VAR}. */
+	    aval = Pop(mc, MOCHA_FALSE);
+	    valid = (aval.tag == MOCHA_NUMBER && (aval.flags & MDF_INT) &&
+		     AddInts(aval.u.num.ival,
+			     (op == MOP_INCARG || op == MOP_INCVAR) ? 1 : -1,
+			     &ival2));
+	    if (valid) {
+		/* Push the post- or pre-incremented int. */
+		PushInt(mc, pc[2] ? aval.u.num.ival : ival2);
+	    } else {
+		ok = mocha_DatumToNumber(mc, aval, &fval);
+		mocha_DropRef(mc, &aval);
+		if (!ok)
+		    goto out;
+
+		/* Push the post- or pre-incremented value. */
+		fval2 = (op == MOP_INCARG || op == MOP_INCVAR) ? fval + 1
+							       : fval - 1;
+		PushNumber(mc, pc[2] ? fval : fval2);
+	    }
+
+	    /* XXX Need two stack slots to call an assign method. */
+	    ok = (sp->ptr + 2 < sp->limit);
+	    if (!ok) {
+		ReportStackOverflow(mc);
+		goto out;
+	    }
+
+	    /*
+	    ** Store the resulting number in the slot.  A slot that holds a
+	    ** number with the same taint has no assign method and no reference
+	    ** to drop, so update it in place.
+	    */
+	    if (valid) {
+		INIT_INT_DATUM(mc, &rval, mc->taintInfo->accum, ival2);
+	    } else {
+		MOCHA_INIT_FULL_DATUM(mc, &rval, MOCHA_NUMBER, 0,
+				      mc->taintInfo->accum, u.fval, fval2);
+	    }
+	    if (vp->tag == MOCHA_NUMBER && vp->taint == rval.taint) {
+		vp->u = rval.u;
+		vp->flags &= ~MDF_INT;
+		vp->flags |= rval.flags | MDF_ENUMERATE;
+		END_CASE
+	    }
+	    ok = StoreSlot(mc, vp, rval, &taint);
+	    if (!ok)
+		goto out;
+	    (void) Pop(mc, MOCHA_TRUE);
+	    END_CASE
+
+#ifdef MOCHA_HAS_DELETE_OPERATOR
+	  BEGIN_CASE(MOP_DELETE)
+	    /* Delete the operand, which must be an object but may be null. */
+	    lval = rval = Pop(mc, MOCHA_FALSE);
+	    ok = mocha_DatumToObject(mc, rval, &obj);
+	    mocha_DropRef(mc, &rval);
+	    if (!ok) goto out;
+	    ok = mocha_ResolveSymbol(mc, &lval, MLF_SET);
+	    if (!ok) goto out;
+	    if (lval.tag != MOCHA_SYMBOL && lval.tag != MOCHA_ELEMENT) {
+		if (mocha_RawDatumToString(mc, rval, &atom)) {
+		    MOCHA_ReportError(mc, "%s can't be deleted",
+				      atom_name(atom));
+		    mocha_DropAtom(mc, atom);
+		}
+		goto out;
+	    }
+	    Push(mc, lval);
+	    PushObject(mc, 0);
+#ifdef DEBUG_brendan
+	    mc->pc = pc;
+#endif
+	    ok = Assign(mc, &taint);
+	    if (!ok)
+		goto out;
+	    END_CASE
+#endif /* MOCHA_HAS_DELETE_OPERATOR */
+
+	  DEFAULT_CASE
+	    MOCHA_ReportError(mc, "unimplemented Mocha bytecode %d", op);
+	    END_CASE
+
+#ifdef MOCHA_THREADED_CODE
+	  L_stop:
+	    PR_ASSERT(ip->pc == script->code + script->length);
+#else
+	}
+
+	pc += len;
+	END_OP();
+#endif
+    }
+
+    /* The end of a called function's script returns undefined. */
+    if (sp->frame == entry)
+	goto out;
+
+  leave:
+    /* Pop the called function's frame and resume its caller's script. */
+    fp = sp->frame;
+    slink = mc->staticLink = fp->slink;
+    script = mc->script = fp->script;
+#ifdef MOCHA_THREADED_CODE
+    LOWER_SCRIPT();
+    next = ip + fp->nextop;
+#else
+    pc = fp->pc;
+    end = script->code + script->length;
+#endif
+    LeaveFrame(mc, fp);
+    FreeFrame(mc, fp);
+
+    /* Finish the caller's MOP_CALL, keeping the taint accumulator. */
+    op = MOP_CALL;
+    taint = mc->taintInfo->accum;
+#ifdef MOCHA_THREADED_CODE
+    END_CASE
+#else
+    END_OP();
+    goto run;
+#endif
+
+out:
+    return ok;
+}
+
+#undef BEGIN_TRACE
+#undef END_OP
+#undef LOWERED
+#undef CHECK_INSTRUMENTATION
+#undef NEXT_PC
+#undef BEGIN_OP
+#undef BEGIN_CASE
+#undef BEGIN_CASE2
+#undef DEFAULT_CASE
+#undef END_CASE
+#undef HANDLER
+#undef DO_JUMP
+#undef GET_IMMEDIATE
+#undef GET_LITERAL
+#undef GET_PCACHE
+#undef LOWER_SCRIPT
+#undef LOAD_LOWERED
+#undef OP_HANDLER
+#undef SET_OP_HANDLER
+#undef DEOPT_COUNT
+#undef SET_DEOPT_COUNT
+#undef ENTER_SCRIPT
+#undef SAVE_NEXT_OP
+#undef CHECK_BRANCH
+#undef COMPARE_FLOATS
+#undef BINARYOP
@@ -279,7 +279,7 @@ javapackage_convert(MochaContext *mc, MochaObject *obj,
 	for (cp = str; *cp != '\0'; cp++)
 	    if (*cp == '/')
 		*cp = '.';
-        atom = MOCHA_Atomize(mc, str);
+        atom = MOCHA_Atomize(mc, str, strlen(str));
         if (!atom) {
 	    MOCHA_ReportOutOfMemory(mc);
             return MOCHA_FALSE;
@@ -319,7 +319,8 @@ javapackage_finalize(MochaContext *mc, MochaObject *obj)
 static MochaClass javapackage_class = {
     "JavaPackage",
     MOCHA_PropertyStub, javapackage_set_property, javapackage_list_properties,
-    javapackage_resolve_name, javapackage_convert, javapackage_finalize
+    javapackage_resolve_name, javapackage_convert, javapackage_finalize,
+    0
 };
 
 /* needs pointer to javapackage_class */
@@ -410,12 +411,11 @@ java_slot_to_name(MochaContext *mc, MochaObject *obj, MochaSlot slot,
     MochaSymbol *sym;
 
     PR_snprintf(buf, sizeof(buf), "%d", slot);
-    atom = mocha_Atomize(mc, buf, ATOM_NUMBER);
+    atom = mocha_AtomizeNumber(mc, buf, strlen(buf), slot, 0);
     if (!atom) {
         MOCHA_ReportOutOfMemory(mc);
         return MOCHA_FALSE;
     }
-    atom->fval = slot;
     if (!mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &sym)) {
         /* this should never happen, since resolve_name should have
          * added a property with this slot number already */
@@ -533,7 +533,8 @@ java_list_one_property(MochaContext *mc, MochaObject *obj,
 	return MOCHA_TRUE;
     }
 
-    atom = mocha_Atomize(mc, fieldname(fb), ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, fieldname(fb), strlen(fieldname(fb)),
+			 ATOM_HELD | ATOM_NAME);
     if (!atom) {
         MOCHA_ReportOutOfMemory(mc);
 	return MOCHA_FALSE;
@@ -650,7 +651,8 @@ java_convert(MochaContext *mc, MochaObject *obj, MochaTag tag,
             MochaFunction *fun;
             MochaAtom *atom;
             PR_LOG(Moja, debug, ("making a constructor\n"));
-            atom = MOCHA_Atomize(mc, classname(java->cb));
+            atom = MOCHA_Atomize(mc, classname(java->cb),
+                                 strlen(classname(java->cb)));
             if (!atom) {
                 MOCHA_ReportOutOfMemory(mc);
                 return MOCHA_FALSE;
@@ -690,7 +692,8 @@ java_convert(MochaContext *mc, MochaObject *obj, MochaTag tag,
 static MochaClass java_class = {
     "Java",
     java_get_property, java_set_property, java_list_properties,
-    java_resolve_name, java_convert, java_finalize
+    java_resolve_name, java_convert, java_finalize,
+    0
 };
 
 /****	****	****	****	****	****	****	****	****/
@@ -821,7 +824,8 @@ javaarray_convert(MochaContext *mc, MochaObject *obj, MochaTag tag,
 static MochaClass javaarray_class = {
     "JavaArray",
     javaarray_get_property, javaarray_set_property, javaarray_list_properties,
-    javaarray_resolve_name, javaarray_convert, javaarray_finalize
+    javaarray_resolve_name, javaarray_convert, javaarray_finalize,
+    0
 };
 
 static MochaPropertySpec javaarray_props[] = {
@@ -1137,7 +1141,7 @@ mocha_convertMDatumToJObject(HObject **objp, MochaContext *mc,
                 if (!checkOnly) {
 		    *objp = (JHandle *)
                       makeJavaString((char*)MOCHA_GetAtomName(mc, atom),
-                                     strlen(MOCHA_GetAtomName(mc, atom)));
+                                     MOCHA_GetAtomLength(mc, atom));
                 }
                 mocha_DropAtom(mc, atom);
                 return MOCHA_TRUE;
@@ -1867,7 +1871,7 @@ mocha_convertJObjectToMString(MochaContext *mc, HObject *ho,
         char buf[256];
         PR_snprintf(buf, sizeof(buf), "[JavaClass %s]",
 		    classname(unhand((HClass*)ho)));
-        atom = MOCHA_Atomize(mc, buf);
+        atom = MOCHA_Atomize(mc, buf, strlen(buf));
         if (!atom) {
             MOCHA_ReportOutOfMemory(mc);
             return MOCHA_FALSE;
@@ -1892,7 +1896,7 @@ mocha_convertJObjectToMString(MochaContext *mc, HObject *ho,
 
         /* convert the java string to a mocha string */
         str = allocCString(hstr);
-        atom = MOCHA_Atomize(mc, str);
+        atom = MOCHA_Atomize(mc, str, strlen(str));
         if (!atom) {
             sysFree(str);
             MOCHA_ReportOutOfMemory(mc);
@@ -2706,7 +2710,7 @@ javaslot_convert(MochaContext *mc, MochaObject *obj, MochaTag tag,
 		for (cp = str; *cp != '\0'; cp++)
 		    if (*cp == '/')
 			*cp = '.';
-		atom = MOCHA_Atomize(mc, str);
+		atom = MOCHA_Atomize(mc, str, strlen(str));
 		free(str);
 	    }
 	    if (!atom) {
@@ -2736,7 +2740,8 @@ javaslot_convert(MochaContext *mc, MochaObject *obj, MochaTag tag,
 static MochaClass javaslot_class = {
     "JavaSlot",
     javaslot_get_property, javaslot_set_property, MOCHA_ListPropStub,
-    javaslot_resolve_name, javaslot_convert, javaslot_finalize
+    javaslot_resolve_name, javaslot_convert, javaslot_finalize,
+    0
 };
 
 static MochaObject *
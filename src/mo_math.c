@@ -91,7 +91,8 @@ static MochaPropertySpec math_static_props[] = {
 static MochaClass math_class = {
     "Math",
     math_get_property, math_get_property, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, MOCHA_FinalizeStub
+    MOCHA_ResolveStub, MOCHA_ConvertStub, MOCHA_FinalizeStub,
+    0
 };
 
 static MochaBoolean
@@ -273,83 +274,83 @@ math_pow(MochaContext *mc, MochaObject *obj,
 
 /*
 ** Math.random() support, lifted from classsrc/java/util/Random.java in the
-** ns/sun-java tree.
+** ns/sun-java tree.  Each context has its own generator, so contexts running
+** on different threads neither share nor race on a seed.
 */
-static MochaBoolean random_initialized;
-static int64        random_multiplier;
-static int64        random_addend;
-static int64        random_mask;
-static int64        random_seed;
-static MochaFloat   random_dscale;
-
 static void
-random_setSeed(int64 seed)
+random_setSeed(MochaContext *mc, int64 seed)
 {
     int64 tmp;
 
     LL_I2L(tmp, 1000);
     LL_DIV(seed, seed, tmp);
-    LL_XOR(tmp, seed, random_multiplier);
-    LL_AND(random_seed, tmp, random_mask);
+    LL_XOR(tmp, seed, mc->rngMultiplier);
+    LL_AND(mc->rngSeed, tmp, mc->rngMask);
 }
 
 static void
-random_init(void)
+random_init(MochaContext *mc)
 {
     int64 tmp, tmp2;
 
     /* Do at most once. */
-    if (random_initialized)
+    if (mc->rngInitialized)
 	return;
-    random_initialized = MOCHA_TRUE;
+    mc->rngInitialized = MOCHA_TRUE;
 
-    /* random_multiplier = 0x5DEECE66DL */
+    /* rngMultiplier = 0x5DEECE66DL */
     LL_ISHL(tmp, 0x5D, 32);
     LL_UI2L(tmp2, 0xEECE66DL);
-    LL_OR(random_multiplier, tmp, tmp2);
+    LL_OR(mc->rngMultiplier, tmp, tmp2);
 
-    /* random_addend = 0xBL */
-    LL_I2L(random_addend, 0xBL);
+    /* rngAddend = 0xBL */
+    LL_I2L(mc->rngAddend, 0xBL);
 
-    /* random_mask = (1L << 48) - 1 */
+    /* rngMask = (1L << 48) - 1 */
     LL_I2L(tmp, 1);
     LL_SHL(tmp2, tmp, 48);
-    LL_SUB(random_mask, tmp2, tmp);
+    LL_SUB(mc->rngMask, tmp2, tmp);
 
-    /* random_dscale = (MochaFloat)(1L << 54) */
+    /* rngDscale = (MochaFloat)(1L << 54) */
     LL_SHL(tmp2, tmp, 54);
-    LL_L2D(random_dscale, tmp2);
-
-    /* Finally, set the seed from current time. */
-    random_setSeed(PR_Now());
+    LL_L2D(mc->rngDscale, tmp2);
+
+    /*
+    ** Finally, set the seed from current time, mixing in mc's address so
+    ** that contexts seeded in the same millisecond differ.
+    */
+    random_setSeed(mc, PR_Now());
+    LL_UI2L(tmp, (uint32)(uprword_t)mc);
+    LL_XOR(tmp, mc->rngSeed, tmp);
+    LL_AND(mc->rngSeed, tmp, mc->rngMask);
 }
 
 static uint32
-random_next(int bits)
+random_next(MochaContext *mc, int bits)
 {
     int64 nextseed, tmp;
     uint32 retval;
 
-    LL_MUL(nextseed, random_seed, random_multiplier);
-    LL_ADD(nextseed, nextseed, random_addend);
-    LL_AND(nextseed, nextseed, random_mask);
-    random_seed = nextseed;
+    LL_MUL(nextseed, mc->rngSeed, mc->rngMultiplier);
+    LL_ADD(nextseed, nextseed, mc->rngAddend);
+    LL_AND(nextseed, nextseed, mc->rngMask);
+    mc->rngSeed = nextseed;
     LL_USHR(tmp, nextseed, 48 - bits);
     LL_L2I(retval, tmp);
     return retval;
 }
 
 static MochaFloat
-random_nextDouble(void)
+random_nextDouble(MochaContext *mc)
 {
     int64 tmp, tmp2;
     MochaFloat fval;
 
-    LL_ISHL(tmp, random_next(27), 27);
-    LL_UI2L(tmp2, random_next(27));
+    LL_ISHL(tmp, random_next(mc, 27), 27);
+    LL_UI2L(tmp2, random_next(mc, 27));
     LL_ADD(tmp, tmp, tmp2);
     LL_L2D(fval, tmp);
-    return fval / random_dscale;
+    return fval / mc->rngDscale;
 }
 
 static MochaBoolean
@@ -358,8 +359,8 @@ math_random(MochaContext *mc, MochaObject *obj,
 {
     MochaFloat z;
 
-    random_init();
-    z = random_nextDouble();
+    random_init(mc);
+    z = random_nextDouble(mc);
     MOCHA_INIT_DATUM(mc, rval, MOCHA_NUMBER, u.fval, z);
     return MOCHA_TRUE;
 }
@@ -75,6 +75,11 @@ mocha_DatumToNumber(MochaContext *mc, MochaDatum d, MochaFloat *fvalp)
     MochaDatum aval;
     MochaAtom *atom;
 
+    /* Numbers are common enough to skip resolving. */
+    if (d.tag == MOCHA_NUMBER) {
+	*fvalp = d.u.fval;
+	return MOCHA_TRUE;
+    }
     aval = d;
     if (!mocha_ResolvePrimitiveValue(mc, &d))
 	return MOCHA_FALSE;
@@ -100,7 +105,7 @@ number_to_atom(MochaContext *mc, MochaFloat fval)
 	PR_snprintf(buf, sizeof buf, "%ld", (long)ival);
     else
 	PR_cnvtf(buf, sizeof buf, 20, fval);
-    atom = mocha_Atomize(mc, buf, ATOM_NUMBER);
+    atom = mocha_NewStringAtom(mc, buf, strlen(buf), ATOM_NUMBER);
     if (atom)
 	atom->fval = fval;
     return atom;
@@ -170,13 +175,28 @@ num_finalize(MochaContext *mc, MochaObject *obj)
     MochaAtom *atom;
 
     atom = obj->data;
-    mocha_DropAtom(mc, atom);
+    if (atom)
+	mocha_DropAtom(mc, atom);
+}
+
+static MochaBoolean
+num_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	  MochaCloner *cl)
+{
+    (void)cl;
+    if (obj->data) {
+	copy->data = mocha_CloneAtom(mc, obj->data);
+	if (!copy->data)
+	    return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
 }
 
 static MochaClass number_class = {
     "Number",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, num_finalize
+    MOCHA_ResolveStub, MOCHA_ConvertStub, num_finalize,
+    num_clone
 };
 
 static MochaBoolean
@@ -208,7 +228,8 @@ num_to_string(MochaContext *mc, MochaObject *obj,
 	}
 	if (*bp == '\0')
 	    *--bp = '0';
-	atom = mocha_Atomize(mc, bp, MOCHA_STRING);
+	atom = mocha_NewStringAtom(mc, bp, buf + sizeof buf - 1 - bp,
+				   ATOM_STRING);
 	if (!atom)
 	    return MOCHA_FALSE;
     }
@@ -3,13 +3,14 @@
 **
 ** Brendan Eich, 11/15/95
 */
+#include <stdlib.h>
 #include <string.h>
 #include "prlog.h"
 #include "prprf.h"
-#include "alloca.h"
 #include "mo_atom.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
+#include "mo_eval.h"
 #include "mo_scope.h"
 #include "mocha.h"
 #include "mochaapi.h"
@@ -67,16 +68,16 @@ mocha_DatumToObject(MochaContext *mc, MochaDatum d, MochaObject **objp)
 MochaBoolean
 mocha_RawObjectToString(MochaContext *mc, MochaObject *obj, MochaAtom **atomp)
 {
-    const char *name;
     char *str;
-    size_t size;
     MochaAtom *atom;
-    
-    name = obj->clazz->name;
-    size = strlen(name) + 10;
-    str = (char *)alloca(size);
-    PR_snprintf(str, size, "[object %s]", name);
-    atom = mocha_Atomize(mc, str, ATOM_HELD | ATOM_STRING);
+
+    str = PR_smprintf("[object %s]", obj->clazz->name);
+    if (!str) {
+	MOCHA_ReportOutOfMemory(mc);
+	return MOCHA_FALSE;
+    }
+    atom = mocha_NewStringAtom(mc, str, strlen(str), ATOM_HELD | ATOM_STRING);
+    free(str);
     if (!atom)
 	return MOCHA_FALSE;
     *atomp = atom;
@@ -149,7 +150,8 @@ mocha_TryMethod(MochaContext *mc, MochaObject *obj, MochaAtom *atom,
 MochaClass mocha_ObjectClass = {
     "Object",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, MOCHA_FinalizeStub
+    MOCHA_ResolveStub, MOCHA_ConvertStub, MOCHA_FinalizeStub,
+    0
 };
 
 static MochaBoolean
@@ -187,14 +189,14 @@ obj_eval(MochaContext *mc, MochaObject *obj,
 	*rval = argv[0];
 	return MOCHA_TRUE;
     }
-    no_parent = (obj->parent == 0 && mc->staticLink != obj);
+    no_parent = (obj->parent == 0 && mc->staticLink != obj &&
+		 obj->nrefs != MOCHA_FROZEN);
     if (no_parent)
 	obj->parent = mc->staticLink;
     atom = argv[0].u.atom;
     filename = mc->script->filename;
     lineno = mocha_PCtoLineNumber(mc->script, mc->pc);
-    ok = MOCHA_EvaluateBuffer(mc, obj, atom_name(atom), atom->length,
-			      filename, lineno, rval);
+    ok = mocha_EvaluateCached(mc, obj, atom, filename, lineno, rval);
     if (ok)
 	MOCHA_WeakenRef(mc, rval);
     if (no_parent)
@@ -218,7 +220,8 @@ Object(MochaContext *mc, MochaObject *obj,
 	    return MOCHA_FALSE;
 	if (!obj)
 	    return MOCHA_TRUE;
-	obj->nrefs--;
+	if (obj->nrefs != MOCHA_FROZEN)
+	    obj->nrefs--;
     }
     MOCHA_INIT_DATUM(mc, rval, MOCHA_OBJECT, u.obj, obj);
     return MOCHA_TRUE;
@@ -241,7 +244,8 @@ mocha_GetPrototype(MochaContext *mc, MochaClass *clazz, MochaObject **objp)
     MochaFunction *fun;
     MochaDatum *dp;
 
-    atom = mocha_Atomize(mc, clazz->name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, clazz->name, strlen(clazz->name),
+			 ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
 
@@ -312,6 +316,17 @@ mocha_GetMutableScope(MochaContext *mc, MochaObject *obj)
     return MOCHA_TRUE;
 }
 
+MochaBoolean
+mocha_CheckMutable(MochaContext *mc, MochaObject *obj)
+{
+    if (obj->nrefs == MOCHA_FROZEN) {
+	MOCHA_ReportError(mc, "shared %s object can't be changed",
+			  obj->clazz->name);
+	return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
+}
+
 MochaBoolean
 mocha_InitObject(MochaContext *mc, MochaObject *obj, MochaClass *clazz,
 		 void *data, MochaObject *prototype, MochaObject *parent)
@@ -57,6 +57,34 @@ static MochaParser MemberExpr;
 static MochaParser PrimaryExpr;
 static MochaParser NameExpr;
 
+/*
+** Mocha syntax checkers, which accept what the parsers above accept but
+** generate no code, for function bodies whose compilation is deferred.
+** A checker notes in its SyntaxChecker what the code generated by the
+** parser would end with, for the errors and warnings that depend on it.
+*/
+typedef struct SyntaxChecker {
+    int                 loopDepth;      /* number of enclosing loops */
+    MochaBoolean        assigned;       /* expr ends in a plain assignment */
+    MochaBoolean        returned;       /* code ends in a return or leave */
+} SyntaxChecker;
+
+typedef MochaBoolean
+MochaChecker(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck);
+
+static MochaChecker CheckStatements;
+static MochaChecker CheckStatement;
+static MochaChecker CheckVariables;
+static MochaChecker CheckStmtExpr;
+static MochaChecker CheckExpr;
+static MochaChecker CheckAssignExpr;
+static MochaChecker CheckCondExpr;
+static MochaChecker CheckBinaryExpr;
+static MochaChecker CheckUnaryExpr;
+static MochaChecker CheckMemberExpr;
+static MochaChecker CheckPrimaryExpr;
+static MochaChecker CheckNameExpr;
+
 /* NB: this macro uses mc, ts, and cg from its lexical environment. */
 #define MUST_MATCH_TOKEN(tt, err) {                                           \
     if (mocha_GetToken(mc, ts, cg) != tt) {                                   \
@@ -65,6 +93,14 @@ static MochaParser NameExpr;
     }                                                                         \
 }
 
+/* Like MUST_MATCH_TOKEN, for checkers, which scan without a cg. */
+#define MUST_CHECK_TOKEN(tt, err) {                                           \
+    if (mocha_GetToken(mc, ts, 0) != tt) {                                    \
+	mocha_ReportSyntaxError(mc, ts, err);                                 \
+	return MOCHA_FALSE;                                                   \
+    }                                                                         \
+}
+
 /*
 ** Parse a top-level Mocha script.
 */
@@ -109,15 +145,13 @@ mocha_Parse(MochaContext *mc, MochaObject *slink, MochaTokenStream *ts,
 }
 
 /*
-** Parse a Mocha function body, which might appear as the value of an event
-** handler attribute in a HTML <INPUT> tag.
+** Parse the function body that ts is about to scan, generating its code with
+** funcg, which this function initializes.
 */
-MochaBoolean
-mocha_ParseFunctionBody(MochaContext *mc, MochaTokenStream *ts,
-			MochaFunction *fun)
+static MochaBoolean
+ParseBody(MochaContext *mc, MochaTokenStream *ts, MochaFunction *fun,
+	  CodeGenerator *funcg)
 {
-    unsigned lineno;
-    CodeGenerator funcg;
     MochaObject *oldslink;
     MochaBoolean ok;
 
@@ -126,22 +160,21 @@ mocha_ParseFunctionBody(MochaContext *mc, MochaTokenStream *ts,
 	return MOCHA_FALSE;
     }
 
-    lineno = ts->lineno - 1;
-    if (!mocha_InitCodeGenerator(mc, &funcg, &mc->codePool))
+    if (!mocha_InitCodeGenerator(mc, funcg, &mc->codePool))
 	return MOCHA_FALSE;
 
     oldslink = mc->staticLink;
     mc->staticLink = &fun->object;
     ts->flags |= TSF_FUNCTION;
-    ok = Statements(mc, ts, &funcg);
+    ok = Statements(mc, ts, funcg);
     ts->flags &= ~TSF_FUNCTION;
     mc->staticLink = oldslink;
 
     /* Check for falling off the end of a function that returns a value. */
     if (ok &&
 	(ts->flags & TSF_RETURN_EXPR) &&
-	funcg.lastOpcode != MOP_RETURN &&
-	funcg.lastOpcode != MOP_LEAVE) {
+	funcg->lastOpcode != MOP_RETURN &&
+	funcg->lastOpcode != MOP_LEAVE) {
 	mocha_ReportSyntaxError(mc, ts,
 				"function does not always return a value");
 	ok = MOCHA_FALSE;
@@ -150,27 +183,180 @@ mocha_ParseFunctionBody(MochaContext *mc, MochaTokenStream *ts,
 
     if (!ok) {
 	CLEAR_PUSHBACK(ts);
-	mocha_DropUnmappedAtoms(mc, &funcg);
+	mocha_DropUnmappedAtoms(mc, funcg);
+    }
+    return ok;
+}
+
+/*
+** Compile the function body that ts is about to scan, giving fun a script
+** whose line numbers are based at lineno.
+*/
+static MochaBoolean
+FunctionBody(MochaContext *mc, MochaTokenStream *ts, MochaFunction *fun,
+	     unsigned lineno)
+{
+    CodeGenerator funcg;
+
+    if (!ParseBody(mc, ts, fun, &funcg))
+	return MOCHA_FALSE;
+    fun->script = mocha_NewScript(mc, &funcg, ts->filename, lineno);
+    return fun->script != 0;
+}
+
+/*
+** Parse a Mocha function body, which might appear as the value of an event
+** handler attribute in a HTML <INPUT> tag.
+*/
+MochaBoolean
+mocha_ParseFunctionBody(MochaContext *mc, MochaTokenStream *ts,
+			MochaFunction *fun)
+{
+    return FunctionBody(mc, ts, fun, ts->lineno - 1);
+}
+
+MochaFunctionSource *
+mocha_NewFunctionSource(MochaContext *mc, const char *text, size_t length,
+			const char *filename, unsigned lineno,
+			unsigned scanLineno)
+{
+    size_t nbytes;
+    MochaFunctionSource *source;
+
+    nbytes = sizeof *source + length;
+    if (filename)
+	nbytes += strlen(filename) + 1;
+    source = MOCHA_malloc(mc, nbytes);
+    if (!source)
+	return 0;
+    source->length = length;
+    source->lineno = lineno;
+    source->scanLineno = scanLineno;
+    source->args = 0;
+    memcpy(source->text, text, length);
+    if (filename) {
+	source->filename = source->text + length;
+	strcpy(source->filename, filename);
     } else {
-	fun->script = mocha_NewScript(mc, &funcg, ts->filename, lineno);
-	if (!fun->script)
+	source->filename = 0;
+    }
+    return source;
+}
+
+MochaBoolean
+mocha_CompileFunctionSource(MochaContext *mc, MochaFunction *fun)
+{
+    MochaFunctionSource *source;
+    void *codeMark, *tempMark;
+    MochaTokenStream *ts;
+    MochaBoolean ok;
+
+    source = fun->source;
+    if (!source)
+	return MOCHA_TRUE;
+
+    /*
+    ** Detach source while compiling it, so that fun does nothing if called
+    ** by an error reporter for a syntax error in its own body.
+    */
+    fun->source = 0;
+    codeMark = PR_ARENA_MARK(&mc->codePool);
+    tempMark = PR_ARENA_MARK(&mc->tempPool);
+    ts = mocha_NewTokenStream(mc, source->text, source->length,
+			      source->filename, source->scanLineno);
+    if (ts) {
+	/* DeferFunctionBody already gave any warnings. */
+	ts->flags |= TSF_NOWARN;
+    }
+    ok = (ts != 0) && FunctionBody(mc, ts, fun, source->lineno);
+    if (ok) {
+	if (mocha_GetToken(mc, ts, 0) != TOK_RC) {
+	    mocha_ReportSyntaxError(mc, ts, "missing } after function body");
+	    mocha_DestroyScript(mc, fun->script);
+	    fun->script = 0;
 	    ok = MOCHA_FALSE;
+	} else {
+	    fun->script->depth += fun->object.scope->freeslot;
+	    fun->script->args = source->args;
+	}
     }
-    return ok;
+    PR_ARENA_RELEASE(&mc->codePool, codeMark);
+    PR_ARENA_RELEASE(&mc->tempPool, tempMark);
+    if (!ok) {
+	fun->source = source;
+	return MOCHA_FALSE;
+    }
+    MOCHA_free(mc, source);
+    return MOCHA_TRUE;
+}
+
+/*
+** Check fun's body, whose { was just matched before start in ts's buffer, up
+** to its closing }, and save its text for the first call to fun to compile.
+** The body is checked now so that a syntax error in it stops the script that
+** defines fun before it runs, but no code is generated for it, and no local
+** variables are declared, till fun is first called.
+*/
+static MochaBoolean
+DeferFunctionBody(MochaContext *mc, MochaTokenStream *ts, MochaFunction *fun,
+		  MochaSymbol *args, const char *start, unsigned scanLineno)
+{
+    unsigned lineno;
+    SyntaxChecker ck;
+    MochaBoolean ok;
+    const char *end;
+
+    if (ts->flags & TSF_FUNCTION) {
+	mocha_ReportSyntaxError(mc, ts, "function defined inside a function");
+	return MOCHA_FALSE;
+    }
+
+    lineno = ts->lineno - 1;
+    ck.loopDepth = 0;
+    ck.assigned = ck.returned = MOCHA_FALSE;
+    ts->flags |= TSF_FUNCTION;
+    ok = CheckStatements(mc, ts, &ck);
+    ts->flags &= ~TSF_FUNCTION;
+
+    /* Check for falling off the end of a function that returns a value. */
+    if (ok && (ts->flags & TSF_RETURN_EXPR) && !ck.returned) {
+	mocha_ReportSyntaxError(mc, ts,
+				"function does not always return a value");
+	ok = MOCHA_FALSE;
+    }
+    ts->flags &= ~(TSF_RETURN_EXPR | TSF_RETURN_VOID);
+
+    if (!ok) {
+	CLEAR_PUSHBACK(ts);
+	return MOCHA_FALSE;
+    }
+    if (mocha_GetToken(mc, ts, 0) != TOK_RC) {
+	mocha_ReportSyntaxError(mc, ts, "missing } after function body");
+	return MOCHA_FALSE;
+    }
+
+    end = mocha_GetTokenStreamPosition(ts, 0);
+    fun->source = mocha_NewFunctionSource(mc, start, end - start,
+					  ts->filename, lineno, scanLineno);
+    if (!fun->source)
+	return MOCHA_FALSE;
+    fun->source->args = args;
+    return MOCHA_TRUE;
 }
 
 static MochaBoolean
 FunctionDefinition(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 {
     MochaAtom *atom;
-    char *cp;
+    const char *cp;
     unsigned nargs;
     MochaAtomMap map;
     MochaFunction *fun;
     MochaBoolean ok;
     MochaSymbol *arg, *args, **argp;
     void *mark;
-    unsigned i;
+    const char *start;
+    unsigned i, scanLineno;
     int snindex;
 
     /* Save atoms indexed but not mapped for the top-level script. */
@@ -182,7 +368,7 @@ FunctionDefinition(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 
     /* Estimate number of arguments for initial function scope size. */
     nargs = 1;
-    for (cp = ts->token.ptr; *cp != '\0'; cp++) {
+    for (cp = ts->token.ptr; cp < ts->userbuf.limit && *cp != ')'; cp++) {
 	if (*cp == ',')
 	    nargs++;
     }
@@ -220,13 +406,27 @@ FunctionDefinition(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
     fun->nargs = nargs;
 
     MUST_MATCH_TOKEN(TOK_LC, "missing { before function body");
-    mark = PR_ARENA_MARK(&mc->codePool);
-    ok = mocha_ParseFunctionBody(mc, ts, fun);
-    if (ok) {
-	MUST_MATCH_TOKEN(TOK_RC, "missing } after function body");
-	fun->script->depth += fun->object.scope->freeslot;
-	fun->script->args = args;
 
+    /*
+    ** Compile the body on the first call if ts's source can be kept, and if
+    ** not parsing commands, whose calls depend on what names are bound to.
+    */
+    start = (ts->flags & TSF_COMMAND)
+	    ? 0
+	    : mocha_GetTokenStreamPosition(ts, &scanLineno);
+    if (start) {
+	ok = DeferFunctionBody(mc, ts, fun, args, start, scanLineno);
+    } else {
+	mark = PR_ARENA_MARK(&mc->codePool);
+	ok = mocha_ParseFunctionBody(mc, ts, fun);
+	if (ok) {
+	    MUST_MATCH_TOKEN(TOK_RC, "missing } after function body");
+	    fun->script->depth += fun->object.scope->freeslot;
+	    fun->script->args = args;
+	}
+	PR_ARENA_RELEASE(&mc->codePool, mark);
+    }
+    if (ok) {
 	/* Generate a setline note for script that follows this function. */
 	snindex = mocha_NewSourceNote(mc, cg, SRC_SETLINE);
 	if (snindex >= 0)
@@ -234,14 +434,17 @@ FunctionDefinition(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 	else
 	    ok = MOCHA_FALSE;
     }
-    PR_ARENA_RELEASE(&mc->codePool, mark);
+    if (ok)
+	ok = mocha_NoteDeclaration(mc, cg, atom, fun);
 
 out:
     if (!ok)
 	mocha_RemoveSymbol(mc, mc->staticLink->scope, atom);
     for (i = 0; i < map.length; i++) {
-	mocha_IndexAtom(mc, map.vector[i], cg);
-	PR_ASSERT(map.vector[i]->index == i);
+	if (mocha_IndexAtom(mc, map.vector[i], cg) != i) {
+	    ok = MOCHA_FALSE;
+	    break;
+	}
     }
     mocha_FreeAtomMap(mc, &map);
     return ok;
@@ -271,20 +474,33 @@ Statements(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 static MochaBoolean
 Condition(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 {
+    MochaOp op;
+    int len;
+
     MUST_MATCH_TOKEN(TOK_LP, "missing ( before condition");
     if (!Expr(mc, ts, cg))
 	return MOCHA_FALSE;
     MUST_MATCH_TOKEN(TOK_RP, "missing ) after condition");
 
-    /* Check for an AssignExpr (see below) and "correct" it to an EqExpr */
-    if (cg->lastOpcode == MOP_ASSIGN &&
+    /*
+    ** Check for an AssignExpr (see below) and "correct" it to an EqExpr.  An
+    ** assignment to a local ends in a store with a slot operand, which the
+    ** equality test doesn't take, so back up over it.
+    */
+    op = cg->lastOpcode;
+    len = mocha_CodeSpec[op].length;
+    if ((op == MOP_ASSIGN || op == MOP_SETARG || op == MOP_SETVAR) &&
 	(cg->noteCount == 0 ||
 	 SN_TYPE(&cg->notes[cg->noteCount-1]) != SRC_ASSIGNOP ||
-	 cg->lastOffset < CG_OFFSET(cg) - 2)) {
-	mocha_ReportSyntaxError(mc, ts,
-	    "test for equality (==) mistyped as assignment (=)?\n"
-	    "Assuming equality test");
+	 cg->lastOffset < CG_OFFSET(cg) - 1 - len)) {
+	if (!(ts->flags & TSF_NOWARN)) {
+	    mocha_ReportSyntaxError(mc, ts,
+		"test for equality (==) mistyped as assignment (=)?\n"
+		"Assuming equality test");
+	}
+	cg->ptr -= len - 1;
 	cg->ptr[-1] = MOP_EQ;
+	cg->lastOpcode = MOP_EQ;
     }
     return MOCHA_TRUE;
 }
@@ -363,14 +579,20 @@ Statement(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 	    if (snindex < 0 || mocha_Emit1(mc, cg, MOP_NOP) < 0)
 		return MOCHA_FALSE;
 	} else {
+	    /*
+	    ** We don't know yet whether this is a for-in loop, whose MOP_IN
+	    ** needs a name to assign, so don't emit local slot bytecodes.
+	    */
+	    cg->nameDepth++;
 	    if (tt == TOK_VAR) {
 		(void) mocha_GetToken(mc, ts, cg);
-		if (!Variables(mc, ts, cg))
-		    return MOCHA_FALSE;
+		ok = Variables(mc, ts, cg);
 	    } else {
-		if (!Expr(mc, ts, cg))
-		    return MOCHA_FALSE;
+		ok = Expr(mc, ts, cg);
 	    }
+	    cg->nameDepth--;
+	    if (!ok)
+		return MOCHA_FALSE;
 	    if (mocha_PeekToken(mc, ts, cg) != TOK_IN) {
 		snindex = mocha_NewSourceNote(mc, cg, SRC_FOR);
 		if (snindex < 0 || mocha_Emit1(mc, cg, MOP_POP) < 0)
@@ -428,17 +650,19 @@ Statement(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 	    if (mocha_PeekToken(mc, ts, cg) != TOK_RP) {
 		if (!mocha_InitCodeGenerator(mc, &updater, &mc->tempPool))
 		    return MOCHA_FALSE;
+		updater.withDepth = cg->withDepth;
+		updater.depthTypeSet = cg->depthTypeSet;
 		upindex = mocha_NewSourceNote(mc, &updater, SRC_SETLINE);
 		if (upindex < 0)
 		    return MOCHA_FALSE;
 		SN_SET_OFFSET(&updater.notes[upindex + 1], ts->lineno);
 /* XXX egad */
-updater.atomList = cg->atomList;
+updater.atomTable = cg->atomTable;
 updater.atomCount = cg->atomCount;
 		if (!Expr(mc, ts, &updater))
 		    return MOCHA_FALSE;
 /* XXX egad */
-cg->atomList = updater.atomList;
+cg->atomTable = updater.atomTable;
 cg->atomCount = updater.atomCount;
 		if (mocha_Emit1(mc, &updater, MOP_POP) < 0)
 		    return MOCHA_FALSE;
@@ -603,20 +827,147 @@ cg->atomCount = updater.atomCount;
 ** on error.
 */
 #define EMIT_CONST_ATOM_OP(op, atomIndex) {                                   \
-    if (mocha_Emit3(mc, cg, op, (MochaCode)((atomIndex) >> 8),                \
+    if ((atomIndex) >= MOCHA_ATOM_INDEX_MAX ||                                \
+	mocha_Emit3(mc, cg, op, (MochaCode)((atomIndex) >> 8),                \
 				(MochaCode)(atomIndex)) < 0) {                \
 	return MOCHA_FALSE;                                                   \
     }                                                                         \
 }
 
+/*
+** Return MOP_GETARG or MOP_GETVAR, and set *slotp, if atom names an argument
+** or variable of the function being compiled, so its value can be loaded
+** from the function's stack frame instead of looked up by name at run time.
+** Return MOP_NAME if the name must be resolved dynamically: outside of a
+** function, in a with statement whose object might have a property of the
+** same name, where cg->nameDepth says the operand must be a name, or if the
+** slot number doesn't fit in a byte.
+*/
+static MochaOp
+LocalNameOp(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg,
+	    MochaAtom *atom, MochaSlot *slotp)
+{
+    int depth;
+    MochaScope *scope;
+    MochaSymbol *sym;
+
+    if (!(ts->flags & TSF_FUNCTION) || cg->nameDepth > 0)
+	return MOP_NAME;
+    for (depth = 0; depth < cg->withDepth; depth++) {
+	if (mocha_IsWithStatementDepth(cg, depth))
+	    return MOP_NAME;
+    }
+
+    scope = mc->staticLink->scope;
+    if (!mocha_LookupSymbol(mc, scope, atom, MLF_GET, &sym) ||
+	!sym || sym->scope != scope ||
+	(unsigned)sym->slot > MOCHA_LOCAL_SLOT_MAX) {
+	return MOP_NAME;
+    }
+    *slotp = sym->slot;
+    switch (sym->type) {
+      case SYM_ARGUMENT:
+	return MOP_GETARG;
+      case SYM_VARIABLE:
+	return MOP_GETVAR;
+      default:
+	return MOP_NAME;
+    }
+}
+
+/*
+** Emit a bytecode that pushes the variable named by atom: MOP_GETARG or
+** MOP_GETVAR for a local, else MOP_NAME.
+*/
+static MochaBoolean
+EmitNameOp(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg,
+	   MochaAtom *atom)
+{
+    MochaOp op;
+    MochaSlot slot;
+    MochaAtomNumber atomIndex;
+
+    op = LocalNameOp(mc, ts, cg, atom, &slot);
+    if (op != MOP_NAME)
+	return mocha_Emit2(mc, cg, op, (MochaCode)slot) >= 0;
+    atomIndex = mocha_IndexAtom(mc, atom, cg);
+    EMIT_CONST_ATOM_OP(MOP_NAME, atomIndex);
+    return MOCHA_TRUE;
+}
+
+/*
+** If the code generated for an operand starting at offset is a lone local
+** load, possibly followed by MOP_NOPs for user parentheses, return its op so
+** the caller can emit a store or increment through the same slot.  Else
+** return MOP_NOP.
+*/
+static MochaOp
+LocalOperandOp(CodeGenerator *cg, ptrdiff_t offset)
+{
+    MochaCode *pc;
+    MochaOp op;
+
+    if (CG_OFFSET(cg) - offset < 2)
+	return MOP_NOP;
+    pc = CG_CODE(cg, offset);
+    op = (MochaOp)*pc;
+    if (op != MOP_GETARG && op != MOP_GETVAR)
+	return MOP_NOP;
+    for (pc += 2; pc < cg->ptr; pc++) {
+	if (*pc != MOP_NOP)
+	    return MOP_NOP;
+    }
+    return op;
+}
+
+/*
+** Emit MOP_ASSIGN, or MOP_SETARG or MOP_SETVAR if lop, the LocalOperandOp of
+** the left operand at offset, is a local load.
+*/
+static MochaBoolean
+EmitAssignOp(MochaContext *mc, CodeGenerator *cg, MochaOp lop,
+	     ptrdiff_t offset)
+{
+    switch (lop) {
+      case MOP_GETARG:
+	return mocha_Emit2(mc, cg, MOP_SETARG, CG_CODE(cg, offset)[1]) >= 0;
+      case MOP_GETVAR:
+	return mocha_Emit2(mc, cg, MOP_SETVAR, CG_CODE(cg, offset)[1]) >= 0;
+      default:
+	return mocha_Emit1(mc, cg, MOP_ASSIGN) >= 0;
+    }
+}
+
+/*
+** Emit op, an increment or decrement bytecode, for the operand at offset.
+*/
+static MochaBoolean
+EmitIncOp(MochaContext *mc, CodeGenerator *cg, MochaOp op, ptrdiff_t offset,
+	  MochaCode post)
+{
+    MochaOp lop;
+    MochaCode slot;
+
+    lop = LocalOperandOp(cg, offset);
+    if (lop == MOP_NOP)
+	return mocha_Emit2(mc, cg, op, post) >= 0;
+    slot = CG_CODE(cg, offset)[1];
+    if (lop == MOP_GETARG)
+	op = (op == MOP_INC) ? MOP_INCARG : MOP_DECARG;
+    else
+	op = (op == MOP_INC) ? MOP_INCVAR : MOP_DECVAR;
+    return mocha_Emit3(mc, cg, op, slot, post) >= 0;
+}
+
 static MochaBoolean
 Variables(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 {
     MochaBoolean ok;
     MochaAtom *atom;
-    MochaAtomNumber atomIndex;
     MochaScope *scope;
     MochaSymbol *var;
+    ptrdiff_t top;
+    MochaOp op;
 
     if (mocha_NewSourceNote(mc, cg, SRC_VAR) < 0)
 	return MOCHA_FALSE;
@@ -624,14 +975,33 @@ Variables(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
     for (;;) {
 	MUST_MATCH_TOKEN(TOK_NAME, "missing variable name");
 	atom = ts->token.u.atom;
-	atomIndex = mocha_IndexAtom(mc, atom, cg);
-	EMIT_CONST_ATOM_OP(MOP_NAME, atomIndex);
 
+	/*
+	** Redeclaring a function's argument or variable must not give it a
+	** new slot, which would orphan any local slot bytecodes emitted for
+	** it so far.
+	*/
 	scope = mc->staticLink->scope;
-	var = mocha_DefineSymbol(mc, scope, atom, SYM_VARIABLE, 0);
-	if (!var)
+	var = 0;
+	if ((ts->flags & TSF_FUNCTION) &&
+	    mocha_LookupSymbol(mc, scope, atom, MLF_GET, &var) &&
+	    var &&
+	    (var->scope != scope ||
+	     (var->type != SYM_ARGUMENT && var->type != SYM_VARIABLE))) {
+	    var = 0;
+	}
+	if (!var) {
+	    var = mocha_DefineSymbol(mc, scope, atom, SYM_VARIABLE, 0);
+	    if (!var)
+		return MOCHA_FALSE;
+	    var->slot = scope->freeslot++;
+	    if (!mocha_NoteDeclaration(mc, cg, atom, 0))
+		return MOCHA_FALSE;
+	}
+
+	top = CG_OFFSET(cg);
+	if (!EmitNameOp(mc, ts, cg, atom))
 	    return MOCHA_FALSE;
-	var->slot = scope->freeslot++;
 
 	if (mocha_MatchToken(mc, ts, cg, TOK_ASSIGN)) {
 	    if (ts->token.u.op != MOP_NOP) {
@@ -639,7 +1009,8 @@ Variables(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 					"illegal variable initialization");
 		ok = MOCHA_FALSE;
 	    }
-	    if (!AssignExpr(mc, ts, cg) || mocha_Emit1(mc, cg, MOP_ASSIGN) < 0)
+	    op = LocalOperandOp(cg, top);
+	    if (!AssignExpr(mc, ts, cg) || !EmitAssignOp(mc, cg, op, top))
 		return MOCHA_FALSE;
 	}
 	if (!mocha_MatchToken(mc, ts, cg, TOK_COMMA))
@@ -694,12 +1065,15 @@ Expr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 static MochaBoolean
 AssignExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 {
-    MochaOp op;
+    ptrdiff_t top;
+    MochaOp op, lop;
 
+    top = CG_OFFSET(cg);
     if (!CondExpr(mc, ts, cg))
 	return MOCHA_FALSE;
     if (mocha_MatchToken(mc, ts, cg, TOK_ASSIGN)) {
 	op = ts->token.u.op;
+	lop = LocalOperandOp(cg, top);
 	if (op != MOP_NOP && mocha_Emit1(mc, cg, MOP_DUP) < 0)
 	    return MOCHA_FALSE;
 	if (!AssignExpr(mc, ts, cg))
@@ -710,7 +1084,7 @@ AssignExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 		return MOCHA_FALSE;
 	    }
 	}
-	if (mocha_Emit1(mc, cg, MOP_ASSIGN) < 0)
+	if (!EmitAssignOp(mc, cg, lop, top))
 	    return MOCHA_FALSE;
     }
     return MOCHA_TRUE;
@@ -907,18 +1281,32 @@ UnaryExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
     MochaOp op;
     int argc;
     unsigned lineno;
+    ptrdiff_t top;
+    MochaBoolean ok;
 
     tt = mocha_GetToken(mc, ts, cg);
     switch (tt) {
       case TOK_UNARYOP:
       case TOK_MINUS:
 	op = ts->token.u.op;
+#ifdef MOCHA_HAS_DELETE_OPERATOR
+	/* MOP_DELETE needs a name to remove, not a local's value. */
+	if (op == MOP_DELETE) {
+	    cg->nameDepth++;
+	    ok = UnaryExpr(mc, ts, cg);
+	    cg->nameDepth--;
+	    if (!ok || mocha_Emit1(mc, cg, op) < 0)
+		return MOCHA_FALSE;
+	    break;
+	}
+#endif
 	if (!UnaryExpr(mc, ts, cg) || mocha_Emit1(mc, cg, op) < 0)
 	    return MOCHA_FALSE;
 	break;
       case TOK_INCOP:
 	op = ts->token.u.op;
-	if (!MemberExpr(mc, ts, cg) || mocha_Emit2(mc, cg, op, 0) < 0)
+	top = CG_OFFSET(cg);
+	if (!MemberExpr(mc, ts, cg) || !EmitIncOp(mc, cg, op, top, 0))
 	    return MOCHA_FALSE;
 	break;
       case TOK_NEW:
@@ -948,13 +1336,14 @@ UnaryExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
       default:
 	mocha_UngetToken(ts);
 	lineno = ts->lineno;
+	top = CG_OFFSET(cg);
 	if (!MemberExpr(mc, ts, cg))
 	    return MOCHA_FALSE;
 
 	/* Don't look across a newline boundary looking for a postfix incop. */
 	if (ts->lineno == lineno && mocha_MatchToken(mc, ts, cg, TOK_INCOP)) {
 	    op = ts->token.u.op;
-	    if (mocha_Emit2(mc, cg, op, 1) < 0)
+	    if (!EmitIncOp(mc, cg, op, top, 1))
 		return MOCHA_FALSE;
 	}
     }
@@ -1065,8 +1454,7 @@ PrimaryExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 	break;
 
       case TOK_NAME:
-	mocha_UngetToken(ts);
-	return NameExpr(mc, ts, cg);
+	return EmitNameOp(mc, ts, cg, ts->token.u.atom);
 
       case TOK_NUMBER:
 	if (ts->token.u.atom->fval == 0) {
@@ -1129,3 +1517,439 @@ NameExpr(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
     }
     return MOCHA_TRUE;
 }
+
+static MochaBoolean
+CheckStatements(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    int newlines;
+    MochaBoolean ok;
+    MochaTokenType tt;
+
+    newlines = ts->flags & TSF_NEWLINES;
+    if (newlines) HIDE_NEWLINES(ts);
+
+    ok = MOCHA_TRUE;
+    while ((tt = mocha_PeekToken(mc, ts, 0)) != TOK_EOF && tt != TOK_RC) {
+	if (!CheckStatement(mc, ts, ck)) {
+	    ok = MOCHA_FALSE;
+	    break;
+	}
+    }
+    if (newlines) SCAN_NEWLINES(ts);
+    return ok;
+}
+
+static MochaBoolean
+CheckCondition(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MUST_CHECK_TOKEN(TOK_LP, "missing ( before condition");
+    if (!CheckExpr(mc, ts, ck))
+	return MOCHA_FALSE;
+    MUST_CHECK_TOKEN(TOK_RP, "missing ) after condition");
+
+    /* Warn as Condition does of an AssignExpr, which it corrects. */
+    if (ck->assigned) {
+	mocha_ReportSyntaxError(mc, ts,
+	    "test for equality (==) mistyped as assignment (=)?\n"
+	    "Assuming equality test");
+    }
+    ck->returned = MOCHA_FALSE;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckStatement(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    int newlines;
+    MochaTokenType tt;
+    MochaBoolean ok;
+
+    switch (mocha_GetToken(mc, ts, 0)) {
+      case TOK_IF:
+	if (!CheckCondition(mc, ts, ck) || !CheckStatement(mc, ts, ck))
+	    return MOCHA_FALSE;
+	if (mocha_MatchToken(mc, ts, 0, TOK_ELSE)) {
+	    ck->returned = MOCHA_FALSE;
+	    if (!CheckStatement(mc, ts, ck))
+		return MOCHA_FALSE;
+	}
+	break;
+
+      case TOK_WHILE:
+	ck->loopDepth++;
+	ok = CheckCondition(mc, ts, ck) && CheckStatement(mc, ts, ck);
+	ck->loopDepth--;
+	if (!ok)
+	    return MOCHA_FALSE;
+	ck->returned = MOCHA_FALSE;
+	break;
+
+      case TOK_FOR:
+	MUST_CHECK_TOKEN(TOK_LP, "missing ( after for");	/* balance) */
+	tt = mocha_PeekToken(mc, ts, 0);
+	if (tt != TOK_SEMI) {
+	    if (tt == TOK_VAR) {
+		(void) mocha_GetToken(mc, ts, 0);
+		ok = CheckVariables(mc, ts, ck);
+	    } else {
+		ok = CheckExpr(mc, ts, ck);
+	    }
+	    if (!ok)
+		return MOCHA_FALSE;
+	}
+
+	if (mocha_MatchToken(mc, ts, 0, TOK_IN)) {
+	    if (!CheckExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	} else {
+	    MUST_CHECK_TOKEN(TOK_SEMI, "missing ; after for-loop initializer");
+	    if (mocha_PeekToken(mc, ts, 0) != TOK_SEMI &&
+		!CheckExpr(mc, ts, ck)) {
+		return MOCHA_FALSE;
+	    }
+	    MUST_CHECK_TOKEN(TOK_SEMI, "missing ; after for-loop condition");
+	    if (mocha_PeekToken(mc, ts, 0) != TOK_RP &&
+		!CheckExpr(mc, ts, ck)) {
+		return MOCHA_FALSE;
+	    }
+	}
+
+	/* (balance: */
+	MUST_CHECK_TOKEN(TOK_RP, "missing ) after for-loop control");
+	ck->loopDepth++;
+	ok = CheckStatement(mc, ts, ck);
+	ck->loopDepth--;
+	if (!ok)
+	    return MOCHA_FALSE;
+	ck->returned = MOCHA_FALSE;
+	break;
+
+      case TOK_BREAK:
+	if (!ck->loopDepth) {
+	    mocha_ReportSyntaxError(mc, ts, "break used outside a loop");
+	    return MOCHA_FALSE;
+	}
+	ck->returned = MOCHA_FALSE;
+	break;
+
+      case TOK_CONTINUE:
+	if (!ck->loopDepth) {
+	    mocha_ReportSyntaxError(mc, ts, "continue used outside a loop");
+	    return MOCHA_FALSE;
+	}
+	ck->returned = MOCHA_FALSE;
+	break;
+
+      case TOK_WITH:
+	MUST_CHECK_TOKEN(TOK_LP, "missing ( before formal parameters");
+	/* balance) */
+	if (!CheckExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	/* (balance: */
+	MUST_CHECK_TOKEN(TOK_RP, "missing ) after formal parameters");
+	if (!CheckStatement(mc, ts, ck))
+	    return MOCHA_FALSE;
+
+	/* The with statement's code ends in MOP_LEAVE. */
+	ck->returned = MOCHA_TRUE;
+	break;
+
+      case TOK_VAR:
+	if (!CheckVariables(mc, ts, ck))
+	    return MOCHA_FALSE;
+	ck->returned = MOCHA_FALSE;
+	break;
+
+      case TOK_RETURN:
+	if (!(ts->flags & TSF_FUNCTION)) {
+	    mocha_ReportSyntaxError(mc, ts, "return used outside a function");
+	    return MOCHA_FALSE;
+	}
+
+	newlines = ts->flags & TSF_NEWLINES;
+	if (!newlines) SCAN_NEWLINES(ts);
+	tt = mocha_PeekToken(mc, ts, 0);
+	if (!newlines) HIDE_NEWLINES(ts);
+
+	if (tt != TOK_EOF && tt != TOK_EOL && tt != TOK_SEMI && tt != TOK_RC) {
+	    if (!CheckStmtExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	    ts->flags |= TSF_RETURN_EXPR;
+	} else {
+	    ts->flags |= TSF_RETURN_VOID;
+	}
+	if ((ts->flags & (TSF_RETURN_EXPR | TSF_RETURN_VOID)) ==
+	    (TSF_RETURN_EXPR | TSF_RETURN_VOID)) {
+	    mocha_ReportSyntaxError(mc, ts,
+				    "function does not always return a value");
+	    return MOCHA_FALSE;
+	}
+	ck->returned = MOCHA_TRUE;
+	break;
+
+      case TOK_LC:
+	if (!CheckStatements(mc, ts, ck))
+	    return MOCHA_FALSE;
+
+	/* {balance: */
+	MUST_CHECK_TOKEN(TOK_RC, "missing } in compound statement");
+	break;
+
+      case TOK_EOL:
+      case TOK_SEMI:
+	return MOCHA_TRUE;
+
+      default:
+	mocha_UngetToken(ts);
+	if (!CheckStmtExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	ck->returned = MOCHA_FALSE;
+	break;
+    }
+
+    (void) mocha_MatchToken(mc, ts, 0, TOK_SEMI);
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckVariables(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaBoolean ok;
+
+    ok = MOCHA_TRUE;
+    for (;;) {
+	MUST_CHECK_TOKEN(TOK_NAME, "missing variable name");
+	if (mocha_MatchToken(mc, ts, 0, TOK_ASSIGN)) {
+	    if (ts->token.u.op != MOP_NOP) {
+		mocha_ReportSyntaxError(mc, ts,
+					"illegal variable initialization");
+		ok = MOCHA_FALSE;
+	    }
+	    if (!CheckAssignExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	}
+	if (!mocha_MatchToken(mc, ts, 0, TOK_COMMA))
+	    break;
+    }
+    return ok;
+}
+
+static MochaBoolean
+CheckStmtExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    unsigned lineno;
+    MochaTokenType tt;
+
+    lineno = ts->lineno;
+    if (!CheckExpr(mc, ts, ck))
+	return MOCHA_FALSE;
+    if (ts->lineno == lineno) {
+	tt = ts->pushback.type;
+	if (tt != TOK_EOF && tt != TOK_EOL && tt != TOK_SEMI && tt != TOK_RC) {
+	    mocha_ReportSyntaxError(mc, ts,
+				    (tt == TOK_LP || IS_PRIMARY_TOKEN(tt))
+				    ? "missing operator in expression"
+				    : "missing semicolon before statement");
+	    return MOCHA_FALSE;
+	}
+    }
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    do {
+	if (!CheckAssignExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+    } while (mocha_MatchToken(mc, ts, 0, TOK_COMMA));
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckAssignExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaOp op;
+
+    if (!CheckCondExpr(mc, ts, ck))
+	return MOCHA_FALSE;
+    if (mocha_MatchToken(mc, ts, 0, TOK_ASSIGN)) {
+	op = ts->token.u.op;
+	if (!CheckAssignExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+
+	/* An op= assignment's code has a note that it is one. */
+	ck->assigned = (op == MOP_NOP);
+    }
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckCondExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    if (!CheckBinaryExpr(mc, ts, ck))
+	return MOCHA_FALSE;
+    ck->assigned = MOCHA_FALSE;
+    if (mocha_MatchToken(mc, ts, 0, TOK_HOOK)) {
+	if (!CheckAssignExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	MUST_CHECK_TOKEN(TOK_COLON, "missing : in conditional expression");
+	if (!CheckAssignExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
+}
+
+/*
+** Check the operands and operators from OrExpr down to MulExpr.  Precedence
+** decides only the code generated, so a checker takes them all in one loop.
+*/
+static MochaBoolean
+CheckBinaryExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaTokenType tt;
+
+    do {
+	if (!CheckUnaryExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	tt = mocha_GetToken(mc, ts, 0);
+    } while (TOK_OR <= tt && tt <= TOK_MULOP);
+    mocha_UngetToken(ts);
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckUnaryExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaTokenType tt;
+    unsigned lineno;
+
+    tt = mocha_GetToken(mc, ts, 0);
+    switch (tt) {
+      case TOK_UNARYOP:
+      case TOK_MINUS:
+	return CheckUnaryExpr(mc, ts, ck);
+      case TOK_INCOP:
+	return CheckMemberExpr(mc, ts, ck);
+      case TOK_NEW:
+	if (!CheckNameExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	while ((tt = mocha_GetToken(mc, ts, 0)) == TOK_DOT) {
+	    if (!CheckNameExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	}
+	if (tt != TOK_LP) {
+	    mocha_UngetToken(ts);
+	} else if (!mocha_MatchToken(mc, ts, 0, TOK_RP)) {
+	    do {
+		if (!CheckAssignExpr(mc, ts, ck))
+		    return MOCHA_FALSE;
+	    } while (mocha_MatchToken(mc, ts, 0, TOK_COMMA));
+
+	    /* (balance: */
+	    MUST_CHECK_TOKEN(TOK_RP, "missing ) after constructor argument list");
+	}
+	break;
+
+      default:
+	mocha_UngetToken(ts);
+	lineno = ts->lineno;
+	if (!CheckMemberExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+
+	/* Don't look across a newline boundary looking for a postfix incop. */
+	if (ts->lineno == lineno)
+	    (void) mocha_MatchToken(mc, ts, 0, TOK_INCOP);
+    }
+    return MOCHA_TRUE;
+}
+
+/*
+** Unlike MemberExpr, don't look for a command-style call, which depends on
+** what a name is bound to when the body is compiled.  FunctionDefinition
+** doesn't defer a body in command parsing mode.
+*/
+static MochaBoolean
+CheckMemberExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaTokenType tt;
+
+    if (!CheckPrimaryExpr(mc, ts, ck))
+	return MOCHA_FALSE;
+    while ((tt = mocha_GetToken(mc, ts, 0)) != TOK_EOF) {
+	if (tt == TOK_DOT) {
+	    if (!CheckNameExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	} else if (tt == TOK_LB) {
+	    if (!CheckExpr(mc, ts, ck))
+		return MOCHA_FALSE;
+	    /* [balance: */
+	    MUST_CHECK_TOKEN(TOK_RB, "missing ] in index expression");
+	} else if (tt == TOK_LP) {
+	    if (!mocha_MatchToken(mc, ts, 0, TOK_RP)) {
+		do {
+		    if (!CheckAssignExpr(mc, ts, ck))
+			return MOCHA_FALSE;
+		} while (mocha_MatchToken(mc, ts, 0, TOK_COMMA));
+
+		/* (balance: */
+		MUST_CHECK_TOKEN(TOK_RP, "missing ) after argument list");
+	    }
+	} else {
+	    mocha_UngetToken(ts);
+	    break;
+	}
+    }
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckPrimaryExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    MochaTokenType tt;
+
+    tt = mocha_GetToken(mc, ts, 0);
+    switch (tt) {
+      case TOK_LP:
+	if (!CheckExpr(mc, ts, ck))
+	    return MOCHA_FALSE;
+	/* (balance: */
+	MUST_CHECK_TOKEN(TOK_RP, "missing ) in parenthetical");
+	break;
+
+      case TOK_NAME:
+      case TOK_NUMBER:
+      case TOK_STRING:
+      case TOK_PRIMARY:
+	break;
+
+      case TOK_RESERVED:
+	mocha_ReportSyntaxError(mc, ts, "identifier is a reserved word");
+	return MOCHA_FALSE;
+
+      default:
+	mocha_ReportSyntaxError(mc, ts, IS_PRIMARY_TOKEN(tt)
+					? "missing operand in expression"
+					: "syntax error");
+	return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+CheckNameExpr(MochaContext *mc, MochaTokenStream *ts, SyntaxChecker *ck)
+{
+    (void)ck;
+    switch (mocha_GetToken(mc, ts, 0)) {
+      case TOK_NAME:
+	break;
+      case TOK_PRIMARY:
+	if (ts->token.u.op == MOP_THIS)
+	    break;
+	/* FALL THROUGH */
+      default:
+	mocha_ReportSyntaxError(mc, ts, "missing name in expression");
+	return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
+}
@@ -21,8 +21,35 @@
 #include "mo_scan.h"
 #include "mochaapi.h"
 
+#if !defined(_WIN32) && !defined(XP_MAC)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define RESERVE_JAVA_KEYWORDS
 
+#ifdef MOCHA_HAS_DELETE_OPERATOR
+#define DELETE_TOKEN    TOK_UNARYOP
+#define DELETE_OP       MOP_DELETE
+#else
+#define DELETE_TOKEN    TOK_NAME
+#define DELETE_OP       MOP_NOP
+#endif
+
+#ifdef RESERVE_JAVA_KEYWORDS
+#define JAVA_RESERVED   TOK_RESERVED
+#define JAVA_PRIMARY    TOK_PRIMARY
+#else
+#define JAVA_RESERVED   TOK_NAME
+#define JAVA_PRIMARY    TOK_NAME
+#endif
+
+/*
+** A keyword whose tokentype is TOK_NAME is not reserved in this build, and
+** scans as a name.  The order of entries is fixed by keywordSlots below.
+*/
 static struct keyword {
     char        *name;
     uint16      tokentype;      /* MochaTokenType */
@@ -32,9 +59,7 @@ static struct keyword {
     {"case",            TOK_CASE,               MOP_NOP},
     {"continue",        TOK_CONTINUE,           MOP_NOP},
     {"default",         TOK_DEFAULT,            MOP_NOP},
-#ifdef MOCHA_HAS_DELETE_OPERATOR
-    {"delete",          TOK_UNARYOP,            MOP_DELETE},
-#endif
+    {"delete",          DELETE_TOKEN,           DELETE_OP},
     {"do",              TOK_DO,                 MOP_NOP},
     {"else",            TOK_ELSE,               MOP_NOP},
     {"false",           TOK_PRIMARY,            MOP_FALSE},
@@ -54,57 +79,99 @@ static struct keyword {
     {"while",           TOK_WHILE,              MOP_NOP},
     {"with",            TOK_WITH,               MOP_NOP},
 
-#ifdef RESERVE_JAVA_KEYWORDS
-    {"abstract",        TOK_RESERVED,           MOP_NOP},
-    {"boolean",         TOK_RESERVED,           MOP_NOP},
-    {"byte",            TOK_RESERVED,           MOP_NOP},
-    {"catch",           TOK_RESERVED,           MOP_NOP},
-    {"char",            TOK_RESERVED,           MOP_NOP},
-    {"class",           TOK_RESERVED,           MOP_NOP},
-    {"const",           TOK_RESERVED,           MOP_NOP},
-    {"double",          TOK_RESERVED,           MOP_NOP},
-    {"extends",         TOK_RESERVED,           MOP_NOP},
-    {"final",           TOK_RESERVED,           MOP_NOP},
-    {"finally",         TOK_RESERVED,           MOP_NOP},
-    {"float",           TOK_RESERVED,           MOP_NOP},
-    {"goto",            TOK_RESERVED,           MOP_NOP},
-    {"implements",      TOK_RESERVED,           MOP_NOP},
-    {"import",          TOK_RESERVED,           MOP_NOP},
-    {"instanceof",      TOK_RESERVED,           MOP_NOP},
-    {"int",             TOK_RESERVED,           MOP_NOP},
-    {"interface",       TOK_RESERVED,           MOP_NOP},
-    {"long",            TOK_RESERVED,           MOP_NOP},
-    {"native",          TOK_RESERVED,           MOP_NOP},
-    {"package",         TOK_RESERVED,           MOP_NOP},
-    {"private",         TOK_RESERVED,           MOP_NOP},
-    {"protected",       TOK_RESERVED,           MOP_NOP},
-    {"public",          TOK_RESERVED,           MOP_NOP},
-    {"short",           TOK_RESERVED,           MOP_NOP},
-    {"static",          TOK_RESERVED,           MOP_NOP},
-    {"super",           TOK_PRIMARY,            MOP_NOP},
-    {"synchronized",    TOK_RESERVED,           MOP_NOP},
-    {"throw",           TOK_RESERVED,           MOP_NOP},
-    {"throws",          TOK_RESERVED,           MOP_NOP},
-    {"transient",       TOK_RESERVED,           MOP_NOP},
-    {"try",             TOK_RESERVED,           MOP_NOP},
-    {"volatile",        TOK_RESERVED,           MOP_NOP},
-#endif
+    {"abstract",        JAVA_RESERVED,          MOP_NOP},
+    {"boolean",         JAVA_RESERVED,          MOP_NOP},
+    {"byte",            JAVA_RESERVED,          MOP_NOP},
+    {"catch",           JAVA_RESERVED,          MOP_NOP},
+    {"char",            JAVA_RESERVED,          MOP_NOP},
+    {"class",           JAVA_RESERVED,          MOP_NOP},
+    {"const",           JAVA_RESERVED,          MOP_NOP},
+    {"double",          JAVA_RESERVED,          MOP_NOP},
+    {"extends",         JAVA_RESERVED,          MOP_NOP},
+    {"final",           JAVA_RESERVED,          MOP_NOP},
+    {"finally",         JAVA_RESERVED,          MOP_NOP},
+    {"float",           JAVA_RESERVED,          MOP_NOP},
+    {"goto",            JAVA_RESERVED,          MOP_NOP},
+    {"implements",      JAVA_RESERVED,          MOP_NOP},
+    {"import",          JAVA_RESERVED,          MOP_NOP},
+    {"instanceof",      JAVA_RESERVED,          MOP_NOP},
+    {"int",             JAVA_RESERVED,          MOP_NOP},
+    {"interface",       JAVA_RESERVED,          MOP_NOP},
+    {"long",            JAVA_RESERVED,          MOP_NOP},
+    {"native",          JAVA_RESERVED,          MOP_NOP},
+    {"package",         JAVA_RESERVED,          MOP_NOP},
+    {"private",         JAVA_RESERVED,          MOP_NOP},
+    {"protected",       JAVA_RESERVED,          MOP_NOP},
+    {"public",          JAVA_RESERVED,          MOP_NOP},
+    {"short",           JAVA_RESERVED,          MOP_NOP},
+    {"static",          JAVA_RESERVED,          MOP_NOP},
+    {"super",           JAVA_PRIMARY,           MOP_NOP},
+    {"synchronized",    JAVA_RESERVED,          MOP_NOP},
+    {"throw",           JAVA_RESERVED,          MOP_NOP},
+    {"throws",          JAVA_RESERVED,          MOP_NOP},
+    {"transient",       JAVA_RESERVED,          MOP_NOP},
+    {"try",             JAVA_RESERVED,          MOP_NOP},
+    {"volatile",        JAVA_RESERVED,          MOP_NOP},
 
     {0}
 };
 
+/*
+** The scanner computes a name's mocha_HashChars hash as it gets the name's
+** chars, and KEYWORD_SLOT maps the hash of each keyword to a different slot
+** in keywordSlots, which holds 1 + the keyword's index in keywords[], or 0
+** if no keyword hashes there.  So one probe and one string compare tell
+** whether a name is a keyword, without atomizing it.  Regenerate the slots,
+** and if need be the multiplier, when changing keywords[]; mocha_InitScanner
+** checks them in DEBUG builds.
+*/
+#define KEYWORD_SLOTS_LOG2      7
+#define KEYWORD_MULTIPLIER      0xf222a927U
+#define KEYWORD_SLOT(keyHash)                                                 \
+    ((uint32)((keyHash) * KEYWORD_MULTIPLIER) >> (32 - KEYWORD_SLOTS_LOG2))
+
+static uint8 keywordSlots[PR_BIT(KEYWORD_SLOTS_LOG2)] = {
+     2, 40,  0,  0,  0,  0, 52, 12,  0,  0,  0, 22,  0,  0,  0,  0,
+     0, 24,  1,  0,  0, 48,  0,  0,  0,  0,  0,  0, 15,  0, 27, 10,
+    44,  0,  6,  0,  0, 33,  4,  0, 19,  0,  0,  0,  7,  0,  0,  0,
+     0, 28,  0, 46, 43,  0,  0,  0,  0, 31,  0,  0, 45,  8, 11,  0,
+     0,  0, 23,  0, 42,  0, 14, 17,  0, 25, 29,  0,  0,  0,  0,  0,
+    21, 38, 56, 32, 54, 36,  0,  0, 26,  0, 53, 51,  0,  0,  0,  0,
+    55,  0, 30, 37, 49,  0,  0,  0,  0,  0, 41, 39, 16, 20,  0,  0,
+     0,  0, 35,  0, 47,  0,  0, 18,  0, 50,  9, 13,  5,  3, 34,  0,
+};
+
+static struct keyword *
+FindKeyword(const char *chars, size_t length, PRHashNumber keyHash)
+{
+    unsigned slot;
+    struct keyword *kw;
+
+    slot = keywordSlots[KEYWORD_SLOT(keyHash)];
+    if (slot == 0)
+	return 0;
+    kw = &keywords[slot - 1];
+    if (strncmp(kw->name, chars, length) != 0 || kw->name[length] != '\0')
+	return 0;
+    return kw;
+}
+
 int
 mocha_InitScanner(MochaContext *mc)
 {
+#ifdef DEBUG
     struct keyword *kw;
-    MochaAtom *atom;
+    size_t length;
+#endif
 
+    (void)mc;
+#ifdef DEBUG
     for (kw = keywords; kw->name; kw++) {
-	atom = mocha_Atomize(mc, kw->name, ATOM_HELD | ATOM_KEYWORD);
-	if (!atom)
-	    return 0;
-	atom->keyIndex = kw - keywords;
+	length = strlen(kw->name);
+	PR_ASSERT(FindKeyword(kw->name, length,
+			      mocha_HashChars(kw->name, length)) == kw);
     }
+#endif
     return 1;
 }
 
@@ -125,18 +192,16 @@ mocha_NewTokenStream(MochaContext *mc, const char *base, size_t length,
 MochaTokenStream *
 mocha_NewBufferTokenStream(MochaContext *mc, const char *base, size_t length)
 {
-    size_t nb;
     MochaTokenStream *ts;
 
-    nb = sizeof(MochaTokenStream) + MOCHA_LINE_MAX;
-    PR_ARENA_ALLOCATE(ts, &mc->tempPool, nb);
+    PR_ARENA_ALLOCATE(ts, &mc->tempPool, sizeof(MochaTokenStream));
     if (!ts) {
 	MOCHA_ReportOutOfMemory(mc);
 	return 0;
     }
-    memset(ts, 0, nb);
+    memset(ts, 0, sizeof(MochaTokenStream));
     CLEAR_PUSHBACK(ts);
-    ts->linebuf.base = ts->linebuf.limit = ts->linebuf.ptr = (char *)(ts + 1);
+    ts->linestart = ts->nextline = base;
     ts->userbuf.base = (char *)base;
     ts->userbuf.limit = (char *)base + length;
     ts->userbuf.ptr = (char *)base;
@@ -148,17 +213,28 @@ MochaTokenStream *
 mocha_NewFileTokenStream(MochaContext *mc, const char *filename)
 {
     MochaTokenStream *ts;
+    MochaMappedFile map;
     FILE *file;
 
-    ts = mocha_NewBufferTokenStream(mc, 0, 0);
-    if (!ts)
-	return 0;
-    file = fopen(filename, "r");
-    if (!file) {
-	MOCHA_ReportError(mc, "can't open %s: %s", filename, strerror(errno));
-	return 0;
+    if (mocha_MapFile(filename, &map)) {
+	ts = mocha_NewBufferTokenStream(mc, map.base, map.size);
+	if (!ts) {
+	    mocha_UnmapFile(&map);
+	    return 0;
+	}
+	ts->map = map;
+    } else {
+	ts = mocha_NewBufferTokenStream(mc, 0, 0);
+	if (!ts)
+	    return 0;
+	file = fopen(filename, "r");
+	if (!file) {
+	    MOCHA_ReportError(mc, "can't open %s: %s", filename,
+			      strerror(errno));
+	    return 0;
+	}
+	ts->file = file;
     }
-    ts->file = file;
     ts->filename = filename;
     return ts;
 }
@@ -168,83 +244,230 @@ MochaBoolean
 mocha_CloseTokenStream(MochaTokenStream *ts)
 {
 #ifdef MOCHAFILE
+    if (ts->map.base) {
+	mocha_UnmapFile(&ts->map);
+	ts->map.base = 0;
+    }
+    if (ts->linebuf.base) {
+	free(ts->linebuf.base);
+	ts->linebuf.base = 0;
+    }
     return !ts->file || fclose(ts->file) == 0;
 #else
     return MOCHA_TRUE;
 #endif
 }
 
-static int
-GetChar(MochaTokenStream *ts)
+#if defined(_WIN32) || defined(XP_MAC)
+MochaBoolean
+mocha_MapFile(const char *path, MochaMappedFile *mf)
+{
+    FILE *fp;
+    long size;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+	return MOCHA_FALSE;
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+	goto bad;
+    rewind(fp);
+    mf->size = size;
+    mf->base = 0;
+    if (size != 0) {
+	mf->base = malloc(size);
+	if (!mf->base)
+	    goto bad;
+	if (fread(mf->base, 1, size, fp) != (size_t)size) {
+	    free(mf->base);
+	    goto bad;
+	}
+    }
+    fclose(fp);
+    return MOCHA_TRUE;
+
+bad:
+    fclose(fp);
+    return MOCHA_FALSE;
+}
+
+void
+mocha_UnmapFile(MochaMappedFile *mf)
+{
+    if (mf->base)
+	free(mf->base);
+}
+#else
+MochaBoolean
+mocha_MapFile(const char *path, MochaMappedFile *mf)
+{
+    int fd;
+    struct stat sb;
+    void *base;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return MOCHA_FALSE;
+    if (fstat(fd, &sb) < 0)
+	goto bad;
+    if (!S_ISREG(sb.st_mode)) {
+	errno = EINVAL;
+	goto bad;
+    }
+    mf->size = sb.st_size;
+    mf->base = 0;
+    if (mf->size != 0) {
+	base = mmap(0, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+	    goto bad;
+	mf->base = base;
+    }
+    close(fd);
+    return MOCHA_TRUE;
+
+bad:
+    close(fd);
+    return MOCHA_FALSE;
+}
+
+void
+mocha_UnmapFile(MochaMappedFile *mf)
 {
-    ptrdiff_t length;
-    char *nl;
+    if (mf->base)
+	munmap(mf->base, mf->size);
+}
+#endif
 
-    if (ts->linebuf.ptr >= ts->linebuf.limit) {
+const char *
+mocha_GetTokenStreamPosition(MochaTokenStream *ts, unsigned *linenop)
+{
+    PR_ASSERT(ts->pushback.type == TOK_EOF);
 #ifdef MOCHAFILE
-	if (ts->file) {
-	    if (!fgets(ts->linebuf.base, MOCHA_LINE_MAX, ts->file)) {
-		ts->flags |= TSF_EOF;
-		return EOF;
-	    }
-	    length = strlen(ts->linebuf.base);
-	} else
+    if (ts->file)
+	return 0;
 #endif
-	{
-	    length = ts->userbuf.limit - ts->userbuf.ptr;
-	    if (length <= 0) {
-		ts->flags |= TSF_EOF;
-		return EOF;
-	    }
 
-	    /*
-	    ** Any one of \n, \r, or \r\n ends a line (longest match wins).
-	    */
-	    for (nl = ts->userbuf.ptr; nl < ts->userbuf.limit; nl++) {
-		if (*nl == '\n')
-		    break;
-		if (*nl == '\r') {
-		    if (nl[1] == '\n')
-			nl++;
-		    break;
-		}
+    /*
+    ** A new stream counts its first line when it gets that line's first
+    ** char, so back up over the current line unless it has yet to begin.
+    */
+    if (linenop) {
+	*linenop = (ts->userbuf.ptr == ts->nextline)
+		   ? ts->lineno
+		   : ts->lineno - 1;
+    }
+    return ts->userbuf.ptr;
+}
+
+#ifdef MOCHAFILE
+/*
+** Read the next line of ts->file, however long, into ts->linebuf and scan
+** it from there.  Return false at end of file or if out of memory.
+*/
+static MochaBoolean
+ReadLine(MochaTokenStream *ts)
+{
+    MochaTokenBuf *lb;
+    size_t length, size;
+    char *base;
+    int c;
+
+    lb = &ts->linebuf;
+    length = 0;
+    while ((c = getc(ts->file)) != EOF) {
+	if (!lb->base || lb->base + length == lb->limit) {
+	    size = lb->base ? 2 * (lb->limit - lb->base) : MOCHA_LINE_MAX;
+	    base = realloc(lb->base, size);
+	    if (!base) {
+		ungetc(c, ts->file);
+		break;
 	    }
+	    lb->base = base;
+	    lb->limit = base + size;
+	}
+	lb->base[length++] = (char)c;
+	if (c == '\n')
+	    break;
+    }
+    if (length == 0)
+	return MOCHA_FALSE;
+    ts->userbuf.base = ts->userbuf.ptr = lb->base;
+    ts->userbuf.limit = lb->base + length;
+    ts->linestart = ts->nextline = lb->base;
+    return MOCHA_TRUE;
+}
+#endif
+
+/*
+** Get the next char from ts.  Any one of \n, \r, or \r\n ends a line (the
+** longest match wins) and is gotten as \n.
+*/
+static int
+GetChar(MochaTokenStream *ts)
+{
+    int c;
 
-	    /*
-	    ** If there was an end of line char, copy through it into linebuf.
-	    ** Else copy MOCHA_LINE_MAX-1 bytes into linebuf.
-	    */
-	    if (nl < ts->userbuf.limit)
-		length = nl - ts->userbuf.ptr + 1;
-	    if (length >= MOCHA_LINE_MAX)
-		length = MOCHA_LINE_MAX - 1;
-	    memcpy(ts->linebuf.base, ts->userbuf.ptr, length);
-	    ts->userbuf.ptr += length;
-
-	    /*
-	    ** Make sure linebuf contains \n for EOL (don't do this in userbuf
-	    ** because the user's input string might readonly).
-	    */
-	    if (*nl == '\r' && ts->linebuf.base[length-1] == '\r')
-		ts->linebuf.base[length-1] = '\n';
+    if (ts->userbuf.ptr >= ts->userbuf.limit) {
+#ifdef MOCHAFILE
+	if (!ts->file || !ReadLine(ts))
+#endif
+	{
+	    ts->flags |= TSF_EOF;
+	    return EOF;
 	}
-	if (ts->linebuf.base[length-1] == '\n' ||
-	    ts->userbuf.ptr == ts->userbuf.limit) {
-	    ts->lineno++;
+    }
+    if (ts->userbuf.ptr == ts->nextline) {
+	ts->linestart = ts->nextline;
+	ts->nextline = 0;
+	ts->lineno++;
+    }
+    c = *ts->userbuf.ptr++;
+    if (c == '\n' || c == '\r') {
+	if (c == '\r') {
+	    if (ts->userbuf.ptr < ts->userbuf.limit &&
+		*ts->userbuf.ptr == '\n') {
+		ts->userbuf.ptr++;
+	    }
+	    c = '\n';
 	}
-	ts->linebuf.limit = ts->linebuf.base + length;
-	ts->linebuf.ptr = ts->linebuf.base;
+	ts->nextline = ts->userbuf.ptr;
     }
-    return *ts->linebuf.ptr++;
+    return c;
 }
 
 static void
 UngetChar(MochaTokenStream *ts, int c)
 {
+    const char *cp;
+
     if (c == EOF)
 	return;
-    PR_ASSERT(ts->linebuf.ptr > ts->linebuf.base);
-    *--ts->linebuf.ptr = c;
+    PR_ASSERT(ts->userbuf.ptr > ts->userbuf.base);
+    if (c == '\n') {
+	/* Back up over the \n, \r, or \r\n gotten as c. */
+	PR_ASSERT(ts->nextline == ts->userbuf.ptr);
+	cp = --ts->userbuf.ptr;
+	if (*cp == '\n' && cp > ts->userbuf.base && cp[-1] == '\r')
+	    ts->userbuf.ptr--;
+	ts->nextline = 0;
+	return;
+    }
+    if (--ts->userbuf.ptr != ts->linestart)
+	return;
+
+    /*
+    ** Uncount the line whose first char c was, and find where the previous
+    ** line, if still in userbuf, starts.
+    */
+    ts->nextline = ts->linestart;
+    ts->lineno--;
+    cp = ts->linestart;
+    if (cp > ts->userbuf.base && *--cp == '\n' &&
+	cp > ts->userbuf.base && cp[-1] == '\r') {
+	cp--;
+    }
+    while (cp > ts->userbuf.base && cp[-1] != '\n' && cp[-1] != '\r')
+	cp--;
+    ts->linestart = cp;
 }
 
 static int
@@ -273,20 +496,39 @@ void
 mocha_ReportSyntaxError(MochaContext *mc, MochaTokenStream *ts,
 			const char *message)
 {
-    char *limit, lastc;
+    const char *start, *limit, *tokenptr;
+    char linebuf[MOCHA_LINE_MAX];
+    size_t length;
     MochaErrorReporter onError;
     MochaErrorReport report;
 
-    PR_ASSERT(ts->linebuf.limit < ts->linebuf.base + MOCHA_LINE_MAX);
-    limit = ts->linebuf.limit;
-    lastc = limit[-1];
-    limit[(lastc == '\n') ? -1 : 0] = '\0';
+    /*
+    ** Copy the current line without its newline, or if it is too long, as
+    ** much of it as fits around the token, into linebuf.
+    */
+    start = ts->linestart;
+    tokenptr = ts->token.ptr;
+    if (!start || !tokenptr || tokenptr < start || tokenptr > ts->userbuf.ptr)
+	tokenptr = start;
+    if (tokenptr - start > MOCHA_LINE_MAX / 2)
+	start = tokenptr - MOCHA_LINE_MAX / 2;
+    for (limit = start; limit < ts->userbuf.limit; limit++) {
+	if (*limit == '\n' || *limit == '\r' ||
+	    limit - start == MOCHA_LINE_MAX - 1) {
+	    break;
+	}
+    }
+    length = limit - start;
+    if (length)
+	memcpy(linebuf, start, length);
+    linebuf[length] = '\0';
+
     onError = mc->errorReporter;
     if (onError) {
 	report.filename = ts->filename;
 	report.lineno = ts->lineno;
-	report.linebuf = ts->linebuf.base;
-	report.tokenptr = ts->token.ptr;
+	report.linebuf = linebuf;
+	report.tokenptr = linebuf + (tokenptr - start);
 	(*onError)(mc, message, &report);
     } else {
 	if (!(ts->flags & TSF_INTERACTIVE))
@@ -295,10 +537,8 @@ mocha_ReportSyntaxError(MochaContext *mc, MochaTokenStream *ts,
 	    fprintf(stderr, "%s, ", ts->filename);
 	if (ts->lineno)
 	    fprintf(stderr, "line %u: ", ts->lineno);
-	fprintf(stderr, "%s:\n%s\n", message, ts->linebuf.base);
+	fprintf(stderr, "%s:\n%s\n", message, linebuf);
     }
-    if (lastc == '\n')
-	limit[-1] = lastc;
 }
 
 MochaTokenType
@@ -355,6 +595,8 @@ MochaTokenType
 mocha_GetToken(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 {
     int c;
+    char *cp;
+    PRHashNumber keyHash;
     MochaAtom *atom;
 
     if (ts->pushback.type != TOK_EOF) {
@@ -365,7 +607,10 @@ mocha_GetToken(MochaContext *mc, MochaTokenStream *ts, CodeGenerator *cg)
 
 #define INIT_TOKENBUF(tb)   ((tb)->ptr = (tb)->base)
 #define FINISH_TOKENBUF(tb) if (!AppendToTokenBuf(mc, tb, '\0')) RETURN(TOK_EOF)
-#define RETURN(tt)          return (ts->token.type = tt)
+#define TOKENBUF_LENGTH(tb) ((size_t)((tb)->ptr - (tb)->base - 1))
+#define RETURN(tt)                                                            \
+    return (ts->token.length = ts->userbuf.ptr - ts->token.ptr,               \
+	    ts->token.type = tt)
 
 retry:
     do {
@@ -377,30 +622,37 @@ retry:
 		break;
 	}
     } while (isspace(c));
-    if (c == EOF)
+    if (c == EOF) {
+	ts->token.ptr = ts->userbuf.ptr;
 	RETURN(TOK_EOF);
+    }
 
-    ts->token.ptr = ts->linebuf.ptr - 1;
+    ts->token.ptr = ts->userbuf.ptr - 1;
 
     if (isalpha(c) || c == '_' || c == '$') {
-	INIT_TOKENBUF(&ts->tokenbuf);
-	do {
-	    if (!AppendToTokenBuf(mc, &ts->tokenbuf, (char)c))
-		RETURN(TOK_EOF);
-	    c = GetChar(ts);
-	} while (isalnum(c) || c == '_' || c == '$');
-	UngetChar(ts, c);
-	FINISH_TOKENBUF(&ts->tokenbuf);
-
-	atom = mocha_Atomize(mc, ts->tokenbuf.base, ATOM_NAME);
-	if (!atom) RETURN(TOK_EOF);
-	if (atom->flags & ATOM_KEYWORD) {
-	    struct keyword *kw;
+	struct keyword *kw;
+
+	/*
+	** No newline can end a name, so scan it in place, hashing it as we
+	** go for the keyword lookup and the atom table.
+	*/
+	keyHash = MOCHA_HASH_CHAR(0, c);
+	cp = ts->userbuf.ptr;
+	while (cp < ts->userbuf.limit &&
+	       (isalnum(*cp) || *cp == '_' || *cp == '$')) {
+	    keyHash = MOCHA_HASH_CHAR(keyHash, *cp);
+	    cp++;
+	}
+	ts->userbuf.ptr = cp;
 
-	    kw = &keywords[atom->keyIndex];
+	kw = FindKeyword(ts->token.ptr, cp - ts->token.ptr, keyHash);
+	if (kw && kw->tokentype != TOK_NAME) {
 	    ts->token.u.op = kw->op;
 	    RETURN(kw->tokentype);
 	}
+	atom = mocha_AtomizeHashed(mc, ts->token.ptr, cp - ts->token.ptr,
+				   keyHash, ATOM_NAME);
+	if (!atom) RETURN(TOK_EOF);
 	ts->token.u.atom = atom;
 	RETURN(TOK_NAME);
     }
@@ -483,9 +735,9 @@ retry:
 		mocha_ReportSyntaxError(mc, ts, "integer literal too large");
 	    fval = ulval;
 	}
-	atom = mocha_Atomize(mc, ts->tokenbuf.base, ATOM_NUMBER);
+	atom = mocha_AtomizeNumber(mc, ts->tokenbuf.base,
+				   TOKENBUF_LENGTH(&ts->tokenbuf), fval, 0);
 	if (!atom) RETURN(TOK_EOF);
-	atom->fval = fval;
 	ts->token.u.atom = atom;
 	RETURN(TOK_NUMBER);
     }
@@ -493,6 +745,28 @@ retry:
     if (c == '"' || c == '\'') {
 	int val, qc = c;
 
+	/*
+	** Atomize a string with no escapes in place.  Leave any other, and
+	** any unterminated string, to the loop below.
+	*/
+	if (!mc->charFilter) {
+	    keyHash = 0;
+	    for (cp = ts->userbuf.ptr; cp < ts->userbuf.limit; cp++) {
+		if (*cp == qc || *cp == '\\' || *cp == '\n' || *cp == '\r')
+		    break;
+		keyHash = MOCHA_HASH_CHAR(keyHash, *cp);
+	    }
+	    if (cp < ts->userbuf.limit && *cp == qc) {
+		atom = mocha_AtomizeHashed(mc, ts->userbuf.ptr,
+					   cp - ts->userbuf.ptr, keyHash,
+					   ATOM_STRING);
+		ts->userbuf.ptr = cp + 1;
+		if (!atom) RETURN(TOK_EOF);
+		ts->token.u.atom = atom;
+		RETURN(TOK_STRING);
+	    }
+	}
+
 	INIT_TOKENBUF(&ts->tokenbuf);
 	while ((c = GetChar(ts)) != qc) {
 	    if (c == '\n' || c == EOF) {
@@ -551,7 +825,8 @@ retry:
 		RETURN(TOK_EOF);
 	}
 	FINISH_TOKENBUF(&ts->tokenbuf);
-	atom = mocha_Atomize(mc, ts->tokenbuf.base, ATOM_STRING);
+	atom = mocha_Atomize(mc, ts->tokenbuf.base,
+			     TOKENBUF_LENGTH(&ts->tokenbuf), ATOM_STRING);
 	if (!atom) RETURN(TOK_EOF);
 	ts->token.u.atom = atom;
 	RETURN(TOK_STRING);
@@ -10,7 +10,11 @@
 #include "prlog.h"
 #include "prmem.h"
 #include "prprf.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
 #include "mo_atom.h"
+#include "mo_clone.h"
 #include "mo_cntxt.h"
 #include "mo_scope.h"
 #include "mocha.h"
@@ -120,6 +124,8 @@ HashAtom(const void *key)
 {
     const MochaAtom *atom = key;
 
+    /* Symbols are named by table atoms; see mocha_InternAtom. */
+    PR_ASSERT(!(ATOM_FLAGS(atom) & ATOM_LOOSE));
     return atom->number;
 }
 
@@ -129,6 +135,388 @@ ComparePointers(const void *ptr1, const void *ptr2)
     return ptr1 == ptr2;
 }
 
+#define HASH_THRESHOLD	10	/* hash shapes with at least this many names */
+#define SHAPE_MAX_SYMS	64	/* scopes with more symbols use a hash table */
+#define KID_THRESHOLD	8	/* hash the kids of shapes with this many */
+#define SHAPE_MAX_KIDS	256	/* shapes with this many kids get no more */
+
+/*
+** The root of the shape tree, describing scopes with no symbols.  It is not
+** reference counted, and lives until the last context is destroyed.
+*/
+static MochaShape emptyShape;
+
+/*
+** The shape tree is shared by all contexts.  In a thread-safe build, kids
+** are found, added, and unlinked only under the shape lock, because a kid is
+** freed once its last reference is dropped.  A thread that holds a shape may
+** hold it again, or drop a reference that isn't the last, without locking.
+** A shape's name table is made once under the lock and published by a
+** release store, which SearchShape loads with acquire ordering, as a linked
+** table never changes.
+*/
+#ifdef MOCHA_THREADSAFE
+static PRSyncLock shape_lock = PR_SYNC_LOCK_INITIALIZER;
+#define LOCK_SHAPES()           PR_SyncLock(&shape_lock)
+#define UNLOCK_SHAPES()         PR_SyncUnlock(&shape_lock)
+#define LOAD_SHAPE_LINK(p)      PR_ATOMIC_LOADP(p)
+#define STORE_SHAPE_LINK(p,v)   PR_ATOMIC_STOREP(p, v)
+#define HOLD_SHAPE(shape)       PR_ATOMIC_INCREMENT(&(shape)->nrefs)
+#define DROP_SHAPE(shape)       PR_ATOMIC_DECREMENT(&(shape)->nrefs)
+#define SHAPE_NREFS(shape)      PR_ATOMIC_LOAD(&(shape)->nrefs)
+#else
+#define LOCK_SHAPES()           ((void)0)
+#define UNLOCK_SHAPES()         ((void)0)
+#define LOAD_SHAPE_LINK(p)      (*(p))
+#define STORE_SHAPE_LINK(p,v)   (*(p) = (v))
+#define HOLD_SHAPE(shape)       (++(shape)->nrefs)
+#define DROP_SHAPE(shape)       (--(shape)->nrefs)
+#define SHAPE_NREFS(shape)      ((shape)->nrefs)
+#endif
+
+/*
+** Make shape's table mapping each kid's atom to the kid.  If out of memory,
+** leave shape without one, so that its kids list is searched instead.  Call
+** with the shape lock held.
+*/
+static void
+HashKids(MochaShape *shape)
+{
+    PRHashTable *table;
+    MochaShape *kid;
+
+    table = PR_NewHashTable(shape->nkids, HashAtom,
+			    ComparePointers, ComparePointers, 0, 0);
+    for (kid = shape->kids; table && kid; kid = kid->sibling) {
+	if (!PR_HashTableAdd(table, kid->atom, kid)) {
+	    PR_HashTableDestroy(table);
+	    table = 0;
+	}
+    }
+    shape->kidTable = table;
+}
+
+/*
+** Return the kid of shape that adds atom, or null if there is none.  Call
+** with the shape lock held.
+*/
+static MochaShape *
+FindKid(MochaShape *shape, MochaAtom *atom)
+{
+    MochaShape *kid;
+
+    if (shape->kidTable)
+	return PR_HashTableLookup(shape->kidTable, atom);
+    for (kid = shape->kids; kid; kid = kid->sibling) {
+	if (kid->atom == atom)
+	    return kid;
+    }
+    return 0;
+}
+
+/*
+** Set *kidp to the child of shape that adds a symbol named by atom, held for
+** the caller, creating it if this is the first scope to make that transition.
+** If shape already has SHAPE_MAX_KIDS kids and none adds atom, set *kidp to
+** null: scopes that add so many different names do better as hash tables.
+** Return false if out of memory.
+*/
+static MochaBoolean
+GetShapeTransition(MochaContext *mc, MochaShape *shape, MochaAtom *atom,
+		   MochaShape **kidp)
+{
+    MochaShape *kid;
+
+    LOCK_SHAPES();
+    kid = FindKid(shape, atom);
+    if (kid) {
+	HOLD_SHAPE(kid);
+	goto out;
+    }
+    if (shape->nkids >= SHAPE_MAX_KIDS)
+	goto out;
+    kid = MOCHA_malloc(mc, sizeof *kid);
+    if (!kid) {
+	UNLOCK_SHAPES();
+	return MOCHA_FALSE;
+    }
+    kid->nrefs = 1;
+    kid->parent = mocha_HoldShape(shape);
+    kid->atom = mocha_HoldAtom(mc, atom);
+    kid->nsyms = shape->nsyms + 1;
+    kid->table = 0;
+    kid->kids = 0;
+    kid->nkids = 0;
+    kid->kidTable = 0;
+
+    /* Link kid at the front of shape's kids, and into its kid table. */
+    kid->sibling = shape->kids;
+    if (kid->sibling)
+	kid->sibling->prevp = &kid->sibling;
+    kid->prevp = &shape->kids;
+    shape->kids = kid;
+    shape->nkids++;
+    if (shape->kidTable) {
+	if (!PR_HashTableAdd(shape->kidTable, atom, kid)) {
+	    /* Search the list till there's memory to hash every kid. */
+	    PR_HashTableDestroy(shape->kidTable);
+	    shape->kidTable = 0;
+	}
+    } else if (shape->nkids >= KID_THRESHOLD) {
+	HashKids(shape);
+    }
+out:
+    UNLOCK_SHAPES();
+    *kidp = kid;
+    return MOCHA_TRUE;
+}
+
+/*
+** Free a shape that no scope, cache, or kid refers to, and drop its atom.
+*/
+static void
+FreeShape(MochaContext *mc, MochaShape *shape)
+{
+    if (shape->table)
+	PR_HashTableDestroy(shape->table);
+    if (shape->kidTable)
+	PR_HashTableDestroy(shape->kidTable);
+    mocha_DropAtom(mc, shape->atom);
+    MOCHA_free(mc, shape);
+}
+
+MochaShape *
+mocha_HoldShape(MochaShape *shape)
+{
+    if (shape != &emptyShape) {
+	PR_ASSERT(SHAPE_NREFS(shape) > 0);
+	HOLD_SHAPE(shape);
+    }
+    return shape;
+}
+
+void
+mocha_DropShape(MochaContext *mc, MochaShape *shape)
+{
+    MochaShape *parent;
+#ifdef MOCHA_THREADSAFE
+    MochaRefCount nrefs;
+#endif
+
+    /* Free shapes up the tree without recursion, till one is still used. */
+    while (shape != &emptyShape) {
+	PR_ASSERT(SHAPE_NREFS(shape) > 0);
+#ifdef MOCHA_THREADSAFE
+	while ((nrefs = SHAPE_NREFS(shape)) > 1) {
+	    if (PR_CAS(nrefs - 1, nrefs, &shape->nrefs) == nrefs)
+		return;
+	}
+#endif
+
+	/* The last drop must lock, lest another thread find shape as a kid. */
+	LOCK_SHAPES();
+	if (DROP_SHAPE(shape) != 0) {
+	    UNLOCK_SHAPES();
+	    return;
+	}
+	parent = shape->parent;
+	*shape->prevp = shape->sibling;
+	if (shape->sibling)
+	    shape->sibling->prevp = shape->prevp;
+	parent->nkids--;
+	if (parent->kidTable)
+	    PR_HashTableRemove(parent->kidTable, shape->atom);
+	UNLOCK_SHAPES();
+	FreeShape(mc, shape);
+	shape = parent;
+    }
+}
+
+/*
+** Make shape's table mapping each of its atoms to the shape that added it.
+** Return null if out of memory.
+*/
+static PRHashTable *
+NewShapeTable(MochaShape *shape)
+{
+    PRHashTable *table;
+    MochaShape *kid;
+
+    table = PR_NewHashTable(shape->nsyms, HashAtom,
+			    ComparePointers, ComparePointers, 0, 0);
+    for (kid = shape; table && kid->nsyms; kid = kid->parent) {
+	if (!PR_HashTableAdd(table, kid->atom, kid)) {
+	    PR_HashTableDestroy(table);
+	    table = 0;
+	}
+    }
+    return table;
+}
+
+/*
+** Return the symbol vector index of the name atom in shape, or -1 if shape
+** has no such name.  Long shapes get a table mapping atom to the shape that
+** added it, built on first search and shared by every scope of that shape.
+*/
+static int32
+SearchShape(MochaShape *shape, PRHashNumber hash, const MochaAtom *atom)
+{
+    MochaShape *kid;
+    PRHashTable *table;
+    PRHashEntry **hep;
+
+    if (shape->nsyms >= HASH_THRESHOLD) {
+	table = LOAD_SHAPE_LINK(&shape->table);
+	if (!table) {
+	    LOCK_SHAPES();
+	    table = shape->table;
+	    if (!table) {
+		table = NewShapeTable(shape);
+		STORE_SHAPE_LINK(&shape->table, table);
+	    }
+	    UNLOCK_SHAPES();
+	}
+	if (table) {
+	    hep = PR_HashTableRawLookup(table, hash, atom);
+	    if (!*hep)
+		return -1;
+	    kid = (*hep)->value;
+	    return kid->nsyms - 1;
+	}
+    }
+    for (kid = shape; kid->nsyms; kid = kid->parent) {
+	if (kid->atom == atom)
+	    return kid->nsyms - 1;
+    }
+    return -1;
+}
+
+/*
+** Append a new symbol named by atom to scope's symbol vector, and move scope
+** to shape, the kid of its shape that adds atom.  Scope takes over the
+** caller's reference to shape, or drops it if out of memory.
+*/
+static MochaSymbol *
+AddShapeSymbol(MochaContext *mc, MochaScope *scope, MochaShape *shape,
+	       MochaAtom *atom)
+{
+    unsigned nsyms, length;
+    MochaSymbol *sym, **symv;
+
+    nsyms = scope->shape->nsyms;
+    if (nsyms == scope->symvlen) {
+	length = nsyms ? 2 * nsyms : 4;
+	symv = MOCHA_malloc(mc, length * sizeof *symv);
+	if (!symv)
+	    goto bad;
+	if (scope->symv) {
+	    memcpy(symv, scope->symv, nsyms * sizeof *symv);
+	    MOCHA_free(mc, scope->symv);
+	}
+	scope->symv = symv;
+	scope->symvlen = length;
+    }
+    sym = (MochaSymbol *)AllocSymbol(mc);
+    if (!sym)
+	goto bad;
+    /* Don't set sym->entry.keyHash until we know we need it. */
+    sym->entry.key = mocha_HoldAtom(mc, atom);
+    sym->entry.next = 0;
+    scope->symv[nsyms] = sym;
+    mocha_DropShape(mc, scope->shape);
+    scope->shape = shape;
+    return sym;
+
+bad:
+    mocha_DropShape(mc, shape);
+    return 0;
+}
+
+PR_STATIC_CALLBACK(int)
+UnhashSymbol(PRHashEntry *he, int i, void *arg)
+{
+    (void)he;
+    (void)i;
+    (void)arg;
+    return HT_ENUMERATE_UNHASH;
+}
+
+/*
+** Convert scope from a shape and symbol vector to a hash table of symbols.
+*/
+static MochaBoolean
+MakeDictionary(MochaContext *mc, MochaScope *scope)
+{
+    unsigned i, nsyms;
+    PRHashTable *table;
+    MochaSymbol *sym;
+    PRHashEntry **hep;
+
+    nsyms = scope->shape->nsyms;
+    table = PR_NewHashTable(nsyms, HashAtom, ComparePointers, ComparePointers,
+			    &scopeHashAllocOps, mc);
+    if (!table)
+	return MOCHA_FALSE;
+    for (i = 0; i < nsyms; i++) {
+	sym = scope->symv[i];
+	sym->entry.keyHash = HashAtom(sym->entry.key);
+	hep = PR_HashTableRawLookup(table, sym->entry.keyHash, sym->entry.key);
+	if (!PR_HashTableRawAddEntry(table, hep, &sym->entry)) {
+	    /* Symbols still belong to symv, so unhash before destroying. */
+	    PR_HashTableEnumerateEntries(table, UnhashSymbol, 0);
+	    PR_HashTableDestroy(table);
+	    MOCHA_ReportOutOfMemory(mc);
+	    return MOCHA_FALSE;
+	}
+    }
+    if (scope->symv)
+	MOCHA_free(mc, scope->symv);
+    mocha_DropShape(mc, scope->shape);
+    scope->shape = 0;
+    scope->symv = 0;
+    scope->symvlen = 0;
+    scope->table = table;
+    return MOCHA_TRUE;
+}
+
+void
+mocha_FreeShapeTree(MochaContext *mc)
+{
+    MochaShape *list, *shape, *kid;
+
+    /* Splice each shape's kids into the list, to free without recursion. */
+    list = emptyShape.kids;
+    while ((shape = list) != 0) {
+	list = shape->sibling;
+	if (shape->kids) {
+	    for (kid = shape->kids; kid->sibling; kid = kid->sibling)
+		continue;
+	    kid->sibling = list;
+	    list = shape->kids;
+	}
+	FreeShape(mc, shape);
+    }
+    if (emptyShape.kidTable)
+	PR_HashTableDestroy(emptyShape.kidTable);
+    emptyShape.kids = 0;
+    emptyShape.nkids = 0;
+    emptyShape.kidTable = 0;
+}
+
+int32
+mocha_SymbolIndex(MochaScope *scope, MochaSymbol *sym)
+{
+    const MochaAtom *atom;
+    int32 i;
+
+    if (!scope->shape || sym->scope != scope)
+	return -1;
+    atom = sym_atom(sym);
+    i = SearchShape(scope->shape, HashAtom(atom), atom);
+    PR_ASSERT(i < 0 || scope->symv[i] == sym);
+    return i;
+}
+
 MochaScope *
 mocha_NewScope(MochaContext *mc, MochaObject *obj)
 {
@@ -141,8 +529,10 @@ mocha_NewScope(MochaContext *mc, MochaObject *obj)
     }
     scope->nrefs = 0;
     scope->object = obj;
+    scope->shape = &emptyShape;
+    scope->symv = 0;
+    scope->symvlen = 0;
     scope->table = 0;
-    scope->list = 0;
     scope->freeslot = scope->minslot = 0;
     scope->props = 0;
     scope->proptail = &scope->props;
@@ -159,16 +549,17 @@ mocha_DestroyScope(MochaContext *mc, MochaScope *scope)
 MochaScope *
 mocha_HoldScope(MochaContext *mc, MochaScope *scope)
 {
-    PR_ASSERT(scope->nrefs >= 0);
-    scope->nrefs++;
+    PR_ASSERT(scope->nrefs == MOCHA_FROZEN || scope->nrefs >= 0);
+    if (scope->nrefs != MOCHA_FROZEN)
+	scope->nrefs++;
     return scope;
 }
 
 MochaScope *
 mocha_DropScope(MochaContext *mc, MochaScope *scope)
 {
-    PR_ASSERT(scope->nrefs > 0);
-    if (--scope->nrefs == 0) {
+    PR_ASSERT(scope->nrefs == MOCHA_FROZEN || scope->nrefs > 0);
+    if (scope->nrefs != MOCHA_FROZEN && --scope->nrefs == 0) {
 	mocha_DestroyScope(mc, scope);
 	return 0;
     }
@@ -225,6 +616,7 @@ MochaBoolean
 mocha_CopyScope(MochaContext *mc, MochaScope *from, MochaScope *to)
 {
     CopyArgs ca;
+    unsigned i;
     MochaSymbol *sym;
 
     ca.context = mc;
@@ -233,8 +625,9 @@ mocha_CopyScope(MochaContext *mc, MochaScope *from, MochaScope *to)
     if (from->table) {
 	PR_HashTableEnumerateEntries(from->table, CopyHashEntry, &ca);
     } else {
-	for (sym = from->list; sym; sym = (MochaSymbol *)sym->entry.next) {
-	    if (CopyHashEntry(&sym->entry, 0, &ca) == HT_ENUMERATE_STOP)
+	for (i = 0; i < from->shape->nsyms; i++) {
+	    sym = from->symv[i];
+	    if (CopyHashEntry(&sym->entry, i, &ca) == HT_ENUMERATE_STOP)
 		break;
 	}
     }
@@ -242,22 +635,351 @@ mocha_CopyScope(MochaContext *mc, MochaScope *from, MochaScope *to)
 }
 #endif
 
+/*
+** Set *valuep to the copy of sym's value made by cl, copying the value if
+** this is its first symbol.  A new copy has a zero reference count, and a
+** new property is appended to to's property list.
+*/
+static MochaBoolean
+CloneSymbolValue(MochaContext *mc, MochaSymbol *sym, MochaScope *to,
+		 MochaCloner *cl, void **valuep)
+{
+    MochaProperty *prop, *copy;
+    MochaDatum *vp, *vcopy;
+
+    *valuep = sym->entry.value;
+    if (!*valuep)
+	return MOCHA_TRUE;
+    *valuep = mocha_GetClone(cl, sym->entry.value);
+    if (*valuep)
+	return MOCHA_TRUE;
+
+    switch (sym->type) {
+      case SYM_PROPERTY:
+	prop = sym_property(sym);
+	copy = MOCHA_malloc(mc, sizeof *copy);
+	if (!copy)
+	    return MOCHA_FALSE;
+	if (!MOCHA_CloneDatum(mc, cl, &prop->datum, &copy->datum))
+	    goto bad_prop;
+	copy->datum.nrefs = 0;
+	if (!mocha_PutClone(mc, cl, prop, copy)) {
+	    mocha_DropRef(mc, &copy->datum);
+	    goto bad_prop;
+	}
+	copy->lastsym = 0;
+	copy->slot = prop->slot;
+	copy->getter = prop->getter;
+	copy->setter = prop->setter;
+	PROP_APPEND(to, copy);
+	*valuep = copy;
+	return MOCHA_TRUE;
+      bad_prop:
+	MOCHA_free(mc, copy);
+	return MOCHA_FALSE;
+
+      case SYM_VARIABLE:
+	vp = sym_datum(sym);
+	vcopy = MOCHA_malloc(mc, sizeof *vcopy);
+	if (!vcopy)
+	    return MOCHA_FALSE;
+	if (!MOCHA_CloneDatum(mc, cl, vp, vcopy))
+	    goto bad_var;
+	vcopy->nrefs = 0;
+	if (!mocha_PutClone(mc, cl, vp, vcopy)) {
+	    mocha_DropRef(mc, vcopy);
+	    goto bad_var;
+	}
+	*valuep = vcopy;
+	return MOCHA_TRUE;
+      bad_var:
+	MOCHA_free(mc, vcopy);
+	return MOCHA_FALSE;
+
+      default:
+	MOCHA_ReportError(mc, "can't clone symbol %s",
+			  atom_name(sym_atom(sym)));
+	return MOCHA_FALSE;
+    }
+}
+
+typedef struct CloneArgs {
+    MochaContext *context;
+    MochaScope   *scope;
+    MochaCloner  *cloner;
+    MochaBoolean status;
+} CloneArgs;
+
+PR_STATIC_CALLBACK(int)
+CloneHashEntry(PRHashEntry *he, int i, void *arg)
+{
+    MochaSymbol *sym = (MochaSymbol *)he;
+    CloneArgs *ca = arg;
+    MochaContext *mc = ca->context;
+    MochaScope *to = ca->scope;
+    MochaProperty *prop;
+    void *value;
+    MochaSymbol *copy;
+
+    (void)i;
+    if (!CloneSymbolValue(mc, sym, to, ca->cloner, &value))
+	goto bad;
+    copy = mocha_DefineSymbol(mc, to, sym_atom(sym), sym->type, value);
+    if (!copy) {
+	/* Free a value made for this symbol, as nothing else refers to it. */
+	if (value && *(MochaRefCount *)value == 0) {
+	    if (sym->type == SYM_PROPERTY) {
+		prop = value;
+		PROP_UNLINK(to, prop);
+	    }
+	    mocha_DropRef(mc, value);
+	    MOCHA_free(mc, value);
+	}
+	goto bad;
+    }
+    copy->slot = sym->slot;
+    if (!mocha_PutClone(mc, ca->cloner, sym, copy))
+	goto bad;
+    return HT_ENUMERATE_NEXT;
+
+bad:
+    ca->status = MOCHA_FALSE;
+    return HT_ENUMERATE_STOP;
+}
+
+MochaBoolean
+mocha_CloneScope(MochaContext *mc, MochaScope *from, MochaScope *to,
+		 MochaCloner *cl)
+{
+    CloneArgs ca;
+    MochaShape *shape;
+    unsigned i, nsyms;
+    MochaSymbol *sym, *copy, **symp;
+    void *value;
+    MochaProperty *prop, *pcopy;
+
+    PR_ASSERT(to->shape == &emptyShape && !to->props);
+    if (from->table) {
+	ca.context = mc;
+	ca.scope = to;
+	ca.cloner = cl;
+	ca.status = MOCHA_TRUE;
+	PR_HashTableEnumerateEntries(from->table, CloneHashEntry, &ca);
+	if (!ca.status)
+	    return MOCHA_FALSE;
+    } else {
+	/*
+	** Copy symbols straight into a vector for from's shape, as to gets
+	** the same shape anyway.  Until all are copied, to's shape stays
+	** empty, so that if we fail, to can be cleared up to the symbol i
+	** at which we failed.
+	*/
+	nsyms = from->shape->nsyms;
+	if (nsyms) {
+	    to->symv = MOCHA_malloc(mc, nsyms * sizeof *to->symv);
+	    if (!to->symv)
+		return MOCHA_FALSE;
+	    to->symvlen = nsyms;
+	}
+	for (i = 0; i < nsyms; i++) {
+	    sym = from->symv[i];
+	    copy = (MochaSymbol *)AllocSymbol(mc);
+	    if (!copy)
+		goto bad;
+	    if (!CloneSymbolValue(mc, sym, to, cl, &value)) {
+		MOCHA_free(mc, copy);
+		goto bad;
+	    }
+	    copy->entry.key = mocha_HoldAtom(mc, sym_atom(sym));
+	    copy->entry.next = 0;
+	    copy->entry.value = value;
+	    copy->scope = to;
+	    copy->type = sym->type;
+	    copy->slot = sym->slot;
+	    copy->next = 0;
+	    if (value)
+		(*(MochaRefCount *)value)++;
+	    to->symv[i] = copy;
+	    if (!mocha_PutClone(mc, cl, sym, copy)) {
+		i++;
+		goto bad;
+	    }
+	}
+	to->shape = mocha_HoldShape(from->shape);
+    }
+
+    /* Put properties in from's order, with their lists of names. */
+    to->props = 0;
+    to->proptail = &to->props;
+    for (prop = from->props; prop; prop = prop->next) {
+	pcopy = mocha_GetClone(cl, prop);
+	PR_ASSERT(pcopy);
+	PROP_APPEND(to, pcopy);
+	symp = &pcopy->lastsym;
+	for (sym = prop->lastsym; sym; sym = sym->next) {
+	    *symp = mocha_GetClone(cl, sym);
+	    PR_ASSERT(*symp);
+	    symp = &(*symp)->next;
+	}
+    }
+    to->freeslot = from->freeslot;
+    to->minslot = from->minslot;
+    return MOCHA_TRUE;
+
+bad:
+    for (shape = from->shape; shape->nsyms > i; shape = shape->parent)
+	continue;
+    to->shape = mocha_HoldShape(shape);
+    return MOCHA_FALSE;
+}
+
+/*
+** Overlays.  mc->overlays maps each frozen scope that mc has set a symbol in
+** to mc's overlay of it.  An overlay's object is the frozen scope's object,
+** so that properties set in the overlay get that object's getter and setter.
+*/
+PR_STATIC_CALLBACK(PRHashNumber)
+HashScope(const void *key)
+{
+    /* Scopes are at least 8-byte aligned, so shift out the zero bits. */
+    return (PRHashNumber)((uprword_t)key >> 3);
+}
+
+static MochaScope *
+FindOverlay(MochaContext *mc, MochaScope *frozen)
+{
+    if (!mc->overlays)
+	return 0;
+    return PR_HashTableLookup(mc->overlays, frozen);
+}
+
+/*
+** Return the scope that changes to scope go to: scope itself, or if it's
+** frozen, mc's overlay of it, made the first time it's needed.  Return null
+** after reporting an error if out of memory.
+*/
+static MochaScope *
+WritableScope(MochaContext *mc, MochaScope *scope)
+{
+    MochaScope *overlay;
+
+    if (!SCOPE_IS_FROZEN(scope))
+	return scope;
+    overlay = FindOverlay(mc, scope);
+    if (overlay)
+	return overlay;
+    if (!mc->overlays) {
+	mc->overlays = PR_NewHashTable(8, HashScope, ComparePointers,
+				       ComparePointers, 0, 0);
+	if (!mc->overlays) {
+	    MOCHA_ReportOutOfMemory(mc);
+	    return 0;
+	}
+    }
+    overlay = mocha_NewScope(mc, scope->object);
+    if (!overlay)
+	return 0;
+    overlay->minslot = scope->minslot;
+    overlay->freeslot = scope->freeslot;
+    if (!PR_HashTableAdd(mc->overlays, scope, overlay)) {
+	mocha_DestroyScope(mc, overlay);
+	MOCHA_ReportOutOfMemory(mc);
+	return 0;
+    }
+    return mocha_HoldScope(mc, overlay);
+}
+
+PR_STATIC_CALLBACK(int)
+DropOverlay(PRHashEntry *he, int i, void *arg)
+{
+    (void)i;
+    mocha_DropScope(arg, he->value);
+    return HT_ENUMERATE_NEXT;
+}
+
+void
+mocha_DestroyOverlays(MochaContext *mc)
+{
+    PRHashTable *overlays;
+
+    /* Loop in case a finalizer sets something in a frozen scope. */
+    while ((overlays = mc->overlays) != 0) {
+	mc->overlays = 0;
+	PR_HashTableEnumerateEntries(overlays, DropOverlay, mc);
+	PR_HashTableDestroy(overlays);
+    }
+}
+
+MochaProperty *
+mocha_FirstProperty(MochaContext *mc, MochaScope *scope)
+{
+    MochaScope *overlay;
+
+    if (SCOPE_IS_FROZEN(scope)) {
+	overlay = FindOverlay(mc, scope);
+	if (overlay && overlay->props)
+	    return overlay->props;
+    }
+    return scope->props;
+}
+
+MochaProperty *
+mocha_NextProperty(MochaContext *mc, MochaScope *scope, MochaProperty *prop)
+{
+    (void)mc;
+    if (prop->next)
+	return prop->next;
+
+    /* The last property in an overlay is followed by the frozen ones. */
+    if (SCOPE_IS_FROZEN(scope) && prop->lastsym->scope != scope)
+	return scope->props;
+    return 0;
+}
+
 void
 mocha_ClearScope(MochaContext *mc, MochaScope *scope)
 {
-    MochaSymbol *sym, **sp;
+    unsigned i, nsyms;
+    MochaShape *shape;
+    MochaSymbol **symv;
 
+    /* Clearing a frozen scope clears only what mc set in it. */
+    if (SCOPE_IS_FROZEN(scope)) {
+	scope = FindOverlay(mc, scope);
+	if (!scope)
+	    return;
+    }
     if (scope->table) {
 	scope->table->allocPool = mc;
 	PR_HashTableDestroy(scope->table);
 	scope->table = 0;
     } else {
-	sp = &scope->list;
-	while ((sym = *sp) != 0) {
-	    *sp = (MochaSymbol *)sym->entry.next;
-	    FreeSymbol(mc, &sym->entry, HT_FREE_ENTRY);
-	}
+	/* Empty scope before freeing, in case a finalizer looks in it. */
+	shape = scope->shape;
+	nsyms = shape->nsyms;
+	symv = scope->symv;
+	scope->shape = &emptyShape;
+	scope->symv = 0;
+	scope->symvlen = 0;
+	for (i = 0; i < nsyms; i++)
+	    FreeSymbol(mc, &symv[i]->entry, HT_FREE_ENTRY);
+	if (symv)
+	    MOCHA_free(mc, symv);
+	mocha_DropShape(mc, shape);
+    }
+    scope->shape = &emptyShape;
+}
+
+static MochaSymbol *
+SearchScope(MochaScope *scope, PRHashNumber hash, const MochaAtom *atom)
+{
+    int32 i;
+
+    if (scope->shape) {
+	i = SearchShape(scope->shape, hash, atom);
+	return (i >= 0) ? scope->symv[i] : 0;
     }
+    return (MochaSymbol *) *PR_HashTableRawLookup(scope->table, hash, atom);
 }
 
 MochaBoolean
@@ -266,30 +988,29 @@ RawLookupSymbol(MochaContext *mc, MochaScope *scope, PRHashNumber hash,
 		MochaSymbol **symp)
 {
     MochaObject *obj;
-    MochaScope *first;
-    PRHashEntry **hep;
-    MochaSymbol *sym, **sp;
+    MochaScope *first, *overlay;
+    MochaSymbol *sym;
 
+    /* A symbol set in a frozen scope must be in mc's overlay of it. */
     first = scope;
+    if (flag == MLF_SET) {
+	first = WritableScope(mc, scope);
+	if (!first)
+	    return MOCHA_FALSE;
+    }
     obj = scope->object;
     for (;;) {
-	if (scope->table) {
-	    hep = PR_HashTableRawLookup(scope->table, hash, atom);
-	    sym = (MochaSymbol *) *hep;
-	    if (sym)
-		goto out;
-	} else {
-	    for (sp = &scope->list; (sym = *sp) != 0;
-		 sp = (MochaSymbol **)&sym->entry.next) {
-		if (sym_atom(sym) == atom) {
-		    /* Move sym to the front for shorter searches. */
-		    *sp = (MochaSymbol *)sym->entry.next;
-		    sym->entry.next = (PRHashEntry *)scope->list;
-		    scope->list = sym;
+	if (SCOPE_IS_FROZEN(scope) && mc->overlays) {
+	    overlay = FindOverlay(mc, scope);
+	    if (overlay) {
+		sym = SearchScope(overlay, hash, atom);
+		if (sym)
 		    goto out;
-		}
 	    }
 	}
+	sym = SearchScope(scope, hash, atom);
+	if (sym)
+	    goto out;
 	obj = scope->object->prototype;
 	if (!obj || obj->scope == scope)
 	    break;
@@ -352,63 +1073,48 @@ mocha_SearchScopes(MochaContext *mc, const MochaAtom *atom,
     return MOCHA_TRUE;
 }
 
-#define HASH_THRESHOLD	10
-
 MochaSymbol *
 mocha_DefineSymbol(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
 		   MochaSymbolType type, void *value)
 {
-    MochaSlot nsyms;
-    MochaSymbol *sym, *next;
-    PRHashEntry **hep;
+    int32 i;
+    MochaShape *shape;
+    MochaSymbol *sym;
 
-    if (!scope->table) {
-	for (nsyms = 0, sym = scope->list; sym;
-	     sym = (MochaSymbol *)sym->entry.next) {
-	    if (sym_atom(sym) == atom)
-		break;
-	    nsyms++;
+    scope = WritableScope(mc, scope);
+    if (!scope)
+	return 0;
+    if (scope->shape) {
+	i = SearchShape(scope->shape, HashAtom(atom), atom);
+	if (i >= 0) {
+	    sym = scope->symv[i];
+	    FreeSymbol(mc, &sym->entry, HT_FREE_VALUE);
+	    sym->entry.value = value;
+	    goto init;
 	}
-	if (nsyms >= HASH_THRESHOLD) {
-	    scope->table = PR_NewHashTable(nsyms, HashAtom,
-					   ComparePointers, ComparePointers,
-					   &scopeHashAllocOps, mc);
-	    if (scope->table) {
-		for (sym = scope->list; sym; sym = next) {
-		    next = (MochaSymbol *)sym->entry.next;
-		    sym->entry.keyHash = HashAtom(sym->entry.key);
-		    sym->entry.next = 0;
-		    hep = PR_HashTableRawLookup(scope->table,
-						sym->entry.keyHash,
-						sym->entry.key);
-		    *hep = &sym->entry;
-		}
-		scope->list = 0;
+	if (scope->shape->nsyms < SHAPE_MAX_SYMS) {
+	    if (!GetShapeTransition(mc, scope->shape, atom, &shape))
+		return 0;
+	    if (shape) {
+		sym = AddShapeSymbol(mc, scope, shape, atom);
+		if (!sym)
+		    return 0;
+		sym->entry.value = value;
+		goto init;
 	    }
 	}
-    }
-
-    if (scope->table) {
-	scope->table->allocPool = mc;
-	sym = (MochaSymbol *)PR_HashTableAdd(scope->table, atom, value);
-	if (!sym)
+	if (!MakeDictionary(mc, scope))
 	    return 0;
-	mocha_HoldAtom(mc, atom);
-    } else {
-	if (sym) {
-	    FreeSymbol(mc, &sym->entry, HT_FREE_VALUE);
-	} else {
-	    sym = (MochaSymbol *)AllocSymbol(mc);
-	    if (!sym)
-		return 0;
-	    /* Don't set sym->entry.keyHash until we know we need it. */
-	    sym->entry.key = mocha_HoldAtom(mc, atom);
-	    sym->entry.next = (PRHashEntry *)scope->list;
-	    scope->list = sym;
-	}
-	sym->entry.value = value;
     }
 
+    scope->table->allocPool = mc;
+    sym = (MochaSymbol *)PR_HashTableAdd(scope->table, atom, value);
+    if (!sym)
+	return 0;
+    mocha_HoldAtom(mc, atom);
+
+init:
+
     sym->scope = scope;
     sym->type = type;
     sym->slot = 0;
@@ -422,21 +1128,22 @@ mocha_DefineSymbol(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
 void
 mocha_RemoveSymbol(MochaContext *mc, MochaScope *scope, MochaAtom *atom)
 {
-    MochaSymbol **sp, *sym;
+    /* mc can remove only the symbols it set in a frozen scope. */
+    if (SCOPE_IS_FROZEN(scope)) {
+	scope = FindOverlay(mc, scope);
+	if (!scope)
+	    return;
+    }
 
-    if (scope->table) {
-	scope->table->allocPool = mc;
-	PR_HashTableRemove(scope->table, atom);
-    } else {
-	for (sp = &scope->list; (sym = *sp) != 0;
-	     sp = (MochaSymbol **)&sym->entry.next) {
-	    if (sym_atom(sym) == atom) {
-		*sp = (MochaSymbol *)sym->entry.next;
-		FreeSymbol(mc, &sym->entry, HT_FREE_ENTRY);
-		return;
-	    }
-	}
+    /* Shapes only grow, so a scope that loses a symbol becomes a table. */
+    if (scope->shape) {
+	if (SearchShape(scope->shape, HashAtom(atom), atom) < 0)
+	    return;
+	if (!MakeDictionary(mc, scope))
+	    return;
     }
+    scope->table->allocPool = mc;
+    PR_HashTableRemove(scope->table, atom);
 }
 
 MochaSymbol *
@@ -444,6 +1151,7 @@ mocha_SetProperty(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
 		  MochaSlot slot, MochaDatum datum)
 {
     MochaObject *obj;
+    MochaScope *first;
     MochaAtom *slotAtom;
     char buf[16];
     PRHashNumber hash;
@@ -451,7 +1159,12 @@ mocha_SetProperty(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
     MochaDatum oldDatum;
     MochaProperty *prop;
 
+    /* Look in a frozen scope, but change only mc's overlay of it. */
     obj = scope->object;
+    first = scope;
+    scope = WritableScope(mc, first);
+    if (!scope)
+	return 0;
     if (scope->table) scope->table->allocPool = mc;
 
     if (slot < 0) {
@@ -462,15 +1175,14 @@ mocha_SetProperty(MochaContext *mc, MochaScope *scope, MochaAtom *atom,
     } else {
 	/* Create canonical index name. */
 	PR_snprintf(buf, sizeof buf, "%ld", (long)slot);
-	slotAtom = mocha_Atomize(mc, buf, ATOM_NUMBER);
+	slotAtom = mocha_AtomizeNumber(mc, buf, strlen(buf), slot, 0);
 	if (!slotAtom)
 	    return 0;
-	slotAtom->fval = slot;
     }
 
     /* Look it up in scope to find a pre-existing slot datum. */
     hash = HashAtom(slotAtom);
-    if (!RawLookupSymbol(mc, scope, hash, slotAtom, MLF_SET, &sym))
+    if (!RawLookupSymbol(mc, first, hash, slotAtom, MLF_SET, &sym))
 	return 0;
     if (sym && sym->type == SYM_PROPERTY) {
 	sym->slot = slot;
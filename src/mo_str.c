@@ -8,7 +8,6 @@
 #include <string.h>
 #include "prmem.h"
 #include "prprf.h"
-#include "alloca.h"
 #include "mo_cntxt.h"
 #include "mochaapi.h"
 #include "mochalib.h"
@@ -29,7 +28,8 @@ mocha_RawDatumToString(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
 
       case MOCHA_INTERNAL:
 	PR_snprintf(buf, sizeof buf, "[internal %p]", d.u.ptr);
-	atom = mocha_Atomize(mc, buf, ATOM_HELD | ATOM_STRING);
+	atom = mocha_NewStringAtom(mc, buf, strlen(buf),
+				   ATOM_HELD | ATOM_STRING);
 	if (!atom)
 	    return MOCHA_FALSE;
 	*atomp = atom;
@@ -40,15 +40,20 @@ mocha_RawDatumToString(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
 	break;
 
       case MOCHA_SYMBOL:
-	atom = sym_atom(d.u.pair.sym);
-	str = (char *)atom_name(atom);
-	if (!isalpha(*str) && *str != '_')
-	    path = PR_smprintf("[%s]", str);
-	else
-	    path = strdup(str);
-	for (obj = d.u.pair.obj;
-	     path && obj && obj != mc->staticLink;
-	     obj = obj->parent) {
+      case MOCHA_ELEMENT:
+	if (d.tag == MOCHA_ELEMENT) {
+	    path = PR_smprintf("[%ld]", (long)d.u.elem.index);
+	    obj = d.u.elem.obj;
+	} else {
+	    atom = sym_atom(d.u.pair.sym);
+	    str = (char *)atom_name(atom);
+	    if (!isalpha(*str) && *str != '_')
+		path = PR_smprintf("[%s]", str);
+	    else
+		path = strdup(str);
+	    obj = d.u.pair.obj;
+	}
+	for (; path && obj && obj != mc->staticLink; obj = obj->parent) {
 	    name = obj->clazz->name;
 	    if (!isalpha(*name) && *name != '_')
 		str = PR_smprintf("[%s]", name);
@@ -69,7 +74,7 @@ mocha_RawDatumToString(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
 	    MOCHA_ReportOutOfMemory(mc);
 	    return MOCHA_FALSE;
 	}
-	atom = mocha_Atomize(mc, path, ATOM_STRING);
+	atom = mocha_NewStringAtom(mc, path, strlen(path), ATOM_STRING);
 	PR_FREEIF(path);
 	if (!atom)
 	    return MOCHA_FALSE;
@@ -135,13 +140,28 @@ str_finalize(MochaContext *mc, MochaObject *obj)
     MochaAtom *atom;
 
     atom = obj->data;
-    mocha_DropAtom(mc, atom);
+    if (atom)
+	mocha_DropAtom(mc, atom);
+}
+
+static MochaBoolean
+str_clone(MochaContext *mc, MochaObject *obj, MochaObject *copy,
+	  MochaCloner *cl)
+{
+    (void)cl;
+    if (obj->data) {
+	copy->data = mocha_CloneAtom(mc, obj->data);
+	if (!copy->data)
+	    return MOCHA_FALSE;
+    }
+    return MOCHA_TRUE;
 }
 
 static MochaClass string_class = {
     "String",
     str_get_property, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub, MOCHA_ConvertStub, str_finalize
+    MOCHA_ResolveStub, MOCHA_ConvertStub, str_finalize,
+    str_clone
 };
 
 /*
@@ -153,7 +173,6 @@ str_substring(MochaContext *mc, MochaObject *obj,
 {
     MochaAtom *atom;
     const char *str;
-    char *sub;
     int len, begin, end;
 
     if (!MOCHA_InstanceOf(mc, obj, &string_class, argv[-1].u.fun))
@@ -181,10 +200,7 @@ str_substring(MochaContext *mc, MochaObject *obj,
 	}
 
 	len = end - begin;
-	sub = (char *)alloca(len + 1);
-	strncpy(sub, str + begin, len);
-	sub[len] = '\0';
-	atom = mocha_Atomize(mc, sub, ATOM_STRING);
+	atom = mocha_NewStringAtom(mc, str + begin, len, ATOM_STRING);
 	if (!atom)
 	    return MOCHA_FALSE;
     }
@@ -210,17 +226,21 @@ str_to_lowercase(MochaContext *mc, MochaObject *obj,
 		 unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
     MochaAtom *atom;
-    char *str, *str1;
+    char *str;
     const char *str2;
+    size_t i;
 
     if (!MOCHA_InstanceOf(mc, obj, &string_class, argv[-1].u.fun))
 	return MOCHA_FALSE;
     atom = obj->data;
-    str = (char *)alloca(atom->length + 1);
-    for (str1 = str, str2 = atom_name(atom); (*str1 = tolower(*str2)) != '\0';
-	 str1++, str2++)
-	;
-    atom = mocha_Atomize(mc, str, ATOM_STRING);
+    str = MOCHA_malloc(mc, atom->length + 1);
+    if (!str)
+	return MOCHA_FALSE;
+    str2 = atom_name(atom);
+    for (i = 0; i < atom->length; i++)
+	str[i] = tolower(str2[i]);
+    atom = mocha_NewStringAtom(mc, str, atom->length, ATOM_STRING);
+    MOCHA_free(mc, str);
     if (!atom)
 	return MOCHA_FALSE;
     MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
@@ -232,17 +252,21 @@ str_to_uppercase(MochaContext *mc, MochaObject *obj,
 		 unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
     MochaAtom *atom;
-    char *str, *str1;
+    char *str;
     const char *str2;
+    size_t i;
 
     if (!MOCHA_InstanceOf(mc, obj, &string_class, argv[-1].u.fun))
 	return MOCHA_FALSE;
     atom = obj->data;
-    str = (char *)alloca(atom->length + 1);
-    for (str1 = str, str2 = atom_name(atom); (*str1 = toupper(*str2)) != '\0';
-	 str1++, str2++)
-	;
-    atom = mocha_Atomize(mc, str, ATOM_STRING);
+    str = MOCHA_malloc(mc, atom->length + 1);
+    if (!str)
+	return MOCHA_FALSE;
+    str2 = atom_name(atom);
+    for (i = 0; i < atom->length; i++)
+	str[i] = toupper(str2[i]);
+    atom = mocha_NewStringAtom(mc, str, atom->length, ATOM_STRING);
+    MOCHA_free(mc, str);
     if (!atom)
 	return MOCHA_FALSE;
     MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
@@ -272,7 +296,7 @@ str_char_at(MochaContext *mc, MochaObject *obj,
 	str = atom_name(atom);
 	buf[0] = str[index];
 	buf[1] = '\0';
-	atom = mocha_Atomize(mc, buf, ATOM_STRING);
+	atom = mocha_NewStringAtom(mc, buf, 1, ATOM_STRING);
 	if (!atom)
 	    return MOCHA_FALSE;
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_STRING, u.atom, atom);
@@ -280,6 +304,29 @@ str_char_at(MochaContext *mc, MochaObject *obj,
     return MOCHA_TRUE;
 }
 
+/*
+** Find the first occurrence of the sublen chars at sub in the len chars at
+** str, either of which may contain NULs.  Return 0 if there is none.
+*/
+static const char *
+FindChars(const char *str, size_t len, const char *sub, size_t sublen)
+{
+    const char *last;
+
+    if (sublen == 0)
+	return str;
+    if (sublen > len)
+	return 0;
+    last = str + len - sublen;
+    while (str <= last &&
+	   (str = memchr(str, *sub, last - str + 1)) != 0) {
+	if (memcmp(str, sub, sublen) == 0)
+	    return str;
+	str++;
+    }
+    return 0;
+}
+
 static MochaBoolean
 str_index_of(MochaContext *mc, MochaObject *obj,
 	     unsigned argc, MochaDatum *argv, MochaDatum *rval)
@@ -299,6 +346,8 @@ str_index_of(MochaContext *mc, MochaObject *obj,
     } else {
 	index = 0;
     }
+    if (index < 0)
+	index = 0;
     if (index >= atom->length) {
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_NUMBER, u.fval, -1);
     } else {
@@ -306,7 +355,8 @@ str_index_of(MochaContext *mc, MochaObject *obj,
 	    return MOCHA_FALSE;
 	str1 = atom_name(atom);
 	str2 = atom_name(atom2);
-	str = strstr(str1 + index, str2);
+	str = FindChars(str1 + index, atom->length - index,
+			str2, atom2->length);
 	index = str ? str - str1 : -1;
 	mocha_DropAtom(mc, atom2);
 	MOCHA_INIT_DATUM(mc, rval, MOCHA_NUMBER, u.fval, index);
@@ -321,7 +371,7 @@ str_last_index_of(MochaContext *mc, MochaObject *obj,
     MochaAtom *atom, *atom2;
     const char *str, *str2;
     MochaFloat fval;
-    int from, len2, i;
+    int from, len, len2, i;
 
     if (!MOCHA_InstanceOf(mc, obj, &string_class, argv[-1].u.fun))
 	return MOCHA_FALSE;
@@ -338,9 +388,13 @@ str_last_index_of(MochaContext *mc, MochaObject *obj,
 	return MOCHA_FALSE;
     str = atom_name(atom);
     str2 = atom_name(atom2);
-    len2 = strlen(str2);
-    for (i = (from >= atom->length) ? atom->length - 1 : from; i >= 0; i--) {
-	if (strncmp(str + i, str2, len2) == 0)
+    len = (int)atom->length;
+    len2 = (int)atom2->length;
+    i = (from >= len) ? len - 1 : from;
+    if (len2 != 0 && i > len - len2)
+	i = len - len2;
+    for (; i >= 0; i--) {
+	if (memcmp(str + i, str2, len2) == 0)
 	    break;
     }
     mocha_DropAtom(mc, atom2);
@@ -379,8 +433,8 @@ str_split(MochaContext *mc, MochaObject *obj,
     MochaAtom *atom, *arg;
     unsigned len, i;
     MochaDatum *vec, d;
-    char *str, *tok, *end, save;
-    const char *sep;
+    const char *str, *limit, *tok, *end, *sep;
+    size_t seplen;
     MochaObject *aobj;
 
     atom = obj->data;
@@ -391,32 +445,27 @@ str_split(MochaContext *mc, MochaObject *obj,
 	len = 1;
 	vec = &d;
     } else {
-	str = MOCHA_strdup(mc, atom_name(atom));
-	if (!str)
-	    return MOCHA_FALSE;
-	if (!mocha_DatumToString(mc, argv[0], &arg)) {
-	    MOCHA_free(mc, str);
+	str = atom_name(atom);
+	limit = str + atom->length;
+	if (!mocha_DatumToString(mc, argv[0], &arg))
 	    return MOCHA_FALSE;
-	}
 	sep = atom_name(arg);
+	seplen = arg->length;
 	len = 1;
-#define STRSTR(tok,sep)	(*(sep) ? strstr(tok, sep) : (tok[1] ? tok + 1 : 0))
-	for (tok = str; (tok = STRSTR(tok, sep)) != 0; tok += arg->length)
+#define FINDSEP(tok)	(seplen ? FindChars(tok, limit - (tok), sep, seplen)   \
+				: ((tok) + 1 < limit ? (tok) + 1 : 0))
+	for (tok = str; (tok = FINDSEP(tok)) != 0; tok += seplen)
 	    len++;
 	vec = MOCHA_malloc(mc, len * sizeof *vec);
 	if (!vec) {
-	    MOCHA_free(mc, str);
 	    mocha_DropAtom(mc, arg);
 	    return MOCHA_FALSE;
 	}
 	len = 0;
-	for (tok = str; ; tok = end + arg->length) {
-	    end = STRSTR(tok, sep);
-	    if (end) {
-		save = *end;
-		*end = '\0';
-	    }
-	    atom = mocha_Atomize(mc, tok, ATOM_HELD | ATOM_STRING);
+	for (tok = str; ; tok = end + seplen) {
+	    end = FINDSEP(tok);
+	    atom = mocha_NewStringAtom(mc, tok, (end ? end : limit) - tok,
+				       ATOM_HELD | ATOM_STRING);
 	    if (!atom)
 		break;
 	    MOCHA_INIT_FULL_DATUM(mc, &d, MOCHA_STRING,
@@ -424,10 +473,8 @@ str_split(MochaContext *mc, MochaObject *obj,
 				  u.atom, atom);
 	    vec[len++] = d;
 	    if (!end) break;
-	    *end = save;
 	}
-#undef STRSTR
-	MOCHA_free(mc, str);
+#undef FINDSEP
 	mocha_DropAtom(mc, arg);
 	if (!atom) {
 	    for (i = 0; i < len; i++)
@@ -490,7 +537,7 @@ tagify(MochaContext *mc, MochaObject *obj, MochaDatum *argv,
 	MOCHA_ReportOutOfMemory(mc);
 	return 0;
     }
-    atom = mocha_Atomize(mc, tagbuf, ATOM_STRING);
+    atom = mocha_NewStringAtom(mc, tagbuf, strlen(tagbuf), ATOM_STRING);
     free((char *)tagbuf);
     return atom;
 }
@@ -13,7 +13,7 @@
 **   - result   : the value of the final top-level expression
 **
 ** Nothing here is gated behind -DDEBUG; the engine stays a black box apart
-** from the single mocha_TraceHook call wired into the interpreter loop.
+** from the single trace hook call wired into the interpreter loop.
 */
 #include <math.h>
 #include <stdarg.h>
@@ -192,6 +192,7 @@ datum_type_name(uint8 tag)
       case MOCHA_INTERNAL: return "internal";
       case MOCHA_ATOM:     return "atom";
       case MOCHA_SYMBOL:   return "symbol";
+      case MOCHA_ELEMENT:  return "element";
       case MOCHA_FUNCTION: return "function";
       case MOCHA_OBJECT:   return "object";
       case MOCHA_NUMBER:   return "number";
@@ -210,6 +211,8 @@ op_format_name(MochaOpFormat f)
       case MOF_INCOP: return "incop";
       case MOF_ARGC:  return "argc";
       case MOF_CONST: return "const";
+      case MOF_LOCAL: return "local";
+      case MOF_LOCALINC: return "localinc";
       default:        return "byte";
     }
 }
@@ -256,6 +259,10 @@ emit_datum(StrBuf *b, MochaDatum d)
       case MOCHA_SYMBOL:
         sb_jstr(b, d.u.pair.sym ? atom_name(sym_atom(d.u.pair.sym)) : "symbol");
         break;
+      case MOCHA_ELEMENT:
+        snprintf(num, sizeof num, "%ld", (long)d.u.elem.index);
+        sb_jstr(b, num);
+        break;
       default:
         sb_jstr(b, "?");
     }
@@ -440,8 +447,14 @@ emit_script_bytecode(StrBuf *b, MochaContext *mc, MochaScript *script)
             sb_jstr(b, pc[1] ? "post" : "pre");
             break;
           case MOF_ARGC:
+          case MOF_LOCAL:
             sb_putf(b, "%u", pc[1]);
             break;
+          case MOF_LOCALINC:
+            sb_putf(b, "{\"slot\":%u,\"order\":", pc[1]);
+            sb_jstr(b, pc[2] ? "post" : "pre");
+            sb_putc(b, '}');
+            break;
           case MOF_CONST:
             atom = GET_CONST_ATOM(mc, script, pc);
             if (op == MOP_NUMBER && atom) {
@@ -495,8 +508,8 @@ emit_tokens(StrBuf *b, MochaContext *mc, const char *src)
             ;   /* still record this final token */
 
         line = ts->lineno;
-        col = (ts->token.ptr && ts->linebuf.base)
-              ? (int)(ts->token.ptr - ts->linebuf.base) : 0;
+        col = (ts->token.ptr && ts->linestart)
+              ? (int)(ts->token.ptr - ts->linestart) : 0;
 
         if (!first)
             sb_putc(b, ',');
@@ -571,7 +584,8 @@ js_error_reporter(MochaContext *mc, const char *message,
 static MochaClass global_class = {
     "global",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub
+    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub,
+    0
 };
 
 static MochaFunctionSpec web_functions[] = {
@@ -591,9 +605,6 @@ mocha_DestroyJavaContext(MochaContext *mc)
 {
 }
 
-/* The trace-hook global the interpreter calls (default: disabled). */
-MochaTraceHook mocha_TraceHook = 0;
-
 /* ------------------------------------------------------------------ */
 /* Entry point                                                        */
 /* ------------------------------------------------------------------ */
@@ -649,10 +660,10 @@ mocha_run_json(const char *source)
                                  "<playground>", 1);
     if (script) {
         script_id(script, "<main>");
-        mocha_TraceHook = trace_hook;
+        mocha_SetTraceHook(mc, trace_hook);
         MOCHA_SetBranchCallback(mc, branch_cb);
         ok = MOCHA_ExecuteScript(mc, glob, script, &result);
-        mocha_TraceHook = 0;
+        mocha_SetTraceHook(mc, 0);
         MOCHA_SetBranchCallback(mc, 0);
     }
 
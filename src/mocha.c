@@ -9,11 +9,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include "prlog.h"
-#include "alloca.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#endif
 #include "mo_atom.h"
 #include "mo_bcode.h"
 #include "mo_cntxt.h"
+#include "mo_parse.h"
 #include "mo_scope.h"
+#include "mo_value.h"
 #include "mocha.h"
 #include "mochaapi.h"
 #include "mochalib.h"
@@ -23,11 +27,6 @@
 # include "mo_emit.h"	/* for mocha_PCtoLineNumber() */
 #endif
 
-static void stub_taint_counter(MochaContext *mc, uint16 taint) { }
-
-MochaTaintCounter mocha_HoldTaint = stub_taint_counter;
-MochaTaintCounter mocha_DropTaint = stub_taint_counter;
-
 /*
 ** MochaDatum tag values used only in this file, for secret stack data types.
 ** If Properties and ObjectStacks were Objects, mocha_Hold/DropRef() might be
@@ -36,6 +35,7 @@ MochaTaintCounter mocha_DropTaint = stub_taint_counter;
 */
 #define MOCHA_PROPERTY		255	/* u.pair, but obj+prop not obj+sym */
 #define MOCHA_OBJECTSTACK	254	/* u.ptr, points at MochaObjectStack */
+#define MOCHA_ITERATOR		253	/* u.elem, next for-in element index */
 
 /*
 ** Hold and release object references from a stack datum, a global variable,
@@ -52,14 +52,17 @@ mocha_HoldRef(MochaContext *mc, MochaDatum *dp)
       case MOCHA_SYMBOL:
 	MOCHA_HoldObject(mc, dp->u.pair.obj);
 	break;
+      case MOCHA_ELEMENT:
+	MOCHA_HoldObject(mc, dp->u.elem.obj);
+	break;
       case MOCHA_FUNCTION:
       case MOCHA_OBJECT:
 	if ((dp->flags & MDF_BACKEDGE) == 0)
 	    MOCHA_HoldObject(mc, dp->u.obj);
 	break;
     }
-    if (dp->taint != MOCHA_TAINT_IDENTITY)
-	(*mocha_HoldTaint)(mc, dp->taint);
+    if (dp->taint != MOCHA_TAINT_IDENTITY && mc->holdTaint)
+	(*mc->holdTaint)(mc, dp->taint);
 }
 
 void
@@ -84,6 +87,12 @@ mocha_DropRef(MochaContext *mc, MochaDatum *dp)
 	}
 	break;
 
+      case MOCHA_ELEMENT:
+	dp->u.elem.obj = MOCHA_DropObject(mc, dp->u.elem.obj);
+	if (!dp->u.elem.obj)
+	    dp->tag = MOCHA_UNDEF;
+	break;
+
       case MOCHA_FUNCTION:
       case MOCHA_OBJECT:
 	if ((dp->flags & MDF_BACKEDGE) == 0) {
@@ -103,6 +112,12 @@ mocha_DropRef(MochaContext *mc, MochaDatum *dp)
 	}
 	break;
 
+      case MOCHA_ITERATOR:
+	PR_ASSERT(dp->u.elem.obj);
+	MOCHA_DropObject(mc, dp->u.elem.obj);
+	dp->u.elem.obj = 0;
+	break;
+
       case MOCHA_OBJECTSTACK:
 	top = dp->u.ptr;
 	PR_ASSERT(top && top->object);
@@ -110,8 +125,141 @@ mocha_DropRef(MochaContext *mc, MochaDatum *dp)
 	dp->u.ptr = 0;
 	break;
     }
-    if (dp->taint != MOCHA_TAINT_IDENTITY)
-	(*mocha_DropTaint)(mc, dp->taint);
+    if (dp->taint != MOCHA_TAINT_IDENTITY && mc->dropTaint)
+	(*mc->dropTaint)(mc, dp->taint);
+}
+
+/*
+** Convert between datums and compact values; see mo_value.h.
+*/
+typedef union MochaValueBits {
+    MochaFloat          fval;
+    MochaValue          value;
+} MochaValueBits;
+
+MochaBoolean
+mocha_BoxDatum(MochaDatum *dp, MochaValue *vp)
+{
+    MochaValueBits bits;
+    uint32 tag;
+    void *ptr;
+
+    if (dp->taint != MOCHA_TAINT_IDENTITY ||
+	(dp->flags & MDF_ALLFLAGS & ~(MDF_ENUMERATE | MDF_INT))) {
+	return MOCHA_FALSE;
+    }
+    if (!(dp->flags & MDF_ENUMERATE)) {
+	if (!MOCHA_DATUM_IS_NULL(*dp))
+	    return MOCHA_FALSE;
+	*vp = MOCHA_VALUE_HOLE;
+	return MOCHA_TRUE;
+    }
+    switch (dp->tag) {
+      case MOCHA_UNDEF:
+	*vp = MOCHA_MAKE_VALUE(MVT_UNDEF, 0);
+	return MOCHA_TRUE;
+      case MOCHA_NUMBER:
+	/* Keep a NaN's sign, which number-to-string conversion shows. */
+	bits.fval = dp->u.fval;
+	*vp = bits.value;
+	if (dp->u.fval != dp->u.fval)
+	    *vp = (*vp & MOCHA_VALUE_SIGN) | MOCHA_VALUE_NAN;
+	return MOCHA_TRUE;
+      case MOCHA_BOOLEAN:
+	*vp = MOCHA_MAKE_VALUE(MVT_BOOLEAN, dp->u.bval != 0);
+	return MOCHA_TRUE;
+      case MOCHA_STRING:
+	tag = MVT_STRING;
+	ptr = dp->u.atom;
+	break;
+      case MOCHA_OBJECT:
+	tag = MVT_OBJECT;
+	ptr = dp->u.obj;
+	break;
+      case MOCHA_FUNCTION:
+	tag = MVT_FUNCTION;
+	ptr = dp->u.fun;
+	break;
+      default:
+	return MOCHA_FALSE;
+    }
+    if ((MochaValue)(uprword_t)ptr > MOCHA_VALUE_PAYLOAD)
+	return MOCHA_FALSE;
+    *vp = MOCHA_MAKE_VALUE(tag, (uprword_t)ptr);
+    return MOCHA_TRUE;
+}
+
+void
+mocha_UnboxValue(MochaContext *mc, MochaValue v, MochaDatum *dp)
+{
+    MochaValueBits bits;
+
+    (void)mc;
+    if (MOCHA_VALUE_IS_NUMBER(v)) {
+	bits.value = v;
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_NUMBER, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.fval, bits.fval);
+	return;
+    }
+    switch (MOCHA_VALUE_TAG(v)) {
+      case MVT_UNDEF:
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_UNDEF, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.ptr, 0);
+	break;
+      case MVT_BOOLEAN:
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_BOOLEAN, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.bval,
+			      (MochaBoolean)(v & 1));
+	break;
+      case MVT_STRING:
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_STRING, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.atom,
+			      MOCHA_VALUE_TO_PTR(v));
+	break;
+      case MVT_OBJECT:
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_OBJECT, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.obj,
+			      MOCHA_VALUE_TO_PTR(v));
+	break;
+      case MVT_FUNCTION:
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_FUNCTION, MDF_ENUMERATE,
+			      MOCHA_TAINT_IDENTITY, u.fun,
+			      MOCHA_VALUE_TO_PTR(v));
+	break;
+      default:
+	PR_ASSERT(v == MOCHA_VALUE_HOLE);
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_OBJECT, 0,
+			      MOCHA_TAINT_IDENTITY, u.obj, 0);
+	break;
+    }
+}
+
+void
+mocha_HoldValue(MochaContext *mc, MochaValue v)
+{
+    switch (MOCHA_VALUE_TAG(v)) {
+      case MVT_STRING:
+	mocha_HoldAtom(mc, MOCHA_VALUE_TO_PTR(v));
+	break;
+      case MVT_OBJECT:
+      case MVT_FUNCTION:
+	MOCHA_HoldObject(mc, MOCHA_VALUE_TO_PTR(v));
+	break;
+    }
+}
+
+void
+mocha_DropValue(MochaContext *mc, MochaValue v)
+{
+    switch (MOCHA_VALUE_TAG(v)) {
+      case MVT_STRING:
+	mocha_DropAtom(mc, MOCHA_VALUE_TO_PTR(v));
+	break;
+      case MVT_OBJECT:
+      case MVT_FUNCTION:
+	MOCHA_DropObject(mc, MOCHA_VALUE_TO_PTR(v));
+	break;
+    }
 }
 
 /*
@@ -152,6 +300,110 @@ ReportStackOverflow(MochaContext *mc)
 		      : "top-level");
 }
 
+/*
+** Slots beyond a script's depth that mocha_Interpret() and EnterFrame() make
+** room for, so that MOP_INC and MOP_DEC can call an assign method.
+*/
+#define STACK_SLOP      3
+
+/*
+** Free the spare stack segment, if any.
+*/
+static void
+FreeSpare(MochaContext *mc)
+{
+    MochaStack *sp;
+    MochaStackSegment *seg;
+
+    sp = &mc->stack;
+    seg = sp->spare;
+    if (!seg)
+	return;
+    sp->spare = 0;
+    MOCHA_free(mc, seg);
+}
+
+/*
+** Push a new stack segment with room for at least nslots, saving the top of
+** the current one.  Only datums in use count against the stack's limit, so
+** the unused end of a segment costs no depth.  Reuse the spare segment if it
+** is big enough; otherwise allocate one twice the size of the current
+** segment, or nslots if that is bigger, but no more than the limit leaves.
+** Return false, having reported the error, if the stack can't grow by nslots.
+*/
+static MochaBoolean
+GrowStack(MochaContext *mc, size_t nslots)
+{
+    MochaStack *sp;
+    MochaStackSegment *seg;
+    size_t used, room, length;
+
+    sp = &mc->stack;
+    used = sp->below + (sp->ptr - sp->base);
+    room = sp->maxbytes / sizeof(MochaDatum);
+    room = (used < room) ? room - used : 0;
+    if (room < nslots) {
+	ReportStackOverflow(mc);
+	return MOCHA_FALSE;
+    }
+    seg = sp->spare;
+    if (seg) {
+	length = seg->limit - seg->base;
+	if (length < nslots || length > room) {
+	    FreeSpare(mc);
+	    seg = 0;
+	}
+    }
+    if (!seg) {
+	length = 2 * (sp->limit - sp->base);
+	if (length < nslots)
+	    length = nslots;
+	if (length > room)
+	    length = room;
+
+	/* The datums follow the segment, whose four pointers align them. */
+	seg = MOCHA_malloc(mc, sizeof *seg + length * sizeof(MochaDatum));
+	if (!seg)
+	    return MOCHA_FALSE;
+	seg->base = (MochaDatum *)(seg + 1);
+	seg->limit = seg->base + length;
+    }
+    sp->spare = 0;
+
+    sp->below = used;
+    sp->segment->ptr = sp->ptr;
+    seg->down = sp->segment;
+    sp->segment = seg;
+    sp->base = sp->ptr = seg->base;
+    sp->limit = seg->limit;
+    return MOCHA_TRUE;
+}
+
+/*
+** Pop the current stack segment, which must be empty, and resume the one
+** under it.  Keep the popped segment as the spare, freeing the old spare.
+*/
+static void
+ShrinkStack(MochaContext *mc)
+{
+    MochaStack *sp;
+    MochaStackSegment *seg;
+
+    sp = &mc->stack;
+    seg = sp->segment;
+    PR_ASSERT(sp->ptr == sp->base && seg->down);
+    FreeSpare(mc);
+    sp->spare = seg;
+
+    seg = seg->down;
+    sp->segment = seg;
+    sp->base = seg->base;
+    sp->limit = seg->limit;
+    sp->ptr = seg->ptr;
+    PR_ASSERT(sp->below >= (size_t)(sp->ptr - sp->base));
+    sp->below -= sp->ptr - sp->base;
+}
+
 static void
 PushSymbol(MochaContext *mc, MochaObject *obj, MochaSymbol *sym)
 {
@@ -164,6 +416,18 @@ PushSymbol(MochaContext *mc, MochaObject *obj, MochaSymbol *sym)
     Push(mc, d);
 }
 
+static void
+PushElement(MochaContext *mc, MochaObject *obj, MochaSlot index)
+{
+    MochaElement elem;
+    MochaDatum d;
+
+    elem.obj = obj, elem.index = index;
+    MOCHA_INIT_FULL_DATUM(mc, &d, MOCHA_ELEMENT, 0, mc->taintInfo->accum,
+			  u.elem, elem);
+    Push(mc, d);
+}
+
 static void
 PushObject(MochaContext *mc, MochaObject *obj)
 {
@@ -184,6 +448,41 @@ PushNumber(MochaContext *mc, MochaFloat fval)
     Push(mc, d);
 }
 
+/*
+** A number that the interpreter knows to be an int32 has MDF_INT set and its
+** value in u.num.ival as well as in u.fval, which natives and API clients
+** read.  Integer ops take ival without converting fval, and push an int when
+** their result fits; see mo_interp.h.  MOCHA_INIT_DATUM clears MDF_INT, so
+** only copies of a whole union from an int datum set it again.
+*/
+#define INIT_INT_DATUM(MC, DP, TAINT, IVAL)                                   \
+    NSPR_BEGIN_MACRO                                                          \
+	MOCHA_INIT_FULL_DATUM(MC, DP, MOCHA_NUMBER, 0, TAINT,                 \
+			      u.num.fval, IVAL);                              \
+	(DP)->u.num.ival = IVAL;                                              \
+	(DP)->flags |= MDF_INT;                                               \
+    NSPR_END_MACRO
+
+#define COPY_INT_FLAG(DP, S)    ((DP)->flags |= (S).flags & MDF_INT)
+
+static void
+PushInt(MochaContext *mc, MochaInt ival)
+{
+    MochaDatum d;
+
+    INIT_INT_DATUM(mc, &d, mc->taintInfo->accum, ival);
+    Push(mc, d);
+}
+
+static void
+PushUint(MochaContext *mc, MochaUint uval)
+{
+    if (uval <= MOCHA_INT_MAX)
+	PushInt(mc, (MochaInt)uval);
+    else
+	PushNumber(mc, uval);
+}
+
 static void
 PushBoolean(MochaContext *mc, MochaBoolean bval)
 {
@@ -204,6 +503,12 @@ PushString(MochaContext *mc, MochaAtom *atom)
     Push(mc, d);
 }
 
+/*
+** An operand that is already an untainted number is popped without the
+** general resolve and convert calls.  PopInt takes an int operand's ival as
+** is, and converts any other number to a MochaInt only after a range check,
+** as casting a double that doesn't fit is undefined.
+*/
 static MochaBoolean
 PopNumber(MochaContext *mc, MochaFloat *fvalp)
 {
@@ -211,29 +516,97 @@ PopNumber(MochaContext *mc, MochaFloat *fvalp)
     MochaBoolean ok;
 
     d = Pop(mc, MOCHA_FALSE);
+    if (d.tag == MOCHA_NUMBER && d.taint == MOCHA_TAINT_IDENTITY) {
+	*fvalp = d.u.fval;
+	return MOCHA_TRUE;
+    }
     ok = mocha_DatumToNumber(mc, d, fvalp);
     mocha_DropRef(mc, &d);
     return ok;
 }
 
+/*
+** Set *ivalp to fval as a MochaInt and return true if fval is an integer
+** that a MochaInt or MochaUint can hold, else return false.
+*/
+static MochaBoolean
+FloatToInt(MochaFloat fval, MochaInt *ivalp)
+{
+#ifdef XP_PC
+    if (MOCHA_FLOAT_IS_NaN(fval))
+	return MOCHA_FALSE;
+#endif
+    if (fval >= -2147483648.0 && fval < 2147483648.0) {
+	*ivalp = (MochaInt)fval;
+	return (MochaFloat)*ivalp == fval;
+    }
+    if (fval >= 0 && fval < 4294967296.0) {
+	*ivalp = (MochaInt)(MochaUint)fval;
+	return (MochaFloat)(MochaUint)*ivalp == fval;
+    }
+    return MOCHA_FALSE;
+}
+
+/*
+** Set *ivalp to the sum, difference or product of ival and ival2 and return
+** true, or return false if it does not fit in a MochaInt, or is -0.  The
+** checks come before the operation, as signed overflow is undefined.  A
+** product of two MochaInts is not always exact as a MochaFloat, but it is
+** when it fits.
+*/
+static MochaBoolean
+AddInts(MochaInt ival, MochaInt ival2, MochaInt *ivalp)
+{
+    if ((ival2 >= 0) ? ival > (MochaInt)MOCHA_INT_MAX - ival2
+		     : ival < MOCHA_INT_MIN - ival2) {
+	return MOCHA_FALSE;
+    }
+    *ivalp = ival + ival2;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+SubInts(MochaInt ival, MochaInt ival2, MochaInt *ivalp)
+{
+    if ((ival2 >= 0) ? ival < MOCHA_INT_MIN + ival2
+		     : ival > (MochaInt)MOCHA_INT_MAX + ival2) {
+	return MOCHA_FALSE;
+    }
+    *ivalp = ival - ival2;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+MulInts(MochaInt ival, MochaInt ival2, MochaInt *ivalp)
+{
+    MochaFloat fval;
+
+    fval = (MochaFloat)ival * ival2;
+    if (fval < MOCHA_INT_MIN || fval > MOCHA_INT_MAX)
+	return MOCHA_FALSE;
+    if (fval == 0 && (ival < 0 || ival2 < 0))
+	return MOCHA_FALSE;
+    *ivalp = (MochaInt)fval;
+    return MOCHA_TRUE;
+}
+
 static MochaBoolean
 PopInt(MochaContext *mc, MochaInt *ivalp, MochaBoolean *validp)
 {
+    MochaDatum *dp;
     MochaFloat fval;
-    MochaInt ival;
 
+    dp = &mc->stack.ptr[-1];
+    if (dp->tag == MOCHA_NUMBER && (dp->flags & MDF_INT) &&
+	dp->taint == MOCHA_TAINT_IDENTITY) {
+	*ivalp = dp->u.num.ival;
+	(void) Pop(mc, MOCHA_FALSE);
+	return MOCHA_TRUE;
+    }
     if (!PopNumber(mc , &fval))
 	return MOCHA_FALSE;
-    ival = (MochaInt)fval;
-    *ivalp = ival;
-#ifdef XP_PC
-    if (MOCHA_FLOAT_IS_NaN(fval)) {
+    if (!FloatToInt(fval, ivalp))
 	*validp = MOCHA_FALSE;
-	return MOCHA_TRUE;
-    }
-#endif
-    *validp &= ((MochaFloat)ival == fval ||
-		(MochaFloat)(MochaUint)ival == fval);
     return MOCHA_TRUE;
 }
 
@@ -302,7 +675,8 @@ MochaDatum *
 mocha_ResolveVariable(MochaContext *mc, MochaSymbol *sym)
 {
     MochaStackFrame *fp, *fp2;
-    MochaDatum *vp;
+    MochaStackSegment *seg;
+    MochaDatum *vp, **topp, *limit;
     MochaSlot nvars, delta;
     ptrdiff_t nbytes;
 
@@ -322,26 +696,48 @@ mocha_ResolveVariable(MochaContext *mc, MochaSymbol *sym)
 	nvars = sym->slot + 1;
 	delta = nvars - fp->nvars;
 	if (delta > 0) {
-	    /* XXX over-conservative */
-	    if (fp->vars + nvars + mc->script->depth > mc->stack.limit) {
+	    /*
+	    ** Find the top of the stack segment holding fp's slots, which is
+	    ** older than the current segment if a script called by fp (e.g.,
+	    ** by eval) needed a new one.  XXX over-conservative
+	    */
+	    vp = &fp->vars[fp->nvars];
+	    seg = mc->stack.segment;
+	    if (vp >= mc->stack.base && vp <= mc->stack.limit) {
+		topp = &mc->stack.ptr;
+		limit = mc->stack.limit - mc->script->depth;
+	    } else {
+		do {
+		    seg = seg->down;
+		} while (vp < seg->base || vp > seg->limit);
+		topp = &seg->ptr;
+		limit = seg->limit;
+	    }
+	    if (*topp + delta > limit) {
 		ReportStackOverflow(mc);
 		return 0;
 	    }
 
 	    /* Add delta slots to the current stack frame. */
-	    vp = &fp->vars[fp->nvars];
 	    fp->nvars = nvars;
-	    nbytes = (char *)mc->stack.ptr - (char *)vp;
+	    nbytes = (char *)*topp - (char *)vp;
 	    PR_ASSERT(nbytes >= 0);
 	    if (nbytes > 0)
 		memmove(vp + delta, vp, nbytes);
-	    mc->stack.ptr += delta;
 
-	    /* Run down the stack frames from top to fp, fixing pointers. */
+	    /*
+	    ** Run down the stack frames from top to fp, fixing pointers into
+	    ** the moved slots.
+	    */
 	    for (fp2 = mc->stack.frame; fp2 != fp; fp2 = fp2->down) {
-		fp2->argv += delta;
-		fp2->vars += delta;
+		if (fp2->argv > vp && fp2->argv <= *topp) {
+		    fp2->argv += delta;
+		    fp2->vars += delta;
+		}
 	    }
+	    *topp += delta;
+	    if (seg != mc->stack.segment)
+		mc->stack.below += delta;
 
 	    /* Clear the new slots. */
 	    do {
@@ -368,7 +764,15 @@ mocha_ResolveValue(MochaContext *mc, MochaDatum *dp)
 
     if (!mocha_ResolveSymbol(mc, dp, MLF_GET))
 	return MOCHA_FALSE;
-    if (dp->tag != MOCHA_SYMBOL) {
+    if (dp->tag == MOCHA_ELEMENT) {
+	if (!mocha_GetArrayElement(mc, dp->u.elem.obj, dp->u.elem.index,
+				   &rval)) {
+	    return MOCHA_FALSE;
+	}
+	MOCHA_INIT_DATUM(mc, dp, rval.tag, u, rval.u);
+	COPY_INT_FLAG(dp, rval);
+	MOCHA_MIX_TAINT(mc, dp->taint, rval.taint);
+    } else if (dp->tag != MOCHA_SYMBOL) {
 	if (dp->tag == MOCHA_ATOM) {
 	    MOCHA_ReportError(mc, "%s is not defined", atom_name(dp->u.atom));
 	    return MOCHA_FALSE;
@@ -391,6 +795,7 @@ mocha_ResolveValue(MochaContext *mc, MochaDatum *dp)
 		}
 	    }
 	    MOCHA_INIT_FULL_DATUM(mc, dp, vp->tag, 0, vp->taint, u, vp->u);
+	    COPY_INT_FLAG(dp, *vp);
 	    break;
 
 	  case SYM_PROPERTY:
@@ -406,6 +811,14 @@ mocha_ResolveValue(MochaContext *mc, MochaDatum *dp)
 /* XXX cope with naughty mo_java.c and lm_img.c (and others?) */
 if (rval.tag == MOCHA_STRING && !rval.u.atom) rval.u.atom = MOCHA_empty.u.atom;
 
+	    /* Other threads may be reading a shared property, so leave it. */
+	    if (SCOPE_IS_FROZEN(sym->scope)) {
+		MOCHA_INIT_DATUM(mc, dp, rval.tag, u, rval.u);
+		COPY_INT_FLAG(dp, rval);
+		MOCHA_MIX_TAINT(mc, dp->taint, rval.taint);
+		break;
+	    }
+
 	    /* Hold any rval reference before dropping the old ref in vp. */
 	    mocha_HoldRef(mc, &rval);
 	    mocha_DropRef(mc, vp);
@@ -413,9 +826,11 @@ if (rval.tag == MOCHA_STRING && !rval.u.atom) rval.u.atom = MOCHA_empty.u.atom;
 	    /* Update vp from rval, now that OBJ_GET_PROPERTY has succeeded. */
 	    MOCHA_INIT_FULL_DATUM(mc, vp, rval.tag, rval.flags, rval.taint,
 				  u, rval.u);
+	    COPY_INT_FLAG(vp, rval);
 
 	    /* Copy most of vp to the temporary pointed at by dp. */
 	    MOCHA_INIT_DATUM(mc, dp, vp->tag, u, vp->u);
+	    COPY_INT_FLAG(dp, *vp);
 
 	    /* NB: dp may have different taint from vp. */
 	    MOCHA_MIX_TAINT(mc, dp->taint, vp->taint);
@@ -449,6 +864,7 @@ mocha_ResolvePrimitiveValue(MochaContext *mc, MochaDatum *dp)
 
 	    /* Copy most of rval to the temporary pointed at by dp. */
 	    MOCHA_INIT_DATUM(mc, dp, rval.tag, u, rval.u);
+	    COPY_INT_FLAG(dp, rval);
 
 	    /* NB: dp may have different taint from rval. */
 	    MOCHA_MIX_TAINT(mc, dp->taint, rval.taint);
@@ -470,35 +886,147 @@ ResolveString(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
     return MOCHA_TRUE;
 }
 
+/*
+** Return the untainted datum that an operand is or, if it is a symbol for a
+** variable or argument, holds, or null if getting its value takes more than
+** a load.  An operand the interpreter can peek at this way resolves to the
+** same value without mocha_ResolveValue, for the typed op bodies and the
+** type checks that quicken ops; see mo_interp.h.
+*/
+static MochaDatum *
+PeekValue(MochaDatum *dp)
+{
+    MochaSymbol *sym;
+
+    if (dp->taint != MOCHA_TAINT_IDENTITY)
+	return 0;
+    if (dp->tag == MOCHA_SYMBOL) {
+	sym = dp->u.pair.sym;
+	if (sym->type != SYM_VARIABLE && sym->type != SYM_ARGUMENT)
+	    return 0;
+	dp = sym_datum(sym);
+	if (!dp || dp->taint != MOCHA_TAINT_IDENTITY)
+	    return 0;
+    }
+    return dp;
+}
+
+static MochaBoolean
+PeekNumber(MochaDatum *dp, MochaFloat *fvalp)
+{
+    dp = PeekValue(dp);
+    if (!dp || dp->tag != MOCHA_NUMBER)
+	return MOCHA_FALSE;
+    *fvalp = dp->u.fval;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+PeekInt(MochaDatum *dp, MochaInt *ivalp)
+{
+    dp = PeekValue(dp);
+    if (!dp || dp->tag != MOCHA_NUMBER || !(dp->flags & MDF_INT))
+	return MOCHA_FALSE;
+    *ivalp = dp->u.num.ival;
+    return MOCHA_TRUE;
+}
+
+static MochaBoolean
+PeekString(MochaDatum *dp, MochaAtom **atomp)
+{
+    dp = PeekValue(dp);
+    if (!dp || dp->tag != MOCHA_STRING)
+	return MOCHA_FALSE;
+    *atomp = dp->u.atom;
+    return MOCHA_TRUE;
+}
+
+/*
+** Concatenate two strings.  A short result is copied into a loose atom, but a
+** long one is a rope that copies nothing until its name is needed, so s = s +
+** t in a loop is linear rather than quadratic.  Neither enters the table.
+*/
+#define ROPE_MIN_LENGTH 64
+
 static MochaAtom *
 CatStrings(MochaContext *mc, MochaAtom *atom1, MochaAtom *atom2)
 {
-    const char *s1, *s2;
-    char *s;
+    size_t length;
+    char s[ROPE_MIN_LENGTH];
+
+    length = atom1->length + atom2->length;
+    if (length >= ROPE_MIN_LENGTH)
+	return mocha_ConcatAtoms(mc, atom1, atom2);
+    memcpy(s, atom_name(atom1), atom1->length);
+    memcpy(s + atom1->length, atom_name(atom2), atom2->length);
+    return mocha_NewStringAtom(mc, s, length, ATOM_STRING);
+}
+
+/*
+** A function whose script the interpreter runs, rather than a native one.
+*/
+#define FUN_INTERPRETED(fun)    (!(fun)->call && (fun)->script)
+
+/*
+** Take a frame from mc's free list, or allocate one.  Return null on
+** allocation failure, which has been reported.
+*/
+static MochaStackFrame *
+NewFrame(MochaContext *mc)
+{
+    MochaStackFrame *fp;
+
+    fp = mc->stack.freeFrames;
+    if (!fp)
+	return MOCHA_malloc(mc, sizeof *fp);
+    mc->stack.freeFrames = fp->down;
+    return fp;
+}
+
+static void
+FreeFrame(MochaContext *mc, MochaStackFrame *fp)
+{
+    fp->down = mc->stack.freeFrames;
+    mc->stack.freeFrames = fp;
+}
+
+void
+mocha_FinishStack(MochaContext *mc)
+{
+    MochaStack *sp;
+    MochaStackFrame *fp;
+    MochaStackSegment *seg;
 
-    s1 = atom_name(atom1), s2 = atom_name(atom2);
-    s = (char *)alloca(strlen(s1) + strlen(s2) + 1);
-    strcat(strcpy(s, s1), s2);
-    return mocha_Atomize(mc, s, ATOM_STRING);
+    sp = &mc->stack;
+    while ((fp = sp->freeFrames) != 0) {
+	sp->freeFrames = fp->down;
+	MOCHA_free(mc, fp);
+    }
+    while ((seg = sp->segment) != &sp->first) {
+	sp->segment = seg->down;
+	MOCHA_free(mc, seg);
+    }
+    FreeSpare(mc);
 }
 
 /*
-** Call() is not stack-invariant: it pushes missing formal arguments and
-** predeclared local variables, calls the function at (sp->ptr - (argc + 1)),
-** pops all variables and arguments, and pushes the return value.
+** Begin a call to the function at (sp->ptr - (argc + 1)): resolve it and its
+** arguments, push fp as the current frame, and push missing formal arguments
+** and predeclared local variables, moving the function and its arguments to
+** a new stack segment if need be.  If the function is interpreted, also set
+** aside mc's object stack, and make the global object the parent of a
+** function that has none, until LeaveFrame().  Return false on error, which
+** has been reported, with fp not pushed.
 */
 static MochaBoolean
-Call(MochaContext *mc, unsigned argc)
+EnterFrame(MochaContext *mc, unsigned argc, MochaStackFrame *fp)
 {
     MochaDatum *vp, aval;
-    MochaBoolean ok, no_parent;
     MochaFunction *fun;
     MochaObject *obj;
-    MochaStackFrame frame;
-    int missing, nslots;
-    uint16 accum, taint;
-    unsigned i;
-    MochaObjectStack *save;
+    int missing;
+    size_t nslots;
+    uint16 accum;
 
     /* Locate the function to call under the arguments on the current stack. */
     vp = mc->stack.ptr - (argc + 1);
@@ -509,32 +1037,42 @@ Call(MochaContext *mc, unsigned argc)
     /* Resolve aval to a held function, and determine its 'this' object. */
     if (!mocha_DatumToFunction(mc, aval, &fun))
 	return MOCHA_FALSE;
+
+    /* Compile fun's body if its definition left that to the first call. */
+    if (fun->source && !mocha_CompileFunctionSource(mc, fun)) {
+	MOCHA_DropObject(mc, &fun->object);
+	return MOCHA_FALSE;
+    }
     if (fun->bound)
 	obj = MOCHA_HoldObject(mc, fun->object.parent);
     else if (aval.tag == MOCHA_SYMBOL)
 	obj = MOCHA_HoldObject(mc, aval.u.pair.obj);
+    else if (aval.tag == MOCHA_ELEMENT)
+	obj = MOCHA_HoldObject(mc, aval.u.elem.obj);
     else
 	obj = MOCHA_HoldObject(mc, mc->staticLink);
 
     /* Make vp refer to fun, which is already held so it can be popped. */
-    if (vp->taint != MOCHA_TAINT_IDENTITY)
-	(*mocha_HoldTaint)(mc, vp->taint);
+    if (vp->taint != MOCHA_TAINT_IDENTITY && mc->holdTaint)
+	(*mc->holdTaint)(mc, vp->taint);
     mocha_DropRef(mc, vp);
     MOCHA_INIT_DATUM(mc, vp, MOCHA_FUNCTION, u.fun, fun);
 
     /* Initialize a stack frame for the function. */
-    frame.fun = fun;
-    frame.thisp = obj;
-    frame.argc = argc;
-    frame.argv = mc->stack.ptr - argc;
-    frame.nvars = fun->object.scope->freeslot;
-    frame.vars = mc->stack.ptr;
-    frame.down = mc->stack.frame;
-    frame.rval = MOCHA_void;
+    fp->fun = fun;
+    fp->thisp = obj;
+    fp->argc = argc;
+    fp->argv = mc->stack.ptr - argc;
+    fp->nvars = fun->object.scope->freeslot;
+    fp->vars = mc->stack.ptr;
+    fp->down = mc->stack.frame;
+    fp->rval = MOCHA_void;
+    fp->noParent = fp->newSegment = MOCHA_FALSE;
+    fp->script = 0;
 
     /* Resolve args to values (call-by-value). */
     accum = mc->taintInfo->accum;
-    for (vp = frame.argv; vp < frame.vars; vp++) {
+    for (vp = fp->argv; vp < fp->vars; vp++) {
 	aval = *vp;
 	if (!mocha_ResolveValue(mc, &aval)) {
 	    MOCHA_DropObject(mc, obj);
@@ -547,64 +1085,221 @@ Call(MochaContext *mc, unsigned argc)
     mc->taintInfo->accum = accum;
 
     /* Now that we're done resolving args, push frame. */
-    mc->stack.frame = &frame;
+    mc->stack.frame = fp;
 
-    /* Prepare to push missing argument and predeclared variable slots. */
+    /*
+    ** Make room for missing argument and predeclared variable slots, and
+    ** for an interpreted function's script to run.  If the current stack
+    ** segment is too small, move the function and its args to a new one.
+    */
     missing = (argc < fun->nargs) ? fun->nargs - argc : 0;
-    frame.vars += missing;
-    if (frame.vars + frame.nvars > mc->stack.limit) {
-	ReportStackOverflow(mc);
-	MOCHA_DropObject(mc, obj);
-	return MOCHA_FALSE;
+    nslots = missing + fp->nvars;
+    if (FUN_INTERPRETED(fun))
+	nslots += fun->script->depth + STACK_SLOP;
+    if (mc->stack.ptr + nslots > mc->stack.limit) {
+	vp = fp->argv - 1;
+	mc->stack.ptr = vp;
+	if (!GrowStack(mc, 1 + argc + nslots)) {
+	    mc->stack.ptr = fp->vars;
+	    mc->stack.frame = fp->down;
+	    MOCHA_DropObject(mc, obj);
+	    return MOCHA_FALSE;
+	}
+	memcpy(mc->stack.ptr, vp, (1 + argc) * sizeof *vp);
+	fp->argv = mc->stack.ptr + 1;
+	mc->stack.ptr = fp->argv + argc;
+	fp->newSegment = MOCHA_TRUE;
     }
-
-    /* Save number of missing args in nslots for post-call Pop() loop. */
-    nslots = missing;
-    missing += frame.nvars;
+    fp->vars = mc->stack.ptr + missing;
+    missing += fp->nvars;
     while (--missing >= 0) {
 	MOCHA_INIT_FULL_DATUM(mc, &aval, MOCHA_UNDEF, 0, accum, u.ptr, 0);
 	Push(mc, aval);
     }
 
+    if (FUN_INTERPRETED(fun)) {
+	fp->objectStack = mc->objectStack;
+	mc->objectStack = 0;
+	if (fun->object.parent == 0 && fun->object.nrefs != MOCHA_FROZEN) {
+	    fun->object.parent = mc->globalObject;
+	    fp->noParent = MOCHA_TRUE;
+	}
+    }
+    return MOCHA_TRUE;
+}
+
+/*
+** Call the native function in fp, setting fp->rval to its held result.
+*/
+static MochaBoolean
+CallNative(MochaContext *mc, MochaStackFrame *fp)
+{
+    MochaBoolean ok;
+    uint16 taint;
+    unsigned i;
+
+    ok = (*fp->fun->call)(mc, fp->thisp, fp->argc, fp->argv, &fp->rval);
+    taint = fp->argv[-1].taint;
+    for (i = 0; i < fp->argc; i++)
+	MOCHA_MIX_TAINT(mc, taint, fp->argv[i].taint);
+    MOCHA_MIX_TAINT(mc, fp->rval.taint, taint);
+    mocha_HoldRef(mc, &fp->rval);
+    return ok;
+}
+
+/*
+** Finish the call that EnterFrame() began: pop fp's variables, arguments and
+** function, and anything else above them, undo what EnterFrame() did, and
+** push the return value.
+*/
+static void
+LeaveFrame(MochaContext *mc, MochaStackFrame *fp)
+{
+    /* Restore stack pointer, taking care to pop dynamic variables too. */
+    while (mc->stack.ptr > fp->argv - 1)
+	(void) Pop(mc, MOCHA_TRUE);
+    if (fp->newSegment)
+	ShrinkStack(mc);
+
+    if (FUN_INTERPRETED(fp->fun)) {
+	if (fp->noParent)
+	    fp->fun->object.parent = 0;
+	mc->objectStack = fp->objectStack;
+    }
+
+    /* Pop stack frame and drop the method's object. */
+    mc->stack.frame = fp->down;
+    MOCHA_DropObject(mc, fp->thisp);
+
+    /* Push return value, *then* drop any object reference held by it. */
+    Push(mc, fp->rval);
+    mocha_DropRef(mc, &fp->rval);
+}
+
+/*
+** Call() is not stack-invariant: it pushes missing formal arguments and
+** predeclared local variables, calls the function at (sp->ptr - (argc + 1)),
+** pops all variables and arguments, and pushes the return value.  It runs
+** an interpreted function's script in a new mocha_Interpret() activation;
+** the interpreter loop's own calls run the script in the same loop instead.
+*/
+static MochaBoolean
+Call(MochaContext *mc, unsigned argc)
+{
+    MochaStackFrame frame;
+    MochaFunction *fun;
+    MochaBoolean ok;
+    MochaDatum aval;
+
+    if (!EnterFrame(mc, argc, &frame))
+	return MOCHA_FALSE;
+
     /* Call the function, which is either native or interpreted. */
+    fun = frame.fun;
     if (fun->call) {
-	ok = (*fun->call)(mc, obj, argc, frame.argv, &frame.rval);
-	taint = frame.argv[-1].taint;
-	for (i = 0; i < argc; i++)
-	    MOCHA_MIX_TAINT(mc, taint, frame.argv[i].taint);
-	MOCHA_MIX_TAINT(mc, frame.rval.taint, taint);
-	mocha_HoldRef(mc, &frame.rval);
+	ok = CallNative(mc, &frame);
     } else if (fun->script) {
-	save = mc->objectStack;
-	mc->objectStack = 0;
-	no_parent = (fun->object.parent == 0);
-	if (no_parent)
-	    fun->object.parent = mc->globalObject;
 	ok = mocha_Interpret(mc, &fun->object, fun->script, &aval);
 	if (ok)
 	    mocha_DropRef(mc, &aval);
-	if (no_parent)
-	    fun->object.parent = 0;
-	mc->objectStack = save;
     } else {
 	/* fun might be onerror trying to report a syntax error in itself. */
 	ok = MOCHA_TRUE;
     }
+    LeaveFrame(mc, &frame);
+    return ok;
+}
 
-    /* Restore stack pointer, taking care to pop dynamic variables too. */
-    nslots += 1 + argc + frame.nvars;
-    while (--nslots >= 0)
-	(void) Pop(mc, MOCHA_TRUE);
-    PR_ASSERT(mc->stack.ptr == frame.argv - 1);
+/*
+** If *vp is an object with an assign method, call that method with rval as
+** Assign would, set *okp to its result, and return true.  Otherwise return
+** false, unless looking for the method failed.
+*/
+static MochaBoolean
+CallAssignMethod(MochaContext *mc, MochaDatum *vp, MochaDatum rval,
+		 uint16 *taintp, MochaBoolean *okp)
+{
+    MochaObject *assignObj;
+    MochaSymbol *assignSym;
 
-    /* Pop stack frame and drop the method's object. */
-    mc->stack.frame = frame.down;
-    MOCHA_DropObject(mc, obj);
+    *okp = MOCHA_TRUE;
+    if (vp->tag != MOCHA_OBJECT || !(assignObj = vp->u.obj))
+	return MOCHA_FALSE;
+    if (!mocha_LookupSymbol(mc, assignObj->scope, mocha_assignAtom,
+			    MLF_GET, &assignSym)) {
+	*okp = MOCHA_FALSE;
+	return MOCHA_TRUE;
+    }
+    if (!assignSym)
+	return MOCHA_FALSE;
+    PushSymbol(mc, assignObj, assignSym);
+    Push(mc, rval);
+    *okp = Call(mc, 1);
 
-    /* Push return value, *then* drop any object reference held by it. */
-    Push(mc, frame.rval);
-    mocha_DropRef(mc, &frame.rval);
-    return ok;
+    /* Don't reset taint accumulator on return from function. */
+    *taintp = mc->taintInfo->accum;
+    return MOCHA_TRUE;
+}
+
+/*
+** Store rval in vp, a frame slot for a local name (see LocalNameOp in
+** mo_parse.c), and push rval.  If the slot holds an object with an assign
+** method, call that method instead.  Call never makes frame slots readonly,
+** so there is no readonly check here.
+*/
+static MochaBoolean
+StoreSlot(MochaContext *mc, MochaDatum *vp, MochaDatum rval, uint16 *taintp)
+{
+    MochaBoolean ok;
+
+    if (CallAssignMethod(mc, vp, rval, taintp, &ok))
+	return ok;
+    MOCHA_ASSERT_VALID_DATUM_FLAGS(vp);
+    vp->flags |= MDF_ENUMERATE;
+
+    /* Hold rval before dropping the old value in case they're the same. */
+    mocha_HoldRef(mc, &rval);
+    mocha_DropRef(mc, vp);
+
+    /* Don't store a reference to a finalizing object. */
+    if (rval.tag == MOCHA_OBJECT &&
+	rval.u.obj && rval.u.obj->nrefs == MOCHA_FINALIZING) {
+	rval.u.obj = 0;
+    }
+    MOCHA_INIT_FULL_DATUM(mc, vp, rval.tag, vp->flags, rval.taint,
+			  u, rval.u);
+    COPY_INT_FLAG(vp, rval);
+    Push(mc, rval);
+    return MOCHA_TRUE;
+}
+
+/*
+** Like StoreSlot, but store rval in the array element elem, whose current
+** value is *vp.  Elements live in the array's vector of compact values, or
+** in properties if it has gone sparse, so the store is done by value.
+*/
+static MochaBoolean
+StoreElement(MochaContext *mc, MochaElement *elem, MochaDatum *vp,
+	     MochaDatum rval, uint16 *taintp)
+{
+    MochaBoolean ok;
+    MochaDatum d;
+
+    if (CallAssignMethod(mc, vp, rval, taintp, &ok))
+	return ok;
+
+    /* Don't store a reference to a finalizing object. */
+    if (rval.tag == MOCHA_OBJECT &&
+	rval.u.obj && rval.u.obj->nrefs == MOCHA_FINALIZING) {
+	rval.u.obj = 0;
+    }
+    MOCHA_INIT_FULL_DATUM(mc, &d, rval.tag, vp->flags | MDF_ENUMERATE,
+			  rval.taint, u, rval.u);
+    COPY_INT_FLAG(&d, rval);
+    if (!mocha_SetArrayElement(mc, elem->obj, elem->index, d))
+	return MOCHA_FALSE;
+    Push(mc, rval);
+    return MOCHA_TRUE;
 }
 
 /*
@@ -615,7 +1310,7 @@ Call(MochaContext *mc, unsigned argc)
 static MochaBoolean
 Assign(MochaContext *mc, uint16 *taintp)
 {
-    MochaDatum *vp, lval, rval, aval, aval2;
+    MochaDatum *vp, lval, rval, aval, aval2, d;
     MochaBoolean ok;
     MochaScope *scope;
     MochaObject *slink, *obj, *assignObj;
@@ -636,6 +1331,17 @@ Assign(MochaContext *mc, uint16 *taintp)
     ok = mocha_ResolveSymbol(mc, &lval, MLF_SET);
     if (!ok)
 	goto out;
+    if (lval.tag == MOCHA_ELEMENT) {
+	/* Set an array element, growing the array if necessary. */
+	ok = mocha_GetArrayElement(mc, lval.u.elem.obj, lval.u.elem.index,
+				   &d);
+	if (!ok)
+	    goto out;
+	if (d.flags & MDF_READONLY)
+	    goto fail;
+	ok = StoreElement(mc, &lval.u.elem, &d, rval, taintp);
+	goto out;
+    }
     if (lval.tag != MOCHA_SYMBOL) {
 	if (lval.tag != MOCHA_ATOM)
 	    goto fail;
@@ -726,6 +1432,7 @@ Assign(MochaContext *mc, uint16 *taintp)
     /* Store rval, taking care not to smash vp->nrefs and vp->flags. */
     MOCHA_INIT_FULL_DATUM(mc, vp, rval.tag, vp->flags, rval.taint,
 			  u, rval.u);
+    COPY_INT_FLAG(vp, rval);
 
     /* Push the return value. */
     Push(mc, rval);
@@ -746,32 +1453,60 @@ fail:
     goto out;
 }
 
+/*
+** AssignSlot is Assign for MOP_SETARG and MOP_SETVAR: it pops the right hand
+** side and the left hand side's value, pushed by MOP_GETARG or MOP_GETVAR,
+** stores through vp, and pushes the result expression.
+*/
+static MochaBoolean
+AssignSlot(MochaContext *mc, MochaDatum *vp, uint16 *taintp)
+{
+    MochaDatum rval, aval, aval2;
+    MochaBoolean ok;
+
+    aval = rval = Pop(mc, MOCHA_FALSE);
+    aval2 = Pop(mc, MOCHA_FALSE);
+    ok = mocha_ResolveValue(mc, &rval);
+    if (ok)
+	ok = StoreSlot(mc, vp, rval, taintp);
+    mocha_DropRef(mc, &aval);
+    mocha_DropRef(mc, &aval2);
+    return ok;
+}
+
 MochaBoolean
 mocha_Call(MochaContext *mc, MochaDatum fd,
 	   unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
     unsigned i;
-    MochaBoolean ok;
+    MochaBoolean grown, ok;
+    MochaDatum *oldtos;
 
-    if (mc->stack.ptr + argc >= mc->stack.limit) {
-	ReportStackOverflow(mc);
+    grown = (mc->stack.ptr + argc >= mc->stack.limit);
+    if (grown && !GrowStack(mc, argc + 1))
 	return MOCHA_FALSE;
-    }
+    oldtos = mc->stack.ptr;
     Push(mc, fd);
     for (i = 0; i < argc; i++)
 	Push(mc, argv[i]);
     ok = Call(mc, argc);
-    if (ok)
+    if (ok) {
 	*rval = Pop(mc, MOCHA_FALSE);
-    else
-	(void) Pop(mc, MOCHA_TRUE);
+    } else {
+	/* Call may fail before it pops the function and its arguments. */
+	while (mc->stack.ptr > oldtos)
+	    (void) Pop(mc, MOCHA_TRUE);
+    }
+    if (grown)
+	ShrinkStack(mc);
     return ok;
 }
 
 MochaBoolean
 mocha_TypeOfDatum(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
 {
-    while (d.tag == MOCHA_ATOM || d.tag == MOCHA_SYMBOL) {
+    while (d.tag == MOCHA_ATOM || d.tag == MOCHA_SYMBOL ||
+	   d.tag == MOCHA_ELEMENT) {
 	if (!mocha_ResolveSymbol(mc, &d, MLF_GET))
 	    return MOCHA_FALSE;
 	if (d.tag == MOCHA_ATOM || d.tag == MOCHA_INTERNAL)
@@ -786,878 +1521,492 @@ mocha_TypeOfDatum(MochaContext *mc, MochaDatum d, MochaAtom **atomp)
     return MOCHA_TRUE;
 }
 
-MochaBoolean
-mocha_Interpret(MochaContext *mc, MochaObject *slink, MochaScript *script,
-		MochaDatum *result)
+/*
+** Threaded code.  When the compiler supports label addresses (GCC's "labels
+** as values" extension), mocha_Interpret lowers a script the first time it
+** runs into a vector of MochaThreadedOps, one per bytecode.  Each op holds
+** the address of its handler and its pre-decoded immediate operand, so the
+** atom for a MOF_CONST literal or name and the target of a MOF_JUMP branch
+** are computed once.  Every handler ends with its own indirect jump to the
+** next op's handler, so there is no switch, no mocha_CodeSpec lookup, and no
+** mocha_GetAtom bounds check per bytecode.
+**
+** Define MOCHA_NO_THREADED_CODE to use the portable switch loop instead.
+*/
+#if defined(__GNUC__) && !defined(MOCHA_NO_THREADED_CODE)
+#define MOCHA_THREADED_CODE
+#endif
+
+#ifdef MOCHA_THREADED_CODE
+/*
+** Lower script's bytecode into threaded code.  The handlers vector maps ops
+** to interpreter labels; ops with no handler get deflt, and a final sentinel
+** op, the target of jumps to the end of script, gets stop.
+*/
+static MochaThreadedOp *
+LowerScript(MochaContext *mc, MochaScript *script, void *const *handlers,
+	    void *deflt, void *stop)
 {
-    MochaObject *oldslink;
-    MochaCode *oldpc, *pc, *end;
-    MochaScript *oldscript;
-    MochaBranchCallback onBranch;
-    MochaBoolean ok, bval, valid;
-    MochaStack *sp;
-    MochaDatum *oldtos, *bottom;
-    uint16 taint;
-    int len, argc;
-    MochaOp op;
+    unsigned length, offset, nops, site;
+    int32 *opindex;
+    MochaThreadedOp *ops, *tp;
+    MochaCode *pc;
     MochaCodeSpec *cs;
-    MochaDatum *vp, lval, rval, aval, aval2;
-    MochaObject *obj, *obj2, *prototype;
-    MochaObjectStack *top;
-    MochaProperty *prop;
-    MochaInt ival, ival2;
-    MochaFloat fval, fval2;
-    MochaSymbol *sym;
-    MochaAtom *atom, *atom2, *atom3;
-    MochaFunction *fun;
-    MochaSlot slot;
+    int len;
+    long target;
 
-    *result = MOCHA_void;
-
-    oldslink = mc->staticLink;
-    mc->staticLink = slink;
-    oldpc = mc->pc;
-    oldscript = mc->script;
-    mc->script = script;
-    onBranch = mc->branchCallback;
-    ok = MOCHA_TRUE;
-
-#define CHECK_BRANCH() {                                                      \
-    if (onBranch && !(*onBranch)(mc, script)) {                               \
-	ok = MOCHA_FALSE;                                                     \
-	goto out;                                                             \
-    }                                                                         \
-}
-
-    sp = &mc->stack;
-    oldtos = sp->ptr;
-    if (oldtos + script->depth >= sp->limit) {
-	ReportStackOverflow(mc);
-	return MOCHA_FALSE;
+    /* Map each bytecode offset to the index of its op, or -1 if mid-op. */
+    length = script->length;
+    opindex = MOCHA_malloc(mc, (length + 1) * sizeof *opindex);
+    if (!opindex)
+	return 0;
+    ops = 0;
+    nops = 0;
+    for (offset = 0; offset < length; offset += len) {
+	pc = script->code + offset;
+	if (*pc >= MOP_MAX)
+	    goto bad;
+	len = mocha_CodeSpec[*pc].length;
+	if (len == 0)
+	    len = 1;
+	if (offset + len > length)
+	    goto bad;
+	opindex[offset] = nops++;
+	while (--len > 0)
+	    opindex[offset + len] = -1;
+	len = mocha_CodeSpec[*pc].length;
+	if (len == 0)
+	    len = 1;
     }
+    opindex[length] = nops;
 
-    pc = script->code;
-    end = pc + script->length;
-
-    while (pc < end) {
-	taint = mc->taintInfo->accum;
-	mc->pc = pc;
-	op = *pc;
-	cs = &mocha_CodeSpec[op];
-	len = cs->length;
-	if (mocha_TraceHook)
-	    (*mocha_TraceHook)(mc, script, pc, sp);
-#ifdef DEBUG
-	if (mc->tracefp) {
-	    int nuses, n;
-	    MochaDatum d;
-
-	    fprintf(mc->tracefp, "%4u: ", mocha_PCtoLineNumber(script, pc));
-	    mocha_Disassemble1(mc, script, pc, pc - script->code, mc->tracefp);
-	    nuses = cs->nuses;
-	    if (nuses) {
-		for (n = nuses; n > 0; n--) {
-		    d = sp->ptr[-n];
-		    if (mocha_RawDatumToString(mc, d, &atom)) {
-			fprintf(mc->tracefp, "%s %s",
-				(n == nuses) ? "  inputs:" : ",",
-				atom_name(atom));
-			mocha_DropAtom(mc, atom);
-		    }
-		}
-		putc('\n', mc->tracefp);
-	    }
-	}
-#endif
-
-	switch (op) {
-	  case MOP_NOP:
-	    ALLOCA_GC();
-	    break;
-
-	  case MOP_PUSH:
-	    Push(mc, MOCHA_void);	/* no need to taint (yet) */
-	    break;
-
-	  case MOP_POP:
-	    aval = rval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_ResolveValue(mc, &rval);
-	    if (rval.tag != MOCHA_PROPERTY) {
-		PR_ASSERT(rval.tag != MOCHA_OBJECTSTACK);
-		mocha_HoldRef(mc, &rval);
-		mocha_DropRef(mc, result);
-		*result = rval;
-	    }
-	    mocha_DropRef(mc, &aval);
-	    if (!ok)
-		goto out;
-	    break;
-
-	  case MOP_ENTER:
-	    rval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_DatumToObject(mc, rval, &obj);
-	    mocha_DropRef(mc, &rval);
-	    if (!obj) {
-		if (mocha_RawDatumToString(mc, rval, &atom)) {
-		    MOCHA_ReportError(mc,
-				      "%s can't be used in a with statement",
-				      atom_name(atom));
-		    mocha_DropAtom(mc, atom);
-		}
-		ok = MOCHA_FALSE;
-	    }
-	    if (!ok) goto out;
-	    ok = mocha_PushObject(mc, obj, &top);
-	    if (!ok) goto out;
-	    MOCHA_INIT_FULL_DATUM(mc, &rval, MOCHA_OBJECTSTACK,
-				  0, MOCHA_TAINT_IDENTITY,
-				  u.ptr, top);
-	    MOCHA_DropObject(mc, obj);
-	    Push(mc, rval);
-	    break;
-
-	  case MOP_LEAVE:
-	    PR_ASSERT(sp->ptr[-1].tag == MOCHA_OBJECTSTACK);
-	    (void) Pop(mc, MOCHA_TRUE);
-	    break;
-
-	  case MOP_RETURN:
-	    CHECK_BRANCH();
-	    aval = rval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_ResolveValue(mc, &rval);
-	    mocha_HoldRef(mc, &rval);
-	    sp->frame->rval = rval;
-	    mocha_DropRef(mc, &aval);
-	    goto out;
-
-	  case MOP_GOTO:
-	    CHECK_BRANCH();
-	    len = GET_JUMP_OFFSET(pc);
-	    break;
-
-	  case MOP_IFEQ:
-	    CHECK_BRANCH();
-	    if (!(ok = PopBoolean(mc, &bval)))
-		goto out;
-	    if (bval == MOCHA_FALSE)
-		len = GET_JUMP_OFFSET(pc);
-	    taint = mc->taintInfo->accum;
-	    break;
-
-	  case MOP_IFNE:
-	    CHECK_BRANCH();
-	    if (!(ok = PopBoolean(mc, &bval)))
-		goto out;
-	    if (bval != MOCHA_FALSE)
-		len = GET_JUMP_OFFSET(pc);
-	    taint = mc->taintInfo->accum;
+    ops = MOCHA_malloc(mc, (nops + 1) * sizeof *ops);
+    if (!ops)
+	goto out;
+    site = 0;
+    for (offset = 0, tp = ops; offset < length; offset += len, tp++) {
+	pc = script->code + offset;
+	cs = &mocha_CodeSpec[*pc];
+	len = cs->length ? cs->length : 1;
+	tp->handler = handlers[*pc] ? handlers[*pc] : deflt;
+	tp->pc = pc;
+	tp->u.atom = 0;
+	switch (cs->format) {
+	  case MOF_JUMP:
+	    target = (long)offset + GET_JUMP_OFFSET(pc);
+	    if (target < 0 || target > (long)length || opindex[target] < 0)
+		goto bad;
+	    tp->u.target = &ops[opindex[target]];
 	    break;
 
-	  case MOP_IN:
-	    aval = rval = Pop(mc, MOCHA_FALSE);
-	    lval = Pop(mc, MOCHA_TRUE);
-
-	    /* If the thing to the right of 'in' isn't an object, break. */
-	    ok = mocha_DatumToObject(mc, rval, &obj);
-	    mocha_DropRef(mc, &aval);
-	    if (!ok) goto out;
-	    if (!obj) {
-		PushBoolean(mc, MOCHA_FALSE);
-		break;
-	    }
-
-	    /* Save obj held by obj2 to suppress clone-parent properties. */
-	    obj2 = MOCHA_HoldObject(mc, obj);
-	  again:
-	    prototype = obj->prototype;
-
-	    /*
-	    ** Don't hold a property reference here, there is no way yet for
-	    ** Mocha users to remove properties (XXX).
-	    */
-	    vp = sp->ptr - 1;
-	    if (vp->tag == MOCHA_UNDEF) {
-		/* Let lazy reflectors be eager so for-in works for them. */
-		ok = OBJ_LIST_PROPERTIES(mc, obj);
-		if (!ok) {
-		    MOCHA_DropObject(mc, obj);
-		    MOCHA_DropObject(mc, obj2);
-		    goto out;
-		}
-
-		/* Set the iterator to point to the first property. */
-		prop = obj->scope->props;
-
-		/* Rewrite the iterator tag so we know to do the next case. */
-		vp->tag = MOCHA_PROPERTY;
-		vp->u.pair.obj = MOCHA_HoldObject(mc, obj);
-	    } else {
-		/* Use the iterator to find the next property. */
-		PR_ASSERT(vp->tag == MOCHA_PROPERTY);
-		prop = (MochaProperty *)vp->u.pair.sym;	/* XXX type me please */
-
-		/* If we're enumerating a prototype, reset obj and prototype. */
-		if (obj != vp->u.pair.obj) {
-		    MOCHA_DropObject(mc, obj);
-		    obj = MOCHA_HoldObject(mc, vp->u.pair.obj);
-		    prototype = obj->prototype;
-		}
-		PR_ASSERT(!prop || prop->lastsym->scope == obj->scope);
-	    }
-	    MOCHA_DropObject(mc, obj);
-
-	    /* Skip pre-defined properties for backward compatibility. */
-	    while (prop) {
-		if (prop->datum.flags & MDF_ENUMERATE) {
-		    /* Have we already enumerated a clone of this property? */
-		    atom = sym_atom(prop->lastsym);
-		    mocha_LookupSymbol(mc, obj2->scope, atom, MLF_GET, &sym);
-		    if (sym && sym->entry.value == prop)
-			break;
-		}
-		prop = prop->next;
-	    }
-
-	    if (!prop) {
-		/* Enumerate prototype properties, if there are any. */
-		if (prototype) {
-		    obj = MOCHA_HoldObject(mc, prototype);
-		    MOCHA_DropObject(mc, vp->u.pair.obj);
-		    vp->u.pair.obj = MOCHA_HoldObject(mc, obj);
-		    vp->u.pair.sym = (MochaSymbol *)obj->scope->props;
-		    goto again;
-		}
-
-		/* End of property list -- terminate this loop. */
-		PushBoolean(mc, MOCHA_FALSE);
-		MOCHA_DropObject(mc, obj2);
-		break;
-	    }
-	    MOCHA_DropObject(mc, obj2);
-
-	    /* Make a string for the iterator name and assign it to lval. */
-	    atom = sym_atom(prop->lastsym);
-	    vp->u.pair.sym = (MochaSymbol *)prop->next;
-	    Push(mc, lval);
-	    PushString(mc, atom);
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
-#endif
-	    ok = Assign(mc, &taint);
-	    if (!ok)
-		goto out;
-
-	    /* Throw away Assign()'s result and push true to keep looping. */
-	    (void) Pop(mc, MOCHA_TRUE);
-	    PushBoolean(mc, MOCHA_TRUE);
+	  case MOF_CONST:
+	    tp->u.atom = GET_CONST_ATOM(mc, script, pc);
+	    if (!tp->u.atom)
+		goto fail;
 	    break;
 
-	  case MOP_DUP:
-	    PR_ASSERT(sp->ptr > sp->base);
-	    Push(mc, sp->ptr[-1]);
+	  default:
+	    if (len > 1)
+		tp->u.immediate = pc[1];
 	    break;
+	}
+	if ((*pc == MOP_MEMBER || *pc == MOP_LMEMBER) &&
+	    site < script->npcache) {
+	    PR_ASSERT(script->pcache[site].offset == offset);
+	    tp->u.cache = &script->pcache[site++];
+	}
+    }
+    tp->handler = stop;
+    tp->pc = script->code + length;
+    tp->u.atom = 0;
 
-	  case MOP_ASSIGN:
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
-#endif
-	    ok = Assign(mc, &taint);
-	    if (!ok)
-		goto out;
-	    break;
+out:
+    MOCHA_free(mc, opindex);
+    return ops;
 
-#define INTEGEROP(OP, EXTRA_CODE, LEFT_CAST) {                                \
-    valid = MOCHA_TRUE;                                                       \
-    if (!(ok = PopInt(mc,&ival2,&valid)) || !(ok = PopInt(mc,&ival,&valid)))  \
-	goto out;                                                             \
-    EXTRA_CODE                                                                \
-    if (valid)                                                                \
-	PushNumber(mc, LEFT_CAST ival OP ival2);                              \
-    else                                                                      \
-	PushNumber(mc, MOCHA_NaN.u.fval);                                     \
+bad:
+    MOCHA_ReportError(mc, "internal error: bad bytecode at offset %u in %s",
+		      offset, script->filename ? script->filename : "script");
+fail:
+    if (ops) {
+	MOCHA_free(mc, ops);
+	ops = 0;
+    }
+    goto out;
 }
 
-#define BITWISEOP(OP)		INTEGEROP(OP, (void) 0;, (MochaInt))
-#define SIGNEDSHIFT(OP)		INTEGEROP(OP, ival2 &= 31;, (MochaInt))
-#define UNSIGNEDSHIFT(OP)	INTEGEROP(OP, ival2 &= 31;, (MochaUint))
-
-	  case MOP_BITOR:
-	    BITWISEOP(|);
-	    break;
-
-	  case MOP_BITXOR:
-	    BITWISEOP(^);
-	    break;
-
-	  case MOP_BITAND:
-	    BITWISEOP(&);
-	    break;
+/*
+** Store ops, just made by LowerScript, in *lowered, unless another thread
+** running the same script has stored its own there first.  Return the ops
+** that won, freeing ops if they lost.
+*/
+static MochaThreadedOp *
+PublishLoweredScript(MochaContext *mc, MochaThreadedOp **lowered,
+		     MochaThreadedOp *ops)
+{
+#ifdef MOCHA_THREADSAFE
+    MochaThreadedOp *first;
 
-#ifdef XP_PC
-#define COMPARE_FLOATS(LVAL, OP, RVAL)                                        \
-    ((MOCHA_FLOAT_IS_NaN(LVAL) || MOCHA_FLOAT_IS_NaN(RVAL))                   \
-     ? MOCHA_FALSE                                                            \
-     : (LVAL) OP (RVAL))
+    first = PR_CASP(ops, 0, lowered);
+    if (first) {
+	MOCHA_free(mc, ops);
+	return first;
+    }
 #else
-#define COMPARE_FLOATS(LVAL, OP, RVAL) ((LVAL) OP (RVAL))
+    (void)mc;
+    *lowered = ops;
 #endif
-
-#define COMPARISON(OP, EXTRA_CODE) {                                          \
-    aval = rval = Pop(mc, MOCHA_FALSE);                                       \
-    aval2 = lval = Pop(mc, MOCHA_FALSE);                                      \
-    ok = mocha_ResolveValue(mc, &lval) && mocha_ResolveValue(mc, &rval);      \
-    if (ok) {                                                                 \
-	atom = 0;                                                             \
-	EXTRA_CODE                                                            \
-	if (ResolveString(mc,lval,&atom) && ResolveString(mc,rval,&atom2)) {  \
-	    bval = strcoll(atom_name(atom), atom_name(atom2)) OP 0;           \
-	    mocha_DropAtom(mc, atom);                                         \
-	    mocha_DropAtom(mc, atom2);                                        \
-	} else {                                                              \
-	    if (atom) mocha_DropAtom(mc, atom);                               \
-	    ok = mocha_DatumToNumber(mc, lval, &fval) &&                      \
-		 mocha_DatumToNumber(mc, rval, &fval2);                       \
-	    if (ok)                                                           \
-		bval = COMPARE_FLOATS(fval, OP, fval2);                       \
-	}                                                                     \
-    }                                                                         \
-    mocha_DropRef(mc, &aval);                                                 \
-    mocha_DropRef(mc, &aval2);                                                \
-    if (!ok)                                                                  \
-	goto out;                                                             \
-    PushBoolean(mc, bval);                                                    \
-}
-
-#define EQUALITYOP(OP) {                                                      \
-    COMPARISON(OP,                                                            \
-	if ((lval.tag == MOCHA_FUNCTION || lval.tag == MOCHA_OBJECT) &&       \
-	    (rval.tag == MOCHA_FUNCTION || rval.tag == MOCHA_OBJECT)) {       \
-	    bval = lval.u.obj OP rval.u.obj;                                  \
-	} else if (MOCHA_DATUM_IS_NULL(lval) || MOCHA_DATUM_IS_NULL(rval)) {  \
-	    obj = obj2 = 0;                                                   \
-	    ok = mocha_DatumToObject(mc, lval, &obj) &&                       \
-		 mocha_DatumToObject(mc, rval, &obj2);                        \
-	    if (ok)                                                           \
-		bval = obj OP obj2;                                           \
-	    if (obj)  MOCHA_DropObject(mc, obj);                              \
-	    if (obj2) MOCHA_DropObject(mc, obj2);                             \
-	} else                                                                \
-    )                                                                         \
+    return ops;
 }
+#endif /* MOCHA_THREADED_CODE */
 
-#define RELATIONAL(OP)	COMPARISON(OP, (void) 0;)
-
-	  case MOP_EQ:
-	    EQUALITYOP(==);
-	    break;
-
-	  case MOP_NE:
-	    EQUALITYOP(!=);
-	    break;
-
-	  case MOP_LT:
-	    RELATIONAL(<);
-	    break;
-
-	  case MOP_LE:
-	    RELATIONAL(<=);
-	    break;
-
-	  case MOP_GT:
-	    RELATIONAL(>);
-	    break;
-
-	  case MOP_GE:
-	    RELATIONAL(>=);
-	    break;
-
-#undef COMPARISON
-#undef EQUALITYOP
-#undef RELATIONAL
-
-	  case MOP_LSH:
-	    SIGNEDSHIFT(<<);
-	    break;
-
-	  case MOP_RSH:
-	    SIGNEDSHIFT(>>);
-	    break;
-
-	  case MOP_URSH:
-	    UNSIGNEDSHIFT(>>);
-	    break;
-
-#undef INTEGEROP
-#undef BITWISEOP
-#undef SIGNEDSHIFT
-#undef UNSIGNEDSHIFT
-
-	  case MOP_ADD:
-	    rval = Pop(mc, MOCHA_FALSE);
-	    lval = Pop(mc, MOCHA_FALSE);
-	    atom = atom2 = 0;
-	    if (ResolveString(mc,lval,&atom) || ResolveString(mc,rval,&atom2)) {
-		ok = atom ? mocha_DatumToString(mc, rval, &atom2)
-			  : mocha_DatumToString(mc, lval, &atom);
-		if (ok) {
-		    if (atom == MOCHA_empty.u.atom)
-			atom3 = atom2;
-		    else if (atom2 == MOCHA_empty.u.atom)
-			atom3 = atom;
-		    else
-			atom3 = CatStrings(mc, atom, atom2);
-		    if (!atom3)
-			ok = MOCHA_FALSE;
-		}
-		if (ok)
-		    PushString(mc, atom3);
-		if (atom)  mocha_DropAtom(mc, atom);
-		if (atom2) mocha_DropAtom(mc, atom2);
-	    } else {
-		ok = mocha_DatumToNumber(mc, lval, &fval) &&
-		     mocha_DatumToNumber(mc, rval, &fval2);
-		if (ok)
-		    PushNumber(mc, fval + fval2);
-	    }
-	    mocha_DropRef(mc, &lval);
-	    mocha_DropRef(mc, &rval);
-	    if (!ok)
-		goto out;
-	    break;
+/*
+** Member op inline caches.  Each MOP_MEMBER or MOP_LMEMBER site in a script
+** has a MochaPropertyCache in script->pcache, sorted by bytecode offset.  A
+** site remembers up to MOCHA_PCACHE_WAYS receiver shapes and the symbol index
+** that mocha_LookupSymbol found in each, so objects built the same way hit
+** the same way.  A scope's shape only grows while it has one, and a scope that
+** loses a symbol has no shape, so a cached index never names a freed symbol.
+** Each way holds its shape, so that the shape can't be freed and its address
+** reused by a new shape while the way still names it.
+**
+** Only symbols found in the receiver's own scope are cached: the receiver's
+** shape says nothing about its prototypes, so a symbol found further along
+** the prototype chain could be shadowed without the cache noticing.
+*/
+MochaBoolean
+mocha_InitPropertyCaches(MochaContext *mc, MochaScript *script)
+{
+    unsigned offset, nsites;
+    MochaCode *pc;
+    MochaPropertyCache *cache;
+    int len;
+
+    nsites = 0;
+    for (offset = 0; offset < script->length; offset += len) {
+	pc = script->code + offset;
+	if (*pc == MOP_MEMBER || *pc == MOP_LMEMBER)
+	    nsites++;
+	len = mocha_CodeSpec[*pc].length;
+	if (len == 0)
+	    len = 1;
+    }
+    script->pcache = 0;
+    script->npcache = 0;
+    if (nsites == 0)
+	return MOCHA_TRUE;
 
-#define BINARYOP(OP) {                                                        \
-    if (!(ok = PopNumber(mc, &fval2)) || !(ok = PopNumber(mc, &fval)))        \
-	goto out;                                                             \
-    PushNumber(mc, fval OP fval2);                                            \
+    cache = MOCHA_malloc(mc, nsites * sizeof *cache);
+    if (!cache)
+	return MOCHA_FALSE;
+    memset(cache, 0, nsites * sizeof *cache);
+    script->pcache = cache;
+    script->npcache = nsites;
+    for (offset = 0; offset < script->length; offset += len) {
+	pc = script->code + offset;
+	if (*pc == MOP_MEMBER || *pc == MOP_LMEMBER)
+	    cache++->offset = offset;
+	len = mocha_CodeSpec[*pc].length;
+	if (len == 0)
+	    len = 1;
+    }
+    return MOCHA_TRUE;
 }
 
-	  case MOP_SUB:
-	    BINARYOP(-);
-	    break;
-
-	  case MOP_MUL:
-	    BINARYOP(*);
-	    break;
-
-	  case MOP_DIV:
-	  case MOP_MOD:
-	    if (!(ok = PopNumber(mc, &fval2)) || !(ok = PopNumber(mc, &fval)))
-		goto out;
-	    if (fval2 == 0)
-		PushNumber(mc, MOCHA_NaN.u.fval);
-	    else if (op == MOP_DIV)
-		PushNumber(mc, fval / fval2);
-	    else
-		PushNumber(mc, fmod(fval, fval2));
-	    break;
-
-	  case MOP_NOT:
-	    if (!(ok = PopBoolean(mc, &bval)))
-		goto out;
-	    PushBoolean(mc, !bval);
-	    break;
-
-	  case MOP_BITNOT:
-	    valid = MOCHA_TRUE;
-	    if (!(ok = PopInt(mc, &ival, &valid)))
-		goto out;
-	    if (!valid)
-		PushNumber(mc, MOCHA_NaN.u.fval);
-	    else
-		PushNumber(mc, ~ival);
-	    break;
-
-	  case MOP_NEG:
-	    if (!(ok = PopNumber(mc, &fval)))
-		goto out;
-	    PushNumber(mc, -fval);
-	    break;
-
-	  case MOP_NEW:
-	    CHECK_BRANCH();
-
-	    /* Get argc from immediate and find the constructor function. */
-	    argc = pc[1];
-	    vp = sp->ptr - (argc + 1);
-	    PR_ASSERT(vp >= sp->base);
-	    ok = mocha_DatumToFunction(mc, *vp, &fun);
-	    if (!ok)
-		goto out;
-
-	    /* Find the constructor name in order to name its new scope. */
-	    lval = *vp;
-	    ok = mocha_ResolveSymbol(mc, &lval, MLF_GET);
-	    if (!ok) {
-		MOCHA_DropObject(mc, &fun->object);
-		goto out;
-	    }
-
-	    /* Get the prototype object for this constructor function. */
-	    ok = mocha_LookupSymbol(mc, fun->object.scope, mocha_prototypeAtom,
-				    MLF_GET, &sym);
-	    if (!ok) {
-		MOCHA_DropObject(mc, &fun->object);
-		goto out;
-	    }
-
-	    if (!sym ||
-		sym->type != SYM_PROPERTY ||
-		(prop = sym_property(sym))->datum.tag != MOCHA_OBJECT ||
-		!(prototype = prop->datum.u.obj)) {
-		prototype = mocha_NewObjectByClass(mc, &mocha_ObjectClass);
-		if (!prototype) {
-		    MOCHA_DropObject(mc, &fun->object);
-		    ok = MOCHA_FALSE;
-		    goto out;
-		}
-		if (!mocha_GetMutableScope(mc, prototype) ||
-		    !mocha_SetPrototype(mc, fun, prototype)) {
-		    MOCHA_DestroyObject(mc, prototype);
-		    MOCHA_DropObject(mc, &fun->object);
-		    ok = MOCHA_FALSE;
-		    goto out;
-		}
-	    }
-
-	    /* Create a new user-allocated object. */
-	    obj = mocha_NewObjectByPrototype(mc, prototype);
-	    if (!obj) {
-                MOCHA_DropObject(mc, &fun->object);
-		ok = MOCHA_FALSE;
-		goto out;
-	    }
-	    obj = MOCHA_HoldObject(mc, obj);
-
-	    /* Find the constructor property in obj's (prototype's) scope. */
-	    ok = mocha_LookupSymbol(mc, obj->scope, mocha_constructorAtom,
-				    MLF_GET, &sym);
-	    if (!ok) {
-		obj->clazz = &mocha_ObjectClass;
-		MOCHA_DropObject(mc, obj);
-                MOCHA_DropObject(mc, &fun->object);
-		goto out;
-	    }
+void
+mocha_FinishPropertyCaches(MochaContext *mc, MochaScript *script)
+{
+    MochaPropertyCache *cache;
+    MochaPropertyCacheWay *way;
+
+    if (!script->pcache)
+	return;
+    for (cache = script->pcache; cache < &script->pcache[script->npcache];
+	 cache++) {
+	for (way = cache->ways; way < &cache->ways[MOCHA_PCACHE_WAYS]; way++) {
+	    if (way->shape)
+		mocha_DropShape(mc, way->shape);
+	}
+    }
+    MOCHA_free(mc, script->pcache);
+    script->pcache = 0;
+    script->npcache = 0;
+}
 
-	    /* Mutate the function reference at vp into a symbol ref. */
-	    mocha_DropRef(mc, vp);
-	    vp->tag = MOCHA_SYMBOL;
-	    vp->u.pair.obj = obj;
-	    vp->u.pair.sym = sym;
-	    mocha_HoldRef(mc, vp);
-
-	    /* Now we have an object with a constructor method -- call it. */
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
+#ifndef MOCHA_THREADED_CODE
+/*
+** Find the cache for the member op at pc, or return null if script has none.
+*/
+static MochaPropertyCache *
+FindPropertyCache(MochaScript *script, MochaCode *pc)
+{
+    unsigned offset, lo, hi, mid;
+    MochaPropertyCache *cache;
+
+    offset = pc - script->code;
+    lo = 0;
+    hi = script->npcache;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	cache = &script->pcache[mid];
+	if (cache->offset == offset)
+	    return cache;
+	if (cache->offset < offset)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return 0;
+}
 #endif
-	    ok = Call(mc, argc);
-            MOCHA_DropObject(mc, &fun->object);
-	    if (!ok) {
-		obj->clazz = &mocha_ObjectClass;
-		MOCHA_DropObject(mc, obj);
-		goto out;
-	    }
-
-	    /* Don't reset taint accumulator on return from function. */
-	    taint = mc->taintInfo->accum;
-
-	    /* Pop the return value, taking care not to drop prematurely. */
-	    rval = Pop(mc, MOCHA_FALSE);
-	    if (rval.tag == MOCHA_OBJECT && rval.u.obj != obj) {
-		obj->clazz = &mocha_ObjectClass;
-		MOCHA_DropObject(mc, obj);
-		obj = MOCHA_HoldObject(mc, rval.u.obj);
-	    }
-	    mocha_DropRef(mc, &rval);
 
-	    /* Then push the newly constructed object. */
-	    PushObject(mc, obj);
-
-	    /* Finally, drop obj -- it may have been the return value(!). */
-	    MOCHA_DropObject(mc, obj);
-	    break;
-
-	  case MOP_TYPEOF:
-	    lval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_TypeOfDatum(mc, lval, &atom);
-	    mocha_DropRef(mc, &lval);
-	    if (!ok) goto out;
-	    PushString(mc, atom ? atom : MOCHA_empty.u.atom);
-	    break;
-
-	  case MOP_VOID:
-	    (void) Pop(mc, MOCHA_TRUE);
-	    Push(mc, MOCHA_void);
-	    break;
+/*
+** Threads running the same script share its caches.  In a thread-safe build,
+** a way is filled only once: a thread claims an empty way by swapping in
+** claimedShape, which is no scope's shape, sets the index, then stores the
+** shape with release ordering.  A thread that loads the shape with acquire
+** ordering therefore sees its index, and no shape is dropped by two threads.
+** A site that sees more shapes than it has ways stops learning.
+*/
+#ifdef MOCHA_THREADSAFE
+static MochaShape claimedShape;
+#define LOAD_WAY_SHAPE(way)     PR_ATOMIC_LOADP(&(way)->shape)
+#else
+#define LOAD_WAY_SHAPE(way)     ((way)->shape)
+#endif
 
-	  case MOP_INC:
-	  case MOP_DEC:
-	    /* The operand must contain a number. */
-	    aval = lval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_DatumToNumber(mc, lval, &fval);
-	    if (!ok) {
-		mocha_DropRef(mc, &aval);
-		goto out;
-	    }
+/*
+** Return the symbol that cache holds for scope's shape, or null on a miss.
+*/
+static MochaSymbol *
+ProbePropertyCache(MochaPropertyCache *cache, MochaScope *scope)
+{
+    MochaShape *shape;
+    MochaPropertyCacheWay *way;
 
-	    /* Push the post- or pre-incremented value. */
-	    if (op == MOP_INC)
-		PushNumber(mc, pc[1] ? fval++ : ++fval);
-	    else
-		PushNumber(mc, pc[1] ? fval-- : --fval);
+    shape = scope->shape;
+    if (!shape)
+	return 0;
+    for (way = cache->ways; way < &cache->ways[MOCHA_PCACHE_WAYS]; way++) {
+	if (LOAD_WAY_SHAPE(way) == shape)
+	    return scope->symv[way->index];
+    }
+    return 0;
+}
 
-	    /* XXX Need two stack slots to call Assign(). */
-	    ok = (sp->ptr + 2 < sp->limit);
-	    if (!ok) {
-		ReportStackOverflow(mc);
-		mocha_DropRef(mc, &aval);
-		goto out;
-	    }
+/*
+** Remember sym's index for scope's shape, in an empty way if there is one,
+** else replacing the ways in round-robin order if only one thread can be
+** using cache.
+*/
+static void
+FillPropertyCache(MochaContext *mc, MochaPropertyCache *cache,
+		  MochaScope *scope, MochaSymbol *sym)
+{
+    int32 index;
+    MochaPropertyCacheWay *way;
 
-	    /* Assign the resulting number to lval. */
-	    Push(mc, lval);
-	    PushNumber(mc, fval);
-	    mocha_DropRef(mc, &aval);
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
+#ifdef MOCHA_THREADSAFE
+    (void)mc;
 #endif
-	    ok = Assign(mc, &taint);
-	    if (!ok)
-		goto out;
-	    (void) Pop(mc, MOCHA_TRUE);
-	    break;
-
-	  case MOP_MEMBER:
-	  case MOP_LMEMBER:
-	    /* Pop an atom (held by an atom map) naming the member. */
-	    rval = Pop(mc, MOCHA_TRUE);
-	    PR_ASSERT(rval.tag == MOCHA_ATOM);
+    index = mocha_SymbolIndex(scope, sym);
+    if (index < 0)
+	return;
+    for (way = cache->ways; way < &cache->ways[MOCHA_PCACHE_WAYS]; way++) {
+#ifdef MOCHA_THREADSAFE
+	if (!LOAD_WAY_SHAPE(way) && !PR_CASP(&claimedShape, 0, &way->shape)) {
+	    way->index = index;
+	    PR_ATOMIC_STOREP(&way->shape, mocha_HoldShape(scope->shape));
+	    return;
+	}
+#else
+	if (!way->shape)
+	    goto fill;
+#endif
+    }
+#ifndef MOCHA_THREADSAFE
+    way = &cache->ways[cache->victim];
+    cache->victim = (cache->victim + 1) % MOCHA_PCACHE_WAYS;
+    mocha_DropShape(mc, way->shape);
+fill:
+    way->shape = mocha_HoldShape(scope->shape);
+    way->index = index;
+#endif
+}
 
-	    /* Pop the left part and resolve it to an object. */
-	    lval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_DatumToObject(mc, lval, &obj);
-	    mocha_DropRef(mc, &lval);
-	    if (!ok) goto out;
-	    if (!obj) {
-		if (mocha_RawDatumToString(mc, lval, &atom)) {
-		    MOCHA_ReportError(mc, "%s has no property named '%s'",
-				      atom_name(atom), atom_name(rval.u.atom));
-		    mocha_DropAtom(mc, atom);
-		}
-		ok = MOCHA_FALSE;
-		goto out;
-	    }
+#ifdef DEBUG
+static void
+TraceInputs(MochaContext *mc, MochaScript *script, MochaCode *pc)
+{
+    int nuses, n;
+    MochaDatum d;
+    MochaAtom *atom;
 
-	    /* Lookup atom in object scope, push undef symbol if not found. */
-	    atom = rval.u.atom;
-	    sym = 0;
-	    if (op == MOP_LMEMBER)
-		ok = mocha_GetMutableScope(mc, obj);
-	    if (ok) {
-		ok = mocha_LookupSymbol(mc, obj->scope, atom,
-					(op == MOP_LMEMBER) ? MLF_SET : MLF_GET,
-					&sym);
-		if (ok && !sym &&
-		    (op == MOP_LMEMBER ||
-		     (ok = mocha_GetMutableScope(mc, obj)))) {	/* XXXhertme! */
-		    /* Create a new undefined symbol in a mutable scope. */
-		    sym = mocha_DefineSymbol(mc, obj->scope, atom,
-					     SYM_UNDEF, 0);
-		    ok = (sym != 0);
-		}
+    fprintf(mc->tracefp, "%4u: ", mocha_PCtoLineNumber(script, pc));
+    mocha_Disassemble1(mc, script, pc, pc - script->code, mc->tracefp);
+    nuses = mocha_CodeSpec[*pc].nuses;
+    if (nuses) {
+	for (n = nuses; n > 0; n--) {
+	    d = mc->stack.ptr[-n];
+	    if (mocha_RawDatumToString(mc, d, &atom)) {
+		fprintf(mc->tracefp, "%s %s",
+			(n == nuses) ? "  inputs:" : ",",
+			atom_name(atom));
+		mocha_DropAtom(mc, atom);
 	    }
-	    if (sym)
-		PushSymbol(mc, obj, sym);
-	    MOCHA_DropObject(mc, obj);
-	    if (!ok) goto out;
-	    break;
+	}
+	putc('\n', mc->tracefp);
+    }
+}
 
-	  case MOP_INDEX:
-	  case MOP_LINDEX:
-	    /* Pop the index (without dropping it!) and resolve it. */
-	    aval = rval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_ResolveValue(mc, &rval) &&
-		 mocha_RawDatumToString(mc, rval, &atom);
-	    mocha_DropRef(mc, &aval);
-	    if (!ok)
-		goto out;
+static void
+TraceOutputs(MochaContext *mc, MochaOp op)
+{
+    int ndefs, n;
+    MochaDatum d;
+    MochaAtom *atom;
 
-	    /* Pop the array and resolve it to an object. */
-	    lval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_DatumToObject(mc, lval, &obj);
-	    mocha_DropRef(mc, &lval);
-	    if (!ok || !obj) {
-		if (ok && mocha_RawDatumToString(mc, lval, &atom2)) {
-		    MOCHA_ReportError(mc,
-				      "%s has no property indexed by '%s'",
-				      atom_name(atom2), atom_name(atom));
-		    mocha_DropAtom(mc, atom2);
-		}
+    ndefs = mocha_CodeSpec[op].ndefs;
+    if (ndefs) {
+	for (n = ndefs; n > 0; n--) {
+	    d = mc->stack.ptr[-n];
+	    if (mocha_RawDatumToString(mc, d, &atom)) {
+		fprintf(mc->tracefp, "%s %s",
+			(n == ndefs) ? "  output:" : ",",
+			atom_name(atom));
 		mocha_DropAtom(mc, atom);
-		ok = MOCHA_FALSE;
-		goto out;
-	    }
-
-	    /* If rval is a nonnegative integer, treat it as a slot number. */
-	    slot = -1;
-	    if (mocha_RawDatumToNumber(mc, rval, &fval)) {
-		ival = (MochaInt)fval;
-		if (ival >= 0 && (MochaFloat)ival == fval)
-		    slot = ival;
 	    }
+	}
+	putc('\n', mc->tracefp);
+    }
+}
 
-	    /* Lookup the indexed symbol, defining a new one if not found. */
-	    sym = 0;
-	    if (op == MOP_LINDEX)
-		ok = mocha_GetMutableScope(mc, obj);
-	    if (ok) {
-		ok = mocha_LookupSymbol(mc, obj->scope, atom,
-					(op == MOP_LINDEX) ? MLF_SET : MLF_GET,
-					&sym);
-		if (ok && !sym &&
-		    (op == MOP_LINDEX ||
-		     (ok = mocha_GetMutableScope(mc, obj)))) {	/* XXXhertme! */
-		    /*
-		    ** Create a new undefined symbol in a mutable scope.
-		    ** XXX want a way to distinguish o[0x10] from o["16"]
-		    */
-		    sym = (slot < 0)
-			? mocha_DefineSymbol(mc, obj->scope, atom, SYM_UNDEF, 0)
-			: mocha_SetProperty(mc, obj->scope, atom, slot,
-					    MOCHA_null);
-		    ok = (sym != 0);
-		}
-	    }
-	    mocha_DropAtom(mc, atom);
-	    if (sym)
-		PushSymbol(mc, obj, sym);
-	    MOCHA_DropObject(mc, obj);
-	    if (!ok) goto out;
-	    break;
+#define TRACE_INPUTS()                                                        \
+    NSPR_BEGIN_MACRO                                                          \
+	if (mc->tracefp)                                                      \
+	    TraceInputs(mc, script, pc);                                      \
+    NSPR_END_MACRO
+#define TRACE_OUTPUTS()                                                       \
+    NSPR_BEGIN_MACRO                                                          \
+	if (mc->tracefp)                                                      \
+	    TraceOutputs(mc, op);                                             \
+    NSPR_END_MACRO
+#else
+#define TRACE_INPUTS()          ((void) 0)
+#define TRACE_OUTPUTS()         ((void) 0)
+#endif /* DEBUG */
 
-	  case MOP_CALL:
-	    CHECK_BRANCH();
+/*
+** Return true if anyone could observe per-op trace or taint state: a trace
+** hook, a DEBUG trace file, taint callbacks, or a non-identity taint.
+*/
+static MochaBoolean
+NeedsInstrumentation(MochaContext *mc)
+{
+    MochaTaintInfo *info;
 
-	    /* Resolve *vp to a function and call it. */
-	    argc = pc[1];
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
+    if (mc->traceHook)
+	return MOCHA_TRUE;
+#ifdef DEBUG
+    if (mc->tracefp)
+	return MOCHA_TRUE;
 #endif
-	    ok = Call(mc, argc);
-	    if (!ok)
-		goto out;
-
-	    /* Don't reset taint accumulator on return from function. */
-	    taint = mc->taintInfo->accum;
-	    break;
-
-	  case MOP_NAME:
-	    MOCHA_INIT_FULL_DATUM(mc, &lval, MOCHA_ATOM,
-				  0, MOCHA_TAINT_IDENTITY,
-				  u.atom, GET_CONST_ATOM(mc, script, pc));
-	    Push(mc, lval);
-	    break;
-
-	  case MOP_NUMBER:
-	    atom = GET_CONST_ATOM(mc, script, pc);
-	    PushNumber(mc, atom->fval);
-	    break;
-
-	  case MOP_STRING:
-	    atom = GET_CONST_ATOM(mc, script, pc);
-	    PushString(mc, atom);
-	    break;
-
-	  case MOP_ZERO:
-	    PushNumber(mc, 0);
-	    break;
+    if (mc->mixTaint || mc->holdTaint || mc->dropTaint)
+	return MOCHA_TRUE;
+    info = mc->taintInfo;
+    return info != &mc->defaultTaintInfo ||
+	   info->taint != MOCHA_TAINT_IDENTITY ||
+	   info->accum != MOCHA_TAINT_IDENTITY;
+}
 
-	  case MOP_ONE:
-	    PushNumber(mc, 1);
-	    break;
+/*
+** Generate the instrumented and fast interpreter loops from mo_interp.h.
+*/
+#define INTERPRET       InterpretTraced
+#define INSTRUMENTED    1
+#include "mo_interp.h"
+#undef INTERPRET
+#undef INSTRUMENTED
+
+#define INTERPRET       InterpretFast
+#define INSTRUMENTED    0
+#include "mo_interp.h"
+#undef INTERPRET
+#undef INSTRUMENTED
 
-	  case MOP_NULL:
-	    PushObject(mc, 0);
-	    break;
+MochaBoolean
+mocha_Interpret(MochaContext *mc, MochaObject *slink, MochaScript *script,
+		MochaDatum *result)
+{
+    MochaObject *oldslink;
+    MochaCode *oldpc, *pc, *resume;
+    MochaScript *oldscript;
+    MochaBoolean grown, ok;
+    MochaStack *sp;
+    MochaStackFrame *entry, *fp;
+    MochaDatum *oldtos, *bottom;
 
-	  case MOP_THIS:
-	    PushObject(mc, sp->frame ? sp->frame->thisp : slink);
-	    break;
+    *result = MOCHA_void;
 
-	  case MOP_FALSE:
-	  case MOP_TRUE:
-	    PushBoolean(mc, (op == MOP_TRUE) ? MOCHA_TRUE : MOCHA_FALSE);
-	    break;
+    /* Run script in a new stack segment if the current one is too small. */
+    sp = &mc->stack;
+    grown = (sp->ptr + script->depth + STACK_SLOP > sp->limit);
+    if (grown && !GrowStack(mc, script->depth + STACK_SLOP))
+	return MOCHA_FALSE;
+    oldtos = sp->ptr;
 
-#ifdef MOCHA_HAS_DELETE_OPERATOR
-	  case MOP_DELETE:
-	    /* Delete the operand, which must be an object but may be null. */
-	    lval = rval = Pop(mc, MOCHA_FALSE);
-	    ok = mocha_DatumToObject(mc, rval, &obj);
-	    mocha_DropRef(mc, &rval);
-	    if (!ok) goto out;
-	    ok = mocha_ResolveSymbol(mc, &lval, MLF_SET);
-	    if (!ok) goto out;
-	    if (lval.tag != MOCHA_SYMBOL) {
-		if (mocha_RawDatumToString(mc, rval, &atom)) {
-		    MOCHA_ReportError(mc, "%s can't be deleted",
-				      atom_name(atom));
-		    mocha_DropAtom(mc, atom);
-		}
-		goto out;
-	    }
-	    Push(mc, lval);
-	    PushObject(mc, 0);
-#ifdef DEBUG_brendan
-	    mc->pc = pc;
-#endif
-	    ok = Assign(mc, &taint);
-	    if (!ok)
-		goto out;
-	    break;
-#endif /* MOCHA_HAS_DELETE_OPERATOR */
+    oldslink = mc->staticLink;
+    mc->staticLink = slink;
+    oldpc = mc->pc;
+    oldscript = mc->script;
+    mc->script = script;
 
-	  default:
-	    MOCHA_ReportError(mc, "unimplemented Mocha bytecode %d", op);
-	    break;
+    /*
+    ** The loop may be running a function that it called when it returns to
+    ** switch loops, so resume in mc->script, which it keeps up to date.
+    */
+    entry = sp->frame;
+    pc = script->code;
+    do {
+	resume = 0;
+	if (NeedsInstrumentation(mc)) {
+	    ok = InterpretTraced(mc, mc->staticLink, mc->script, pc, entry,
+				 &resume, result);
+	} else {
+	    ok = InterpretFast(mc, mc->staticLink, mc->script, pc, entry,
+			       &resume, result);
 	}
+	pc = resume;
+    } while (ok && pc);
 
-	pc += len;
-	mc->taintInfo->accum = taint;
-
-#ifdef DEBUG
-	if (mc->tracefp) {
-	    int ndefs, n;
-	    MochaDatum d;
-
-	    ndefs = cs->ndefs;
-	    if (ndefs) {
-		for (n = ndefs; n > 0; n--) {
-		    d = sp->ptr[-n];
-		    if (mocha_RawDatumToString(mc, d, &atom)) {
-			fprintf(mc->tracefp, "%s %s",
-				(n == ndefs) ? "  output:" : ",",
-				atom_name(atom));
-			mocha_DropAtom(mc, atom);
-		    }
-		}
-		putc('\n', mc->tracefp);
-	    }
-	}
-#endif
+    /*
+    ** Unwind the frames of any functions that the loop called and was
+    ** running when it failed.
+    */
+    PR_ASSERT(!ok || sp->frame == entry);
+    while (sp->frame != entry) {
+	fp = sp->frame;
+	LeaveFrame(mc, fp);
+	FreeFrame(mc, fp);
     }
 
-out:
     /*
     ** Pop anything left by an exception on the stack, taking care not to pop
-    ** new variables created by eval("var x = ...").
+    ** new variables created by eval("var x = ...") in this segment.
     */
     if (sp->frame) {
 	bottom = sp->frame->vars + sp->frame->nvars;
-	if (oldtos < bottom)
+	if (oldtos < bottom && bottom <= sp->limit)
 	    oldtos = bottom;
     }
     while (sp->ptr > oldtos)
 	Pop(mc, MOCHA_TRUE);
+    if (grown)
+	ShrinkStack(mc);
+
+    /* Give back the spare segment once the stack is empty. */
+    if (sp->ptr == sp->first.base)
+	FreeSpare(mc);
 
     /*
     ** Restore the previous frame's execution state.
@@ -1665,7 +2014,6 @@ out:
     mc->staticLink = oldslink;
     mc->pc = oldpc;
     mc->script = oldscript;
-    ALLOCA_GC();
 
     /*
     ** Drop result if there was an error.
@@ -15,6 +15,7 @@
 #include "mo_atom.h"
 #include "mo_cntxt.h"
 #include "mo_emit.h"
+#include "mo_eval.h"
 #include "mo_parse.h"
 #include "mo_scan.h"
 #include "mo_scope.h"
@@ -22,8 +23,6 @@
 #include "mochaapi.h"
 #include "mochalib.h"
 
-uint16 (*mocha_MixTaint)(MochaContext *mc, uint16 accum, uint16 taint);
-
 MochaDatum MOCHA_void  = {0,MOCHA_UNDEF,  MDF_TRACEBITS,MOCHA_TAINT_IDENTITY};
 MochaDatum MOCHA_null  = {0,MOCHA_OBJECT, MDF_TRACEBITS,MOCHA_TAINT_IDENTITY};
 MochaDatum MOCHA_zero  = {0,MOCHA_NUMBER, MDF_TRACEBITS,MOCHA_TAINT_IDENTITY};
@@ -33,15 +32,17 @@ MochaDatum MOCHA_true  = {0,MOCHA_BOOLEAN,MDF_TRACEBITS,MOCHA_TAINT_IDENTITY};
 MochaDatum MOCHA_empty = {0,MOCHA_STRING, MDF_TRACEBITS,MOCHA_TAINT_IDENTITY};
 
 /*
-** Do first things first, at most once.
+** Do first things first, at most once.  MOCHA_empty's atom is freed with the
+** atom table when the last context is destroyed, so mocha_InitAtomState sets
+** it each time it makes the table.
 */
 static void
 mocha_StaticInit(MochaContext *mc)
 {
+    (void)mc;
     if (MOCHA_true.u.bval)
 	return;
     MOCHA_true.u.bval = MOCHA_TRUE;
-    MOCHA_empty.u.atom = mocha_Atomize(mc, "", ATOM_HELD | ATOM_STRING);
 }
 
 void
@@ -62,14 +63,22 @@ MOCHA_WeakenRef(MochaContext *mc, MochaDatum *dp)
     switch (dp->tag) {
       case MOCHA_ATOM:
       case MOCHA_STRING:
+#ifdef MOCHA_THREADSAFE
+	if (!(ATOM_FLAGS(dp->u.atom) & ATOM_LOOSE)) {
+	    PR_ATOMIC_DECREMENT(&dp->u.atom->nrefs);
+	    break;
+	}
+#endif
 	dp->u.atom->nrefs--;
 	break;
       case MOCHA_FUNCTION:
-	dp->u.fun->object.nrefs--;
+	if (dp->u.fun->object.nrefs != MOCHA_FROZEN)
+	    dp->u.fun->object.nrefs--;
 	break;
       case MOCHA_OBJECT:
       case MOCHA_SYMBOL:
-	if (dp->u.obj)
+      case MOCHA_ELEMENT:
+	if (dp->u.obj && dp->u.obj->nrefs != MOCHA_FROZEN)
 	    dp->u.obj->nrefs--;
 	break;
       default:;
@@ -287,7 +296,8 @@ MOCHA_InitClass(MochaContext *mc, MochaObject *obj, MochaClass *clazz,
     MochaFunction *fun;
     MochaDatum d;
 
-    atom = mocha_Atomize(mc, clazz->name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, clazz->name, strlen(clazz->name),
+			 ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return 0;
 
@@ -400,7 +410,7 @@ MOCHA_DefineObject(MochaContext *mc, MochaObject *obj, const char *name,
 
     if (!mocha_GetMutableScope(mc, obj))
 	return MOCHA_FALSE;
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     MOCHA_INIT_FULL_DATUM(mc, &od, MOCHA_OBJECT, flags, MOCHA_TAINT_IDENTITY,
@@ -420,7 +430,7 @@ SetProperty(MochaContext *mc, MochaObject *obj, const char *name,
     if (!name) {
 	atom = 0;
     } else {
-	atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+	atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
 	if (!atom)
 	    return MOCHA_FALSE;
     }
@@ -477,7 +487,7 @@ MOCHA_RemoveProperty(MochaContext *mc, MochaObject *obj, const char *name)
 
     if (!mocha_GetMutableScope(mc, obj))
 	return;	/* XXX */
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return;
     mocha_RemoveProperty(mc, obj->scope, atom);
@@ -492,9 +502,17 @@ MOCHA_GetSlot(MochaContext *mc, MochaObject *obj, MochaSlot slot,
     MochaAtom *atom;
     MochaBoolean ok;
     MochaPair pair;
-
+    MochaElement elem;
+
+    if (obj->clazz == &mocha_ArrayClass) {
+	elem.obj = obj;
+	elem.index = slot;
+	MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_ELEMENT, 0, MOCHA_TAINT_IDENTITY,
+			      u.elem, elem);
+	return mocha_ResolveValue(mc, dp);
+    }
     PR_snprintf(buf, sizeof buf, "%d", slot);
-    atom = mocha_Atomize(mc, buf, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, buf, strlen(buf), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     ok = mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &pair.sym);
@@ -520,6 +538,8 @@ MochaBoolean
 MOCHA_SetSlot(MochaContext *mc, MochaObject *obj, MochaSlot slot,
 	      MochaDatum datum)
 {
+    if (obj->clazz == &mocha_ArrayClass)
+	return mocha_SetArrayElement(mc, obj, slot, datum);
     if (!mocha_GetMutableScope(mc, obj))
 	return MOCHA_FALSE;
     return mocha_SetProperty(mc, obj->scope, 0, slot, datum) != 0;
@@ -530,16 +550,20 @@ MOCHA_RemoveSlot(MochaContext *mc, MochaObject *obj, MochaSlot slot)
 {
     char buf[20];
 
+    if (obj->clazz == &mocha_ArrayClass) {
+	mocha_RemoveArrayElement(mc, obj, slot);
+	return;
+    }
     PR_snprintf(buf, sizeof buf, "%d", slot);
     MOCHA_RemoveProperty(mc, obj, buf);
 }
 
 MochaAtom *
-MOCHA_Atomize(MochaContext *mc, const char *name)
+MOCHA_Atomize(MochaContext *mc, const char *name, size_t length)
 {
     if (!name)
 	return MOCHA_empty.u.atom;
-    return mocha_Atomize(mc, name, ATOM_STRING);
+    return mocha_Atomize(mc, name, length, ATOM_STRING);
 }
 
 const char *
@@ -550,6 +574,15 @@ MOCHA_GetAtomName(MochaContext *mc, MochaAtom *atom)
     return atom_name(atom);
 }
 
+size_t
+MOCHA_GetAtomLength(MochaContext *mc, MochaAtom *atom)
+{
+    (void)mc;
+    if (!atom)
+	return 0;
+    return atom->length;
+}
+
 MochaAtom *
 MOCHA_HoldAtom(MochaContext *mc, MochaAtom *atom)
 {
@@ -586,7 +619,7 @@ DefineFunction(MochaContext *mc, MochaObject *obj, const char *name,
     MochaAtom *atom;
     MochaFunction *fun;
 
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return 0;
     fun = mocha_DefineFunction(mc, obj, atom, call, nargs, flags);
@@ -607,26 +640,14 @@ MochaBoolean
 MOCHA_DefineFunctions(MochaContext *mc, MochaObject *obj, MochaFunctionSpec *fs)
 {
     MochaFunction *fun;
-    MochaDatum fd;
-    MochaSymbol *sym;
 
     if (!mocha_GetMutableScope(mc, obj))
 	return MOCHA_FALSE;
     for (; fs->name; fs++) {
-	if (!fs->fun) {
-	    fun = DefineFunction(mc, obj, fs->name, fs->call, fs->nargs,
-				 fs->flags);
-	    if (!fun)
-		return MOCHA_FALSE;
-	    fs->fun = (MochaFunction *)MOCHA_HoldObject(mc, &fun->object);
-	} else {
-	    MOCHA_INIT_FULL_DATUM(mc, &fd, MOCHA_FUNCTION,
-				  fs->flags, MOCHA_TAINT_IDENTITY,
-				  u.fun, fs->fun);
-	    sym = SetProperty(mc, obj, fs->name, obj->scope->minslot-1, fd);
-	    if (!sym)
-		return MOCHA_FALSE;
-	}
+	fun = DefineFunction(mc, obj, fs->name, fs->call, fs->nargs,
+			     fs->flags);
+	if (!fun)
+	    return MOCHA_FALSE;
     }
     return MOCHA_TRUE;
 }
@@ -636,8 +657,9 @@ MOCHA_HoldObject(MochaContext *mc, MochaObject *obj)
 {
     if (!obj)
 	return 0;
-    PR_ASSERT(obj->nrefs == MOCHA_FINALIZING || obj->nrefs >= 0);
-    if (obj->nrefs != MOCHA_FINALIZING)
+    PR_ASSERT(obj->nrefs == MOCHA_FINALIZING || obj->nrefs == MOCHA_FROZEN ||
+	      obj->nrefs >= 0);
+    if (obj->nrefs != MOCHA_FINALIZING && obj->nrefs != MOCHA_FROZEN)
 	obj->nrefs++;
     return obj;
 }
@@ -647,7 +669,10 @@ MOCHA_DropObject(MochaContext *mc, MochaObject *obj)
 {
     if (!obj)
 	return 0;
-    PR_ASSERT(obj->nrefs == MOCHA_FINALIZING || obj->nrefs > 0);
+    PR_ASSERT(obj->nrefs == MOCHA_FINALIZING || obj->nrefs == MOCHA_FROZEN ||
+	      obj->nrefs > 0);
+    if (obj->nrefs == MOCHA_FROZEN)
+	return obj;
     if (obj->nrefs != MOCHA_FINALIZING && --obj->nrefs == 0) {
 	mocha_DestroyObject(mc, obj);
 	return 0;
@@ -665,7 +690,7 @@ MOCHA_LookupName(MochaContext *mc, MochaObject *obj, const char *name,
     MochaPair pair;
     MochaBoolean ok;
 
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     ok = mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &pair.sym);
@@ -690,7 +715,7 @@ MOCHA_ResolveName(MochaContext *mc, MochaObject *obj, const char *name,
     MochaObject *oldslink;
     MochaBoolean ok;
 
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     MOCHA_INIT_FULL_DATUM(mc, dp, MOCHA_ATOM, 0, MOCHA_TAINT_IDENTITY,
@@ -716,7 +741,7 @@ MOCHA_UndefineName(MochaContext *mc, MochaObject *obj, const char *name)
 
     if (!mocha_GetMutableScope(mc, obj))
 	return;
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return;
     mocha_RemoveSymbol(mc, obj->scope, atom);
@@ -806,7 +831,7 @@ MOCHA_CompileMethod(MochaContext *mc, MochaObject *obj,
     ts = mocha_NewTokenStream(mc, base, length, filename, lineno);
     if (!ts)
 	return MOCHA_FALSE;
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     ok = (atom != 0);
     if (ok) {
 	if (!mocha_GetMutableScope(mc, obj)) {
@@ -848,8 +873,17 @@ MochaBoolean
 MOCHA_DecompileFunctionBody(MochaContext *mc, MochaFunction *fun,
 			    unsigned indent, char **sp)
 {
-    return MOCHA_DecompileScript(mc, fun->script, atom_name(fun->atom),
-				 indent, sp);
+    MochaPrinter *mp;
+    MochaBoolean ok;
+
+    mp = mocha_NewPrinter(mc, atom_name(fun->atom), indent);
+    if (!mp)
+	return MOCHA_FALSE;
+    ok = mocha_DecompileFunctionBody(fun, mp);
+    if (ok)
+	ok = mocha_GetPrinterOutput(mp, sp);
+    mocha_DestroyPrinter(mp);
+    return ok;
 }
 
 MochaBoolean
@@ -891,7 +925,7 @@ MOCHA_CallMethod(MochaContext *mc, MochaObject *obj, const char *name,
     MochaDatum fd;
     MochaBoolean ok;
 
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     if (!mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &pair.sym))
@@ -954,9 +988,15 @@ void
 MOCHA_SetTaintCallbacks(MochaTaintCounter hold, MochaTaintCounter drop,
                         MochaTaintMixer mix)
 {
-    mocha_HoldTaint = hold;
-    mocha_DropTaint = drop;
-    mocha_MixTaint = mix;
+    mocha_SetTaintCallbacks(hold, drop, mix);
+}
+
+uint16
+MOCHA_MixTaint(MochaContext *mc, uint16 accum, uint16 taint)
+{
+    if (!mc->mixTaint)
+	return MOCHA_TAINT_MAX;
+    return (*mc->mixTaint)(mc, accum, taint);
 }
 
 MochaTaintInfo *
@@ -982,7 +1022,7 @@ MOCHA_SetPropertyTaint(MochaContext *mc, MochaObject *obj, const char *name,
     MochaBoolean ok;
     MochaSymbol *sym;
 
-    atom = mocha_Atomize(mc, name, ATOM_HELD | ATOM_NAME);
+    atom = mocha_Atomize(mc, name, strlen(name), ATOM_HELD | ATOM_NAME);
     if (!atom)
 	return MOCHA_FALSE;
     ok = mocha_LookupSymbol(mc, obj->scope, atom, MLF_GET, &sym);
@@ -999,4 +1039,5 @@ MOCHA_SetCharFilter(MochaContext *mc, MochaCharFilter filter, void *arg)
 {
     mc->charFilter = filter;
     mc->charFilterArg = arg;
+    mocha_FlushEvalCache(mc);
 }
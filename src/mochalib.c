@@ -31,8 +31,8 @@ mocha_untaint(MochaContext *mc, MochaObject *obj,
     taintp = (argc == 0) ? &mc->taintInfo->accum : &argv[0].taint;
     if (*taintp == mc->taintInfo->taint) {
 	/* Drop the argument's taint so Call won't propagate it to rval. */
-	if (argc != 0)
-	    (*mocha_DropTaint)(mc, *taintp);
+	if (argc != 0 && mc->dropTaint)
+	    (*mc->dropTaint)(mc, *taintp);
 	*taintp = MOCHA_TAINT_IDENTITY;
     }
     *rval = argv[0];
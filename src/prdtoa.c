@@ -8,6 +8,11 @@
 #include "prmacros.h"
 #include "prdtoa.h"
 #include "prprf.h"
+#ifdef MOCHA_THREADSAFE
+#include "prsync.h"
+#else
+#define PR_THREAD_LOCAL
+#endif
 
 /****************************************************************
  *
@@ -334,7 +339,12 @@ struct Bigint {
 
 typedef struct Bigint Bigint;
 
-static Bigint *freelist[Kmax+1];
+/*
+ * The Bigint free lists, the cache of powers of 5, and PR_dtoa's result
+ * buffer are kept per thread, so that threads converting numbers at once
+ * neither lock nor share them.
+ */
+static PR_THREAD_LOCAL Bigint *freelist[Kmax+1];
 
 static Bigint *Balloc(int k)
 {
@@ -598,7 +608,7 @@ static Bigint *mult(Bigint *a, Bigint *b)
 	return c;
 }
 
-static Bigint *p5s;
+static PR_THREAD_LOCAL Bigint *p5s;
 
 static Bigint *pow5mult(Bigint *b, int k)
 {
@@ -1807,8 +1817,8 @@ PR_dtoa(double d, int mode, int ndigits, int *decpt, int *sign, char **rve)
 	Bigint *b, *b1, *delta, *mlo, *mhi, *S;
 	double d2, ds, eps;
 	char *s, *s0;
-	static Bigint *result;
-	static int result_k;
+	static PR_THREAD_LOCAL Bigint *result;
+	static PR_THREAD_LOCAL int result_k;
 
 	if (result) {
 		result->k = result_k;
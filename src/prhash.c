@@ -8,18 +8,116 @@
 #include "prhash.h"
 #include "prglobal.h"
 
+/*
+** The table is open-addressed in the style of Google's "Swiss tables".  Each
+** slot in ht->buckets holds an entry pointer or null, and has a control byte
+** in ht->ctrl that is either CTRL_EMPTY, CTRL_DELETED, or the low 7 bits of
+** the entry's mixed hash.  Slots are probed a group of GROUP_SIZE at a time:
+** one compare of the group's control bytes against the wanted 7-bit tag
+** rules out almost every non-matching entry without touching it, and any
+** empty slot in the group ends the search.  Lookup never allocates.
+*/
+#define CTRL_EMPTY      ((uint8)0x80)
+#define CTRL_DELETED    ((uint8)0xFE)
+#define CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
+#define GROUP_SIZE      16
+#define GROUP_SHIFT     4
+
 /* Compute the number of buckets in ht */
-#define NBUCKETS(ht)    (1 << (PR_HASH_BITS - (ht)->shift))
+#define NBUCKETS(ht)    ((uint32)1 << (PR_HASH_BITS - (ht)->shift))
 
-/* The smallest table has 16 buckets */
-#define MINBUCKETSLOG2  4
+/* The smallest table has 16 buckets, one group */
+#define MINBUCKETSLOG2  GROUP_SHIFT
 #define MINBUCKETS      (1 << MINBUCKETSLOG2)
 
-/* Compute the maximum entries given n buckets that we will tolerate, ~90% */
+/* Compute the maximum live plus deleted slots we tolerate in n buckets */
 #define OVERLOADED(n)   ((n) - ((n) >> 3))
 
 /* Compute the number of entries below which we shrink the table by half */
-#define UNDERLOADED(n)  (((n) > MINBUCKETS) ? ((n) >> 2) : 0)
+#define UNDERLOADED(n)  (((n) > MINBUCKETS) ? ((n) >> 3) : 0)
+
+#if defined __SSE2__ || defined _M_X64 ||                                     \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+typedef __m128i PRHashGroup;
+
+#define LOAD_GROUP(ctrl)        _mm_loadu_si128((const __m128i *)(ctrl))
+#define MATCH_BYTE(g, c)        ((uint32)_mm_movemask_epi8(                  \
+                                    _mm_cmpeq_epi8(g, _mm_set1_epi8((char)c))))
+#define MATCH_NOT_FULL(g)       ((uint32)_mm_movemask_epi8(g))
+#else
+typedef const uint8 *PRHashGroup;
+
+#define LOAD_GROUP(ctrl)        (ctrl)
+#define MATCH_BYTE(g, c)        MatchByte(g, c)
+#define MATCH_NOT_FULL(g)       MatchNotFull(g)
+
+static uint32
+MatchByte(const uint8 *ctrl, uint8 c)
+{
+    uint32 i, mask;
+
+    mask = 0;
+    for (i = 0; i < GROUP_SIZE; i++) {
+        if (ctrl[i] == c)
+            mask |= 1U << i;
+    }
+    return mask;
+}
+
+static uint32
+MatchNotFull(const uint8 *ctrl)
+{
+    uint32 i, mask;
+
+    mask = 0;
+    for (i = 0; i < GROUP_SIZE; i++) {
+        if (!CTRL_IS_FULL(ctrl[i]))
+            mask |= 1U << i;
+    }
+    return mask;
+}
+#endif
+
+#if defined __GNUC__
+#define LOWEST_BIT(mask)        ((uint32)__builtin_ctz(mask))
+#else
+#define LOWEST_BIT(mask)        LowestBit(mask)
+
+static uint32
+LowestBit(uint32 mask)
+{
+    uint32 i;
+
+    for (i = 0; !(mask & 1); i++)
+        mask >>= 1;
+    return i;
+}
+#endif
+
+/*
+** Callers' hash functions range from string hashes to serial numbers, so mix
+** keyHash well (Knuth's multiplicative hash, 6.4, then an avalanche step)
+** before taking the group index from its high bits and the tag from its low
+** bits.
+*/
+#define GOLDEN_RATIO    0x9E3779B9U
+
+static PRHashNumber
+MixHash(PRHashNumber keyHash)
+{
+    PRHashNumber h;
+
+    h = keyHash * GOLDEN_RATIO;
+    h ^= h >> 15;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    return h;
+}
+
+#define HASH_TAG(h)     ((uint8)((h) & 0x7F))
 
 /*
 ** Stubs for default hash allocator ops.
@@ -27,24 +125,28 @@
 static void *
 DefaultAllocTable(void *pool, size_t size)
 {
+    (void)pool;
     return malloc(size);
 }
 
 static void
 DefaultFreeTable(void *pool, void *item)
 {
+    (void)pool;
     free(item);
 }
 
 static PRHashEntry *
 DefaultAllocEntry(void *pool)
 {
+    (void)pool;
     return malloc(sizeof(PRHashEntry));
 }
 
 static void
 DefaultFreeEntry(void *pool, PRHashEntry *he, int flag)
 {
+    (void)pool;
     if (flag == HT_FREE_ENTRY)
         free(he);
 }
@@ -54,14 +156,53 @@ static PRHashAllocOps defaultHashAllocOps = {
     DefaultAllocEntry, DefaultFreeEntry
 };
 
+/*
+** Allocate ht's entry and control vectors for 1 << log2 buckets, in one
+** chunk with the control bytes after the entry pointers.
+*/
+static PRBool
+NewBuckets(PRHashTable *ht, uint32 log2)
+{
+    uint32 n;
+    size_t nb;
+
+    n = 1 << log2;
+#if defined(XP_PC) && !defined(_WIN32)
+    if (n > 16000)
+        return PR_FALSE;
+#endif  /* WIN16 */
+    nb = n * (sizeof(PRHashEntry *) + 1);
+    ht->buckets = (*ht->allocOps->allocTable)(ht->allocPool, nb);
+    if (!ht->buckets)
+        return PR_FALSE;
+    memset(ht->buckets, 0, n * sizeof(PRHashEntry *));
+    ht->ctrl = (uint8 *)(ht->buckets + n);
+    memset(ht->ctrl, CTRL_EMPTY, n);
+    ht->shift = PR_HASH_BITS - log2;
+    ht->ndeleted = 0;
+    return PR_TRUE;
+}
+
+static void
+FreeBuckets(PRHashTable *ht, PRHashEntry **buckets, uint32 n)
+{
+#ifdef DEBUG
+    memset(buckets, 0xDB, n * (sizeof(PRHashEntry *) + 1));
+#else
+    (void)n;
+#endif
+    (*ht->allocOps->freeTable)(ht->allocPool, buckets);
+}
+
 PR_PUBLIC_API(PRHashTable *)
 PR_NewHashTable(uint32 n, PRHashFunction keyHash,
                 PRHashComparator keyCompare, PRHashComparator valueCompare,
                 PRHashAllocOps *allocOps, void *allocPool)
 {
     PRHashTable *ht;
-    size_t nb;
 
+    /* Make room for n entries without overloading. */
+    n += n >> 2;
     if (n <= MINBUCKETS) {
         n = MINBUCKETSLOG2;
     } else {
@@ -75,27 +216,15 @@ PR_NewHashTable(uint32 n, PRHashFunction keyHash,
     ht = (*allocOps->allocTable)(allocPool, sizeof *ht);
     if (!ht) return 0;
     memset(ht, 0, sizeof *ht);
-    ht->shift = PR_HASH_BITS - n;
-    n = 1 << n;
-#if defined(XP_PC) && !defined(_WIN32)
-    if (n > 16000) {
-        (*allocOps->freeTable)(allocPool, ht);
-        return 0;
-    }
-#endif  /* WIN16 */
-    nb = n * sizeof(PRHashEntry *);
-    ht->buckets = (*allocOps->allocTable)(allocPool, nb);
-    if (!ht->buckets) {
-        (*allocOps->freeTable)(allocPool, ht);
-        return 0;
-    }
-    memset(ht->buckets, 0, nb);
-
     ht->keyHash = keyHash;
     ht->keyCompare = keyCompare;
     ht->valueCompare = valueCompare;
     ht->allocOps = allocOps;
     ht->allocPool = allocPool;
+    if (!NewBuckets(ht, n)) {
+        (*allocOps->freeTable)(allocPool, ht);
+        return 0;
+    }
     return ht;
 }
 
@@ -103,21 +232,19 @@ PR_PUBLIC_API(void)
 PR_HashTableDestroy(PRHashTable *ht)
 {
     uint32 i, n;
-    PRHashEntry *he, *next;
+    PRHashEntry *he;
     PRHashAllocOps *allocOps = ht->allocOps;
     void *allocPool = ht->allocPool;
 
     n = NBUCKETS(ht);
     for (i = 0; i < n; i++) {
-        for (he = ht->buckets[i]; he; he = next) {
-            next = he->next;
+        he = ht->buckets[i];
+        if (he) {
+            ht->buckets[i] = 0;
             (*allocOps->freeEntry)(allocPool, he, HT_FREE_ENTRY);
         }
     }
-#ifdef DEBUG
-    memset(ht->buckets, 0xDB, n * sizeof ht->buckets[0]);
-#endif
-    (*allocOps->freeTable)(allocPool, ht->buckets);
+    FreeBuckets(ht, ht->buckets, n);
 #ifdef DEBUG
     memset(ht, 0xDB, sizeof *ht);
 #endif
@@ -125,83 +252,136 @@ PR_HashTableDestroy(PRHashTable *ht)
 }
 
 /*
-** Multiplicative hash, from Knuth 6.4.
+** Return a pointer to the bucket holding the entry for key, or if there is
+** none, to the empty bucket where PR_HashTableRawAdd should put it.  Groups
+** are probed in triangular order, which visits every group of a table whose
+** group count is a power of two.
 */
-#define GOLDEN_RATIO    0x9E3779B9U
-
 PR_PUBLIC_API(PRHashEntry **)
 PR_HashTableRawLookup(PRHashTable *ht, PRHashNumber keyHash, const void *key)
 {
-    PRHashEntry *he, **hep, **hep0;
     PRHashNumber h;
+    uint32 gmask, g, step, base, mask, avail;
+    uint8 tag;
+    PRHashGroup group;
+    PRHashEntry *he;
 
 #ifdef HASHMETER
     ht->nlookups++;
 #endif
-    h = keyHash * GOLDEN_RATIO;
-    h >>= ht->shift;
-    hep = hep0 = &ht->buckets[h];
-    while ((he = *hep) != 0) {
-        if (he->keyHash == keyHash && (*ht->keyCompare)(key, he->key)) {
-            /* Move to front of chain if not already there */
-            if (hep != hep0) {
-                *hep = he->next;
-                he->next = *hep0;
-                *hep0 = he;
-            }
-            return hep0;
+    h = MixHash(keyHash);
+    tag = HASH_TAG(h);
+    gmask = (NBUCKETS(ht) >> GROUP_SHIFT) - 1;
+    g = (h >> 7) & gmask;
+    avail = (uint32)-1;
+    for (step = 1; ; step++) {
+        base = g << GROUP_SHIFT;
+        group = LOAD_GROUP(&ht->ctrl[base]);
+        for (mask = MATCH_BYTE(group, tag); mask; mask &= mask - 1) {
+            he = ht->buckets[base + LOWEST_BIT(mask)];
+            if (he->keyHash == keyHash && (*ht->keyCompare)(key, he->key))
+                return &ht->buckets[base + LOWEST_BIT(mask)];
         }
-        hep = &he->next;
+        mask = MATCH_NOT_FULL(group);
+        if (mask) {
+            if (avail == (uint32)-1)
+                avail = base + LOWEST_BIT(mask);
+            if (MATCH_BYTE(group, CTRL_EMPTY))
+                break;
+        }
+        g = (g + step) & gmask;
 #ifdef HASHMETER
         ht->nsteps++;
 #endif
     }
-    return hep;
+    return &ht->buckets[avail];
 }
 
-PR_PUBLIC_API(PRHashEntry *)
-PR_HashTableRawAdd(PRHashTable *ht, PRHashEntry **hep,
-                   PRHashNumber keyHash, const void *key, void *value)
+/*
+** Rehash ht's entries into 1 << log2 buckets, dropping deleted markers.
+*/
+static PRBool
+Rehash(PRHashTable *ht, uint32 log2)
 {
-    uint32 i, n;
-    PRHashEntry *he, *next, **oldbuckets;
-    size_t nb;
+    uint32 i, n, shift, ndeleted;
+    PRHashEntry *he, **hep, **oldbuckets;
+    uint8 *oldctrl;
+
+    n = NBUCKETS(ht);
+    oldbuckets = ht->buckets;
+    oldctrl = ht->ctrl;
+    shift = ht->shift;
+    ndeleted = ht->ndeleted;
+    if (!NewBuckets(ht, log2)) {
+        ht->buckets = oldbuckets;
+        ht->ctrl = oldctrl;
+        ht->shift = shift;
+        ht->ndeleted = ndeleted;
+        return PR_FALSE;
+    }
+    for (i = 0; i < n; i++) {
+        he = oldbuckets[i];
+        if (!he)
+            continue;
+        hep = PR_HashTableRawLookup(ht, he->keyHash, he->key);
+        PR_ASSERT(*hep == 0);
+        *hep = he;
+        ht->ctrl[hep - ht->buckets] = HASH_TAG(MixHash(he->keyHash));
+    }
+    FreeBuckets(ht, oldbuckets, n);
+    return PR_TRUE;
+}
+
+/*
+** Make sure *hep can take a new entry without overloading ht, rehashing if
+** need be.  Return the (possibly moved) bucket pointer, or null on failure.
+*/
+static PRHashEntry **
+ReserveBucket(PRHashTable *ht, PRHashEntry **hep, PRHashNumber keyHash,
+              const void *key)
+{
+    uint32 n, log2;
 
-    /* Grow the table if it is overloaded */
+    PR_ASSERT(*hep == 0);
     n = NBUCKETS(ht);
-    if (ht->nentries >= OVERLOADED(n)) {
+    if (ht->ctrl[hep - ht->buckets] == CTRL_EMPTY &&
+        ht->nentries + ht->ndeleted >= OVERLOADED(n)) {
+        /* Grow if live entries fill half the table, else just rehash. */
+        log2 = PR_HASH_BITS - ht->shift;
+        if (ht->nentries >= n / 2) {
 #ifdef HASHMETER
-        ht->ngrows++;
+            ht->ngrows++;
 #endif
-        ht->shift--;
-        oldbuckets = ht->buckets;
-#if defined(XP_PC) && !defined(_WIN32)
-        if (2 * n > 16000)
-            return 0;
-#endif  /* WIN16 */
-        nb = 2 * n * sizeof(PRHashEntry *);
-        ht->buckets = (*ht->allocOps->allocTable)(ht->allocPool, nb);
-        if (!ht->buckets) {
-            ht->buckets = oldbuckets;
-            return 0;
+            log2++;
         }
-        memset(ht->buckets, 0, nb);
-
-        for (i = 0; i < n; i++) {
-            for (he = oldbuckets[i]; he; he = next) {
-                next = he->next;
-                hep = PR_HashTableRawLookup(ht, he->keyHash, he->key);
-                PR_ASSERT(*hep == 0);
-                he->next = 0;
-                *hep = he;
-            }
-        }
-#ifdef DEBUG
-        memset(oldbuckets, 0xDB, n * sizeof oldbuckets[0]);
-#endif
-        (*ht->allocOps->freeTable)(ht->allocPool, oldbuckets);
+        if (!Rehash(ht, log2))
+            return 0;
         hep = PR_HashTableRawLookup(ht, keyHash, key);
     }
+    return hep;
+}
+
+static void
+FillBucket(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he)
+{
+    uint8 *cp;
+
+    cp = &ht->ctrl[hep - ht->buckets];
+    if (*cp == CTRL_DELETED)
+        ht->ndeleted--;
+    *cp = HASH_TAG(MixHash(he->keyHash));
+    *hep = he;
+    ht->nentries++;
+}
+
+PR_PUBLIC_API(PRHashEntry *)
+PR_HashTableRawAdd(PRHashTable *ht, PRHashEntry **hep,
+                   PRHashNumber keyHash, const void *key, void *value)
+{
+    PRHashEntry *he;
+
+    hep = ReserveBucket(ht, hep, keyHash, key);
+    if (!hep) return 0;
 
     /* Make a new key value entry */
     he = (*ht->allocOps->allocEntry)(ht->allocPool);
@@ -209,9 +389,18 @@ PR_HashTableRawAdd(PRHashTable *ht, PRHashEntry **hep,
     he->keyHash = keyHash;
     he->key = key;
     he->value = value;
-    he->next = *hep;
-    *hep = he;
-    ht->nentries++;
+    he->next = 0;
+    FillBucket(ht, hep, he);
+    return he;
+}
+
+PR_PUBLIC_API(PRHashEntry *)
+PR_HashTableRawAddEntry(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he)
+{
+    hep = ReserveBucket(ht, hep, he->keyHash, he->key);
+    if (!hep) return 0;
+    he->next = 0;
+    FillBucket(ht, hep, he);
     return he;
 }
 
@@ -237,48 +426,47 @@ PR_HashTableAdd(PRHashTable *ht, const void *key, void *value)
     return PR_HashTableRawAdd(ht, hep, keyHash, key, value);
 }
 
-PR_PUBLIC_API(void)
-PR_HashTableRawRemove(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he)
+/*
+** Empty bucket i.  If its group has an empty bucket already, no probe goes
+** on past this group, so bucket i can be empty too rather than deleted.
+*/
+static void
+ClearBucket(PRHashTable *ht, uint32 i)
 {
-    uint32 i, n;
-    PRHashEntry *next, **oldbuckets;
-    size_t nb;
+    uint32 base;
 
-    *hep = he->next;
-    (*ht->allocOps->freeEntry)(ht->allocPool, he, HT_FREE_ENTRY);
+    base = i & ~(uint32)(GROUP_SIZE - 1);
+    ht->buckets[i] = 0;
+    if (MATCH_BYTE(LOAD_GROUP(&ht->ctrl[base]), CTRL_EMPTY)) {
+        ht->ctrl[i] = CTRL_EMPTY;
+    } else {
+        ht->ctrl[i] = CTRL_DELETED;
+        ht->ndeleted++;
+    }
+    ht->nentries--;
+}
 
-    /* Shrink table if it's underloaded */
-    n = NBUCKETS(ht);
-    if (--ht->nentries < UNDERLOADED(n)) {
+/* Shrink table if it's underloaded */
+static void
+MaybeShrink(PRHashTable *ht)
+{
+    if (ht->nentries < UNDERLOADED(NBUCKETS(ht))) {
 #ifdef HASHMETER
         ht->nshrinks++;
 #endif
-        ht->shift++;
-        oldbuckets = ht->buckets;
-        nb = n * sizeof(PRHashEntry*) / 2;
-        ht->buckets = (*ht->allocOps->allocTable)(ht->allocPool, nb);
-        if (!ht->buckets) {
-            ht->buckets = oldbuckets;
-            return;
-        }
-        memset(ht->buckets, 0, nb);
-
-        for (i = 0; i < n; i++) {
-            for (he = oldbuckets[i]; he; he = next) {
-                next = he->next;
-                hep = PR_HashTableRawLookup(ht, he->keyHash, he->key);
-                PR_ASSERT(*hep == 0);
-                he->next = 0;
-                *hep = he;
-            }
-        }
-#ifdef DEBUG
-        memset(oldbuckets, 0xDB, n * sizeof oldbuckets[0]);
-#endif
-        (*ht->allocOps->freeTable)(ht->allocPool, oldbuckets);
+        (void) Rehash(ht, PR_HASH_BITS - ht->shift - 1);
     }
 }
 
+PR_PUBLIC_API(void)
+PR_HashTableRawRemove(PRHashTable *ht, PRHashEntry **hep, PRHashEntry *he)
+{
+    PR_ASSERT(*hep == he);
+    ClearBucket(ht, hep - ht->buckets);
+    (*ht->allocOps->freeEntry)(ht->allocPool, he, HT_FREE_ENTRY);
+    MaybeShrink(ht);
+}
+
 PR_PUBLIC_API(PRBool)
 PR_HashTableRemove(PRHashTable *ht, const void *key)
 {
@@ -317,87 +505,47 @@ PR_HashTableLookup(PRHashTable *ht, const void *key)
 PR_PUBLIC_API(int)
 PR_HashTableEnumerateEntries(PRHashTable *ht, PRHashEnumerator f, void *arg)
 {
-    PRHashEntry *he, **hep;
+    PRHashEntry *he;
     uint32 i, nbuckets;
     int rv, n = 0;
-    PRHashEntry *todo = 0;
 
     nbuckets = NBUCKETS(ht);
     for (i = 0; i < nbuckets; i++) {
-        hep = &ht->buckets[i];
-        while ((he = *hep) != 0) {
-            rv = (*f)(he, n, arg);
-            n++;
-            if (rv & (HT_ENUMERATE_REMOVE | HT_ENUMERATE_UNHASH)) {
-                *hep = he->next;
-                if (rv & HT_ENUMERATE_REMOVE) {
-                    he->next = todo;
-                    todo = he;
-                }
-            } else {
-                hep = &he->next;
-            }
-            if (rv & HT_ENUMERATE_STOP) {
-                goto out;
-            }
+        he = ht->buckets[i];
+        if (!he)
+            continue;
+        rv = (*f)(he, n, arg);
+        n++;
+        if (rv & (HT_ENUMERATE_REMOVE | HT_ENUMERATE_UNHASH)) {
+            ClearBucket(ht, i);
+            if (rv & HT_ENUMERATE_REMOVE)
+                (*ht->allocOps->freeEntry)(ht->allocPool, he, HT_FREE_ENTRY);
         }
+        if (rv & HT_ENUMERATE_STOP)
+            break;
     }
 
-out:
-    hep = &todo;
-    while ((he = *hep) != 0) {
-        PR_HashTableRawRemove(ht, hep, he);
-    }
+    /* Don't move entries until the walk over buckets is done. */
+    MaybeShrink(ht);
     return n;
 }
 
 #ifdef HASHMETER
-#include <math.h>
 #include <stdio.h>
 
 PR_PUBLIC_API(void)
 PR_HashTableDumpMeter(PRHashTable *ht, PRHashEnumerator dump, FILE *fp)
 {
-    double mean, variance;
-    uint32 nchains, nbuckets;
-    uint32 i, n, maxChain, maxChainLen;
-    PRHashEntry *he;
-
-    variance = 0;
-    nchains = 0;
-    maxChainLen = 0;
-    nbuckets = NBUCKETS(ht);
-    for (i = 0; i < nbuckets; i++) {
-        he = ht->buckets[i];
-        if (!he)
-            continue;
-        nchains++;
-        for (n = 0; he; he = he->next)
-            n++;
-        variance += n * n;
-        if (n > maxChainLen) {
-            maxChainLen = n;
-            maxChain = i;
-        }
-    }
-    mean = (double)ht->nentries / nchains;
-    variance = fabs(variance / nchains - mean * mean);
-
+    (void)dump;                 /* no chains to show the longest of */
     fprintf(fp, "\nHash table statistics:\n");
     fprintf(fp, "     number of lookups: %u\n", ht->nlookups);
     fprintf(fp, "     number of entries: %u\n", ht->nentries);
+    fprintf(fp, "     number of buckets: %u\n", NBUCKETS(ht));
+    fprintf(fp, "       deleted buckets: %u\n", ht->ndeleted);
     fprintf(fp, "       number of grows: %u\n", ht->ngrows);
     fprintf(fp, "     number of shrinks: %u\n", ht->nshrinks);
-    fprintf(fp, "   mean steps per hash: %g\n", (double)ht->nsteps
-                                                / ht->nlookups);
-    fprintf(fp, "mean hash chain length: %g\n", mean);
-    fprintf(fp, "    standard deviation: %g\n", sqrt(variance));
-    fprintf(fp, " max hash chain length: %u\n", maxChainLen);
-    fprintf(fp, "        max hash chain: [%u]\n", maxChain);
-
-    for (he = ht->buckets[maxChain], i = 0; he; he = he->next, i++)
-        if ((*dump)(he, i, fp) != HT_ENUMERATE_NEXT)
-            break;
+    fprintf(fp, " mean groups per probe: %g\n", 1 + (double)ht->nsteps
+                                                    / ht->nlookups);
 }
 #endif /* HASHMETER */
 
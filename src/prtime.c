@@ -363,6 +363,9 @@ PR_PUBLIC_API(size_t) PR_FormatTime(char *buf, int buflen, char *fmt, PRTime *pr
 {
 #if defined(XP_UNIX) || defined(XP_PC) || defined(XP_MAC)
     struct tm a;
+
+    /* Zero fields such as tm_zone that strftime may use but we don't set. */
+    memset(&a, 0, sizeof a);
     a.tm_sec = prtm->tm_sec;
     a.tm_min = prtm->tm_min;
     a.tm_hour = prtm->tm_hour;
@@ -0,0 +1,9 @@
+/*
+** Eval defers compiling never() to its first call, but the syntax error in
+** its body must still stop the eval'd script before it runs.  Expect only the
+** "missing variable name" report.
+*/
+var ran = false
+eval("ran = true; function never() { var = ; } 0")
+if (ran) print("ERROR: script with a bad function body ran!")
+print("ERROR: script with a bad function body was not rejected!")
@@ -44,11 +44,13 @@ Process(MochaContext *mc, MochaObject *obj, char *filename)
 	if (ts) ts->file = stdin;
     }
     if (!ts) goto out;
-    if (isatty(fileno(ts->file)))
+    if (ts->file && isatty(fileno(ts->file)))
 	ts->flags |= (TSF_INTERACTIVE | TSF_COMMAND);
 
     mocha_InitCodeGenerator(mc, &cg, &mc->codePool);
     script.notes = 0;
+    script.threaded = script.traced = 0;
+    script.pcache = 0;
     while (!(ts->flags & TSF_EOF)) {
 	script.lineno = ts->lineno;
 	if (ts->flags & TSF_INTERACTIVE)
@@ -63,6 +65,10 @@ Process(MochaContext *mc, MochaObject *obj, char *filename)
 	script.depth = cg.maxStackDepth;
 	if (mocha_InitAtomMap(mc, &script.atomMap, &cg)) {
 	    script.notes = mocha_FinishTakingSourceNotes(mc, &cg);
+	    if (script.notes && !mocha_InitPropertyCaches(mc, &script)) {
+		free(script.notes);
+		script.notes = 0;
+	    }
 	    if (script.notes) {
 		if (MOCHA_ExecuteScript(mc, obj, &script, &result)) {
 		    if ((ts->flags & TSF_INTERACTIVE) &&
@@ -74,6 +80,15 @@ Process(MochaContext *mc, MochaObject *obj, char *filename)
 		    mocha_DropRef(mc, &result);
 		}
 		free(script.notes);
+		if (script.threaded) {
+		    free(script.threaded);
+		    script.threaded = 0;
+		}
+		if (script.traced) {
+		    free(script.traced);
+		    script.traced = 0;
+		}
+		mocha_FinishPropertyCaches(mc, &script);
 	    }
 	    mocha_FreeAtomMap(mc, &script.atomMap);
 	}
@@ -126,7 +141,9 @@ Print(MochaContext *mc, MochaObject *obj,
     for (i = n = 0; i < argc; i++) {
 	if (!MOCHA_DatumToString(mc, argv[i], &atom))
 	    return MOCHA_FALSE;
-	printf("%s%s", i ? " " : "", atom_name(atom));
+	if (i)
+	    putchar(' ');
+	fwrite(atom_name(atom), 1, atom->length, stdout);
 	mocha_DropAtom(mc, atom);
 	n++;
     }
@@ -162,6 +179,8 @@ Disassemble(MochaContext *mc, MochaObject *obj,
 	}
 
 	fun = argv[i].u.fun;
+	if (!mocha_CompileFunctionSource(mc, fun))
+	    return MOCHA_FALSE;
 	mocha_Disassemble(mc, fun->script, stdout);
 	notes = fun->script->notes;
 	if (notes) {
@@ -227,8 +246,8 @@ DumpAtom(PRHashEntry *he, int i, void *arg)
     FILE *fp = arg;
     MochaAtom *atom = (MochaAtom *)he;
 
-    fprintf(fp, "%3d %08x %5u %5ld %.16g \"%s\"\n",
-	    i, (unsigned)he->keyHash, atom->index, atom->number, atom->fval,
+    fprintf(fp, "%3d %08x %5ld %.16g \"%s\"\n",
+	    i, (unsigned)he->keyHash, atom->number, atom->fval,
 	    atom_name(atom));
     return HT_ENUMERATE_NEXT;
 }
@@ -261,7 +280,7 @@ static MochaBoolean
 DumpStats(MochaContext *mc, MochaObject *obj,
 	  unsigned argc, MochaDatum *argv, MochaDatum *rval)
 {
-    unsigned i;
+    unsigned i, j;
     MochaAtom *atom, *atom2;
     const char *which;
     MochaScope *scope;
@@ -278,14 +297,17 @@ DumpStats(MochaContext *mc, MochaObject *obj,
 #endif
 	} else if (strcmp(which, "atom") == 0) {
 	    printf("\natom table contents:\n");
-	    PR_HashTableDump(mocha_AtomState.table, DumpAtom, stdout);
+	    for (j = 0; j < MOCHA_ATOM_SHARDS; j++) {
+		PR_HashTableDump(mocha_AtomState.shards[j].table, DumpAtom,
+				 stdout);
+	    }
 	} else if (strcmp(which, "global") == 0) {
 	    for (scope = mc->staticLink->scope; scope->object->parent;
 		 scope = scope->object->parent->scope)
 		;
 	    DumpScope(scope, DumpSymbol, stdout);
 	} else {
-	    atom2 = mocha_Atomize(mc, which, ATOM_STRING);
+	    atom2 = mocha_Atomize(mc, which, strlen(which), ATOM_STRING);
 	    if (atom2) {
 		if (!mocha_SearchScopes(mc, atom2, MLF_GET, &pair))
 		    pair.sym = 0;
@@ -427,7 +449,8 @@ static MochaPropertySpec its_props[] = {
 static MochaClass its_class = {
     "It",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub,  MOCHA_ConvertStub, MOCHA_FinalizeStub
+    MOCHA_ResolveStub,  MOCHA_ConvertStub, MOCHA_FinalizeStub,
+    0
 };
 
 static void
@@ -469,7 +492,8 @@ my_ErrorReporter(MochaContext *mc, const char *message,
 static MochaClass global_class = {
     "global",
     MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
-    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub
+    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub,
+    0
 };
 
 /* Stub to avoid linking with half the known universe. */
@@ -0,0 +1,342 @@
+/*
+** Mocha multi-threaded stress test.
+**
+** Each thread repeatedly creates a context, runs a script that exercises
+** strings, number conversion, Math.random, objects and their shapes, arrays
+** and decompilation, checks the script's result, and destroys the context.
+** Run once with one thread and again with N, reporting throughput for each,
+** then again with N whose contexts get their globals from a template, and
+** with N whose contexts share one standard library.  The script sets a
+** property of String.prototype, which no other context may see.  Then run
+** the script as jobs on an N-thread executor, whose workers reuse their
+** contexts.  Build with MOCHA_THREADSAFE defined and link with
+** -lpthread; without it, only one thread is run and the executor is skipped.
+**
+** Usage: mo_stress [threads [runs-per-thread]]
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mo_atom.h"
+#include "mo_cntxt.h"
+#include "mo_exec.h"
+#include "mocha.h"
+#include "mochaapi.h"
+
+static char script[] =
+    "function fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2) }\n"
+    "function Point(x, y) { this.x = x; this.y = y }\n"
+    "var a = new Array(), s = \"\", t, i, p, sum = 0, bad = 0;\n"
+    "if (\"\".mark) bad++;\n"
+    "String.prototype.mark = 1;\n"
+    "if (\"\".mark != 1) bad++;\n"
+    "for (i = 0; i < 300; i++) {\n"
+    "    p = new Point(i, i / 8);\n"
+    "    p[\"z\" + (i % 7)] = i;\n"
+    "    a[i] = p.x + p.y;\n"
+    "    s = s + (i * 1.25) + \",\";\n"
+    "    t = Math.random();\n"
+    "    if (t < 0 || t >= 1) bad++;\n"
+    "}\n"
+    "for (i = 0; i < a.length; i++)\n"
+    "    sum += a[i];\n"
+    "t = s.substring(10, 40).toUpperCase();\n"
+    "sum + \" \" + s.length + \" \" + t + \" \" + fib(15) + \" \" + bad +\n"
+    "    \" \" + (\"\" + fib).length\n";
+
+static char expected[] =
+    "50456.25 1712 ,3.75,5,6.25,7.5,8.75,10,11.25 610 0 98";
+
+typedef struct Worker {
+    pthread_t       thread;
+    unsigned        runs;
+    unsigned        failures;
+    MochaTemplate   *tmpl;
+    MochaBoolean    shared;
+} Worker;
+
+static void
+my_ErrorReporter(MochaContext *mc, const char *message,
+		 MochaErrorReport *report)
+{
+    fprintf(stderr, "Mocha: %s\n", message);
+}
+
+static MochaClass global_class = {
+    "global",
+    MOCHA_PropertyStub, MOCHA_PropertyStub, MOCHA_ListPropStub,
+    MOCHA_ResolveStub,  MOCHA_ConvertStub,  MOCHA_FinalizeStub,
+    0
+};
+
+/* Stub to avoid linking with half the known universe. */
+MochaBoolean
+mocha_InitJava(MochaContext *mc, MochaObject *obj)
+{
+    return MOCHA_TRUE;
+}
+
+/* Another stub to avoid linking with half the known universe. */
+void
+mocha_DestroyJavaContext(MochaContext *mc)
+{
+}
+
+/*
+** Run the script in a new context, returning true if it produced the
+** expected result.  Clone the context's global from tmpl if it's not null,
+** else give it the shared library if shared is true.
+*/
+static MochaBoolean
+RunOnce(MochaTemplate *tmpl, MochaBoolean shared)
+{
+    MochaContext *mc;
+    MochaObject *glob;
+    MochaDatum result;
+    MochaAtom *atom;
+    MochaBoolean ok;
+
+    mc = MOCHA_NewContext(8192);
+    if (!mc)
+	return MOCHA_FALSE;
+    MOCHA_SetErrorReporter(mc, my_ErrorReporter);
+
+    ok = MOCHA_FALSE;
+    if (tmpl)
+	glob = MOCHA_CloneTemplate(mc, tmpl);
+    else
+	glob = MOCHA_NewObject(mc, &global_class, 0, 0, 0, 0, 0);
+    if (!glob)
+	goto out;
+    MOCHA_HoldObject(mc, glob);
+    if ((tmpl ||
+	 (shared ? MOCHA_SetSharedGlobalObject(mc, glob)
+		 : MOCHA_SetGlobalObject(mc, glob))) &&
+	MOCHA_EvaluateBuffer(mc, glob, script, sizeof script - 1,
+			     "stress", 1, &result)) {
+	if (MOCHA_DatumToString(mc, result, &atom)) {
+	    ok = atom->length == sizeof expected - 1 &&
+		 memcmp(atom_name(atom), expected, atom->length) == 0;
+	    if (!ok) {
+		fprintf(stderr, "mo_stress: got \"%.*s\"\n",
+			(int)atom->length, atom_name(atom));
+	    }
+	    mocha_DropAtom(mc, atom);
+	}
+	mocha_DropRef(mc, &result);
+    }
+    MOCHA_DropObject(mc, glob);
+out:
+    MOCHA_DestroyContext(mc);
+    return ok;
+}
+
+static void *
+WorkerMain(void *arg)
+{
+    Worker *w = arg;
+    unsigned i;
+
+    for (i = 0; i < w->runs; i++) {
+	if (!RunOnce(w->tmpl, w->shared))
+	    w->failures++;
+    }
+    return 0;
+}
+
+static double
+Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+** Run nthreads workers, each doing runs runs with globals cloned from tmpl
+** if it's not null or using the shared library if shared is true, and
+** return the number of failed runs, or -1 if a thread couldn't be started.
+*/
+static int
+RunWorkers(unsigned nthreads, unsigned runs, MochaTemplate *tmpl,
+	   MochaBoolean shared, double *ratep)
+{
+    Worker *workers;
+    unsigned i, failures;
+    double start;
+
+    workers = calloc(nthreads, sizeof *workers);
+    if (!workers)
+	return -1;
+    start = Now();
+    for (i = 0; i < nthreads; i++) {
+	workers[i].runs = runs;
+	workers[i].tmpl = tmpl;
+	workers[i].shared = shared;
+	if (pthread_create(&workers[i].thread, 0, WorkerMain, &workers[i])) {
+	    nthreads = i;
+	    failures = (unsigned)-1;
+	    goto out;
+	}
+    }
+    failures = 0;
+out:
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(workers[i].thread, 0);
+	if (failures != (unsigned)-1)
+	    failures += workers[i].failures;
+    }
+    *ratep = nthreads * runs / (Now() - start);
+    free(workers);
+    return (int)failures;
+}
+
+/*
+** Make a template from a global object initialized in a throwaway context.
+*/
+static MochaTemplate *
+MakeTemplate(void)
+{
+    MochaContext *mc;
+    MochaObject *glob;
+    MochaTemplate *tmpl;
+
+    mc = MOCHA_NewContext(8192);
+    if (!mc)
+	return 0;
+    MOCHA_SetErrorReporter(mc, my_ErrorReporter);
+    tmpl = 0;
+    glob = MOCHA_NewObject(mc, &global_class, 0, 0, 0, 0, 0);
+    if (glob) {
+	MOCHA_HoldObject(mc, glob);
+	if (MOCHA_SetGlobalObject(mc, glob))
+	    tmpl = MOCHA_NewTemplate(mc, glob);
+	MOCHA_DropObject(mc, glob);
+    }
+    MOCHA_DestroyContext(mc);
+    return tmpl;
+}
+
+#ifdef MOCHA_THREADSAFE
+/*
+** Run njobs copies of the script on an executor with nthreads workers, and
+** return the number of failed jobs, or -1 if the executor couldn't be made.
+*/
+static int
+RunExecutor(unsigned nthreads, unsigned njobs, double *ratep)
+{
+    MochaExecutor *ex;
+    MochaJob *jobs, *job;
+    unsigned i, failures;
+    double start;
+
+    jobs = calloc(njobs, sizeof *jobs);
+    if (!jobs)
+	return -1;
+    ex = MOCHA_NewExecutor(nthreads, 8192);
+    if (!ex) {
+	free(jobs);
+	return -1;
+    }
+    start = Now();
+    for (i = 0; i < njobs; i++) {
+	jobs[i].source = script;
+	jobs[i].length = sizeof script - 1;
+	jobs[i].filename = "stress";
+	MOCHA_SubmitJob(ex, &jobs[i]);
+    }
+    failures = 0;
+    for (i = 0; i < njobs; i++) {
+	job = MOCHA_NextDoneJob(ex, MOCHA_TRUE);
+	if (!job->ok) {
+	    fprintf(stderr, "mo_stress: job failed: %s\n",
+		    job->error ? job->error : "out of memory");
+	    failures++;
+	} else if (job->resultLength != sizeof expected - 1 ||
+		   memcmp(job->result, expected, job->resultLength) != 0) {
+	    fprintf(stderr, "mo_stress: job got \"%s\"\n", job->result);
+	    failures++;
+	}
+	free(job->result);
+	free(job->error);
+    }
+    *ratep = njobs / (Now() - start);
+    if (MOCHA_NextDoneJob(ex, MOCHA_TRUE) != 0)
+	failures++;
+    MOCHA_DestroyExecutor(ex);
+    free(jobs);
+    return (int)failures;
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+    unsigned nthreads, runs;
+    int failures;
+    double rate1, rateN;
+    MochaTemplate *tmpl;
+
+    nthreads = (argc > 1) ? atoi(argv[1]) : 4;
+    runs = (argc > 2) ? atoi(argv[2]) : 200;
+    if (nthreads == 0 || runs == 0) {
+	fprintf(stderr, "usage: %s [threads [runs-per-thread]]\n", argv[0]);
+	return 2;
+    }
+#ifndef MOCHA_THREADSAFE
+    if (nthreads > 1) {
+	fprintf(stderr, "%s: built without MOCHA_THREADSAFE, using 1 thread\n",
+		argv[0]);
+	nthreads = 1;
+    }
+#endif
+
+    failures = RunWorkers(1, runs, 0, MOCHA_FALSE, &rate1);
+    if (failures != 0)
+	goto fail;
+    printf("1 thread: %.1f runs/sec\n", rate1);
+
+    failures = RunWorkers(nthreads, runs, 0, MOCHA_FALSE, &rateN);
+    if (failures != 0)
+	goto fail;
+    printf("%u threads: %.1f runs/sec, %.2fx\n",
+	   nthreads, rateN, rateN / rate1);
+
+    tmpl = MakeTemplate();
+    if (!tmpl) {
+	fprintf(stderr, "mo_stress: can't make template\n");
+	return 1;
+    }
+    failures = RunWorkers(nthreads, runs, tmpl, MOCHA_FALSE, &rateN);
+    MOCHA_DestroyTemplate(tmpl);
+    if (failures != 0)
+	goto fail;
+    printf("%u threads from template: %.1f runs/sec, %.2fx\n",
+	   nthreads, rateN, rateN / rate1);
+
+    failures = RunWorkers(nthreads, runs, 0, MOCHA_TRUE, &rateN);
+    if (failures != 0)
+	goto fail;
+    printf("%u threads sharing library: %.1f runs/sec, %.2fx\n",
+	   nthreads, rateN, rateN / rate1);
+
+#ifdef MOCHA_THREADSAFE
+    failures = RunExecutor(nthreads, nthreads * runs, &rateN);
+    if (failures != 0)
+	goto fail;
+    printf("%u-thread executor: %.1f runs/sec, %.2fx\n",
+	   nthreads, rateN, rateN / rate1);
+#endif
+    MOCHA_DestroySharedLibrary();
+    return 0;
+
+fail:
+    if (failures < 0)
+	fprintf(stderr, "mo_stress: can't start threads\n");
+    else
+	fprintf(stderr, "mo_stress: %d runs failed\n", failures);
+    return 1;
+}